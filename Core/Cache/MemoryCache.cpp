@@ -93,4 +93,13 @@ namespace Orthanc
   {
     return *Load(id).content_;
   }
+
+  void MemoryCache::Invalidate(const std::string& id)
+  {
+    if (index_.Contains(id))
+    {
+      VLOG(1) << "Invalidating a cache page";
+      delete index_.Invalidate(id);
+    }
+  }
 }
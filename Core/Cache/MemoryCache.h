@@ -64,5 +64,8 @@ namespace Orthanc
     ~MemoryCache();
 
     IDynamicObject& Access(const std::string& id);
+
+    // Drops the page of this item, if it is currently cached
+    void Invalidate(const std::string& id);
   };
 }
@@ -147,6 +147,11 @@ namespace Orthanc
   static const DicomTag DICOM_TAG_IMAGE_ORIENTATION_PATIENT(0x0020, 0x0037);
   static const DicomTag DICOM_TAG_IMAGE_POSITION_PATIENT(0x0020, 0x0032);
 
+  // Tags for cine loops
+  static const DicomTag DICOM_TAG_RECOMMENDED_DISPLAY_FRAME_RATE(0x0008, 0x2144);
+  static const DicomTag DICOM_TAG_CINE_RATE(0x0018, 0x0040);
+  static const DicomTag DICOM_TAG_FRAME_TIME(0x0018, 0x1063);
+
   // Tags related to date and time
   static const DicomTag DICOM_TAG_ACQUISITION_DATE(0x0008, 0x0022);
   static const DicomTag DICOM_TAG_ACQUISITION_TIME(0x0008, 0x0032);
@@ -335,6 +335,28 @@ namespace Orthanc
       throw OrthancException(ErrorCode_NoPresentationContext);
     }
 
+    // If the remote modality has only accepted one of the fallback
+    // transfer syntaxes, transcode the instance on the fly using the
+    // codecs that are registered in DCMTK
+    T_ASC_PresentationContext pc;
+    Check(ASC_findAcceptedPresentationContext(assoc_->params, presID, &pc));
+
+    DcmXfer accepted(pc.acceptedTransferSyntax);
+    if (accepted.getXfer() != xfer.getXfer())
+    {
+      LOG(INFO) << "Transcoding from " << xfer.getXferName() << " to "
+                << accepted.getXferName() << " for C-Store";
+
+      DcmDataset& dataset = *dcmff.getDataset();
+      if (!dataset.chooseRepresentation(accepted.getXfer(), NULL).good() ||
+          !dataset.canWriteXfer(accepted.getXfer()))
+      {
+        LOG(ERROR) << "Cannot transcode from " << xfer.getXferName() << " to "
+                   << accepted.getXferName() << " for C-Store";
+        throw OrthancException(ErrorCode_NoPresentationContext);
+      }
+    }
+
     // Prepare the transmission of data
     T_DIMSE_C_StoreRQ request;
     memset(&request, 0, sizeof(request));
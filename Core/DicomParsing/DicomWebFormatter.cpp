@@ -0,0 +1,293 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "DicomWebFormatter.h"
+
+#include "FromDcmtkBridge.h"
+#include "../OrthancException.h"
+#include "../Toolbox.h"
+
+#include <boost/lexical_cast.hpp>
+
+namespace Orthanc
+{
+  static bool IsIntegerValueRepresentation(ValueRepresentation vr)
+  {
+    return (vr == ValueRepresentation_IntegerString ||
+            vr == ValueRepresentation_SignedLong ||
+            vr == ValueRepresentation_SignedShort ||
+            vr == ValueRepresentation_UnsignedLong ||
+            vr == ValueRepresentation_UnsignedShort);
+  }
+
+
+  static bool IsFloatValueRepresentation(ValueRepresentation vr)
+  {
+    return (vr == ValueRepresentation_DecimalString ||
+            vr == ValueRepresentation_FloatingPointSingle ||
+            vr == ValueRepresentation_FloatingPointDouble);
+  }
+
+
+  static bool IsBinary(ValueRepresentation vr)
+  {
+    // The other binary value representations of DICOM (such as US or
+    // FL) are stored as strings by Orthanc
+    return (vr == ValueRepresentation_OtherByte ||
+            vr == ValueRepresentation_OtherDouble ||
+            vr == ValueRepresentation_OtherFloat ||
+            vr == ValueRepresentation_OtherLong ||
+            vr == ValueRepresentation_OtherWord ||
+            vr == ValueRepresentation_Unknown);
+  }
+
+
+  static bool IsMultiValued(ValueRepresentation vr)
+  {
+    // These value representations cannot contain multiple values,
+    // and may contain backslashes
+    return !(vr == ValueRepresentation_LongText ||
+             vr == ValueRepresentation_ShortText ||
+             vr == ValueRepresentation_UnlimitedText ||
+             vr == ValueRepresentation_UniversalResource);
+  }
+
+
+  static Json::Value FormatValue(ValueRepresentation vr,
+                                 const std::string& value)
+  {
+    if (vr == ValueRepresentation_PersonName)
+    {
+      Json::Value name = Json::objectValue;
+      name["Alphabetic"] = value;
+      return name;
+    }
+
+    std::string stripped = Toolbox::StripSpaces(value);
+
+    try
+    {
+      if (IsIntegerValueRepresentation(vr))
+      {
+        return Json::Value(static_cast<Json::Int64>(boost::lexical_cast<int64_t>(stripped)));
+      }
+      else if (IsFloatValueRepresentation(vr))
+      {
+        return Json::Value(boost::lexical_cast<double>(stripped));
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      // Badly formatted number: Keep it as a string
+    }
+
+    return Json::Value(stripped);
+  }
+
+
+  static ValueRepresentation LookupValueRepresentation(const DicomTag& tag)
+  {
+    ValueRepresentation vr = FromDcmtkBridge::LookupValueRepresentation(tag);
+    if (vr == ValueRepresentation_NotSupported)
+    {
+      return ValueRepresentation_Unknown;
+    }
+    else
+    {
+      return vr;
+    }
+  }
+
+
+  static void FormatLeaf(Json::Value& target,
+                         const DicomTag& tag,
+                         bool isNull,
+                         bool isBinary,
+                         const std::string& content)
+  {
+    ValueRepresentation vr = LookupValueRepresentation(tag);
+
+    Json::Value node = Json::objectValue;
+    node["vr"] = EnumerationToString(vr);
+
+    if (!isNull)
+    {
+      if (isBinary ||
+          IsBinary(vr))
+      {
+        std::string base64;
+        Toolbox::EncodeBase64(base64, content);
+        node["InlineBinary"] = base64;
+      }
+      else if (!content.empty())
+      {
+        Json::Value values = Json::arrayValue;
+
+        if (IsMultiValued(vr))
+        {
+          std::vector<std::string> tokens;
+          Toolbox::TokenizeString(tokens, content, '\\');
+
+          for (size_t i = 0; i < tokens.size(); i++)
+          {
+            values.append(FormatValue(vr, tokens[i]));
+          }
+        }
+        else
+        {
+          values.append(content);
+        }
+
+        node["Value"] = values;
+      }
+    }
+
+    target[DicomWebFormatter::FormatTag(tag)] = node;
+  }
+
+
+  std::string DicomWebFormatter::FormatTag(const DicomTag& tag)
+  {
+    char buf[16];
+    sprintf(buf, "%04X%04X", tag.GetGroup(), tag.GetElement());
+    return buf;
+  }
+
+
+  bool DicomWebFormatter::ParseTag(DicomTag& target,
+                                   const std::string& source)
+  {
+    try
+    {
+      target = FromDcmtkBridge::ParseTag(source);
+      return true;
+    }
+    catch (OrthancException&)
+    {
+      return false;
+    }
+  }
+
+
+  void DicomWebFormatter::Apply(Json::Value& target,
+                                const DicomMap& source)
+  {
+    if (target.type() == Json::nullValue)
+    {
+      target = Json::objectValue;
+    }
+
+    std::set<DicomTag> tags;
+    source.GetTags(tags);
+
+    for (std::set<DicomTag>::const_iterator
+           it = tags.begin(); it != tags.end(); ++it)
+    {
+      const DicomValue& value = source.GetValue(*it);
+      FormatLeaf(target, *it, value.IsNull(), value.IsBinary(),
+                 value.IsNull() ? std::string() : value.GetContent());
+    }
+  }
+
+
+  void DicomWebFormatter::ApplyFullJson(Json::Value& target,
+                                        const Json::Value& source)
+  {
+    if (source.type() != Json::objectValue)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    if (target.type() == Json::nullValue)
+    {
+      target = Json::objectValue;
+    }
+
+    Json::Value::Members members = source.getMemberNames();
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      const Json::Value& node = source[members[i]];
+      if (node.type() != Json::objectValue ||
+          !node.isMember("Type") ||
+          node["Type"].type() != Json::stringValue)
+      {
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+
+      const DicomTag tag = FromDcmtkBridge::ParseTag(members[i]);
+      const std::string type = node["Type"].asString();
+
+      if (type == "Sequence")
+      {
+        Json::Value sequence = Json::objectValue;
+        sequence["vr"] = "SQ";
+
+        const Json::Value& items = node["Value"];
+        if (items.type() == Json::arrayValue &&
+            items.size() > 0)
+        {
+          sequence["Value"] = Json::arrayValue;
+          for (Json::Value::ArrayIndex j = 0; j < items.size(); j++)
+          {
+            Json::Value item = Json::objectValue;
+            ApplyFullJson(item, items[j]);
+            sequence["Value"].append(item);
+          }
+        }
+
+        target[FormatTag(tag)] = sequence;
+      }
+      else if (type == "String")
+      {
+        FormatLeaf(target, tag, false, false, node["Value"].asString());
+      }
+      else if (type == "Binary")
+      {
+        // The value is encoded using the data URI scheme
+        std::string mime, content;
+        if (!Toolbox::DecodeDataUriScheme(mime, content, node["Value"].asString()))
+        {
+          throw OrthancException(ErrorCode_BadFileFormat);
+        }
+
+        FormatLeaf(target, tag, false, true, content);
+      }
+      else
+      {
+        // "Null" or "TooLong" values: Only report the value representation
+        FormatLeaf(target, tag, true, false, "");
+      }
+    }
+  }
+}
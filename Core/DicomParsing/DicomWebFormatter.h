@@ -0,0 +1,69 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../DicomFormat/DicomMap.h"
+
+#include <json/value.h>
+
+namespace Orthanc
+{
+  /**
+   * Conversion to the DICOM JSON model that is used by DICOMweb
+   * (PS3.18 Annex F). The value representations are taken from the
+   * DICOM dictionary.
+   **/
+  class DicomWebFormatter
+  {
+  public:
+    // Formats a tag as in the DICOM JSON model (e.g. "00100010")
+    static std::string FormatTag(const DicomTag& tag);
+
+    // Parses a tag given as a keyword (e.g. "PatientID"), or as 8
+    // hexadecimal digits (e.g. "00100020"). Returns "false" if the
+    // tag is unknown.
+    static bool ParseTag(DicomTag& target,
+                         const std::string& source);
+
+    // Adds the tags of "source" (e.g. the main DICOM tags that are
+    // stored in the index) to the DICOM JSON object "target"
+    static void Apply(Json::Value& target,
+                      const DicomMap& source);
+
+    // Converts the "full" JSON format of Orthanc (as stored in the
+    // "dicom-as-json" attachments) to the DICOM JSON model
+    static void ApplyFullJson(Json::Value& target,
+                              const Json::Value& source);
+  };
+}
@@ -46,6 +46,7 @@
 #include "../OrthancException.h"
 
 #include <list>
+#include <cstring>
 #include <limits>
 
 #include <boost/lexical_cast.hpp>
@@ -83,17 +84,29 @@
 #include <dcmtk/dcmdata/dcvrul.h>
 #include <dcmtk/dcmdata/dcvrus.h>
 #include <dcmtk/dcmdata/dcvrut.h>
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmdata/dcrleerg.h>
 
 #if DCMTK_USE_EMBEDDED_DICTIONARIES == 1
 #  include <EmbeddedResources.h>
 #endif
 
+#if !defined(DCMTK_HAS_ENCODERS)
+#  error The macro DCMTK_HAS_ENCODERS must be defined
+#endif
+
 #if ORTHANC_ENABLE_DCMTK_JPEG == 1
 #  include <dcmtk/dcmjpeg/djdecode.h>
+#  if DCMTK_HAS_ENCODERS == 1
+#    include <dcmtk/dcmjpeg/djencode.h>
+#  endif
 #endif
 
 #if ORTHANC_ENABLE_DCMTK_JPEG_LOSSLESS == 1
 #  include <dcmtk/dcmjpls/djdecode.h>
+#  if DCMTK_HAS_ENCODERS == 1
+#    include <dcmtk/dcmjpls/djencode.h>
+#  endif
 #endif
 
 
@@ -1190,6 +1203,14 @@ namespace Orthanc
       xfer = EXS_LittleEndianExplicit;
     }
 
+    return SaveToMemoryBuffer(buffer, dataSet, xfer);
+  }
+
+
+  bool FromDcmtkBridge::SaveToMemoryBuffer(std::string& buffer,
+                                           DcmDataset& dataSet,
+                                           E_TransferSyntax xfer)
+  {
     E_EncodingType encodingType = /*opt_sequenceType*/ EET_ExplicitLength;
 
     // Create the meta-header information
@@ -1891,6 +1912,299 @@ namespace Orthanc
   }
 
 
+  static uint16_t ReadRawUint16(const uint8_t* p,
+                                bool littleEndian)
+  {
+    return (littleEndian ?
+            static_cast<uint16_t>(p[0] | (p[1] << 8)) :
+            static_cast<uint16_t>((p[0] << 8) | p[1]));
+  }
+
+
+  static uint32_t ReadRawUint32(const uint8_t* p,
+                                bool littleEndian)
+  {
+    return (littleEndian ?
+            (static_cast<uint32_t>(p[0]) |
+             (static_cast<uint32_t>(p[1]) << 8) |
+             (static_cast<uint32_t>(p[2]) << 16) |
+             (static_cast<uint32_t>(p[3]) << 24)) :
+            ((static_cast<uint32_t>(p[0]) << 24) |
+             (static_cast<uint32_t>(p[1]) << 16) |
+             (static_cast<uint32_t>(p[2]) << 8) |
+             static_cast<uint32_t>(p[3])));
+  }
+
+
+  static bool HasRawLongLength(const uint8_t* vr)
+  {
+    // In explicit VR, these value representations are followed by 2
+    // reserved bytes and a 4-byte length (PS3.5 Section 7.1.2)
+    static const char* const LONG_VR[] = {
+      "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV"
+    };
+
+    for (size_t i = 0; i < sizeof(LONG_VR) / sizeof(const char*); i++)
+    {
+      if (vr[0] == LONG_VR[i][0] &&
+          vr[1] == LONG_VR[i][1])
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  static const unsigned int MAX_RAW_DEPTH = 32;
+
+  static bool SkipRawElement(size_t& pos,
+                             const uint8_t* buffer,
+                             size_t size,
+                             bool explicitVR,
+                             bool littleEndian,
+                             unsigned int depth);
+
+
+  // Skips the items of a sequence of undefined length, up to its
+  // sequence delimitation item
+  static bool SkipRawItems(size_t& pos,
+                           const uint8_t* buffer,
+                           size_t size,
+                           bool explicitVR,
+                           bool littleEndian,
+                           unsigned int depth)
+  {
+    for (;;)
+    {
+      if (size - pos < 8)
+      {
+        return false;
+      }
+
+      uint16_t group = ReadRawUint16(buffer + pos, littleEndian);
+      uint16_t element = ReadRawUint16(buffer + pos + 2, littleEndian);
+      uint32_t length = ReadRawUint32(buffer + pos + 4, littleEndian);
+      pos += 8;
+
+      if (group != 0xfffe)
+      {
+        return false;
+      }
+      else if (element == 0xe0dd)
+      {
+        return true;  // Sequence delimitation item
+      }
+      else if (element != 0xe000)
+      {
+        return false;
+      }
+      else if (length != 0xffffffffu)
+      {
+        if (length > size - pos)
+        {
+          return false;
+        }
+
+        pos += length;
+      }
+      else
+      {
+        // Item of undefined length: Nested dataset, up to the item
+        // delimitation item
+        for (;;)
+        {
+          if (size - pos < 8)
+          {
+            return false;
+          }
+
+          if (ReadRawUint16(buffer + pos, littleEndian) == 0xfffe &&
+              ReadRawUint16(buffer + pos + 2, littleEndian) == 0xe00d)
+          {
+            pos += 8;
+            break;
+          }
+
+          if (!SkipRawElement(pos, buffer, size, explicitVR, littleEndian, depth + 1))
+          {
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+
+  static bool SkipRawElement(size_t& pos,
+                             const uint8_t* buffer,
+                             size_t size,
+                             bool explicitVR,
+                             bool littleEndian,
+                             unsigned int depth)
+  {
+    if (depth > MAX_RAW_DEPTH ||
+        pos > size ||
+        size - pos < 8)
+    {
+      return false;
+    }
+
+    uint32_t length;
+    bool isUnknown = false;
+
+    if (explicitVR)
+    {
+      const uint8_t* vr = buffer + pos + 4;
+      if (HasRawLongLength(vr))
+      {
+        if (size - pos < 12)
+        {
+          return false;
+        }
+
+        length = ReadRawUint32(buffer + pos + 8, littleEndian);
+        isUnknown = (vr[0] == 'U' && vr[1] == 'N');
+        pos += 12;
+      }
+      else
+      {
+        length = ReadRawUint16(buffer + pos + 6, littleEndian);
+        pos += 8;
+      }
+    }
+    else
+    {
+      length = ReadRawUint32(buffer + pos + 4, littleEndian);
+      pos += 8;
+    }
+
+    if (length != 0xffffffffu)
+    {
+      if (length > size - pos)
+      {
+        return false;
+      }
+
+      pos += length;
+      return true;
+    }
+    else if (isUnknown)
+    {
+      // The content of an UN element of undefined length is encoded
+      // using the implicit VR little endian transfer syntax
+      return SkipRawItems(pos, buffer, size, false, true, depth + 1);
+    }
+    else
+    {
+      return SkipRawItems(pos, buffer, size, explicitVR, littleEndian, depth + 1);
+    }
+  }
+
+
+  bool FromDcmtkBridge::LookupPixelDataOffset(size_t& offset,
+                                              const void* dicom,
+                                              size_t size)
+  {
+    const uint8_t* buffer = reinterpret_cast<const uint8_t*>(dicom);
+
+    // Preamble of 128 bytes, followed by the "DICM" prefix
+    if (buffer == NULL ||
+        size < 132 ||
+        memcmp(buffer + 128, "DICM", 4) != 0)
+    {
+      return false;
+    }
+
+    // Walk through the meta-header (group 0x0002), that is always
+    // encoded using the explicit VR little endian transfer syntax
+    size_t pos = 132;
+    std::string transferSyntax;
+
+    while (size - pos >= 8 &&
+           ReadRawUint16(buffer + pos, true) == 0x0002)
+    {
+      const size_t start = pos;
+      if (!SkipRawElement(pos, buffer, size, true, true, 0))
+      {
+        return false;
+      }
+
+      if (ReadRawUint16(buffer + start + 2, true) == 0x0010)
+      {
+        // The (0002,0010) element is a "UI", with a 2-byte length
+        transferSyntax.assign(reinterpret_cast<const char*>(buffer) + start + 8, pos - start - 8);
+
+        // Remove the padding
+        while (!transferSyntax.empty() &&
+               (transferSyntax[transferSyntax.size() - 1] == '\0' ||
+                transferSyntax[transferSyntax.size() - 1] == ' '))
+        {
+          transferSyntax.resize(transferSyntax.size() - 1);
+        }
+      }
+    }
+
+    bool explicitVR = true;
+    bool littleEndian = true;
+
+    if (transferSyntax == "1.2.840.10008.1.2")
+    {
+      explicitVR = false;   // Implicit VR little endian
+    }
+    else if (transferSyntax == "1.2.840.10008.1.2.2")
+    {
+      littleEndian = false;   // Explicit VR big endian
+    }
+    else if (transferSyntax.empty() ||
+             transferSyntax == "1.2.840.10008.1.2.1.99")
+    {
+      return false;   // Unknown or deflated transfer syntax
+    }
+
+    // Walk through the top-level elements of the dataset
+    while (pos < size)
+    {
+      if (size - pos < 4)
+      {
+        return false;
+      }
+
+      uint16_t group = ReadRawUint16(buffer + pos, littleEndian);
+      uint16_t element = ReadRawUint16(buffer + pos + 2, littleEndian);
+
+      if (group == 0x7fe0 &&
+          element == 0x0010)
+      {
+        // Found: Check that this is the last element of the file
+        size_t end = pos;
+        if (SkipRawElement(end, buffer, size, explicitVR, littleEndian, 0) &&
+            end == size)
+        {
+          offset = pos;
+          return true;
+        }
+        else
+        {
+          return false;
+        }
+      }
+      else if (group > 0x7fe0 ||
+               (group == 0x7fe0 && element > 0x0010))
+      {
+        return false;   // No pixel data, as the tags are sorted
+      }
+      else if (!SkipRawElement(pos, buffer, size, explicitVR, littleEndian, 0))
+      {
+        return false;
+      }
+    }
+
+    return false;
+  }
+
+
   DcmFileFormat* FromDcmtkBridge::LoadFromMemoryBuffer(const void* buffer,
                                                        size_t size)
   {
@@ -2070,28 +2384,48 @@ namespace Orthanc
 
   void FromDcmtkBridge::InitializeCodecs()
   {
+    LOG(WARNING) << "Registering RLE codecs in DCMTK";
+    DcmRLEDecoderRegistration::registerCodecs();
+    DcmRLEEncoderRegistration::registerCodecs();
+
 #if ORTHANC_ENABLE_DCMTK_JPEG_LOSSLESS == 1
     LOG(WARNING) << "Registering JPEG Lossless codecs in DCMTK";
     DJLSDecoderRegistration::registerCodecs();    
+#  if DCMTK_HAS_ENCODERS == 1
+    DJLSEncoderRegistration::registerCodecs();
+#  endif
 #endif
 
 #if ORTHANC_ENABLE_DCMTK_JPEG == 1
     LOG(WARNING) << "Registering JPEG codecs in DCMTK";
     DJDecoderRegistration::registerCodecs(); 
+#  if DCMTK_HAS_ENCODERS == 1
+    DJEncoderRegistration::registerCodecs();
+#  endif
 #endif
   }
 
 
   void FromDcmtkBridge::FinalizeCodecs()
   {
+    // Unregister RLE codecs
+    DcmRLEDecoderRegistration::cleanup();
+    DcmRLEEncoderRegistration::cleanup();
+
 #if ORTHANC_ENABLE_DCMTK_JPEG_LOSSLESS == 1
     // Unregister JPEG-LS codecs
     DJLSDecoderRegistration::cleanup();
+#  if DCMTK_HAS_ENCODERS == 1
+    DJLSEncoderRegistration::cleanup();
+#  endif
 #endif
 
 #if ORTHANC_ENABLE_DCMTK_JPEG == 1
     // Unregister JPEG codecs
     DJDecoderRegistration::cleanup();
+#  if DCMTK_HAS_ENCODERS == 1
+    DJEncoderRegistration::cleanup();
+#  endif
 #endif
   }
 }
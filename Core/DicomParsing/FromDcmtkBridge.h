@@ -189,6 +189,12 @@ namespace Orthanc
     static bool SaveToMemoryBuffer(std::string& buffer,
                                    DcmDataset& dataSet);
 
+    // Writes the dataset using the given transfer syntax, that must
+    // match the current representation of its pixel data
+    static bool SaveToMemoryBuffer(std::string& buffer,
+                                   DcmDataset& dataSet,
+                                   E_TransferSyntax xfer);
+
     static ValueRepresentation Convert(DcmEVR vr);
 
     static ValueRepresentation LookupValueRepresentation(const DicomTag& tag);
@@ -219,6 +225,14 @@ namespace Orthanc
     static DcmFileFormat* LoadFromMemoryBuffer(const void* buffer,
                                                size_t size);
 
+    // Locates the pixel data (7FE0,0010) of a DICOM file by walking
+    // through its raw encoding, without parsing it with DCMTK. Returns
+    // "false" if the pixel data is absent or is not the last element
+    // of the file, or if the transfer syntax is not supported.
+    static bool LookupPixelDataOffset(size_t& offset,
+                                      const void* dicom,
+                                      size_t size);
+
     static void FromJson(DicomMap& values,
                          const Json::Value& result);
 
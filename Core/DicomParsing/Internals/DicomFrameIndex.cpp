@@ -35,6 +35,7 @@
 #include "DicomFrameIndex.h"
 
 #include "../../OrthancException.h"
+#include "../../Toolbox.h"
 #include "../../DicomFormat/DicomImageInformation.h"
 #include "../FromDcmtkBridge.h"
 #include "../../Endianness.h"
@@ -45,6 +46,7 @@
 #include <dcmtk/dcmdata/dcdeftag.h>
 #include <dcmtk/dcmdata/dcpxitem.h>
 #include <dcmtk/dcmdata/dcpixseq.h>
+#include <dcmtk/dcmdata/dcxfer.h>
 
 namespace Orthanc
 {
@@ -53,6 +55,7 @@ namespace Orthanc
   private:
     DcmPixelSequence*           pixelSequence_;
     std::vector<DcmPixelItem*>  startFragment_;
+    std::vector<unsigned int>   startFragmentIndex_;
     std::vector<unsigned int>   countFragments_;
     std::vector<unsigned int>   frameSize_;
 
@@ -105,6 +108,7 @@ namespace Orthanc
       assert(pixelSequence != NULL);
 
       startFragment_.resize(countFrames);
+      startFragmentIndex_.resize(countFrames);
       countFragments_.resize(countFrames);
       frameSize_.resize(countFrames);
 
@@ -129,6 +133,7 @@ namespace Orthanc
         {
           fragment = pixelSequence_->nextInContainer(fragment);
           startFragment_[i] = dynamic_cast<DcmPixelItem*>(fragment);
+          startFragmentIndex_[i] = i + 1;
           frameSize_[i] = fragment->getLength();
           countFragments_[i] = 1;
         }
@@ -165,6 +170,7 @@ namespace Orthanc
       uint32_t offset = 0;
       unsigned int currentFrame = 0;
       startFragment_[0] = dynamic_cast<DcmPixelItem*>(fragment);
+      startFragmentIndex_[0] = 1;
 
       unsigned int currentFragment = 1;
       while (fragment != NULL)
@@ -174,6 +180,7 @@ namespace Orthanc
         {
           currentFrame += 1;
           startFragment_[currentFrame] = dynamic_cast<DcmPixelItem*>(fragment);
+          startFragmentIndex_[currentFrame] = currentFragment;
         }
 
         frameSize_[currentFrame] += fragment->getLength();
@@ -233,6 +240,16 @@ namespace Orthanc
         fragment = dynamic_cast<DcmPixelItem*>(pixelSequence_->nextInContainer(fragment));
       }
     }
+
+    virtual unsigned int GetStartFragment(unsigned int index) const
+    {
+      if (index >= startFragmentIndex_.size())
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      return startFragmentIndex_[index];
+    }
   };
 
 
@@ -318,6 +335,186 @@ namespace Orthanc
   };
 
 
+  class DicomFrameIndex::RawIndex : public DicomFrameIndex::IIndex
+  {
+  private:
+    typedef std::pair<size_t, size_t>  Chunk;   // Offset and size in the buffer
+    typedef std::vector<Chunk>         Chunks;
+
+    const uint8_t*       buffer_;
+    std::vector<Chunks>  frames_;
+
+    static uint16_t ReadUint16(const uint8_t* p)
+    {
+      return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t ReadUint32(const uint8_t* p)
+    {
+      return (static_cast<uint32_t>(p[0]) |
+              (static_cast<uint32_t>(p[1]) << 8) |
+              (static_cast<uint32_t>(p[2]) << 16) |
+              (static_cast<uint32_t>(p[3]) << 24));
+    }
+
+  public:
+    RawIndex(DcmFileFormat& dicom,
+             bool explicitVR,
+             const void* pixelData,
+             size_t size,
+             unsigned int countFrames) :
+      buffer_(reinterpret_cast<const uint8_t*>(pixelData))
+    {
+      frames_.resize(countFrames);
+
+      // Skip the header of the pixel data element. In explicit VR,
+      // "OB" and "OW" are followed by 2 reserved bytes.
+      const size_t headerSize = (explicitVR ? 12 : 8);
+      if (buffer_ == NULL ||
+          size < headerSize ||
+          ReadUint16(buffer_) != 0x7fe0 ||
+          ReadUint16(buffer_ + 2) != 0x0010)
+      {
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+
+      const uint32_t length = ReadUint32(buffer_ + headerSize - 4);
+      size_t pos = headerSize;
+
+      if (length != 0xffffffffu)
+      {
+        // Uncompressed image
+        DicomMap tags;
+        FromDcmtkBridge::ExtractDicomSummary(tags, *dicom.getDataset());
+
+        DicomImageInformation information(tags);
+        const size_t frameSize = information.GetFrameSize();
+
+        if (length > size - pos ||
+            length < frameSize * countFrames)
+        {
+          throw OrthancException(ErrorCode_BadFileFormat);
+        }
+
+        for (unsigned int i = 0; i < countFrames; i++)
+        {
+          frames_[i].push_back(Chunk(pos + i * frameSize, frameSize));
+        }
+
+        return;
+      }
+
+      // Encapsulated image: List the fragments, the first one being
+      // the offset table
+      Chunks fragments;
+
+      for (;;)
+      {
+        if (size - pos < 8)
+        {
+          throw OrthancException(ErrorCode_BadFileFormat);
+        }
+
+        const uint16_t group = ReadUint16(buffer_ + pos);
+        const uint16_t element = ReadUint16(buffer_ + pos + 2);
+        const uint32_t itemLength = ReadUint32(buffer_ + pos + 4);
+        pos += 8;
+
+        if (group == 0xfffe &&
+            element == 0xe0dd)
+        {
+          break;  // Sequence delimitation item
+        }
+
+        if (group != 0xfffe ||
+            element != 0xe000 ||
+            itemLength > size - pos)
+        {
+          throw OrthancException(ErrorCode_BadFileFormat);
+        }
+
+        fragments.push_back(Chunk(pos, itemLength));
+        pos += itemLength;
+      }
+
+      if (fragments.size() < countFrames + 1)
+      {
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+
+      if (fragments.size() == countFrames + 1)
+      {
+        // Simple case: There is one fragment per frame
+        for (unsigned int i = 0; i < countFrames; i++)
+        {
+          frames_[i].push_back(fragments[i + 1]);
+        }
+
+        return;
+      }
+
+      // Use the offset table, as in "FragmentIndex"
+      const Chunk& table = fragments[0];
+      if (table.second != 4 * countFrames ||
+          ReadUint32(buffer_ + table.first) != 0)
+      {
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+
+      uint32_t offset = 0;
+      unsigned int currentFrame = 0;
+
+      for (size_t i = 1; i < fragments.size(); i++)
+      {
+        if (currentFrame + 1 < countFrames &&
+            offset == ReadUint32(buffer_ + table.first + 4 * (currentFrame + 1)))
+        {
+          currentFrame += 1;
+        }
+
+        frames_[currentFrame].push_back(fragments[i]);
+
+        // 8 bytes = overhead for the item tag and length field
+        offset += static_cast<uint32_t>(fragments[i].second) + 8;
+      }
+
+      if (currentFrame + 1 != countFrames)
+      {
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+    }
+
+    virtual void GetRawFrame(std::string& frame,
+                             unsigned int index) const
+    {
+      if (index >= frames_.size())
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      const Chunks& chunks = frames_[index];
+
+      size_t size = 0;
+      for (size_t i = 0; i < chunks.size(); i++)
+      {
+        size += chunks[i].second;
+      }
+
+      frame.resize(size);
+
+      size_t offset = 0;
+      for (size_t i = 0; i < chunks.size(); i++)
+      {
+        if (chunks[i].second > 0)
+        {
+          memcpy(&frame[offset], buffer_ + chunks[i].first, chunks[i].second);
+          offset += chunks[i].second;
+        }
+      }
+    }
+  };
+
+
 
   bool DicomFrameIndex::IsVideo(DcmFileFormat& dicom)
   {
@@ -420,6 +617,46 @@ namespace Orthanc
   }
 
 
+  bool DicomFrameIndex::IsRawIndexSupported(DcmFileFormat& dicom)
+  {
+    std::string transferSyntax;
+    if (!FromDcmtkBridge::LookupTransferSyntax(transferSyntax, dicom))
+    {
+      return false;
+    }
+
+    // On big endian hosts, DCMTK would swap the uncompressed pixels
+    DcmXfer xfer(transferSyntax.c_str());
+    return (xfer.getXfer() != EXS_Unknown &&
+            xfer.isLittleEndian() &&
+            Toolbox::DetectEndianness() == Endianness_Little &&
+            !DicomImageDecoder::IsPsmctRle1(*dicom.getDataset()));
+  }
+
+
+  DicomFrameIndex::DicomFrameIndex(DcmFileFormat& dicom,
+                                   const void* pixelData,
+                                   size_t size)
+  {
+    countFrames_ = GetFramesCount(dicom);
+    if (countFrames_ == 0)
+    {
+      return;
+    }
+
+    if (!IsRawIndexSupported(dicom))
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    std::string transferSyntax;
+    FromDcmtkBridge::LookupTransferSyntax(transferSyntax, dicom);
+
+    DcmXfer xfer(transferSyntax.c_str());
+    index_.reset(new RawIndex(dicom, xfer.isExplicitVR(), pixelData, size, countFrames_));
+  }
+
+
   void DicomFrameIndex::GetRawFrame(std::string& frame,
                                     unsigned int index) const
   {
@@ -436,4 +673,21 @@ namespace Orthanc
       frame.clear();
     }
   }
+
+
+  unsigned int DicomFrameIndex::GetStartFragment(unsigned int index) const
+  {
+    if (index >= countFrames_)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else if (index_.get() != NULL)
+    {
+      return index_->GetStartFragment(index);
+    }
+    else
+    {
+      return 0;
+    }
+  }
 }
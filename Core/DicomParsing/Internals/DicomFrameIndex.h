@@ -56,11 +56,17 @@ namespace Orthanc
 
       virtual void GetRawFrame(std::string& frame,
                                unsigned int index) const = 0;
+
+      virtual unsigned int GetStartFragment(unsigned int index) const
+      {
+        return 0;  // Unknown
+      }
     };
 
     class FragmentIndex;
     class UncompressedIndex;
     class PsmctRle1Index;
+    class RawIndex;
 
     std::auto_ptr<IIndex>  index_;
     unsigned int           countFrames_;
@@ -68,6 +74,14 @@ namespace Orthanc
   public:
     DicomFrameIndex(DcmFileFormat& dicom);
 
+    // Indexes the frames using the raw encoding of the pixel data
+    // element (7FE0,0010), as found in the DICOM file, without
+    // having DCMTK parse it. The buffer must stay unchanged as long
+    // as the index is used.
+    DicomFrameIndex(DcmFileFormat& dicom,
+                    const void* pixelData,
+                    size_t size);
+
     unsigned int GetFramesCount() const
     {
       return countFrames_;
@@ -76,8 +90,17 @@ namespace Orthanc
     void GetRawFrame(std::string& frame,
                      unsigned int index) const;
 
+    // Index of the fragment that starts the given frame in the pixel
+    // sequence (the offset table being the fragment 0), as expected by
+    // "DcmCodec::decodeFrame()". Returns 0 if unknown.
+    unsigned int GetStartFragment(unsigned int index) const;
+
     static bool IsVideo(DcmFileFormat& dicom);
 
     static unsigned int GetFramesCount(DcmFileFormat& dicom);
+
+    // Tells whether the frames can be indexed from the raw encoding of
+    // the pixel data (little endian transfer syntaxes only)
+    static bool IsRawIndexSupported(DcmFileFormat& dicom);
   };
 }
@@ -95,8 +95,12 @@
 #endif
 
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
+#include <dcmtk/dcmdata/dcdeftag.h>
 #include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcpixseq.h>
+#include <dcmtk/dcmdata/dcpxitem.h>
 #include <dcmtk/dcmdata/dcrleccd.h>
 #include <dcmtk/dcmdata/dcrlecp.h>
 
@@ -470,87 +474,28 @@ namespace Orthanc
   }
 
 
-  ImageAccessor* DicomImageDecoder::ApplyCodec(const DcmCodec& codec,
-                                               const DcmCodecParameter& parameters,
-                                               DcmDataset& dataset,
-                                               unsigned int frame)
-  {
-    DcmPixelSequence* pixelSequence = FromDcmtkBridge::GetPixelSequence(dataset);
-    if (pixelSequence == NULL)
-    {
-      throw OrthancException(ErrorCode_BadFileFormat);
-    }
-
-    std::auto_ptr<ImageAccessor> target(CreateImage(dataset, true));
-
-    Uint32 startFragment = 0;  // Default 
-    OFString decompressedColorModel;  // Out
-    DJ_RPLossless representationParameter;
-    OFCondition c = codec.decodeFrame(&representationParameter, 
-                                      pixelSequence, &parameters, 
-                                      &dataset, frame, startFragment, target->GetBuffer(), 
-                                      target->GetSize(), decompressedColorModel);
-
-    if (c.good())
-    {
-      return target.release();    
-    }
-    else
-    {
-      LOG(ERROR) << "Cannot decode an image";
-      throw OrthancException(ErrorCode_BadFileFormat);
-    }
-  }
-
-
-  ImageAccessor* DicomImageDecoder::Decode(ParsedDicomFile& dicom,
-                                           unsigned int frame)
+  DcmCodec* DicomImageDecoder::CreateCodec(std::auto_ptr<DcmCodecParameter>& parameters,
+                                           E_TransferSyntax syntax)
   {
-    DcmDataset& dataset = *dicom.GetDcmtkObject().getDataset();
-    E_TransferSyntax syntax = dataset.getOriginalXfer();
-
-    /**
-     * Deal with uncompressed, raw images.
-     * http://support.dcmtk.org/docs/dcxfer_8h-source.html
-     **/
-    if (syntax == EXS_Unknown ||
-        syntax == EXS_LittleEndianImplicit ||
-        syntax == EXS_BigEndianImplicit ||
-        syntax == EXS_LittleEndianExplicit ||
-        syntax == EXS_BigEndianExplicit)
-    {
-      return DecodeUncompressedImage(dataset, frame);
-    }
-
-
 #if ORTHANC_ENABLE_DCMTK_JPEG_LOSSLESS == 1
     /**
      * Deal with JPEG-LS images.
      **/
 
-    if (syntax == EXS_JPEGLSLossless ||
-        syntax == EXS_JPEGLSLossy)
+    switch (syntax)
     {
-      DJLSCodecParameter parameters;
-      std::auto_ptr<DJLSDecoderBase> decoder;
-
-      switch (syntax)
-      {
-        case EXS_JPEGLSLossless:
-          LOG(INFO) << "Decoding a JPEG-LS lossless DICOM image";
-          decoder.reset(new DJLSLosslessDecoder);
-          break;
+      case EXS_JPEGLSLossless:
+        LOG(INFO) << "Decoding a JPEG-LS lossless DICOM image";
+        parameters.reset(new DJLSCodecParameter);
+        return new DJLSLosslessDecoder;
           
-        case EXS_JPEGLSLossy:
-          LOG(INFO) << "Decoding a JPEG-LS near-lossless DICOM image";
-          decoder.reset(new DJLSNearLosslessDecoder);
-          break;
+      case EXS_JPEGLSLossy:
+        LOG(INFO) << "Decoding a JPEG-LS near-lossless DICOM image";
+        parameters.reset(new DJLSCodecParameter);
+        return new DJLSNearLosslessDecoder;
 
-        default:
-          throw OrthancException(ErrorCode_InternalError);
-      }
-    
-      return ApplyCodec(*decoder, parameters, dataset, frame);
+      default:
+        break;
     }
 #endif
 
@@ -568,50 +513,41 @@ namespace Orthanc
         syntax == EXS_JPEGProcess14SV1)    // DJDecoderP14SV1
     {
       // http://support.dcmtk.org/docs-snapshot/djutils_8h.html#a2a9695e5b6b0f5c45a64c7f072c1eb9d
-      DJCodecParameter parameters(
+      parameters.reset(new DJCodecParameter(
         ECC_lossyYCbCr,  // Mode for color conversion for compression, Unused for decompression
         EDC_photometricInterpretation,  // Perform color space conversion from YCbCr to RGB if DICOM photometric interpretation indicates YCbCr
         EUC_default,     // Mode for UID creation, unused for decompression
-        EPC_default);    // Automatically determine whether color-by-plane is required from the SOP Class UID and decompressed photometric interpretation
-      std::auto_ptr<DJCodecDecoder> decoder;
+        EPC_default));   // Automatically determine whether color-by-plane is required from the SOP Class UID and decompressed photometric interpretation
 
       switch (syntax)
       {
         case EXS_JPEGProcess1:
           LOG(INFO) << "Decoding a JPEG baseline (process 1) DICOM image";
-          decoder.reset(new DJDecoderBaseline);
-          break;
+          return new DJDecoderBaseline;
           
         case EXS_JPEGProcess2_4 :
           LOG(INFO) << "Decoding a JPEG baseline (processes 2 and 4) DICOM image";
-          decoder.reset(new DJDecoderExtended);
-          break;
+          return new DJDecoderExtended;
           
         case EXS_JPEGProcess6_8:   // Retired
           LOG(INFO) << "Decoding a JPEG spectral section, nonhierarchical (processes 6 and 8) DICOM image";
-          decoder.reset(new DJDecoderSpectralSelection);
-          break;
+          return new DJDecoderSpectralSelection;
           
         case EXS_JPEGProcess10_12:   // Retired
           LOG(INFO) << "Decoding a JPEG full progression, nonhierarchical (processes 10 and 12) DICOM image";
-          decoder.reset(new DJDecoderProgressive);
-          break;
+          return new DJDecoderProgressive;
           
         case EXS_JPEGProcess14:
           LOG(INFO) << "Decoding a JPEG lossless, nonhierarchical (process 14) DICOM image";
-          decoder.reset(new DJDecoderLossless);
-          break;
+          return new DJDecoderLossless;
           
         case EXS_JPEGProcess14SV1:
           LOG(INFO) << "Decoding a JPEG lossless, nonhierarchical, first-order prediction (process 14 selection value 1) DICOM image";
-          decoder.reset(new DJDecoderP14SV1);
-          break;
+          return new DJDecoderP14SV1;
           
         default:
           throw OrthancException(ErrorCode_InternalError);
       }
-    
-      return ApplyCodec(*decoder, parameters, dataset, frame);      
     }
 #endif
 
@@ -619,9 +555,94 @@ namespace Orthanc
     if (syntax == EXS_RLELossless)
     {
       LOG(INFO) << "Decoding a RLE lossless DICOM image";
-      DcmRLECodecParameter parameters;
-      DcmRLECodecDecoder decoder;
-      return ApplyCodec(decoder, parameters, dataset, frame);
+      parameters.reset(new DcmRLECodecParameter);
+      return new DcmRLECodecDecoder;
+    }
+
+    return NULL;
+  }
+
+
+  ImageAccessor* DicomImageDecoder::ApplyCodec(const DcmCodec& codec,
+                                               const DcmCodecParameter& parameters,
+                                               DcmDataset& dataset,
+                                               DcmPixelSequence& pixelSequence,
+                                               unsigned int frame,
+                                               unsigned int startFragment)
+  {
+    std::auto_ptr<ImageAccessor> target(CreateImage(dataset, true));
+
+    Uint32 fragment = startFragment;  // In/out, 0 if unknown
+    OFString decompressedColorModel;  // Out
+    DJ_RPLossless representationParameter;
+    OFCondition c = codec.decodeFrame(&representationParameter, 
+                                      &pixelSequence, &parameters, 
+                                      &dataset, frame, fragment, target->GetBuffer(), 
+                                      target->GetSize(), decompressedColorModel);
+
+    if (c.good())
+    {
+      return target.release();    
+    }
+    else
+    {
+      LOG(ERROR) << "Cannot decode an image";
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+  }
+
+
+  ImageAccessor* DicomImageDecoder::Decode(ParsedDicomFile& dicom,
+                                           unsigned int frame)
+  {
+    DcmDataset& dataset = *dicom.GetDcmtkObject().getDataset();
+    E_TransferSyntax syntax = dataset.getOriginalXfer();
+
+    /**
+     * Deal with uncompressed, raw images.
+     * http://support.dcmtk.org/docs/dcxfer_8h-source.html
+     **/
+    if (syntax == EXS_Unknown ||
+        syntax == EXS_LittleEndianImplicit ||
+        syntax == EXS_BigEndianImplicit ||
+        syntax == EXS_LittleEndianExplicit ||
+        syntax == EXS_BigEndianExplicit)
+    {
+      return DecodeUncompressedImage(dataset, frame);
+    }
+
+
+    /**
+     * Deal with the images that are supported by the built-in codecs
+     * of DCMTK (JPEG, JPEG-LS and RLE).
+     **/
+    {
+      std::auto_ptr<DcmCodecParameter> parameters;
+      std::auto_ptr<DcmCodec> codec(CreateCodec(parameters, syntax));
+
+      if (codec.get() != NULL)
+      {
+        DcmPixelSequence* pixelSequence = FromDcmtkBridge::GetPixelSequence(dataset);
+        if (pixelSequence == NULL)
+        {
+          throw OrthancException(ErrorCode_BadFileFormat);
+        }
+
+        // Use the frame index to locate the first fragment of the
+        // frame, otherwise DCMTK scans the pixel sequence from its
+        // beginning for each frame
+        unsigned int startFragment;
+        try
+        {
+          startFragment = dicom.GetFrameStartFragment(frame);
+        }
+        catch (OrthancException&)
+        {
+          startFragment = 0;  // Let DCMTK find the fragment
+        }
+
+        return ApplyCodec(*codec, *parameters, dataset, *pixelSequence, frame, startFragment);
+      }
     }
 
 
@@ -651,6 +672,280 @@ namespace Orthanc
   }
 
 
+  class DicomImageDecoder::ParallelDecoder : public boost::noncopyable
+  {
+  private:
+    boost::mutex                  mutex_;
+    ParsedDicomFile&              dicom_;
+    E_TransferSyntax              syntax_;
+    unsigned int                  first_;
+    std::vector<ImageAccessor*>&  frames_;  // One slot per frame
+    unsigned int                  next_;
+    ErrorCode                     error_;
+
+    // DCMTK is not thread-safe: Each worker decodes its frames using
+    // a private copy of the DICOM tags (without the pixel data)
+    static DcmDataset* CloneHeader(DcmDataset& source)
+    {
+      std::auto_ptr<DcmDataset> target(new DcmDataset);
+
+      for (unsigned long i = 0; i < source.card(); i++)
+      {
+        DcmElement* element = source.getElement(i);
+        if (element != NULL &&
+            element->getTag() != DCM_PixelData)
+        {
+          std::auto_ptr<DcmElement> clone(dynamic_cast<DcmElement*>(element->clone()));
+          if (clone.get() == NULL ||
+              !target->insert(clone.get(), false, false).good())
+          {
+            throw OrthancException(ErrorCode_InternalError);
+          }
+
+          clone.release();
+        }
+      }
+
+      return target.release();
+    }
+
+    static void AppendFragment(DcmPixelSequence& sequence,
+                               const std::string& content)
+    {
+      std::auto_ptr<DcmPixelItem> fragment(new DcmPixelItem(DcmTag(DCM_Item, EVR_OB)));
+
+      if (!content.empty() &&
+          !fragment->putUint8Array(reinterpret_cast<const Uint8*>(content.c_str()),
+                                   content.size()).good())
+      {
+        throw OrthancException(ErrorCode_NotEnoughMemory);
+      }
+
+      if (!sequence.insert(fragment.get()).good())
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      fragment.release();
+    }
+
+    bool GetNextFrame(unsigned int& slot,
+                      std::string& compressed)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (error_ != ErrorCode_Success ||
+          next_ >= frames_.size())
+      {
+        return false;
+      }
+
+      // The access to the source DICOM file is serialized, but this
+      // is a mere copy of the fragments thanks to the frame index
+      std::string mime;
+      slot = next_++;
+      dicom_.GetRawFrame(compressed, mime, first_ + slot);
+
+      return true;
+    }
+
+    void SignalError(ErrorCode error)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (error_ == ErrorCode_Success)
+      {
+        error_ = error;
+      }
+    }
+
+    static void Worker(ParallelDecoder* that,
+                       DcmDataset* header)
+    {
+      try
+      {
+        std::auto_ptr<DcmCodecParameter> parameters;
+        std::auto_ptr<DcmCodec> codec(CreateCodec(parameters, that->syntax_));
+        if (codec.get() == NULL)
+        {
+          throw OrthancException(ErrorCode_InternalError);
+        }
+
+        unsigned int slot;
+        std::string compressed;
+
+        while (that->GetNextFrame(slot, compressed))
+        {
+          // Wrap the frame into a pixel sequence of its own, made of
+          // an empty offset table followed by one single fragment
+          DcmPixelSequence sequence(DcmTag(DCM_PixelData, EVR_OB));
+          AppendFragment(sequence, "");
+          AppendFragment(sequence, compressed);
+
+          that->frames_[slot] = ApplyCodec(*codec, *parameters, *header, sequence, 0, 1);
+        }
+      }
+      catch (OrthancException& e)
+      {
+        that->SignalError(e.GetErrorCode());
+      }
+      catch (...)
+      {
+        that->SignalError(ErrorCode_InternalError);
+      }
+    }
+
+  public:
+    ParallelDecoder(ParsedDicomFile& dicom,
+                    E_TransferSyntax syntax,
+                    unsigned int first,
+                    std::vector<ImageAccessor*>& frames) :
+      dicom_(dicom),
+      syntax_(syntax),
+      first_(first),
+      frames_(frames),
+      next_(0),
+      error_(ErrorCode_Success)
+    {
+    }
+
+    void Run(DcmDataset& source,
+             unsigned int threadsCount)
+    {
+      std::vector<DcmDataset*> headers;
+      std::vector<boost::thread*> threads;
+
+      try
+      {
+        for (unsigned int i = 0; i < threadsCount; i++)
+        {
+          headers.push_back(NULL);
+          headers.back() = CloneHeader(source);
+        }
+
+        for (unsigned int i = 0; i < threadsCount; i++)
+        {
+          threads.push_back(NULL);
+          threads.back() = new boost::thread(Worker, this, headers[i]);
+        }
+      }
+      catch (...)
+      {
+        SignalError(ErrorCode_InternalError);
+      }
+
+      for (size_t i = 0; i < threads.size(); i++)
+      {
+        if (threads[i] != NULL)
+        {
+          if (threads[i]->joinable())
+          {
+            threads[i]->join();
+          }
+
+          delete threads[i];
+        }
+      }
+
+      for (size_t i = 0; i < headers.size(); i++)
+      {
+        if (headers[i] != NULL)
+        {
+          delete headers[i];
+        }
+      }
+
+      if (error_ != ErrorCode_Success)
+      {
+        throw OrthancException(error_);
+      }
+    }
+  };
+
+
+  void DicomImageDecoder::DecodeFrames(std::vector<ImageAccessor*>& target,
+                                       ParsedDicomFile& dicom,
+                                       unsigned int first,
+                                       unsigned int count,
+                                       unsigned int threadsCount)
+  {
+    if (first + count < first ||
+        first + count > dicom.GetFramesCount())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (threadsCount == 0)
+    {
+      threadsCount = boost::thread::hardware_concurrency();
+    }
+
+    if (threadsCount > count)
+    {
+      threadsCount = count;
+    }
+
+    DcmDataset& dataset = *dicom.GetDcmtkObject().getDataset();
+    E_TransferSyntax syntax = dataset.getOriginalXfer();
+
+    bool parallel = false;
+    if (threadsCount > 1)
+    {
+      std::auto_ptr<DcmCodecParameter> parameters;
+      std::auto_ptr<DcmCodec> codec(CreateCodec(parameters, syntax));
+
+      if (codec.get() != NULL)
+      {
+        try
+        {
+          // The frames can only be decoded independently of each
+          // other if the fragments of each frame are known
+          parallel = (dicom.GetFrameStartFragment(first) != 0);
+        }
+        catch (OrthancException&)
+        {
+        }
+      }
+    }
+
+    target.reserve(target.size() + count);
+
+    std::vector<ImageAccessor*> frames(count, NULL);
+
+    try
+    {
+      if (parallel)
+      {
+        ParallelDecoder decoder(dicom, syntax, first, frames);
+        decoder.Run(dataset, threadsCount);
+      }
+      else
+      {
+        // Uncompressed images, or images that are decoded by
+        // converting their transfer syntax: Sequential decoding
+        for (unsigned int i = 0; i < count; i++)
+        {
+          frames[i] = Decode(dicom, first + i);
+        }
+      }
+    }
+    catch (OrthancException&)
+    {
+      for (size_t i = 0; i < frames.size(); i++)
+      {
+        if (frames[i] != NULL)
+        {
+          delete frames[i];
+        }
+      }
+
+      throw;
+    }
+
+    target.insert(target.end(), frames.begin(), frames.end());
+  }
+
+
   static bool IsColorImage(PixelFormat format)
   {
     return (format == PixelFormat_RGB24 ||
@@ -784,11 +1079,13 @@ namespace Orthanc
   void DicomImageDecoder::ExtractPngImage(std::string& result,
                                           std::auto_ptr<ImageAccessor>& image,
                                           ImageExtractionMode mode,
-                                          bool invert)
+                                          bool invert,
+                                          ImageEncoderProfile profile)
   {
     ApplyExtractionMode(image, mode, invert);
 
     PngWriter writer;
+    writer.SetProfile(profile);
     writer.WriteToMemory(result, *image);
   }
 #endif
@@ -799,7 +1096,9 @@ namespace Orthanc
                                            std::auto_ptr<ImageAccessor>& image,
                                            ImageExtractionMode mode,
                                            bool invert,
-                                           uint8_t quality)
+                                           uint8_t quality,
+                                           ImageEncoderProfile profile,
+                                           bool chromaSubsampling)
   {
     if (mode != ImageExtractionMode_UInt8 &&
         mode != ImageExtractionMode_Preview)
@@ -811,6 +1110,8 @@ namespace Orthanc
 
     JpegWriter writer;
     writer.SetQuality(quality);
+    writer.SetProfile(profile);
+    writer.SetChromaSubsampling(chromaSubsampling);
     writer.WriteToMemory(result, *image);
   }
 #endif
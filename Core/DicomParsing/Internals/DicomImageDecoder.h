@@ -36,6 +36,8 @@
 #include "../ParsedDicomFile.h"
 
 #include <memory>
+#include <vector>
+#include <dcmtk/dcmdata/dcxfer.h>
 
 #if !defined(ORTHANC_ENABLE_JPEG)
 #  error The macro ORTHANC_ENABLE_JPEG must be defined
@@ -57,6 +59,7 @@
 class DcmDataset;
 class DcmCodec;
 class DcmCodecParameter;
+class DcmPixelSequence;
 
 namespace Orthanc
 {
@@ -64,6 +67,7 @@ namespace Orthanc
   {
   private:
     class ImageSource;
+    class ParallelDecoder;
 
     DicomImageDecoder()   // This is a fully abstract class, no constructor
     {
@@ -75,10 +79,17 @@ namespace Orthanc
     static ImageAccessor* DecodeUncompressedImage(DcmDataset& dataset,
                                                   unsigned int frame);
 
+    // Returns NULL if no built-in codec of DCMTK can decode this
+    // transfer syntax
+    static DcmCodec* CreateCodec(std::auto_ptr<DcmCodecParameter>& parameters,
+                                 E_TransferSyntax syntax);
+
     static ImageAccessor* ApplyCodec(const DcmCodec& codec,
                                      const DcmCodecParameter& parameters,
                                      DcmDataset& dataset,
-                                     unsigned int frame);
+                                     DcmPixelSequence& pixelSequence,
+                                     unsigned int frame,
+                                     unsigned int startFragment);
 
     static bool TruncateDecodedImage(std::auto_ptr<ImageAccessor>& image,
                                      PixelFormat format,
@@ -99,11 +110,22 @@ namespace Orthanc
     static ImageAccessor *Decode(ParsedDicomFile& dicom,
                                  unsigned int frame);
 
+    // Decodes the frames in the range [first, first + count[. The
+    // compressed frames are decoded in parallel by "threadsCount"
+    // threads (0 means one thread per CPU core). The decoded frames
+    // are appended to "target", and the caller takes their ownership.
+    static void DecodeFrames(std::vector<ImageAccessor*>& target,
+                             ParsedDicomFile& dicom,
+                             unsigned int first,
+                             unsigned int count,
+                             unsigned int threadsCount);
+
 #if ORTHANC_ENABLE_PNG == 1
     static void ExtractPngImage(std::string& result,
                                 std::auto_ptr<ImageAccessor>& image,
                                 ImageExtractionMode mode,
-                                bool invert);
+                                bool invert,
+                                ImageEncoderProfile profile);
 #endif
 
 #if ORTHANC_ENABLE_JPEG == 1
@@ -111,7 +133,9 @@ namespace Orthanc
                                  std::auto_ptr<ImageAccessor>& image,
                                  ImageExtractionMode mode,
                                  bool invert,
-                                 uint8_t quality);
+                                 uint8_t quality,
+                                 ImageEncoderProfile profile,
+                                 bool chromaSubsampling);
 #endif
   };
 }
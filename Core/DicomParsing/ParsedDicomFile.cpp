@@ -138,11 +138,24 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/math/special_functions/round.hpp>
 #include <dcmtk/dcmdata/dcostrmb.h>
+#include <dcmtk/dcmdata/dcistrmb.h>
+#include <dcmtk/dcmdata/dcxfer.h>
+#include <dcmtk/dcmdata/dcrlerp.h>
 #include <boost/algorithm/string/predicate.hpp>
 
+#if ORTHANC_ENABLE_DCMTK_JPEG == 1
+#  include <dcmtk/dcmjpeg/djrplol.h>
+#endif
+
+#if ORTHANC_ENABLE_DCMTK_JPEG_LOSSLESS == 1
+#  include <dcmtk/dcmjpls/djrparam.h>
+#endif
+
 
 #if DCMTK_VERSION_NUMBER <= 360
 #  define EXS_JPEGProcess1      EXS_JPEGProcess1TransferSyntax
+#  define EXS_JPEGProcess14     EXS_JPEGProcess14TransferSyntax
+#  define EXS_JPEGProcess14SV1  EXS_JPEGProcess14SV1TransferSyntax
 #endif
 
 
@@ -153,9 +166,62 @@ namespace Orthanc
   {
     std::auto_ptr<DcmFileFormat> file_;
     std::auto_ptr<DicomFrameIndex>  frameIndex_;
+
+    // Raw encoding of the pixel data element (7FE0,0010), if it has
+    // not been parsed by DCMTK yet (lazy mode)
+    bool              hasLazyPixelData_;
+    std::string       lazyPixelData_;
+    E_TransferSyntax  lazyPixelDataXfer_;
+
+    PImpl() :
+      hasLazyPixelData_(false),
+      lazyPixelDataXfer_(EXS_Unknown)
+    {
+    }
   };
 
 
+  namespace
+  {
+    // Temporarily inserts an empty pixel data element into a dataset
+    // whose pixel data has not been parsed yet, so that the summaries
+    // are the same as if the pixel data was parsed
+    class PixelDataPlaceholder : public boost::noncopyable
+    {
+    private:
+      DcmDataset&  dataset_;
+      bool         inserted_;
+
+    public:
+      PixelDataPlaceholder(DcmDataset& dataset,
+                           bool insert) :
+        dataset_(dataset),
+        inserted_(false)
+      {
+        if (insert)
+        {
+          DcmPixelData* element = new DcmPixelData(DCM_PixelData);
+          if (!dataset_.insert(element, false, false).good())
+          {
+            delete element;
+            throw OrthancException(ErrorCode_InternalError);
+          }
+
+          inserted_ = true;
+        }
+      }
+
+      ~PixelDataPlaceholder()
+      {
+        if (inserted_)
+        {
+          delete dataset_.remove(DCM_PixelData);
+        }
+      }
+    };
+  }
+
+
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
   static const char* CONTENT_TYPE_OCTET_STREAM = "application/octet-stream";
 
@@ -262,6 +328,24 @@ namespace Orthanc
       {
         return length_;
       }
+
+      virtual bool HasETag(std::string& /*etag*/)
+      {
+        return false;
+      }
+
+      virtual bool SeekTo(uint64_t position)
+      {
+        if (position > length_)
+        {
+          return false;
+        }
+        else
+        {
+          offset_ = static_cast<uint32_t>(position);
+          return true;
+        }
+      }
  
       virtual bool ReadNextChunk()
       {
@@ -450,6 +534,8 @@ namespace Orthanc
   void ParsedDicomFile::SendPathValue(RestApiOutput& output,
                                       const UriComponents& uri)
   {
+    LoadPixelData();
+
     DcmItem* dicom = pimpl_->file_->getDataset();
     E_TransferSyntax transferSyntax = pimpl_->file_->getDataset()->getOriginalXfer();
 
@@ -510,6 +596,15 @@ namespace Orthanc
   {
     InvalidateCache();
 
+    if (tag == DICOM_TAG_PIXEL_DATA &&
+        pimpl_->hasLazyPixelData_)
+    {
+      // No need to parse the pixel data that is removed
+      pimpl_->hasLazyPixelData_ = false;
+      pimpl_->lazyPixelData_.clear();
+      return;
+    }
+
     DcmTagKey key(tag.GetGroup(), tag.GetElement());
     DcmElement* element = pimpl_->file_->getDataset()->remove(key);
     if (element != NULL)
@@ -524,6 +619,11 @@ namespace Orthanc
   {
     InvalidateCache();
 
+    if (tag == DICOM_TAG_PIXEL_DATA)
+    {
+      LoadPixelData();
+    }
+
     DcmItem* dicom = pimpl_->file_->getDataset();
     DcmTagKey key(tag.GetGroup(), tag.GetElement());
 
@@ -609,6 +709,11 @@ namespace Orthanc
                                const Json::Value& value,
                                bool decodeDataUriScheme)
   {
+    if (tag == DICOM_TAG_PIXEL_DATA)
+    {
+      LoadPixelData();
+    }
+
     if (pimpl_->file_->getDataset()->tagExists(ToDcmtkBridge::Convert(tag)))
     {
       throw OrthancException(ErrorCode_AlreadyExistingTag);
@@ -723,6 +828,11 @@ namespace Orthanc
   {
     InvalidateCache();
 
+    if (tag == DICOM_TAG_PIXEL_DATA)
+    {
+      LoadPixelData();
+    }
+
     DcmDataset& dicom = *pimpl_->file_->getDataset();
     if (CanReplaceProceed(dicom, ToDcmtkBridge::Convert(tag), mode))
     {
@@ -755,6 +865,11 @@ namespace Orthanc
   {
     InvalidateCache();
 
+    if (tag == DICOM_TAG_PIXEL_DATA)
+    {
+      LoadPixelData();
+    }
+
     DcmDataset& dicom = *pimpl_->file_->getDataset();
     if (CanReplaceProceed(dicom, ToDcmtkBridge::Convert(tag), mode))
     {
@@ -792,7 +907,7 @@ namespace Orthanc
   void ParsedDicomFile::Answer(RestApiOutput& output)
   {
     std::string serialized;
-    if (FromDcmtkBridge::SaveToMemoryBuffer(serialized, *pimpl_->file_->getDataset()))
+    if (SaveToMemoryBufferInternal(serialized))
     {
       output.AnswerBuffer(serialized, CONTENT_TYPE_OCTET_STREAM);
     }
@@ -803,6 +918,11 @@ namespace Orthanc
   bool ParsedDicomFile::GetTagValue(std::string& value,
                                     const DicomTag& tag)
   {
+    if (tag == DICOM_TAG_PIXEL_DATA)
+    {
+      LoadPixelData();
+    }
+
     DcmTagKey k(tag.GetGroup(), tag.GetElement());
     DcmDataset& dataset = *pimpl_->file_->getDataset();
 
@@ -879,9 +999,92 @@ namespace Orthanc
   }
 
 
+  bool ParsedDicomFile::SaveToMemoryBufferInternal(std::string& buffer)
+  {
+    DcmDataset& dataset = *pimpl_->file_->getDataset();
+
+    if (pimpl_->hasLazyPixelData_ &&
+        (dataset.getOriginalXfer() != pimpl_->lazyPixelDataXfer_ ||
+         dataset.tagExists(DcmTagKey(0x7fe0, 0x0000))))
+    {
+      // The raw pixel data cannot be appended as such, because the
+      // transfer syntax differs, or because its group length would
+      // be wrong
+      LoadPixelData();
+    }
+
+    if (!FromDcmtkBridge::SaveToMemoryBuffer(buffer, dataset))
+    {
+      return false;
+    }
+
+    if (pimpl_->hasLazyPixelData_)
+    {
+      // The pixel data is the last element of the dataset
+      buffer.append(pimpl_->lazyPixelData_);
+    }
+
+    return true;
+  }
+
+
   void ParsedDicomFile::SaveToMemoryBuffer(std::string& buffer)
   {
-    FromDcmtkBridge::SaveToMemoryBuffer(buffer, *pimpl_->file_->getDataset());
+    SaveToMemoryBufferInternal(buffer);
+  }
+
+
+  bool ParsedDicomFile::Transcode(std::string& target,
+                                  const std::string& transferSyntaxUid)
+  {
+    E_TransferSyntax xfer = DcmXfer(transferSyntaxUid.c_str()).getXfer();
+
+    // Only the lossless transfer syntaxes are supported, so that
+    // the SOP Instance UID can be kept
+    std::auto_ptr<DcmRepresentationParameter> parameters;
+
+    switch (xfer)
+    {
+      case EXS_LittleEndianImplicit:
+      case EXS_LittleEndianExplicit:
+      case EXS_BigEndianExplicit:
+        break;
+
+      case EXS_RLELossless:
+        parameters.reset(new DcmRLERepresentationParameter);
+        break;
+
+#if ORTHANC_ENABLE_DCMTK_JPEG == 1
+      case EXS_JPEGProcess14:
+      case EXS_JPEGProcess14SV1:
+        parameters.reset(new DJ_RPLossless);
+        break;
+#endif
+
+#if ORTHANC_ENABLE_DCMTK_JPEG_LOSSLESS == 1
+      case EXS_JPEGLSLossless:
+        parameters.reset(new DJLSRepresentationParameter(0 /* near-lossless */, OFTrue));
+        break;
+#endif
+
+      default:
+        LOG(ERROR) << "Cannot transcode to this transfer syntax: " << transferSyntaxUid;
+        throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    LoadPixelData();
+    InvalidateCache();
+
+    // This fails if no codec is registered in DCMTK for the source
+    // or for the target transfer syntax
+    DcmDataset& dataset = *pimpl_->file_->getDataset();
+    if (!dataset.chooseRepresentation(xfer, parameters.get()).good() ||
+        !dataset.canWriteXfer(xfer))
+    {
+      return false;
+    }
+
+    return FromDcmtkBridge::SaveToMemoryBuffer(target, dataset, xfer);
   }
 
 
@@ -960,22 +1163,101 @@ namespace Orthanc
   }
 
 
-  ParsedDicomFile::ParsedDicomFile(const void* content, 
-                                   size_t size) : pimpl_(new PImpl)
+  void ParsedDicomFile::LoadFromMemoryBuffer(const void* content,
+                                             size_t size,
+                                             bool lazyPixelData)
   {
-    pimpl_->file_.reset(FromDcmtkBridge::LoadFromMemoryBuffer(content, size));
+    size_t offset;
+    if (lazyPixelData &&
+        size > 0 &&
+        FromDcmtkBridge::LookupPixelDataOffset(offset, content, size))
+    {
+      // Only parse the elements that precede the pixel data, and keep
+      // a raw copy of the latter
+      pimpl_->file_.reset(FromDcmtkBridge::LoadFromMemoryBuffer(content, offset));
+
+      std::string transferSyntax;
+      if (FromDcmtkBridge::LookupTransferSyntax(transferSyntax, *pimpl_->file_))
+      {
+        DcmXfer xfer(transferSyntax.c_str());
+        if (xfer.getXfer() != EXS_Unknown)
+        {
+          pimpl_->hasLazyPixelData_ = true;
+          pimpl_->lazyPixelData_.assign(reinterpret_cast<const char*>(content) + offset, size - offset);
+          pimpl_->lazyPixelDataXfer_ = xfer.getXfer();
+          return;
+        }
+      }
+    }
+
+    pimpl_->file_.reset(FromDcmtkBridge::LoadFromMemoryBuffer(size > 0 ? content : NULL, size));
   }
 
-  ParsedDicomFile::ParsedDicomFile(const std::string& content) : pimpl_(new PImpl)
+
+  void ParsedDicomFile::LoadPixelData() const
   {
-    if (content.size() == 0)
+    if (!pimpl_->hasLazyPixelData_)
     {
-      pimpl_->file_.reset(FromDcmtkBridge::LoadFromMemoryBuffer(NULL, 0));
+      return;
     }
-    else
+
+    DcmInputBufferStream is;
+    is.setBuffer(pimpl_->lazyPixelData_.c_str(), pimpl_->lazyPixelData_.size());
+    is.setEos();
+
+    DcmDataset tmp;
+    tmp.transferInit();
+    if (!tmp.read(is, pimpl_->lazyPixelDataXfer_).good())
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    tmp.loadAllDataIntoMemory();
+    tmp.transferEnd();
+
+    DcmElement* element = tmp.remove(DCM_PixelData);
+    if (element == NULL)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    if (!pimpl_->file_->getDataset()->insert(element, true /* replace */, false).good())
     {
-      pimpl_->file_.reset(FromDcmtkBridge::LoadFromMemoryBuffer(&content[0], content.size()));
+      delete element;
+      throw OrthancException(ErrorCode_InternalError);
     }
+
+    // The frame index might refer to the raw pixel data
+    pimpl_->frameIndex_.reset(NULL);
+    pimpl_->hasLazyPixelData_ = false;
+    pimpl_->lazyPixelData_.clear();
+  }
+
+
+  ParsedDicomFile::ParsedDicomFile(const void* content, 
+                                   size_t size) : pimpl_(new PImpl)
+  {
+    LoadFromMemoryBuffer(content, size, false);
+  }
+
+  ParsedDicomFile::ParsedDicomFile(const std::string& content) : pimpl_(new PImpl)
+  {
+    LoadFromMemoryBuffer(content.empty() ? NULL : content.c_str(), content.size(), false);
+  }
+
+
+  ParsedDicomFile::ParsedDicomFile(const void* content, 
+                                   size_t size,
+                                   bool lazyPixelData) : pimpl_(new PImpl)
+  {
+    LoadFromMemoryBuffer(content, size, lazyPixelData);
+  }
+
+
+  ParsedDicomFile::ParsedDicomFile(const std::string& content,
+                                   bool lazyPixelData) : pimpl_(new PImpl)
+  {
+    LoadFromMemoryBuffer(content.empty() ? NULL : content.c_str(), content.size(), lazyPixelData);
   }
 
 
@@ -983,6 +1265,9 @@ namespace Orthanc
     pimpl_(new PImpl)
   {
     pimpl_->file_.reset(dynamic_cast<DcmFileFormat*>(other.pimpl_->file_->clone()));
+    pimpl_->hasLazyPixelData_ = other.pimpl_->hasLazyPixelData_;
+    pimpl_->lazyPixelData_ = other.pimpl_->lazyPixelData_;
+    pimpl_->lazyPixelDataXfer_ = other.pimpl_->lazyPixelDataXfer_;
 
     // Create a new instance-level identifier
     ReplacePlainString(DICOM_TAG_SOP_INSTANCE_UID, FromDcmtkBridge::GenerateUniqueIdentifier(ResourceType_Instance));
@@ -1009,6 +1294,8 @@ namespace Orthanc
 
   DcmFileFormat& ParsedDicomFile::GetDcmtkObject() const
   {
+    // The caller might access the pixel data through DCMTK
+    LoadPixelData();
     return *pimpl_->file_.get();
   }
 
@@ -1107,6 +1394,7 @@ namespace Orthanc
     }
 
     InvalidateCache();
+    LoadPixelData();
 
     if (accessor.GetFormat() == PixelFormat_RGBA32)
     {
@@ -1243,9 +1531,7 @@ namespace Orthanc
                                       unsigned int maxStringLength)
   {
     std::set<DicomTag> ignoreTagLength;
-    FromDcmtkBridge::ExtractDicomAsJson(target, *pimpl_->file_->getDataset(),
-                                        format, flags, maxStringLength,
-                                        GetDefaultDicomEncoding(), ignoreTagLength);
+    DatasetToJson(target, format, flags, maxStringLength, ignoreTagLength);
   }
 
 
@@ -1255,6 +1541,23 @@ namespace Orthanc
                                       unsigned int maxStringLength,
                                       const std::set<DicomTag>& ignoreTagLength)
   {
+    bool placeholder = false;
+
+    if (pimpl_->hasLazyPixelData_ &&
+        (flags & DicomToJsonFlags_IncludePixelData))
+    {
+      if (flags & DicomToJsonFlags_ConvertBinaryToNull)
+      {
+        // The value of the pixel data is not needed
+        placeholder = true;
+      }
+      else
+      {
+        LoadPixelData();
+      }
+    }
+
+    PixelDataPlaceholder guard(*pimpl_->file_->getDataset(), placeholder);
     FromDcmtkBridge::ExtractDicomAsJson(target, *pimpl_->file_->getDataset(),
                                         format, flags, maxStringLength,
                                         GetDefaultDicomEncoding(), ignoreTagLength);
@@ -1264,14 +1567,16 @@ namespace Orthanc
   void ParsedDicomFile::DatasetToJson(Json::Value& target,
                                       const std::set<DicomTag>& ignoreTagLength)
   {
-    FromDcmtkBridge::ExtractDicomAsJson(target, *pimpl_->file_->getDataset(), ignoreTagLength);
+    // Same parameters as "FromDcmtkBridge::ExtractDicomAsJson()"
+    DatasetToJson(target, DicomToJsonFormat_Full, DicomToJsonFlags_Default,
+                  ORTHANC_MAXIMUM_TAG_LENGTH, ignoreTagLength);
   }
 
 
   void ParsedDicomFile::DatasetToJson(Json::Value& target)
   {
     const std::set<DicomTag> ignoreTagLength;
-    FromDcmtkBridge::ExtractDicomAsJson(target, *pimpl_->file_->getDataset(), ignoreTagLength);
+    DatasetToJson(target, ignoreTagLength);
   }
 
 
@@ -1284,6 +1589,12 @@ namespace Orthanc
 
   bool ParsedDicomFile::HasTag(const DicomTag& tag) const
   {
+    if (tag == DICOM_TAG_PIXEL_DATA &&
+        pimpl_->hasLazyPixelData_)
+    {
+      return true;
+    }
+
     DcmTag key(tag.GetGroup(), tag.GetElement());
     return pimpl_->file_->getDataset()->tagExists(key);
   }
@@ -1412,15 +1723,31 @@ namespace Orthanc
   }
 
 
-  void ParsedDicomFile::GetRawFrame(std::string& target,
-                                    std::string& mime,
-                                    unsigned int frameId)
+  void ParsedDicomFile::LoadFrameIndex()
   {
     if (pimpl_->frameIndex_.get() == NULL)
     {
-      pimpl_->frameIndex_.reset(new DicomFrameIndex(*pimpl_->file_));
+      if (pimpl_->hasLazyPixelData_ &&
+          DicomFrameIndex::IsRawIndexSupported(*pimpl_->file_))
+      {
+        // Index the frames directly in the raw pixel data
+        pimpl_->frameIndex_.reset(new DicomFrameIndex(*pimpl_->file_, pimpl_->lazyPixelData_.c_str(),
+                                                      pimpl_->lazyPixelData_.size()));
+      }
+      else
+      {
+        LoadPixelData();
+        pimpl_->frameIndex_.reset(new DicomFrameIndex(*pimpl_->file_));
+      }
     }
+  }
 
+
+  void ParsedDicomFile::GetRawFrame(std::string& target,
+                                    std::string& mime,
+                                    unsigned int frameId)
+  {
+    LoadFrameIndex();
     pimpl_->frameIndex_->GetRawFrame(target, frameId);
 
     E_TransferSyntax transferSyntax = pimpl_->file_->getDataset()->getOriginalXfer();
@@ -1442,6 +1769,13 @@ namespace Orthanc
   }
 
 
+  unsigned int ParsedDicomFile::GetFrameStartFragment(unsigned int frameId)
+  {
+    LoadFrameIndex();
+    return pimpl_->frameIndex_->GetStartFragment(frameId);
+  }
+
+
   void ParsedDicomFile::InvalidateCache()
   {
     pimpl_->frameIndex_.reset(NULL);
@@ -1468,6 +1802,7 @@ namespace Orthanc
 
   void ParsedDicomFile::ExtractDicomSummary(DicomMap& target) const
   {
+    PixelDataPlaceholder guard(*pimpl_->file_->getDataset(), pimpl_->hasLazyPixelData_);
     FromDcmtkBridge::ExtractDicomSummary(target, *pimpl_->file_->getDataset());
   }
 
@@ -85,6 +85,16 @@ namespace Orthanc
 
     bool EmbedContentInternal(const std::string& dataUriScheme);
 
+    void LoadFromMemoryBuffer(const void* content,
+                              size_t size,
+                              bool lazyPixelData);
+
+    void LoadPixelData() const;
+
+    bool SaveToMemoryBufferInternal(std::string& buffer);
+
+    void LoadFrameIndex();
+
   public:
     ParsedDicomFile(bool createIdentifiers);  // Create a minimal DICOM instance
 
@@ -98,6 +108,16 @@ namespace Orthanc
 
     ParsedDicomFile(const std::string& content);
 
+    // If "lazyPixelData" is "true", the pixel data is only parsed by
+    // DCMTK when it is actually accessed. This only applies if the
+    // pixel data is the last element of the file.
+    ParsedDicomFile(const void* content,
+                    size_t size,
+                    bool lazyPixelData);
+
+    ParsedDicomFile(const std::string& content,
+                    bool lazyPixelData);
+
     ParsedDicomFile(DcmDataset& dicom);
 
     ParsedDicomFile(DcmFileFormat& dicom);
@@ -159,6 +179,13 @@ namespace Orthanc
 
     void SaveToMemoryBuffer(std::string& buffer);
 
+    // Writes this instance using another lossless transfer syntax,
+    // given by its UID. Returns "false" if DCMTK has no codec for
+    // this conversion (e.g. the JPEG encoders are not available in
+    // the static builds of DCMTK).
+    bool Transcode(std::string& target,
+                   const std::string& transferSyntaxUid);
+
     void SaveToFile(const std::string& path);
 
     void EmbedContent(const std::string& dataUriScheme);
@@ -210,6 +237,10 @@ namespace Orthanc
 
     unsigned int GetFramesCount() const;
 
+    // Index of the fragment that starts the given frame in the pixel
+    // sequence, as expected by "DcmCodec::decodeFrame()" (0 if unknown)
+    unsigned int GetFrameStartFragment(unsigned int frameId);
+
     static ParsedDicomFile* CreateFromJson(const Json::Value& value,
                                            DicomFromJsonFlags flags);
 
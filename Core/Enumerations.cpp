@@ -574,6 +574,25 @@ namespace Orthanc
   }
 
 
+  const char* EnumerationToString(ImageEncoderProfile profile)
+  {
+    switch (profile)
+    {
+      case ImageEncoderProfile_Fast:
+        return "Fast";
+
+      case ImageEncoderProfile_Balanced:
+        return "Balanced";
+
+      case ImageEncoderProfile_Small:
+        return "Small";
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
   const char* EnumerationToString(Encoding encoding)
   {
     switch (encoding)
@@ -869,6 +888,109 @@ namespace Orthanc
   }
 
 
+  const char* EnumerationToString(ValueRepresentation vr)
+  {
+    switch (vr)
+    {
+      case ValueRepresentation_ApplicationEntity:
+        return "AE";
+
+      case ValueRepresentation_AgeString:
+        return "AS";
+
+      case ValueRepresentation_AttributeTag:
+        return "AT";
+
+      case ValueRepresentation_CodeString:
+        return "CS";
+
+      case ValueRepresentation_Date:
+        return "DA";
+
+      case ValueRepresentation_DecimalString:
+        return "DS";
+
+      case ValueRepresentation_DateTime:
+        return "DT";
+
+      case ValueRepresentation_FloatingPointSingle:
+        return "FL";
+
+      case ValueRepresentation_FloatingPointDouble:
+        return "FD";
+
+      case ValueRepresentation_IntegerString:
+        return "IS";
+
+      case ValueRepresentation_LongString:
+        return "LO";
+
+      case ValueRepresentation_LongText:
+        return "LT";
+
+      case ValueRepresentation_OtherByte:
+        return "OB";
+
+      case ValueRepresentation_OtherDouble:
+        return "OD";
+
+      case ValueRepresentation_OtherFloat:
+        return "OF";
+
+      case ValueRepresentation_OtherLong:
+        return "OL";
+
+      case ValueRepresentation_OtherWord:
+        return "OW";
+
+      case ValueRepresentation_PersonName:
+        return "PN";
+
+      case ValueRepresentation_ShortString:
+        return "SH";
+
+      case ValueRepresentation_SignedLong:
+        return "SL";
+
+      case ValueRepresentation_Sequence:
+        return "SQ";
+
+      case ValueRepresentation_SignedShort:
+        return "SS";
+
+      case ValueRepresentation_ShortText:
+        return "ST";
+
+      case ValueRepresentation_Time:
+        return "TM";
+
+      case ValueRepresentation_UnlimitedCharacters:
+        return "UC";
+
+      case ValueRepresentation_UniqueIdentifier:
+        return "UI";
+
+      case ValueRepresentation_UnsignedLong:
+        return "UL";
+
+      case ValueRepresentation_Unknown:
+        return "UN";
+
+      case ValueRepresentation_UniversalResource:
+        return "UR";
+
+      case ValueRepresentation_UnsignedShort:
+        return "US";
+
+      case ValueRepresentation_UnlimitedText:
+        return "UT";
+
+      default: 
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
   Encoding StringToEncoding(const char* encoding)
   {
     std::string s(encoding);
@@ -994,6 +1116,28 @@ namespace Orthanc
   }
 
 
+  ImageEncoderProfile StringToImageEncoderProfile(const char* profile)
+  {
+    std::string s(profile);
+    Toolbox::ToUpperCase(s);
+
+    if (s == "FAST")
+    {
+      return ImageEncoderProfile_Fast;
+    }
+    else if (s == "BALANCED")
+    {
+      return ImageEncoderProfile_Balanced;
+    }
+    else if (s == "SMALL")
+    {
+      return ImageEncoderProfile_Small;
+    }
+
+    throw OrthancException(ErrorCode_ParameterOutOfRange);
+  }
+
+
   LogLevel StringToLogLevel(const char *level)
   {
     if (strcmp(level, "ERROR") == 0)
@@ -319,6 +319,16 @@ namespace Orthanc
   };
 
 
+  // Trade-off between the speed of the PNG/JPEG encoders and the
+  // size of the encoded images
+  enum ImageEncoderProfile
+  {
+    ImageEncoderProfile_Fast,
+    ImageEncoderProfile_Balanced,
+    ImageEncoderProfile_Small
+  };
+
+
   // https://en.wikipedia.org/wiki/HTTP_compression
   enum HttpCompression
   {
@@ -553,6 +563,7 @@ namespace Orthanc
     FileContentType_Unknown = 0,
     FileContentType_Dicom = 1,
     FileContentType_DicomAsJson = 2,
+    FileContentType_Thumbnail = 3,
 
     // Make sure that the value "65535" can be stored into this enumeration
     FileContentType_StartUser = 1024,
@@ -578,6 +589,8 @@ namespace Orthanc
 
   const char* EnumerationToString(ImageFormat format);
 
+  const char* EnumerationToString(ImageEncoderProfile profile);
+
   const char* EnumerationToString(Encoding encoding);
 
   const char* EnumerationToString(PhotometricInterpretation photometric);
@@ -596,12 +609,16 @@ namespace Orthanc
 
   const char* EnumerationToString(DicomVersion version);
 
+  const char* EnumerationToString(ValueRepresentation vr);
+
   Encoding StringToEncoding(const char* encoding);
 
   ResourceType StringToResourceType(const char* type);
 
   ImageFormat StringToImageFormat(const char* format);
 
+  ImageEncoderProfile StringToImageEncoderProfile(const char* profile);
+
   LogLevel StringToLogLevel(const char* level);
 
   ValueRepresentation StringToValueRepresentation(const std::string& vr,
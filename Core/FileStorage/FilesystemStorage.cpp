@@ -104,6 +104,9 @@ namespace Orthanc
       case FileContentType_DicomAsJson:
         return "JSON summary of DICOM";
 
+      case FileContentType_Thumbnail:
+        return "JPEG thumbnail";
+
       default:
         return "User-defined";
     }
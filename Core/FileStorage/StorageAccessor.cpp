@@ -165,21 +165,41 @@ namespace Orthanc
         extension = ".json";
         break;
 
+      case FileContentType_Thumbnail:
+        extension = ".jpg";
+        break;
+
       default:
         // Non-standard content type
         extension = "";
     }
 
     sender.SetContentFilename(info.GetUuid() + std::string(extension));
+
+    // The attachments are immutable, hence their UUID can be used as
+    // a strong validator
+    sender.SetETag(GetETag(info));
   }
 #endif
 
 
+  std::string StorageAccessor::GetETag(const FileInfo& info)
+  {
+    return "\"" + info.GetUuid() + "\"";
+  }
+
+
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
   void StorageAccessor::AnswerFile(HttpOutput& output,
                                    const FileInfo& info,
                                    const std::string& mime)
   {
+    if (output.AnswerNotModified(GetETag(info)))
+    {
+      // Avoid reading the file from the storage area
+      return;
+    }
+
     BufferHttpSender sender;
     SetupSender(sender, info, mime);
   
@@ -194,6 +214,11 @@ namespace Orthanc
                                    const FileInfo& info,
                                    const std::string& mime)
   {
+    if (output.AnswerNotModified(GetETag(info)))
+    {
+      return;
+    }
+
     BufferHttpSender sender;
     SetupSender(sender, info, mime);
   
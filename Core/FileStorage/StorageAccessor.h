@@ -107,6 +107,9 @@ namespace Orthanc
       area_.Remove(info.GetUuid(), info.GetContentType());
     }
 
+    // Strong HTTP validator of the uncompressed content of an attachment
+    static std::string GetETag(const FileInfo& info);
+
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
     void AnswerFile(HttpOutput& output,
                     const FileInfo& info,
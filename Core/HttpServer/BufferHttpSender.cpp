@@ -47,6 +47,21 @@ namespace Orthanc
   }
 
 
+  bool BufferHttpSender::SeekTo(uint64_t position)
+  {
+    if (position > buffer_.size())
+    {
+      return false;
+    }
+    else
+    {
+      position_ = static_cast<size_t>(position);
+      currentChunkSize_ = 0;
+      return true;
+    }
+  }
+
+
   bool BufferHttpSender::ReadNextChunk()
   {
     assert(position_ + currentChunkSize_ <= buffer_.size());
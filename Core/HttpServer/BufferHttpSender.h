@@ -74,6 +74,8 @@ namespace Orthanc
       return buffer_.size();
     }
 
+    virtual bool SeekTo(uint64_t position);
+
     virtual bool ReadNextChunk();
 
     virtual const char* GetChunkContent();
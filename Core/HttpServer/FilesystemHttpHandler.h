@@ -65,6 +65,19 @@ namespace Orthanc
       const char* /*bodyData*/,
       size_t /*bodySize*/);
 
+    virtual bool CreateChunkedRequestReader(
+      std::auto_ptr<IChunkedRequestReader>& target,
+      RequestOrigin origin,
+      const char* remoteIp,
+      const char* username,
+      HttpMethod method,
+      const UriComponents& uri,
+      const Arguments& headers)
+    {
+      // This handler only serves GET requests, that have no body
+      return false;
+    }
+
     bool IsListDirectoryContent() const
     {
       return listDirectoryContent_;
@@ -55,6 +55,19 @@ namespace Orthanc
   }
 
 
+  bool FilesystemHttpSender::SeekTo(uint64_t position)
+  {
+    if (position > size_)
+    {
+      return false;
+    }
+
+    file_.clear();
+    file_.seekg(static_cast<std::streamoff>(position), file_.beg);
+    return file_.good();
+  }
+
+
   bool FilesystemHttpSender::ReadNextChunk()
   {
     if (chunk_.size() == 0)
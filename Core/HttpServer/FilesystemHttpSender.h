@@ -76,6 +76,8 @@ namespace Orthanc
       return size_;
     }
 
+    virtual bool SeekTo(uint64_t position);
+
     virtual bool ReadNextChunk();
 
     virtual const char* GetChunkContent()
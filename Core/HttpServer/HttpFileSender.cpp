@@ -52,6 +52,25 @@ namespace Orthanc
   }
 
 
+  void HttpFileSender::SetETag(const std::string& etag)
+  {
+    if (etag.empty())
+    {
+      etag_.clear();
+    }
+    else if (etag.size() >= 2 &&
+             etag[0] == '"' &&
+             etag[etag.size() - 1] == '"')
+    {
+      etag_ = etag;
+    }
+    else
+    {
+      etag_ = "\"" + etag + "\"";
+    }
+  }
+
+
   bool HttpFileSender::HasContentFilename(std::string& filename)
   {
     if (filename_.empty())
@@ -76,4 +95,18 @@ namespace Orthanc
       return contentType_;
     }
   }
+
+
+  bool HttpFileSender::HasETag(std::string& etag)
+  {
+    if (etag_.empty())
+    {
+      return false;
+    }
+    else
+    {
+      etag = etag_;
+      return true;
+    }
+  }
 }
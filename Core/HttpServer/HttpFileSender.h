@@ -42,6 +42,7 @@ namespace Orthanc
   private:
     std::string contentType_;
     std::string filename_;
+    std::string etag_;
 
   public:
     void SetContentType(const std::string& contentType)
@@ -61,6 +62,14 @@ namespace Orthanc
       return filename_;
     }
 
+    // The ETag must only be set if the content is immutable
+    void SetETag(const std::string& etag);
+
+    const std::string& GetETag() const
+    {
+      return etag_;
+    }
+
 
     /**
      * Implementation of the IHttpStreamAnswer interface.
@@ -75,5 +84,7 @@ namespace Orthanc
     virtual bool HasContentFilename(std::string& filename);
     
     virtual std::string GetContentType();
+
+    virtual bool HasETag(std::string& etag);
   };
 }
@@ -41,14 +41,173 @@
 #include "../Compression/GzipCompressor.h"
 #include "../Compression/ZlibCompressor.h"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <stdio.h>
+#include <string.h>
+#include <zlib.h>
 #include <boost/lexical_cast.hpp>
 
 
 namespace Orthanc
 {
+  namespace
+  {
+    enum RangeStatus
+    {
+      RangeStatus_Ignored,
+      RangeStatus_Satisfiable,
+      RangeStatus_Unsatisfiable
+    };
+  }
+
+
+  static bool MatchETag(const std::string& ifNoneMatch,
+                        const std::string& etag)
+  {
+    if (ifNoneMatch.empty() ||
+        etag.empty())
+    {
+      return false;
+    }
+
+    std::vector<std::string> tokens;
+    Toolbox::TokenizeString(tokens, ifNoneMatch, ',');
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      std::string s = Toolbox::StripSpaces(tokens[i]);
+
+      // "If-None-Match" uses the weak comparison function
+      if (Toolbox::StartsWith(s, "W/"))
+      {
+        s = s.substr(2);
+      }
+
+      if (s == "*" ||
+          s == etag)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  static std::string GetEncodedETag(const std::string& etag,
+                                    HttpCompression compression)
+  {
+    // Each content encoding is a distinct representation, that must
+    // receive its own strong validator
+    if (compression == HttpCompression_None ||
+        etag.size() < 2)
+    {
+      return etag;
+    }
+
+    std::string suffix;
+    switch (compression)
+    {
+      case HttpCompression_Gzip:
+        suffix = "-gzip";
+        break;
+
+      case HttpCompression_Deflate:
+        suffix = "-deflate";
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    return etag.substr(0, etag.size() - 1) + suffix + "\"";
+  }
+
+
+  static RangeStatus ParseRange(uint64_t& start,
+                                uint64_t& end,
+                                const std::string& range,
+                                uint64_t length)
+  {
+    // Only a single range of bytes is supported, other requests
+    // are answered with the full content, as allowed by RFC 7233
+    std::string s = Toolbox::StripSpaces(range);
+    if (!Toolbox::StartsWith(s, "bytes=") ||
+        s.find(',') != std::string::npos)
+    {
+      return RangeStatus_Ignored;
+    }
+
+    s = s.substr(6);
+
+    size_t dash = s.find('-');
+    if (dash == std::string::npos)
+    {
+      return RangeStatus_Ignored;
+    }
+
+    std::string first = Toolbox::StripSpaces(s.substr(0, dash));
+    std::string last = Toolbox::StripSpaces(s.substr(dash + 1));
+
+    try
+    {
+      if (first.empty())
+      {
+        // Suffix range: "bytes=-500" means the last 500 bytes
+        if (last.empty())
+        {
+          return RangeStatus_Ignored;
+        }
+
+        uint64_t suffix = boost::lexical_cast<uint64_t>(last);
+        if (suffix == 0 ||
+            length == 0)
+        {
+          return RangeStatus_Unsatisfiable;
+        }
+
+        start = (suffix >= length ? 0 : length - suffix);
+        end = length - 1;
+      }
+      else
+      {
+        start = boost::lexical_cast<uint64_t>(first);
+
+        if (last.empty())
+        {
+          end = (length == 0 ? 0 : length - 1);
+        }
+        else
+        {
+          end = boost::lexical_cast<uint64_t>(last);
+          if (end < start)
+          {
+            return RangeStatus_Ignored;
+          }
+        }
+
+        if (start >= length)
+        {
+          return RangeStatus_Unsatisfiable;
+        }
+
+        if (end >= length)
+        {
+          end = length - 1;
+        }
+      }
+
+      return RangeStatus_Satisfiable;
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return RangeStatus_Ignored;
+    }
+  }
+
+
   HttpOutput::StateMachine::StateMachine(IHttpOutputStream& stream,
                                          bool isKeepAlive) : 
     stream_(stream),
@@ -75,6 +234,23 @@ namespace Orthanc
   }
 
 
+  void HttpOutput::StateMachine::CloseConnection()
+  {
+    if (keepAlive_)
+    {
+      try
+      {
+        stream_.DisableKeepAlive();
+      }
+      catch (OrthancException&)
+      {
+        LOG(WARNING) << "This HTTP server cannot close a keep-alive connection, "
+                     << "the client might wait for the rest of a truncated answer";
+      }
+    }
+  }
+
+
   void HttpOutput::StateMachine::SetHttpStatus(HttpStatus status)
   {
     if (state_ != State_WritingHeader)
@@ -157,7 +333,8 @@ namespace Orthanc
       }
     }
 
-    if (state_ == State_WritingMultipart)
+    if (state_ == State_WritingMultipart ||
+        state_ == State_WritingChunks)
     {
       throw OrthancException(ErrorCode_InternalError);
     }
@@ -184,13 +361,30 @@ namespace Orthanc
         s += *it;
       }
 
-      if (status_ != HttpStatus_200_Ok)
+      if (status_ != HttpStatus_200_Ok &&
+          status_ != HttpStatus_206_PartialContent)
       {
         hasContentLength_ = false;
       }
 
-      uint64_t contentLength = (hasContentLength_ ? contentLength_ : length);
-      s += "Content-Length: " + boost::lexical_cast<std::string>(contentLength) + "\r\n\r\n";
+      if (status_ == HttpStatus_304_NotModified)
+      {
+        // A "304 Not Modified" answer never has a body, and its
+        // "Content-Length" would be the one of the full representation
+        // (RFC 7230, section 3.3.2): Do not send this header
+        if (length != 0)
+        {
+          LOG(WARNING) << "Ignoring the body of a \"304 Not Modified\" HTTP answer";
+          length = 0;
+        }
+
+        s += "\r\n";
+      }
+      else
+      {
+        uint64_t contentLength = (hasContentLength_ ? contentLength_ : length);
+        s += "Content-Length: " + boost::lexical_cast<std::string>(contentLength) + "\r\n\r\n";
+      }
 
       stream_.Send(true, s.c_str(), s.size());
       state_ = State_WritingBody;
@@ -244,6 +438,10 @@ namespace Orthanc
         LOG(ERROR) << "Cannot invoke CloseBody() with multipart outputs";
         throw OrthancException(ErrorCode_BadSequenceOfCalls);
 
+      case State_WritingChunks:
+        LOG(ERROR) << "Cannot invoke CloseBody() with chunked outputs";
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+
       case State_Done:
         return;  // Ignore
 
@@ -397,21 +595,25 @@ namespace Orthanc
   }
 
 
+  static std::string FormatChunkSize(size_t size)
+  {
+    // Header of one chunk in the chunked transfer encoding (RFC 7230, Section 4.1)
+    char tmp[32];
+    sprintf(tmp, "%lx\r\n", static_cast<unsigned long>(size));
+    return tmp;
+  }
+
+
   void HttpOutput::StateMachine::StartMultipart(const std::string& subType,
                                                 const std::string& contentType)
   {
     if (subType != "mixed" &&
-        subType != "related")
+        subType != "related" &&
+        subType != "x-mixed-replace")
     {
       throw OrthancException(ErrorCode_ParameterOutOfRange);
     }
 
-    if (keepAlive_)
-    {
-      LOG(ERROR) << "Multipart answers are not implemented together with keep-alive connections";
-      throw OrthancException(ErrorCode_NotImplemented);
-    }
-
     if (state_ != State_WritingHeader)
     {
       throw OrthancException(ErrorCode_BadSequenceOfCalls);
@@ -427,6 +629,14 @@ namespace Orthanc
 
     std::string header = "HTTP/1.1 200 OK\r\n";
 
+    if (keepAlive_)
+    {
+      // The length of a multipart answer is not known in advance: Use
+      // the chunked transfer encoding so that the connection can be
+      // reused once the answer is complete
+      header += "Connection: keep-alive\r\nTransfer-Encoding: chunked\r\n";
+    }
+
     // Possibly add the cookies
     for (std::list<std::string>::const_iterator
            it = headers_.begin(); it != headers_.end(); ++it)
@@ -442,7 +652,16 @@ namespace Orthanc
 
     multipartBoundary_ = SystemToolbox::GenerateUuid();
     multipartContentType_ = contentType;
-    header += "Content-Type: multipart/" + subType + "; type=" + contentType + "; boundary=" + multipartBoundary_ + "\r\n\r\n";
+    header += "Content-Type: multipart/" + subType + "; type=" + contentType + "; boundary=" + multipartBoundary_ + "\r\n";
+
+    if (subType == "x-mixed-replace")
+    {
+      // Each part replaces the previous one (MJPEG streams): Prevent
+      // the intermediate proxies from buffering the answer
+      header += "Cache-Control: no-cache\r\n";
+    }
+
+    header += "\r\n";
 
     stream_.Send(true, header.c_str(), header.size());
     state_ = State_WritingMultipart;
@@ -503,6 +722,13 @@ namespace Orthanc
       header += "MIME-Version: 1.0\r\n\r\n";
     }
 
+    if (keepAlive_)
+    {
+      // Each part is sent as one chunk
+      std::string chunk = FormatChunkSize(header.size() + length + 2);
+      stream_.Send(false, chunk.c_str(), chunk.size());
+    }
+
     stream_.Send(false, header.c_str(), header.size());
 
     if (length > 0)
@@ -510,7 +736,7 @@ namespace Orthanc
       stream_.Send(false, item, length);
     }
 
-    stream_.Send(false, "\r\n", 2);    
+    stream_.Send(false, keepAlive_ ? "\r\n\r\n" : "\r\n", keepAlive_ ? 4 : 2);
   }
 
 
@@ -526,6 +752,13 @@ namespace Orthanc
     try
     {
       std::string header = "--" + multipartBoundary_ + "--\r\n";
+
+      if (keepAlive_)
+      {
+        // Last chunk of data, followed by the terminating empty chunk
+        header = FormatChunkSize(header.size()) + header + "\r\n0\r\n\r\n";
+      }
+
       stream_.Send(false, header.c_str(), header.size());
     }
     catch (OrthancException&)
@@ -536,10 +769,304 @@ namespace Orthanc
   }
 
 
+  void HttpOutput::StateMachine::StartChunkedBody()
+  {
+    if (state_ != State_WritingHeader)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (status_ != HttpStatus_200_Ok)
+    {
+      SendBody(NULL, 0);
+      return;
+    }
+
+    stream_.OnHttpStatusReceived(status_);
+
+    std::string header = "HTTP/1.1 200 OK\r\n";
+
+    if (keepAlive_)
+    {
+      header += "Connection: keep-alive\r\n";
+    }
+
+    for (std::list<std::string>::const_iterator
+           it = headers_.begin(); it != headers_.end(); ++it)
+    {
+      header += *it;
+    }
+
+    header += "Transfer-Encoding: chunked\r\n\r\n";
+
+    stream_.Send(true, header.c_str(), header.size());
+    state_ = State_WritingChunks;
+  }
+
+
+  void HttpOutput::StateMachine::SendChunk(const void* buffer,
+                                           size_t length)
+  {
+    if (state_ != State_WritingChunks)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (length > 0)  // An empty chunk would terminate the body
+    {
+      std::string chunk = FormatChunkSize(length);
+      stream_.Send(false, chunk.c_str(), chunk.size());
+      stream_.Send(false, buffer, length);
+      stream_.Send(false, "\r\n", 2);
+    }
+  }
+
+
+  void HttpOutput::StateMachine::CloseChunkedBody()
+  {
+    if (state_ != State_WritingChunks)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    stream_.Send(false, "0\r\n\r\n", 5);
+    state_ = State_Done;
+  }
+
+
+  class HttpOutput::ChunksCompressor : public boost::noncopyable
+  {
+  private:
+    z_stream     stream_;
+    std::string  buffer_;
+
+  public:
+    ChunksCompressor(HttpCompression compression)
+    {
+      memset(&stream_, 0, sizeof(stream_));
+
+      // Adding 16 to the window bits makes zlib write a gzip header
+      // and trailer, instead of the zlib ones that are expected by
+      // the "deflate" content encoding
+      int windowBits;
+      switch (compression)
+      {
+        case HttpCompression_Gzip:
+          windowBits = MAX_WBITS + 16;
+          break;
+
+        case HttpCompression_Deflate:
+          windowBits = MAX_WBITS;
+          break;
+
+        default:
+          throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      if (deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      buffer_.resize(64 * 1024);
+    }
+
+    ~ChunksCompressor()
+    {
+      deflateEnd(&stream_);
+    }
+
+    // The compressed data is sent as soon as it fills the buffer:
+    // The memory usage does not depend on the size of the answer
+    void Compress(StateMachine& target,
+                  const void* data,
+                  size_t size,
+                  bool finish)
+    {
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+
+      do
+      {
+        const size_t block = std::min(size, static_cast<size_t>(1024 * 1024 * 1024));
+        const bool isLast = (block == size);
+
+        stream_.next_in = const_cast<Bytef*>(p);
+        stream_.avail_in = static_cast<uInt>(block);
+
+        const int flush = (finish && isLast) ? Z_FINISH : Z_NO_FLUSH;
+        int code;
+
+        do
+        {
+          stream_.next_out = reinterpret_cast<Bytef*>(&buffer_[0]);
+          stream_.avail_out = static_cast<uInt>(buffer_.size());
+
+          code = deflate(&stream_, flush);
+          if (code == Z_STREAM_ERROR)
+          {
+            throw OrthancException(ErrorCode_InternalError);
+          }
+
+          const size_t produced = buffer_.size() - stream_.avail_out;
+          if (produced > 0)
+          {
+            target.SendChunk(buffer_.c_str(), produced);
+          }
+        }
+        while (flush == Z_FINISH ? code != Z_STREAM_END : stream_.avail_out == 0);
+
+        p += block;
+        size -= block;
+      }
+      while (size > 0);
+    }
+  };
+
+
+  HttpOutput::~HttpOutput()
+  {
+  }
+
+
+  void HttpOutput::StartChunkedBody(bool allowCompression)
+  {
+    HttpCompression compression = (allowCompression ?
+                                   GetPreferredCompression(0) :
+                                   HttpCompression_None);
+
+    std::auto_ptr<ChunksCompressor> compressor;
+
+    switch (compression)
+    {
+      case HttpCompression_None:
+        break;
+
+      case HttpCompression_Gzip:
+        compressor.reset(new ChunksCompressor(compression));
+        stateMachine_.AddHeader("Content-Encoding", "gzip");
+        break;
+
+      case HttpCompression_Deflate:
+        compressor.reset(new ChunksCompressor(compression));
+        stateMachine_.AddHeader("Content-Encoding", "deflate");
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_InternalError);
+    }
+
+    stateMachine_.StartChunkedBody();
+
+    if (stateMachine_.GetState() == StateMachine::State_WritingChunks)
+    {
+      chunksCompressor_ = compressor;
+    }
+  }
+
+
+  void HttpOutput::SendChunk(const void* buffer,
+                             size_t length)
+  {
+    if (chunksCompressor_.get() == NULL)
+    {
+      stateMachine_.SendChunk(buffer, length);
+    }
+    else if (length > 0)
+    {
+      if (stateMachine_.GetState() != StateMachine::State_WritingChunks)
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+
+      chunksCompressor_->Compress(stateMachine_, buffer, length, false);
+    }
+  }
+
+
+  void HttpOutput::CloseChunkedBody()
+  {
+    if (chunksCompressor_.get() != NULL)
+    {
+      if (stateMachine_.GetState() != StateMachine::State_WritingChunks)
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+
+      chunksCompressor_->Compress(stateMachine_, NULL, 0, true);
+      chunksCompressor_.reset(NULL);
+    }
+
+    stateMachine_.CloseChunkedBody();
+  }
+
+
+  bool HttpOutput::AnswerNotModified(const std::string& etag)
+  {
+    if (MatchETag(ifNoneMatch_, etag))
+    {
+      stateMachine_.AddHeader("ETag", etag);
+      SendStatus(HttpStatus_304_NotModified);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
   void HttpOutput::Answer(IHttpStreamAnswer& stream)
   {
     HttpCompression compression = stream.SetupHttpCompression(isGzipAllowed_, isDeflateAllowed_);
 
+    std::string etag;
+    if (stream.HasETag(etag))
+    {
+      etag = GetEncodedETag(etag, compression);
+
+      if (AnswerNotModified(etag))
+      {
+        return;
+      }
+
+      stateMachine_.AddHeader("ETag", etag);
+    }
+
+    const uint64_t length = stream.GetContentLength();
+    uint64_t start = 0, end = 0;
+    bool isPartial = false;
+
+    // Byte ranges are only served on the uncompressed representation
+    if (compression == HttpCompression_None &&
+        length > 0 &&
+        stream.SeekTo(0))
+    {
+      stateMachine_.AddHeader("Accept-Ranges", "bytes");
+
+      if (!range_.empty() &&
+          (ifRange_.empty() || ifRange_ == etag))
+      {
+        switch (ParseRange(start, end, range_, length))
+        {
+          case RangeStatus_Ignored:
+            break;
+
+          case RangeStatus_Satisfiable:
+            isPartial = true;
+            break;
+
+          case RangeStatus_Unsatisfiable:
+            stateMachine_.AddHeader("Content-Range", "bytes */" + boost::lexical_cast<std::string>(length));
+            SendStatus(HttpStatus_416_RequestedRangeNotSatisfiable);
+            return;
+
+          default:
+            throw OrthancException(ErrorCode_InternalError);
+        }
+      }
+    }
+
     switch (compression)
     {
       case HttpCompression_None:
@@ -557,7 +1084,24 @@ namespace Orthanc
         throw OrthancException(ErrorCode_ParameterOutOfRange);
     }
 
-    stateMachine_.SetContentLength(stream.GetContentLength());
+    uint64_t remaining = length;
+
+    if (isPartial)
+    {
+      if (!stream.SeekTo(start))
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      remaining = end - start + 1;
+      stateMachine_.SetHttpStatus(HttpStatus_206_PartialContent);
+      stateMachine_.AddHeader("Content-Range", "bytes " + 
+                              boost::lexical_cast<std::string>(start) + "-" +
+                              boost::lexical_cast<std::string>(end) + "/" +
+                              boost::lexical_cast<std::string>(length));
+    }
+
+    stateMachine_.SetContentLength(remaining);
 
     std::string contentType = stream.GetContentType();
     if (contentType.empty())
@@ -575,8 +1119,25 @@ namespace Orthanc
 
     while (stream.ReadNextChunk())
     {
-      stateMachine_.SendBody(stream.GetChunkContent(),
-                             stream.GetChunkSize());
+      size_t size = stream.GetChunkSize();
+
+      if (isPartial)
+      {
+        if (size > remaining)
+        {
+          size = static_cast<size_t>(remaining);
+        }
+
+        remaining -= size;
+      }
+
+      stateMachine_.SendBody(stream.GetChunkContent(), size);
+
+      if (isPartial &&
+          remaining == 0)
+      {
+        break;
+      }
     }
 
     stateMachine_.CloseBody();
@@ -41,6 +41,7 @@
 #include <string>
 #include <stdint.h>
 #include <map>
+#include <memory>
 
 namespace Orthanc
 {
@@ -57,6 +58,7 @@ namespace Orthanc
         State_WritingHeader,      
         State_WritingBody,
         State_WritingMultipart,
+        State_WritingChunks,
         State_Done
       };
 
@@ -107,17 +109,32 @@ namespace Orthanc
 
       void CloseMultipart();
 
+      void StartChunkedBody();
+
+      void SendChunk(const void* buffer,
+                     size_t length);
+
+      void CloseChunkedBody();
+
       void CloseBody();
 
+      void CloseConnection();
+
       State GetState() const
       {
         return state_;
       }
     };
 
+    class ChunksCompressor;
+
     StateMachine stateMachine_;
     bool         isDeflateAllowed_;
     bool         isGzipAllowed_;
+    std::string  ifNoneMatch_;
+    std::string  range_;
+    std::string  ifRange_;
+    std::auto_ptr<ChunksCompressor>  chunksCompressor_;
 
     HttpCompression GetPreferredCompression(size_t bodySize) const;
 
@@ -130,6 +147,28 @@ namespace Orthanc
     {
     }
 
+    ~HttpOutput();
+
+    // Value of the "If-None-Match" header of the HTTP request
+    void SetIfNoneMatch(const std::string& ifNoneMatch)
+    {
+      ifNoneMatch_ = ifNoneMatch;
+    }
+
+    // Values of the "Range" and "If-Range" headers of the HTTP
+    // request. Only single byte ranges are supported.
+    void SetRange(const std::string& range,
+                  const std::string& ifRange)
+    {
+      range_ = range;
+      ifRange_ = ifRange;
+    }
+
+    // Answers with "304 Not Modified" if the client already owns the
+    // content with the given strong ETag. This allows to skip the
+    // reading of immutable content from the storage area.
+    bool AnswerNotModified(const std::string& etag);
+
     void SetDeflateAllowed(bool allowed)
     {
       isDeflateAllowed_ = allowed;
@@ -223,6 +262,33 @@ namespace Orthanc
       return stateMachine_.GetState() == StateMachine::State_WritingMultipart;
     }
 
+    // Sends a body whose size is not known in advance, using the
+    // chunked transfer encoding. This allows to produce large answers
+    // progressively, without keeping them in memory.
+    // If "allowCompression" is "true", the chunks are compressed on
+    // the fly if the HTTP client accepts "gzip" or "deflate"
+    void StartChunkedBody(bool allowCompression = false);
+
+    void SendChunk(const void* buffer,
+                   size_t length);
+
+    void CloseChunkedBody();
+
+    bool IsWritingChunks() const
+    {
+      return stateMachine_.GetState() == StateMachine::State_WritingChunks;
+    }
+
+    // Asks the HTTP server to close the connection once the current
+    // request is handled. This must be called if an answer is aborted
+    // after its header was sent, as the client could otherwise wait
+    // for the remainder of a truncated answer on a keep-alive
+    // connection.
+    void CloseConnection()
+    {
+      stateMachine_.CloseConnection();
+    }
+
     void Answer(IHttpStreamAnswer& stream);
   };
 }
@@ -38,12 +38,252 @@
 #include "../Compression/ZlibCompressor.h"
 
 #include <string.h>   // For memcpy()
+#include <algorithm>
 #include <cassert>
+#include <zlib.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <stdio.h>
 
 namespace Orthanc
 {
+  namespace
+  {
+    class TranscodingStatistics : public boost::noncopyable
+    {
+    private:
+      boost::mutex  mutex_;
+      uint64_t      deflateCount_;
+      uint64_t      deflateBytes_;
+      uint64_t      deflateUncompressedBytes_;
+      uint64_t      gzipCount_;
+      uint64_t      gzipBytes_;
+      uint64_t      gzipUncompressedBytes_;
+      uint64_t      inflateCount_;
+      uint64_t      inflateBytes_;
+      uint64_t      inflateMicroseconds_;
+      int64_t       savedBytes_;
+
+      // Uncompressed minus sent bytes. This is negative if the
+      // compression has expanded a small attachment.
+      void AddSaved(uint64_t uncompressedBytes,
+                    uint64_t sentBytes)
+      {
+        savedBytes_ += (static_cast<int64_t>(uncompressedBytes) -
+                        static_cast<int64_t>(sentBytes));
+      }
+
+    public:
+      TranscodingStatistics() :
+        deflateCount_(0),
+        deflateBytes_(0),
+        deflateUncompressedBytes_(0),
+        gzipCount_(0),
+        gzipBytes_(0),
+        gzipUncompressedBytes_(0),
+        inflateCount_(0),
+        inflateBytes_(0),
+        inflateMicroseconds_(0),
+        savedBytes_(0)
+      {
+      }
+
+      void AddDeflate(uint64_t sentBytes,
+                      uint64_t uncompressedBytes)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        deflateCount_++;
+        deflateBytes_ += sentBytes;
+        deflateUncompressedBytes_ += uncompressedBytes;
+        AddSaved(uncompressedBytes, sentBytes);
+      }
+
+      // The time that is spent inflating the payload to compute its
+      // CRC-32 is accounted in "InflateMilliseconds"
+      void AddGzip(uint64_t sentBytes,
+                   uint64_t uncompressedBytes,
+                   uint64_t microseconds)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        gzipCount_++;
+        gzipBytes_ += sentBytes;
+        gzipUncompressedBytes_ += uncompressedBytes;
+        AddSaved(uncompressedBytes, sentBytes);
+        inflateMicroseconds_ += microseconds;
+      }
+
+      void AddInflate(uint64_t sentBytes,
+                      uint64_t microseconds)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        inflateCount_++;
+        inflateBytes_ += sentBytes;
+        inflateMicroseconds_ += microseconds;
+      }
+
+      void Format(Json::Value& target)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        // Use strings, as "Json::Value" cannot store 64bit integers
+        target["DeflatePassThroughCount"] = boost::lexical_cast<std::string>(deflateCount_);
+        target["DeflatePassThroughBytes"] = boost::lexical_cast<std::string>(deflateBytes_);
+        target["DeflatePassThroughUncompressedBytes"] = boost::lexical_cast<std::string>(deflateUncompressedBytes_);
+        target["GzipRewrapCount"] = boost::lexical_cast<std::string>(gzipCount_);
+        target["GzipRewrapBytes"] = boost::lexical_cast<std::string>(gzipBytes_);
+        target["GzipRewrapUncompressedBytes"] = boost::lexical_cast<std::string>(gzipUncompressedBytes_);
+
+        // Bytes that were not sent on the network thanks to the
+        // compression of the attachments (uncompressed minus sent)
+        target["SavedBytes"] = boost::lexical_cast<std::string>(savedBytes_);
+
+        target["InflateCount"] = boost::lexical_cast<std::string>(inflateCount_);
+        target["InflateBytes"] = boost::lexical_cast<std::string>(inflateBytes_);
+        target["InflateMilliseconds"] = boost::lexical_cast<std::string>(inflateMicroseconds_ / 1000);
+      }
+    };
+  }
+
+
+  static TranscodingStatistics  statistics_;
+
+
+  static uint64_t GetElapsedMicroseconds(const boost::posix_time::ptime& start)
+  {
+    boost::posix_time::time_duration elapsed = 
+      boost::posix_time::microsec_clock::universal_time() - start;
+
+    return static_cast<uint64_t>(elapsed.total_microseconds());
+  }
+
+
+  static void WriteLittleEndian32(std::string& target,
+                                  size_t offset,
+                                  uint32_t value)
+  {
+    target[offset] = static_cast<char>(value & 0xff);
+    target[offset + 1] = static_cast<char>((value >> 8) & 0xff);
+    target[offset + 2] = static_cast<char>((value >> 16) & 0xff);
+    target[offset + 3] = static_cast<char>((value >> 24) & 0xff);
+  }
+
+
+  // Returns the uncompressed size
+  static uint64_t ConvertZlibToGzip(std::string& gzip,
+                                    const std::string& zlib)
+  {
+    /**
+     * Both formats share the same raw "deflate" payload, only the
+     * header and the trailer differ (RFC 1950 vs. RFC 1952). The
+     * gzip trailer contains the CRC32 of the uncompressed data, that
+     * is not stored with the attachment: It is computed by inflating
+     * the whole payload chunk by chunk. This is cheaper than
+     * deflating the data once again, and the uncompressed data is
+     * never entirely stored in memory, but the compressed attachment
+     * is.
+     **/
+
+    static const size_t ZLIB_HEADER = 2;
+    static const size_t ZLIB_TRAILER = 4;   // Adler-32
+    static const size_t GZIP_HEADER = 10;
+    static const size_t GZIP_TRAILER = 8;   // CRC-32 + ISIZE
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    const size_t prefix = sizeof(uint64_t);
+
+    if (zlib.size() < prefix + ZLIB_HEADER + ZLIB_TRAILER)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    uint64_t uncompressedSize;
+    memcpy(&uncompressedSize, zlib.c_str(), sizeof(uint64_t));
+
+    const uint8_t cmf = static_cast<uint8_t>(zlib[prefix]);
+    const uint8_t flg = static_cast<uint8_t>(zlib[prefix + 1]);
+
+    if ((cmf & 0x0f) != 8 /* deflate */ ||
+        (flg & 0x20) != 0 /* preset dictionary */ ||
+        ((static_cast<unsigned int>(cmf) << 8) + flg) % 31 != 0)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    // Compute the CRC32 of the uncompressed data
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (inflateInit(&stream) != Z_OK)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    std::string chunk;
+    chunk.resize(CHUNK_SIZE);
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(zlib.c_str() + prefix));
+    stream.avail_in = static_cast<uInt>(zlib.size() - prefix);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t total = 0;
+    int code;
+
+    do
+    {
+      stream.next_out = reinterpret_cast<Bytef*>(&chunk[0]);
+      stream.avail_out = static_cast<uInt>(chunk.size());
+
+      code = inflate(&stream, Z_NO_FLUSH);
+
+      if (code != Z_OK &&
+          code != Z_STREAM_END)
+      {
+        inflateEnd(&stream);
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      size_t produced = chunk.size() - stream.avail_out;
+      crc = crc32(crc, reinterpret_cast<const Bytef*>(chunk.c_str()), static_cast<uInt>(produced));
+      total += produced;
+    }
+    while (code != Z_STREAM_END);
+
+    inflateEnd(&stream);
+
+    if (total != uncompressedSize)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    // Re-wrap the raw deflate payload
+    const size_t payload = zlib.size() - prefix - ZLIB_HEADER - ZLIB_TRAILER;
+    gzip.resize(GZIP_HEADER + payload + GZIP_TRAILER);
+
+    static const uint8_t header[GZIP_HEADER] = {
+      0x1f, 0x8b,   // Magic number
+      0x08,         // Compression method: deflate
+      0x00,         // Flags
+      0, 0, 0, 0,   // Modification time (not available)
+      0x00,         // Extra flags
+      0xff          // Operating system (unknown)
+    };
+
+    memcpy(&gzip[0], header, GZIP_HEADER);
+
+    if (payload > 0)
+    {
+      memcpy(&gzip[GZIP_HEADER], zlib.c_str() + prefix + ZLIB_HEADER, payload);
+    }
+
+    WriteLittleEndian32(gzip, GZIP_HEADER + payload, static_cast<uint32_t>(crc));
+    WriteLittleEndian32(gzip, GZIP_HEADER + payload + 4, static_cast<uint32_t>(uncompressedSize & 0xffffffffu));
+
+    return uncompressedSize;
+  }
+
+
   void HttpStreamTranscoder::ReadSource(std::string& buffer)
   {
     if (source_.SetupHttpCompression(false, false) != HttpCompression_None)
@@ -74,7 +314,8 @@ namespace Orthanc
   }
 
 
-  HttpCompression HttpStreamTranscoder::SetupZlibCompression(bool deflateAllowed)
+  HttpCompression HttpStreamTranscoder::SetupZlibCompression(bool gzipAllowed,
+                                                             bool deflateAllowed)
   {
     uint64_t size = source_.GetContentLength();
 
@@ -90,20 +331,37 @@ namespace Orthanc
 
     if (deflateAllowed)
     {
+      // The zlib stream is sent as such, after its size prefix: No
+      // CPU is spent on the compression. The statistics are updated
+      // once the prefix is read by "ReadNextChunk()".
       bytesToSkip_ = sizeof(uint64_t);
 
       return HttpCompression_Deflate;
     }
+
+    std::string compressed;
+    ReadSource(compressed);
+
+    transcoded_.reset(new BufferHttpSender);
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    if (gzipAllowed)
+    {
+      // Only the header and the trailer of the stream are rewritten,
+      // but the payload is inflated to compute the gzip CRC-32
+      uint64_t uncompressedSize = ConvertZlibToGzip(transcoded_->GetBuffer(), compressed);
+      statistics_.AddGzip(transcoded_->GetBuffer().size(), uncompressedSize,
+                          GetElapsedMicroseconds(start));
+
+      return HttpCompression_Gzip;
+    }
     else
     {
       // TODO Use stream-based zlib decoding to reduce memory usage
-      std::string compressed;
-      ReadSource(compressed);
-
-      uncompressed_.reset(new BufferHttpSender);
-
       ZlibCompressor compressor;
-      IBufferCompressor::Uncompress(uncompressed_->GetBuffer(), compressor, compressed);
+      IBufferCompressor::Uncompress(transcoded_->GetBuffer(), compressor, compressed);
+      statistics_.AddInflate(transcoded_->GetBuffer().size(), GetElapsedMicroseconds(start));
 
       return HttpCompression_None;
     }
@@ -118,19 +376,22 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls);
     }
 
-    ready_ = true;
-
     switch (sourceCompression_)
     {
       case CompressionType_None:
-        return HttpCompression_None;
+        compression_ = HttpCompression_None;
+        break;
 
       case CompressionType_ZlibWithSize:
-        return SetupZlibCompression(deflateAllowed);
+        compression_ = SetupZlibCompression(gzipAllowed, deflateAllowed);
+        break;
 
       default:
         throw OrthancException(ErrorCode_NotImplemented);
     }
+
+    ready_ = true;
+    return compression_;
   }
 
 
@@ -141,9 +402,9 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls);
     }
 
-    if (uncompressed_.get() != NULL)
+    if (transcoded_.get() != NULL)
     {
-      return uncompressed_->GetContentLength();
+      return transcoded_->GetContentLength();
     }
     else
     {
@@ -158,6 +419,49 @@ namespace Orthanc
   }
 
 
+  bool HttpStreamTranscoder::SeekTo(uint64_t position)
+  {
+    if (!ready_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (compression_ != HttpCompression_None)
+    {
+      // Cannot seek inside a compressed stream
+      return false;
+    }
+    else if (transcoded_.get() != NULL)
+    {
+      return transcoded_->SeekTo(position);
+    }
+    else if (bytesToSkip_ == 0)
+    {
+      // The source is not compressed
+      return source_.SeekTo(position);
+    }
+    else
+    {
+      // The compressed source is sent as such to the client
+      return false;
+    }
+  }
+
+
+  void HttpStreamTranscoder::OnPrefixSkipped()
+  {
+    if (compression_ == HttpCompression_Deflate)
+    {
+      assert(prefix_.size() == sizeof(uint64_t));
+
+      uint64_t uncompressedSize;
+      memcpy(&uncompressedSize, prefix_.c_str(), sizeof(uint64_t));
+
+      statistics_.AddDeflate(GetContentLength(), uncompressedSize);
+    }
+  }
+
+
   bool HttpStreamTranscoder::ReadNextChunk()
   {
     if (!ready_)
@@ -165,9 +469,9 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls);
     }
 
-    if (uncompressed_.get() != NULL)
+    if (transcoded_.get() != NULL)
     {
-      return uncompressed_->ReadNextChunk();
+      return transcoded_->ReadNextChunk();
     }
 
     assert(skipped_ <= bytesToSkip_);
@@ -192,6 +496,9 @@ namespace Orthanc
       size_t remaining = static_cast<size_t>(bytesToSkip_ - skipped_);
       size_t s = source_.GetChunkSize();
 
+      // Keep the skipped bytes, that contain the uncompressed size
+      prefix_.append(source_.GetChunkContent(), std::min(s, remaining));
+
       if (s < remaining)
       {
         skipped_ += s;
@@ -201,6 +508,7 @@ namespace Orthanc
         // We have skipped enough bytes, but we must read a new chunk
         currentChunkOffset_ = 0;            
         skipped_ = bytesToSkip_;
+        OnPrefixSkipped();
         return source_.ReadNextChunk();
       }
       else
@@ -209,6 +517,7 @@ namespace Orthanc
         assert(s > remaining);
         currentChunkOffset_ = remaining;
         skipped_ = bytesToSkip_;
+        OnPrefixSkipped();
         return true;
       }
     }
@@ -222,9 +531,9 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls);
     }
 
-    if (uncompressed_.get() != NULL)
+    if (transcoded_.get() != NULL)
     {
-      return uncompressed_->GetChunkContent();
+      return transcoded_->GetChunkContent();
     }
     else
     {
@@ -239,13 +548,24 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls);
     }
 
-    if (uncompressed_.get() != NULL)
+    if (transcoded_.get() != NULL)
     {
-      return uncompressed_->GetChunkSize();
+      return transcoded_->GetChunkSize();
     }
     else
     {
       return static_cast<size_t>(source_.GetChunkSize() - currentChunkOffset_);
     }
   }
+
+
+  void HttpStreamTranscoder::GetStatistics(Json::Value& target)
+  {
+    if (target.type() != Json::objectValue)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    statistics_.Format(target);
+  }
 }
@@ -36,6 +36,7 @@
 #include "BufferHttpSender.h"
 
 #include <memory>  // For std::auto_ptr
+#include <json/value.h>
 
 namespace Orthanc
 {
@@ -48,12 +49,19 @@ namespace Orthanc
     uint64_t           skipped_;
     uint64_t           currentChunkOffset_;
     bool               ready_;
+    HttpCompression    compression_;
+    std::string        prefix_;
 
-    std::auto_ptr<BufferHttpSender>  uncompressed_;
+    // Content that was prepared in memory (either inflated, or
+    // re-wrapped as gzip), if the source cannot be sent as such
+    std::auto_ptr<BufferHttpSender>  transcoded_;
 
     void ReadSource(std::string& buffer);
 
-    HttpCompression SetupZlibCompression(bool deflateAllowed);
+    void OnPrefixSkipped();
+
+    HttpCompression SetupZlibCompression(bool gzipAllowed,
+                                         bool deflateAllowed);
 
   public:
     HttpStreamTranscoder(IHttpStreamAnswer& source,
@@ -63,7 +71,8 @@ namespace Orthanc
       bytesToSkip_(0),
       skipped_(0),
       currentChunkOffset_(0),
-      ready_(false)
+      ready_(false),
+      compression_(HttpCompression_None)
     {
     }
 
@@ -83,10 +92,22 @@ namespace Orthanc
 
     virtual uint64_t GetContentLength();
 
+    virtual bool HasETag(std::string& etag)
+    {
+      return source_.HasETag(etag);
+    }
+
+    virtual bool SeekTo(uint64_t position);
+
     virtual bool ReadNextChunk();
 
     virtual const char* GetChunkContent();
 
     virtual size_t GetChunkSize();
+
+    // Global counters about the compressed attachments that were sent
+    // without being recompressed, about the network bytes that were
+    // saved this way, and about the time spent inflating
+    static void GetStatistics(Json::Value& target);
   };
 }
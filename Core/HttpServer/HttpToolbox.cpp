@@ -37,9 +37,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
+#include <algorithm>
 
 #include "HttpOutput.h"
 #include "StringHttpOutput.h"
+#include "../OrthancException.h"
 
 
 static const char* LOCALHOST = "127.0.0.1";
@@ -187,6 +189,139 @@ namespace Orthanc
   }
 
 
+  bool HttpToolbox::LookupMultipartBoundary(std::string& boundary,
+                                            const std::string& contentType)
+  {
+    std::vector<std::string> tokens;
+    Toolbox::TokenizeString(tokens, contentType, ';');
+
+    if (tokens.empty())
+    {
+      return false;
+    }
+
+    std::string mime = Toolbox::StripSpaces(tokens[0]);
+    Toolbox::ToLowerCase(mime);
+    if (mime.compare(0, 10, "multipart/") != 0)
+    {
+      return false;
+    }
+
+    for (size_t i = 1; i < tokens.size(); i++)
+    {
+      std::string parameter = Toolbox::StripSpaces(tokens[i]);
+
+      size_t equal = parameter.find('=');
+      if (equal != std::string::npos)
+      {
+        std::string name = Toolbox::StripSpaces(parameter.substr(0, equal));
+        Toolbox::ToLowerCase(name);
+
+        if (name == "boundary")
+        {
+          boundary = Toolbox::StripSpaces(parameter.substr(equal + 1));
+
+          if (boundary.size() >= 2 &&
+              boundary[0] == '"' &&
+              boundary[boundary.size() - 1] == '"')
+          {
+            boundary = boundary.substr(1, boundary.size() - 2);
+          }
+
+          return !boundary.empty();
+        }
+      }
+    }
+
+    return false;
+  }
+
+
+  static const char* FindPattern(const char* start,
+                                 const char* end,
+                                 const std::string& pattern)
+  {
+    const char* found = std::search(start, end, pattern.begin(), pattern.end());
+    return (found == end ? NULL : found);
+  }
+
+
+  static void ParseMultipartHeaders(IHttpHandler::Arguments& headers,
+                                    const char* start,
+                                    const char* end)
+  {
+    std::vector<std::string> lines;
+    Toolbox::TokenizeString(lines, std::string(start, end), '\n');
+
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+      size_t colon = lines[i].find(':');
+      if (colon != std::string::npos)
+      {
+        std::string name = Toolbox::StripSpaces(lines[i].substr(0, colon));
+        Toolbox::ToLowerCase(name);
+        headers[name] = Toolbox::StripSpaces(lines[i].substr(colon + 1));
+      }
+    }
+  }
+
+
+  void HttpToolbox::ParseMultipartBody(std::vector<MultipartPart>& parts,
+                                       const char* body,
+                                       size_t size,
+                                       const std::string& boundary)
+  {
+    parts.clear();
+
+    const std::string delimiter = "--" + boundary;
+    const std::string separator = "\r\n" + delimiter;
+    const char* end = body + size;
+
+    // Skip the preamble
+    const char* current = FindPattern(body, end, delimiter);
+    if (current == NULL)
+    {
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+
+    for (;;)
+    {
+      current += delimiter.size();
+
+      if (current + 2 > end)
+      {
+        throw OrthancException(ErrorCode_BadRequest);
+      }
+      else if (current[0] == '-' && current[1] == '-')
+      {
+        return;   // Closing delimiter, the epilogue is ignored
+      }
+      else if (current[0] != '\r' || current[1] != '\n')
+      {
+        throw OrthancException(ErrorCode_BadRequest);
+      }
+
+      // The search includes the end of line of the delimiter, as the
+      // headers of the part can be empty
+      const char* headersEnd = FindPattern(current, end, "\r\n\r\n");
+      const char* contentEnd = (headersEnd == NULL ? NULL :
+                                FindPattern(headersEnd + 4, end, separator));
+      if (contentEnd == NULL)
+      {
+        throw OrthancException(ErrorCode_BadRequest);
+      }
+
+      MultipartPart part;
+      ParseMultipartHeaders(part.headers, current + 2, std::max(current + 2, headersEnd));
+      part.content = headersEnd + 4;
+      part.size = contentEnd - part.content;
+      parts.push_back(part);
+
+      current = contentEnd + 2;
+    }
+  }
+
+
   void HttpToolbox::CompileGetArguments(IHttpHandler::Arguments& compiled,
                                         const IHttpHandler::GetArguments& source)
   {
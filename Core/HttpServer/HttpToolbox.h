@@ -40,6 +40,15 @@ namespace Orthanc
   class HttpToolbox
   {
   public:
+    // One part of a "multipart/..." body. The content points into the
+    // parsed body, which must outlive the part.
+    struct MultipartPart
+    {
+      IHttpHandler::Arguments  headers;   // The names are in lower case
+      const char*              content;
+      size_t                   size;
+    };
+
     static void ParseGetArguments(IHttpHandler::GetArguments& result, 
                                   const char* query);
 
@@ -58,6 +67,17 @@ namespace Orthanc
     static void ParseCookies(IHttpHandler::Arguments& result, 
                              const IHttpHandler::Arguments& httpHeaders);
 
+    // Extracts the "boundary" parameter of the "Content-Type" header
+    // of a multipart body. Returns "false" if this is not multipart.
+    static bool LookupMultipartBoundary(std::string& boundary,
+                                        const std::string& contentType);
+
+    // Splits a multipart body (RFC 2046) without copying its content
+    static void ParseMultipartBody(std::vector<MultipartPart>& parts,
+                                   const char* body,
+                                   size_t size,
+                                   const std::string& boundary);
+
     static void CompileGetArguments(IHttpHandler::Arguments& compiled,
                                     const IHttpHandler::GetArguments& source);
 
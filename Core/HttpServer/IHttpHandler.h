@@ -37,6 +37,7 @@
 #include "HttpOutput.h"
 
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 #include <string>
@@ -49,10 +50,44 @@ namespace Orthanc
     typedef std::map<std::string, std::string>                  Arguments;
     typedef std::vector< std::pair<std::string, std::string> >  GetArguments;
 
+    /**
+     * Object that receives the body of a POST or PUT request
+     * progressively, as the chunks arrive from the network, instead of
+     * waiting for the full body to be available in memory.
+     **/
+    class IChunkedRequestReader : public boost::noncopyable
+    {
+    public:
+      virtual ~IChunkedRequestReader()
+      {
+      }
+
+      virtual void AddBodyChunk(const void* data,
+                                size_t size) = 0;
+
+      virtual void Execute(HttpOutput& output) = 0;
+    };
+
+
     virtual ~IHttpHandler()
     {
     }
 
+    /**
+     * Returns "false" if this handler does not serve the given URI.
+     * Otherwise, returns "true", and possibly creates a reader to
+     * process the body of the request as a stream. If the handler
+     * serves the URI but leaves "target" empty, the body is read
+     * entirely, then provided to "Handle()".
+     **/
+    virtual bool CreateChunkedRequestReader(std::auto_ptr<IChunkedRequestReader>& target,
+                                            RequestOrigin origin,
+                                            const char* remoteIp,
+                                            const char* username,
+                                            HttpMethod method,
+                                            const UriComponents& uri,
+                                            const Arguments& headers) = 0;
+
     virtual bool Handle(HttpOutput& output,
                         RequestOrigin origin,
                         const char* remoteIp,
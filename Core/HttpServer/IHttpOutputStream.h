@@ -50,5 +50,9 @@ namespace Orthanc
     virtual void OnHttpStatusReceived(HttpStatus status) = 0;
 
     virtual void Send(bool isHeader, const void* buffer, size_t length) = 0;
+
+    // Closes the connection once the current request is handled,
+    // even if keep-alive is enabled
+    virtual void DisableKeepAlive() = 0;
   };
 }
@@ -58,6 +58,15 @@ namespace Orthanc
 
     virtual uint64_t GetContentLength() = 0;
 
+    // Strong validator of the content (including the surrounding
+    // double quotes), if the content is known to be immutable
+    virtual bool HasETag(std::string& etag) = 0;
+
+    // Move to the given offset in the uncompressed content, in order
+    // to serve byte ranges. Can only be called before the first call
+    // to "ReadNextChunk()". Returns "false" if seeking is unsupported.
+    virtual bool SeekTo(uint64_t position) = 0;
+
     virtual bool ReadNextChunk() = 0;
 
     virtual const char* GetChunkContent() = 0;
@@ -51,7 +51,20 @@
 #  error "Either Mongoose or Civetweb must be enabled to compile this file"
 #endif
 
+#if ORTHANC_ENABLE_MONGOOSE == 1
+#  if !defined(MONGOOSE_HAS_DISABLE_KEEP_ALIVE)
+#    error The macro MONGOOSE_HAS_DISABLE_KEEP_ALIVE must be defined
+#  endif
+#  define ORTHANC_HAS_DISABLE_KEEP_ALIVE  MONGOOSE_HAS_DISABLE_KEEP_ALIVE
+#else
+#  if !defined(CIVETWEB_HAS_DISABLE_KEEP_ALIVE)
+#    error The macro CIVETWEB_HAS_DISABLE_KEEP_ALIVE must be defined
+#  endif
+#  define ORTHANC_HAS_DISABLE_KEEP_ALIVE  CIVETWEB_HAS_DISABLE_KEEP_ALIVE
+#endif
+
 #include <algorithm>
+#include <vector>
 #include <string.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
@@ -107,6 +120,15 @@ namespace Orthanc
       {
         // Ignore this
       }
+
+      virtual void DisableKeepAlive()
+      {
+#if ORTHANC_HAS_DISABLE_KEEP_ALIVE == 1
+        mg_disable_keep_alive(connection_);
+#else
+        throw OrthancException(ErrorCode_NotImplemented);
+#endif
+      }
     };
 
 
@@ -117,6 +139,56 @@ namespace Orthanc
       PostDataStatus_Pending,
       PostDataStatus_Failure
     };
+
+
+    // Destination of the chunks of the body of a request, as they are
+    // read from the network
+    class IBodySink : public boost::noncopyable
+    {
+    public:
+      virtual ~IBodySink()
+      {
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size) = 0;
+    };
+
+
+    class MemoryBodySink : public IBodySink
+    {
+    private:
+      ChunkedBuffer&  buffer_;
+
+    public:
+      MemoryBodySink(ChunkedBuffer& buffer) : buffer_(buffer)
+      {
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size)
+      {
+        buffer_.AddChunk(data, size);
+      }
+    };
+
+
+    class ReaderBodySink : public IBodySink
+    {
+    private:
+      IHttpHandler::IChunkedRequestReader&  reader_;
+
+    public:
+      ReaderBodySink(IHttpHandler::IChunkedRequestReader& reader) : reader_(reader)
+      {
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size)
+      {
+        reader_.AddBodyChunk(data, size);
+      }
+    };
   }
 
 
@@ -323,6 +395,103 @@ namespace Orthanc
 
 
 
+  static bool GetContentLength(uint64_t& length,
+                               const IHttpHandler::Arguments& headers)
+  {
+    IHttpHandler::Arguments::const_iterator cs = headers.find("content-length");
+    if (cs == headers.end())
+    {
+      return false;
+    }
+
+    try
+    {
+      length = boost::lexical_cast<uint64_t>(cs->second);
+      return true;
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+  }
+
+
+  static bool IsChunkedTransferEncoding(const IHttpHandler::Arguments& headers)
+  {
+    IHttpHandler::Arguments::const_iterator it = headers.find("transfer-encoding");
+    if (it == headers.end())
+    {
+      return false;
+    }
+    else
+    {
+      std::string s = Toolbox::StripSpaces(it->second);
+      Toolbox::ToLowerCase(s);
+      return s == "chunked";
+    }
+  }
+
+
+  static PostDataStatus ReadBodyChunks(IBodySink& sink,
+                                       struct mg_connection *connection,
+                                       const IHttpHandler::Arguments& headers)
+  {
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    std::string chunk;
+    chunk.resize(CHUNK_SIZE);
+
+    uint64_t length;
+    if (GetContentLength(length, headers))
+    {
+      while (length > 0)
+      {
+        size_t toRead = (length < CHUNK_SIZE ? static_cast<size_t>(length) : CHUNK_SIZE);
+
+        int r = mg_read(connection, &chunk[0], toRead);
+        if (r <= 0)
+        {
+          return PostDataStatus_Failure;
+        }
+
+        assert(static_cast<size_t>(r) <= toRead);
+        sink.AddChunk(chunk.c_str(), r);
+        length -= r;
+      }
+
+      return PostDataStatus_Success;
+    }
+
+    if (IsChunkedTransferEncoding(headers))
+    {
+#if ORTHANC_ENABLE_CIVETWEB == 1
+      // Civetweb decodes the chunked transfer encoding inside
+      // "mg_read()", that returns 0 at the end of the body
+      for (;;)
+      {
+        int r = mg_read(connection, &chunk[0], CHUNK_SIZE);
+        if (r < 0)
+        {
+          return PostDataStatus_Failure;
+        }
+        else if (r == 0)
+        {
+          return PostDataStatus_Success;
+        }
+        else
+        {
+          sink.AddChunk(chunk.c_str(), r);
+        }
+      }
+#else
+      LOG(ERROR) << "The chunked transfer encoding is only supported if Orthanc is compiled with Civetweb";
+#endif
+    }
+
+    return PostDataStatus_NoLength;
+  }
+
+
   static PostDataStatus ParseMultipartPost(std::string &completedFile,
                                            struct mg_connection *connection,
                                            const IHttpHandler::Arguments& headers,
@@ -588,6 +757,27 @@ namespace Orthanc
   }
 
 
+  static void ConfigureConditionalRequest(HttpOutput& output,
+                                          const IHttpHandler::Arguments& headers)
+  {
+    // Validators and byte ranges, to avoid the download of unchanged
+    // content and to resume interrupted downloads
+    // https://tools.ietf.org/html/rfc7232 and https://tools.ietf.org/html/rfc7233
+    IHttpHandler::Arguments::const_iterator it = headers.find("if-none-match");
+    if (it != headers.end())
+    {
+      output.SetIfNoneMatch(it->second);
+    }
+
+    it = headers.find("range");
+    if (it != headers.end())
+    {
+      IHttpHandler::Arguments::const_iterator ifRange = headers.find("if-range");
+      output.SetRange(it->second, ifRange == headers.end() ? "" : ifRange->second);
+    }
+  }
+
+
   static void InternalCallback(HttpOutput& output /* out */,
                                HttpMethod& method /* out */,
                                MongooseServer& server,
@@ -638,6 +828,7 @@ namespace Orthanc
     IHttpHandler::GetArguments argumentsGET;
     if (!strcmp(request->request_method, "GET"))
     {
+      ConfigureConditionalRequest(output, headers);
       HttpToolbox::ParseGetArguments(argumentsGET, request->query_string);
     }
 
@@ -689,33 +880,68 @@ namespace Orthanc
     }
 
 
-    // Extract the body of the request for PUT and POST
+    // Decompose the URI into its components
+    UriComponents uri;
+    try
+    {
+      Toolbox::SplitUriComponents(uri, request->uri);
+    }
+    catch (OrthancException&)
+    {
+      output.SendStatus(HttpStatus_400_BadRequest);
+      return;
+    }
 
-    // TODO Avoid unneccessary memcopy of the body
 
+    // Extract the body of the request for PUT and POST
     std::string body;
+    std::auto_ptr<IHttpHandler::IChunkedRequestReader> reader;
+
     if (method == HttpMethod_Post ||
         method == HttpMethod_Put)
     {
       PostDataStatus status;
 
       IHttpHandler::Arguments::const_iterator ct = headers.find("content-type");
-      if (ct == headers.end())
+      if (ct != headers.end() &&
+          ct->second.size() >= multipartLength &&
+          !memcmp(ct->second.c_str(), multipart, multipartLength))
+      {
+        status = ParseMultipartPost(body, connection, headers, ct->second, server.GetChunkStore());
+      }
+      else if (server.HasHandler() &&
+               server.GetHandler().CreateChunkedRequestReader(reader, RequestOrigin_RestApi, remoteIp, username.c_str(), 
+                                                              method, uri, headers) &&
+               reader.get() != NULL)
       {
-        // No content-type specified. Assume no multi-part content occurs at this point.
-        status = ReadBody(body, connection, headers);          
+        // The handler consumes the body progressively
+        ReaderBodySink sink(*reader);
+        status = ReadBodyChunks(sink, connection, headers);
       }
       else
       {
-        std::string contentType = ct->second;
-        if (contentType.size() >= multipartLength &&
-            !memcmp(contentType.c_str(), multipart, multipartLength))
+        // The handlers that cannot stream the body need it as one
+        // single memory buffer: Handlers that must bound the memory
+        // footprint of large uploads provide a chunked reader. This
+        // is notably the case of "POST /instances", as DCMTK parses
+        // DICOM files from memory: The body is not spooled to disk.
+        uint64_t length;
+
+        if (GetContentLength(length, headers))
         {
-          status = ParseMultipartPost(body, connection, headers, contentType, server.GetChunkStore());
+          status = ReadBody(body, connection, headers);          
         }
         else
         {
-          status = ReadBody(body, connection, headers);
+          // Unknown size (chunked transfer encoding)
+          ChunkedBuffer buffer;
+          MemoryBodySink sink(buffer);
+          status = ReadBodyChunks(sink, connection, headers);
+
+          if (status == PostDataStatus_Success)
+          {
+            buffer.Flatten(body);
+          }
         }
       }
 
@@ -739,21 +965,14 @@ namespace Orthanc
     }
 
 
-    // Decompose the URI into its components
-    UriComponents uri;
-    try
-    {
-      Toolbox::SplitUriComponents(uri, request->uri);
-    }
-    catch (OrthancException&)
+    LOG(INFO) << EnumerationToString(method) << " " << Toolbox::FlattenUri(uri);
+
+    if (reader.get() != NULL)
     {
-      output.SendStatus(HttpStatus_400_BadRequest);
+      reader->Execute(output);
       return;
     }
 
-
-    LOG(INFO) << EnumerationToString(method) << " " << Toolbox::FlattenUri(uri);
-
     bool found = false;
 
     if (server.HasHandler())
@@ -851,7 +1070,9 @@ namespace Orthanc
         catch (OrthancException&)
         {
           // An exception here reflects the fact that the status code
-          // was already set by the HTTP handler.
+          // was already set by the HTTP handler. The answer is
+          // truncated: The client cannot reuse this connection.
+          output.CloseConnection();
         }
       }
     }
@@ -917,6 +1138,9 @@ namespace Orthanc
     keepAlive_ = false;
     httpCompression_ = true;
     exceptionFormatter_ = NULL;
+    threadsCount_ = 50;  // Default value in Mongoose and Civetweb
+    requestTimeout_ = 0;
+    keepAliveTimeout_ = 1;
 
 #if ORTHANC_ENABLE_SSL == 1
     // Check for the Heartbleed exploit
@@ -961,28 +1185,69 @@ namespace Orthanc
         port += "s";
       }
 
-      const char *options[] = {
-        // Set the TCP port for the HTTP server
-        "listening_ports", port.c_str(), 
+      std::string numThreads = boost::lexical_cast<std::string>(threadsCount_);
+      std::string requestTimeoutMs = boost::lexical_cast<std::string>(requestTimeout_ * 1000);
+      std::string keepAliveTimeoutMs = boost::lexical_cast<std::string>(keepAliveTimeout_ * 1000);
+
+      std::vector<const char*> options;
+
+      // Set the TCP port for the HTTP server
+      options.push_back("listening_ports");
+      options.push_back(port.c_str());
         
-        // Optimization reported by Chris Hafey
-        // https://groups.google.com/d/msg/orthanc-users/CKueKX0pJ9E/_UCbl8T-VjIJ
-        "enable_keep_alive", (keepAlive_ ? "yes" : "no"),
+      // Optimization reported by Chris Hafey
+      // https://groups.google.com/d/msg/orthanc-users/CKueKX0pJ9E/_UCbl8T-VjIJ
+      options.push_back("enable_keep_alive");
+      options.push_back(keepAlive_ ? "yes" : "no");
 
-        // Set the SSL certificate, if any. This must be the last option.
-        ssl_ ? "ssl_certificate" : NULL,
-        certificate_.c_str(),
-        NULL
-      };
+      if (keepAlive_)
+      {
+        // As one worker thread is dedicated to each connection, an
+        // idle keep-alive connection must not hold its thread for
+        // long, otherwise a few hundred idle clients (e.g. Web
+        // viewers left open in browser tabs) would exhaust the pool
+#if ORTHANC_ENABLE_CIVETWEB == 1
+        options.push_back("keep_alive_timeout_ms");
+        options.push_back(keepAliveTimeoutMs.c_str());
+#else
+        LOG(WARNING) << "With Mongoose, each idle keep-alive connection holds one of the "
+                     << threadsCount_ << " HTTP threads until the client closes it, "
+                     << "consider using Civetweb instead";
+#endif
+      }
+
+      // Size of the pool of worker threads
+      options.push_back("num_threads");
+      options.push_back(numThreads.c_str());
+
+      if (requestTimeout_ != 0)
+      {
+#if ORTHANC_ENABLE_CIVETWEB == 1
+        options.push_back("request_timeout_ms");
+        options.push_back(requestTimeoutMs.c_str());
+#else
+        LOG(INFO) << "The timeout of the HTTP requests cannot be configured with Mongoose, "
+                  << "consider using Civetweb instead";
+#endif
+      }
+
+      // Set the SSL certificate, if any
+      if (ssl_)
+      {
+        options.push_back("ssl_certificate");
+        options.push_back(certificate_.c_str());
+      }
+
+      options.push_back(NULL);
 
 #if MONGOOSE_USE_CALLBACKS == 0
-      pimpl_->context_ = mg_start(&Callback, this, options);
+      pimpl_->context_ = mg_start(&Callback, this, &options[0]);
 
 #elif MONGOOSE_USE_CALLBACKS == 1
       struct mg_callbacks callbacks;
       memset(&callbacks, 0, sizeof(callbacks));
       callbacks.begin_request = Callback;
-      pimpl_->context_ = mg_start(&callbacks, this, options);
+      pimpl_->context_ = mg_start(&callbacks, this, &options[0]);
 
 #else
 #error Please set MONGOOSE_USE_CALLBACKS
@@ -1075,6 +1340,29 @@ namespace Orthanc
     LOG(WARNING) << "HTTP compression is " << (enabled ? "enabled" : "disabled");
   }
   
+  void MongooseServer::SetThreadsCount(unsigned int threads)
+  {
+    if (threads == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    Stop();
+    threadsCount_ = threads;
+  }
+
+  void MongooseServer::SetRequestTimeout(unsigned int seconds)
+  {
+    Stop();
+    requestTimeout_ = seconds;
+  }
+
+  void MongooseServer::SetKeepAliveTimeout(unsigned int seconds)
+  {
+    Stop();
+    keepAliveTimeout_ = seconds;
+  }
+
   void MongooseServer::SetIncomingHttpRequestFilter(IIncomingHttpRequestFilter& filter)
   {
     Stop();
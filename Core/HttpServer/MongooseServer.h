@@ -96,6 +96,9 @@ namespace Orthanc
     bool keepAlive_;
     bool httpCompression_;
     IHttpExceptionFormatter* exceptionFormatter_;
+    unsigned int threadsCount_;
+    unsigned int requestTimeout_;
+    unsigned int keepAliveTimeout_;
   
     bool IsRunning() const;
 
@@ -162,6 +165,34 @@ namespace Orthanc
 
     void SetHttpCompressionEnabled(bool enabled);
 
+    unsigned int GetThreadsCount() const
+    {
+      return threadsCount_;
+    }
+
+    // Number of worker threads that handle the HTTP requests
+    void SetThreadsCount(unsigned int threads);
+
+    unsigned int GetRequestTimeout() const
+    {
+      return requestTimeout_;
+    }
+
+    // Timeout (in seconds) for the reception of the HTTP requests
+    // ("0" means the default of the embedded server). Only
+    // available with Civetweb.
+    void SetRequestTimeout(unsigned int seconds);
+
+    unsigned int GetKeepAliveTimeout() const
+    {
+      return keepAliveTimeout_;
+    }
+
+    // Time (in seconds) during which an idle keep-alive connection
+    // keeps its worker thread, waiting for a new request, before
+    // being closed. Only available with Civetweb.
+    void SetKeepAliveTimeout(unsigned int seconds);
+
     const IIncomingHttpRequestFilter* GetIncomingHttpRequestFilter() const
     {
       return filter_;
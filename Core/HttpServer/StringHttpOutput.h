@@ -54,6 +54,11 @@ namespace Orthanc
 
     virtual void Send(bool isHeader, const void* buffer, size_t length);
 
+    virtual void DisableKeepAlive()
+    {
+      // No connection
+    }
+
     void GetOutput(std::string& output);
   };
 }
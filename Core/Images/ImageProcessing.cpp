@@ -38,13 +38,648 @@
 
 #include <boost/math/special_functions/round.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <string.h>
 #include <limits>
 #include <stdint.h>
 
+/**
+ * SSE2 is part of the baseline of the x86_64 architecture, so no
+ * runtime detection of the CPU features is needed. On this
+ * architecture, the scalar floating-point arithmetic also uses SSE,
+ * which makes the vectorized routines bit-exact with the scalar ones.
+ **/
+#if !defined(ORTHANC_ENABLE_SSE2)
+#  if defined(__x86_64__) || defined(_M_X64)
+#    define ORTHANC_ENABLE_SSE2 1
+#  else
+#    define ORTHANC_ENABLE_SSE2 0
+#  endif
+#endif
+
+#if ORTHANC_ENABLE_SSE2 == 1
+#  include <emmintrin.h>
+#endif
+
 namespace Orthanc
 {
+  static bool simdEnabled_ = (ORTHANC_ENABLE_SSE2 == 1);
+
+
+  /**
+   * Vectorized processing of one row of pixels. Each of these
+   * functions returns the number of pixels it has processed at the
+   * beginning of the row, the remaining pixels being processed by
+   * the generic scalar code. The templates are the fallback for the
+   * combinations of pixel types that are not vectorized.
+   **/
+
+  template <typename TargetType, typename SourceType>
+  static unsigned int ConvertRowSimd(TargetType* target,
+                                     const SourceType* source,
+                                     unsigned int width)
+  {
+    return 0;
+  }
+
+
+  template <typename PixelType>
+  static unsigned int GetMinMaxRowSimd(PixelType& minValue,
+                                       PixelType& maxValue,
+                                       const PixelType* row,
+                                       unsigned int width)
+  {
+    return 0;
+  }
+
+
+  template <typename PixelType>
+  static unsigned int AddConstantRowSimd(PixelType* row,
+                                         unsigned int width,
+                                         int64_t constant)
+  {
+    return 0;
+  }
+
+
+  template <typename PixelType>
+  static unsigned int AccumulateRowSimd(int32_t* sums,
+                                        const PixelType* row,
+                                        unsigned int count)
+  {
+    return 0;
+  }
+
+
+  template <typename PixelType>
+  static unsigned int ShiftScaleRowSimd(PixelType* row,
+                                        unsigned int width,
+                                        float offset,
+                                        float scaling)
+  {
+    return 0;
+  }
+
+
+#if ORTHANC_ENABLE_SSE2 == 1
+  static inline __m128i LoadVector(const void* p)
+  {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+
+
+  static inline void StoreVector(void* p,
+                                 __m128i v)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  }
+
+
+  // Unsigned minimum of 16-bit integers, which is missing from SSE2
+  static inline __m128i MinUnsigned16(__m128i v,
+                                      __m128i bound)
+  {
+    return _mm_sub_epi16(v, _mm_subs_epu16(v, bound));
+  }
+
+
+  static unsigned int ConvertRowSimd(uint16_t* target,
+                                     const uint8_t* source,
+                                     unsigned int width)
+  {
+    const __m128i zero = _mm_setzero_si128();
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i v = LoadVector(source + x);
+      StoreVector(target + x, _mm_unpacklo_epi8(v, zero));
+      StoreVector(target + x + 8, _mm_unpackhi_epi8(v, zero));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ConvertRowSimd(int16_t* target,
+                                     const uint8_t* source,
+                                     unsigned int width)
+  {
+    return ConvertRowSimd(reinterpret_cast<uint16_t*>(target), source, width);
+  }
+
+
+  static unsigned int ConvertRowSimd(uint8_t* target,
+                                     const uint16_t* source,
+                                     unsigned int width)
+  {
+    const __m128i bound = _mm_set1_epi16(255);
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i a = MinUnsigned16(LoadVector(source + x), bound);
+      __m128i b = MinUnsigned16(LoadVector(source + x + 8), bound);
+      StoreVector(target + x, _mm_packus_epi16(a, b));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ConvertRowSimd(int16_t* target,
+                                     const uint16_t* source,
+                                     unsigned int width)
+  {
+    const __m128i bound = _mm_set1_epi16(0x7fff);
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      StoreVector(target + x, MinUnsigned16(LoadVector(source + x), bound));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ConvertRowSimd(uint8_t* target,
+                                     const int16_t* source,
+                                     unsigned int width)
+  {
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      // Signed saturation to the [0, 255] range
+      StoreVector(target + x, _mm_packus_epi16(LoadVector(source + x),
+                                               LoadVector(source + x + 8)));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ConvertRowSimd(uint16_t* target,
+                                     const int16_t* source,
+                                     unsigned int width)
+  {
+    const __m128i zero = _mm_setzero_si128();
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      StoreVector(target + x, _mm_max_epi16(LoadVector(source + x), zero));
+    }
+
+    return x;
+  }
+
+
+  // Conversion of 8 pixels of 16 bits to 2 vectors of 32-bit integers
+  static inline void Unpack16To32(__m128i& low,
+                                  __m128i& high,
+                                  __m128i v,
+                                  bool isSigned)
+  {
+    if (isSigned)
+    {
+      low = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      high = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    }
+    else
+    {
+      const __m128i zero = _mm_setzero_si128();
+      low = _mm_unpacklo_epi16(v, zero);
+      high = _mm_unpackhi_epi16(v, zero);
+    }
+  }
+
+
+  static unsigned int ConvertRowSimd(float* target,
+                                     const uint8_t* source,
+                                     unsigned int width)
+  {
+    const __m128i zero = _mm_setzero_si128();
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i v = LoadVector(source + x);
+      __m128i a, b, c, d;
+      Unpack16To32(a, b, _mm_unpacklo_epi8(v, zero), false);
+      Unpack16To32(c, d, _mm_unpackhi_epi8(v, zero), false);
+      _mm_storeu_ps(target + x, _mm_cvtepi32_ps(a));
+      _mm_storeu_ps(target + x + 4, _mm_cvtepi32_ps(b));
+      _mm_storeu_ps(target + x + 8, _mm_cvtepi32_ps(c));
+      _mm_storeu_ps(target + x + 12, _mm_cvtepi32_ps(d));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ConvertRowSimd(float* target,
+                                     const uint16_t* source,
+                                     unsigned int width)
+  {
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i a, b;
+      Unpack16To32(a, b, LoadVector(source + x), false);
+      _mm_storeu_ps(target + x, _mm_cvtepi32_ps(a));
+      _mm_storeu_ps(target + x + 4, _mm_cvtepi32_ps(b));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ConvertRowSimd(float* target,
+                                     const int16_t* source,
+                                     unsigned int width)
+  {
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i a, b;
+      Unpack16To32(a, b, LoadVector(source + x), true);
+      _mm_storeu_ps(target + x, _mm_cvtepi32_ps(a));
+      _mm_storeu_ps(target + x + 4, _mm_cvtepi32_ps(b));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int GetMinMaxRowSimd(uint8_t& minValue,
+                                       uint8_t& maxValue,
+                                       const uint8_t* row,
+                                       unsigned int width)
+  {
+    if (width < 16)
+    {
+      return 0;
+    }
+
+    __m128i a = _mm_set1_epi8(static_cast<char>(minValue));
+    __m128i b = _mm_set1_epi8(static_cast<char>(maxValue));
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i v = LoadVector(row + x);
+      a = _mm_min_epu8(a, v);
+      b = _mm_max_epu8(b, v);
+    }
+
+    uint8_t mins[16], maxs[16];
+    StoreVector(mins, a);
+    StoreVector(maxs, b);
+
+    for (unsigned int i = 0; i < 16; i++)
+    {
+      minValue = std::min(minValue, mins[i]);
+      maxValue = std::max(maxValue, maxs[i]);
+    }
+
+    return x;
+  }
+
+
+  // The 16-bit integers are processed as signed integers, after
+  // flipping their sign bit if they are unsigned
+  static unsigned int GetMinMaxRow16(int16_t& minValue,
+                                     int16_t& maxValue,
+                                     const void* row,
+                                     unsigned int width,
+                                     bool isSigned)
+  {
+    if (width < 8)
+    {
+      return 0;
+    }
+
+    const __m128i flip = _mm_set1_epi16(isSigned ? 0 : static_cast<short>(0x8000));
+
+    __m128i a = _mm_set1_epi16(minValue);
+    __m128i b = _mm_set1_epi16(maxValue);
+
+    const int16_t* p = reinterpret_cast<const int16_t*>(row);
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i v = _mm_xor_si128(LoadVector(p + x), flip);
+      a = _mm_min_epi16(a, v);
+      b = _mm_max_epi16(b, v);
+    }
+
+    int16_t mins[8], maxs[8];
+    StoreVector(mins, a);
+    StoreVector(maxs, b);
+
+    for (unsigned int i = 0; i < 8; i++)
+    {
+      minValue = std::min(minValue, mins[i]);
+      maxValue = std::max(maxValue, maxs[i]);
+    }
+
+    return x;
+  }
+
+
+  static unsigned int GetMinMaxRowSimd(int16_t& minValue,
+                                       int16_t& maxValue,
+                                       const int16_t* row,
+                                       unsigned int width)
+  {
+    return GetMinMaxRow16(minValue, maxValue, row, width, true);
+  }
+
+
+  static unsigned int GetMinMaxRowSimd(uint16_t& minValue,
+                                       uint16_t& maxValue,
+                                       const uint16_t* row,
+                                       unsigned int width)
+  {
+    int16_t a = static_cast<int16_t>(minValue ^ 0x8000);
+    int16_t b = static_cast<int16_t>(maxValue ^ 0x8000);
+
+    unsigned int x = GetMinMaxRow16(a, b, row, width, false);
+
+    minValue = static_cast<uint16_t>(a) ^ 0x8000;
+    maxValue = static_cast<uint16_t>(b) ^ 0x8000;
+    return x;
+  }
+
+
+  static unsigned int AddConstantRowSimd(uint8_t* row,
+                                         unsigned int width,
+                                         int64_t constant)
+  {
+    // Adding more than 255 saturates all the pixels anyway
+    const bool isPositive = (constant > 0);
+    const __m128i c = _mm_set1_epi8(static_cast<char>(std::min<int64_t>(isPositive ? constant : -constant, 255)));
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i v = LoadVector(row + x);
+      StoreVector(row + x, isPositive ? _mm_adds_epu8(v, c) : _mm_subs_epu8(v, c));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int AddConstantRowSimd(uint16_t* row,
+                                         unsigned int width,
+                                         int64_t constant)
+  {
+    const bool isPositive = (constant > 0);
+    const __m128i c = _mm_set1_epi16(static_cast<short>(std::min<int64_t>(isPositive ? constant : -constant, 65535)));
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i v = LoadVector(row + x);
+      StoreVector(row + x, isPositive ? _mm_adds_epu16(v, c) : _mm_subs_epu16(v, c));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int AddConstantRowSimd(int16_t* row,
+                                         unsigned int width,
+                                         int64_t constant)
+  {
+    if (constant < std::numeric_limits<int16_t>::min() ||
+        constant > std::numeric_limits<int16_t>::max())
+    {
+      // A single saturated addition cannot handle this constant
+      return 0;
+    }
+
+    const __m128i c = _mm_set1_epi16(static_cast<short>(constant));
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      StoreVector(row + x, _mm_adds_epi16(LoadVector(row + x), c));
+    }
+
+    return x;
+  }
+
+
+  class ShiftScaleVector
+  {
+  private:
+    __m128  offset_;
+    __m128  scaling_;
+    __m128  minValue_;
+    __m128  maxValue_;
+    __m128  half_;
+    __m128  minusHalf_;
+
+  public:
+    ShiftScaleVector(float offset,
+                     float scaling,
+                     float minValue,
+                     float maxValue) :
+      offset_(_mm_set1_ps(offset)),
+      scaling_(_mm_set1_ps(scaling)),
+      minValue_(_mm_set1_ps(minValue)),
+      maxValue_(_mm_set1_ps(maxValue)),
+      half_(_mm_set1_ps(0.5f)),
+      minusHalf_(_mm_set1_ps(-0.5f))
+    {
+    }
+
+    // Computes "(v + offset) * scaling", clamped to the range of the
+    // pixel type, and rounded half away from zero as
+    // "boost::math::iround()" does
+    __m128i Apply(__m128i v) const
+    {
+      __m128 f = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(v), offset_), scaling_);
+      f = _mm_min_ps(_mm_max_ps(f, minValue_), maxValue_);
+
+      __m128i truncated = _mm_cvttps_epi32(f);
+      __m128 fraction = _mm_sub_ps(f, _mm_cvtepi32_ps(truncated));
+
+      // The comparison masks are -1 where true
+      truncated = _mm_sub_epi32(truncated, _mm_castps_si128(_mm_cmpge_ps(fraction, half_)));
+      truncated = _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmple_ps(fraction, minusHalf_)));
+      return truncated;
+    }
+  };
+
+
+  static unsigned int ShiftScaleRowSimd(uint8_t* row,
+                                        unsigned int width,
+                                        float offset,
+                                        float scaling)
+  {
+    const ShiftScaleVector f(offset, scaling, 0.0f, 255.0f);
+    const __m128i zero = _mm_setzero_si128();
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i v = LoadVector(row + x);
+      __m128i a, b, c, d;
+      Unpack16To32(a, b, _mm_unpacklo_epi8(v, zero), false);
+      Unpack16To32(c, d, _mm_unpackhi_epi8(v, zero), false);
+
+      __m128i low = _mm_packs_epi32(f.Apply(a), f.Apply(b));
+      __m128i high = _mm_packs_epi32(f.Apply(c), f.Apply(d));
+      StoreVector(row + x, _mm_packus_epi16(low, high));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ShiftScaleRowSimd(uint16_t* row,
+                                        unsigned int width,
+                                        float offset,
+                                        float scaling)
+  {
+    const ShiftScaleVector f(offset, scaling, 0.0f, 65535.0f);
+
+    // There is no unsigned saturation from 32 to 16 bits in SSE2:
+    // Shift the range to signed values before packing
+    const __m128i shift32 = _mm_set1_epi32(32768);
+    const __m128i shift16 = _mm_set1_epi16(static_cast<short>(0x8000));
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i a, b;
+      Unpack16To32(a, b, LoadVector(row + x), false);
+
+      __m128i v = _mm_packs_epi32(_mm_sub_epi32(f.Apply(a), shift32),
+                                  _mm_sub_epi32(f.Apply(b), shift32));
+      StoreVector(row + x, _mm_xor_si128(v, shift16));
+    }
+
+    return x;
+  }
+
+
+  static unsigned int ShiftScaleRowSimd(int16_t* row,
+                                        unsigned int width,
+                                        float offset,
+                                        float scaling)
+  {
+    const ShiftScaleVector f(offset, scaling, -32768.0f, 32767.0f);
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i a, b;
+      Unpack16To32(a, b, LoadVector(row + x), true);
+      StoreVector(row + x, _mm_packs_epi32(f.Apply(a), f.Apply(b)));
+    }
+
+    return x;
+  }
+
+
+  static inline void AddVector32(int32_t* sums,
+                                 __m128i v)
+  {
+    StoreVector(sums, _mm_add_epi32(LoadVector(sums), v));
+  }
+
+
+  static unsigned int AccumulateRowSimd(int32_t* sums,
+                                        const uint8_t* row,
+                                        unsigned int count)
+  {
+    const __m128i zero = _mm_setzero_si128();
+
+    unsigned int x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+      __m128i v = LoadVector(row + x);
+      __m128i a, b, c, d;
+      Unpack16To32(a, b, _mm_unpacklo_epi8(v, zero), false);
+      Unpack16To32(c, d, _mm_unpackhi_epi8(v, zero), false);
+      AddVector32(sums + x, a);
+      AddVector32(sums + x + 4, b);
+      AddVector32(sums + x + 8, c);
+      AddVector32(sums + x + 12, d);
+    }
+
+    return x;
+  }
+
+
+  static unsigned int AccumulateRow16(int32_t* sums,
+                                      const void* row,
+                                      unsigned int count,
+                                      bool isSigned)
+  {
+    const uint16_t* p = reinterpret_cast<const uint16_t*>(row);
+
+    unsigned int x = 0;
+    for (; x + 8 <= count; x += 8)
+    {
+      __m128i a, b;
+      Unpack16To32(a, b, LoadVector(p + x), isSigned);
+      AddVector32(sums + x, a);
+      AddVector32(sums + x + 4, b);
+    }
+
+    return x;
+  }
+
+
+  static unsigned int AccumulateRowSimd(int32_t* sums,
+                                        const uint16_t* row,
+                                        unsigned int count)
+  {
+    return AccumulateRow16(sums, row, count, false);
+  }
+
+
+  static unsigned int AccumulateRowSimd(int32_t* sums,
+                                        const int16_t* row,
+                                        unsigned int count)
+  {
+    return AccumulateRow16(sums, row, count, true);
+  }
+
+
+  static unsigned int InvertRowSimd(uint8_t* row,
+                                    unsigned int width)
+  {
+    const __m128i ones = _mm_set1_epi8(static_cast<char>(0xff));
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      StoreVector(row + x, _mm_xor_si128(LoadVector(row + x), ones));
+    }
+
+    return x;
+  }
+
+#else
+
+  static unsigned int InvertRowSimd(uint8_t* row,
+                                    unsigned int width)
+  {
+    return 0;
+  }
+
+#endif
+
+
   template <typename TargetType, typename SourceType>
   static void ConvertInternal(ImageAccessor& target,
                               const ImageAccessor& source)
@@ -57,7 +692,15 @@ namespace Orthanc
       TargetType* t = reinterpret_cast<TargetType*>(target.GetRow(y));
       const SourceType* s = reinterpret_cast<const SourceType*>(source.GetConstRow(y));
 
-      for (unsigned int x = 0; x < source.GetWidth(); x++, t++, s++)
+      unsigned int x = 0;
+      if (simdEnabled_)
+      {
+        x = ConvertRowSimd(t, s, source.GetWidth());
+        t += x;
+        s += x;
+      }
+
+      for (; x < source.GetWidth(); x++, t++, s++)
       {
         if (static_cast<int32_t>(*s) < static_cast<int32_t>(minValue))
         {
@@ -87,7 +730,15 @@ namespace Orthanc
       float* t = reinterpret_cast<float*>(target.GetRow(y));
       const SourceType* s = reinterpret_cast<const SourceType*>(source.GetConstRow(y));
 
-      for (unsigned int x = 0; x < source.GetWidth(); x++, t++, s++)
+      unsigned int x = 0;
+      if (simdEnabled_)
+      {
+        x = ConvertRowSimd(t, s, source.GetWidth());
+        t += x;
+        s += x;
+      }
+
+      for (; x < source.GetWidth(); x++, t++, s++)
       {
         *t = static_cast<float>(*s);
       }
@@ -170,7 +821,14 @@ namespace Orthanc
     {
       const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(y));
 
-      for (unsigned int x = 0; x < source.GetWidth(); x++, p++)
+      unsigned int x = 0;
+      if (simdEnabled_)
+      {
+        x = GetMinMaxRowSimd(minValue, maxValue, p, source.GetWidth());
+        p += x;
+      }
+
+      for (; x < source.GetWidth(); x++, p++)
       {
         if (*p < minValue)
         {
@@ -203,7 +861,14 @@ namespace Orthanc
     {
       PixelType* p = reinterpret_cast<PixelType*>(image.GetRow(y));
 
-      for (unsigned int x = 0; x < image.GetWidth(); x++, p++)
+      unsigned int x = 0;
+      if (simdEnabled_)
+      {
+        x = AddConstantRowSimd(p, image.GetWidth(), constant);
+        p += x;
+      }
+
+      for (; x < image.GetWidth(); x++, p++)
       {
         int64_t v = static_cast<int64_t>(*p) + constant;
 
@@ -241,7 +906,16 @@ namespace Orthanc
     {
       PixelType* p = reinterpret_cast<PixelType*>(image.GetRow(y));
 
-      for (unsigned int x = 0; x < image.GetWidth(); x++, p++)
+      unsigned int x = 0;
+      if (simdEnabled_)
+      {
+        // Adding a zero offset to an integer does not change the
+        // product, and the rounding of "llround()" is the same
+        x = ShiftScaleRowSimd(p, image.GetWidth(), 0.0f, factor);
+        p += x;
+      }
+
+      for (; x < image.GetWidth(); x++, p++)
       {
         int64_t v = boost::math::llround(static_cast<float>(*p) * factor);
 
@@ -274,7 +948,14 @@ namespace Orthanc
     {
       PixelType* p = reinterpret_cast<PixelType*>(image.GetRow(y));
 
-      for (unsigned int x = 0; x < image.GetWidth(); x++, p++)
+      unsigned int x = 0;
+      if (simdEnabled_)
+      {
+        x = ShiftScaleRowSimd(p, image.GetWidth(), offset, scaling);
+        p += x;
+      }
+
+      for (; x < image.GetWidth(); x++, p++)
       {
         float v = (static_cast<float>(*p) + offset) * scaling;
 
@@ -295,6 +976,46 @@ namespace Orthanc
   }
 
 
+  template <typename PixelType>
+  static void AccumulateRowInternal(int32_t* sums,
+                                    const ImageAccessor& image,
+                                    unsigned int y,
+                                    unsigned int channels)
+  {
+    const PixelType* p = reinterpret_cast<const PixelType*>(image.GetConstRow(y));
+    const unsigned int count = image.GetWidth() * channels;
+
+    unsigned int x = 0;
+    if (simdEnabled_)
+    {
+      x = AccumulateRowSimd(sums, p, count);
+    }
+
+    for (; x < count; x++)
+    {
+      sums[x] += static_cast<int32_t>(p[x]);
+    }
+  }
+
+
+  bool ImageProcessing::IsSimdAvailable()
+  {
+    return (ORTHANC_ENABLE_SSE2 == 1);
+  }
+
+
+  void ImageProcessing::SetSimdEnabled(bool enabled)
+  {
+    simdEnabled_ = (enabled && IsSimdAvailable());
+  }
+
+
+  bool ImageProcessing::IsSimdEnabled()
+  {
+    return simdEnabled_;
+  }
+
+
   void ImageProcessing::Copy(ImageAccessor& target,
                              const ImageAccessor& source)
   {
@@ -774,6 +1495,39 @@ namespace Orthanc
   }
 
 
+  void ImageProcessing::AccumulateRow(int32_t* sums,
+                                      const ImageAccessor& image,
+                                      unsigned int y)
+  {
+    if (y >= image.GetHeight())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    switch (image.GetFormat())
+    {
+      case PixelFormat_Grayscale8:
+        AccumulateRowInternal<uint8_t>(sums, image, y, 1);
+        return;
+
+      case PixelFormat_RGB24:
+        AccumulateRowInternal<uint8_t>(sums, image, y, 3);
+        return;
+
+      case PixelFormat_Grayscale16:
+        AccumulateRowInternal<uint16_t>(sums, image, y, 1);
+        return;
+
+      case PixelFormat_SignedGrayscale16:
+        AccumulateRowInternal<int16_t>(sums, image, y, 1);
+        return;
+
+      default:
+        throw OrthancException(ErrorCode_NotImplemented);
+    }
+  }
+
+
   void ImageProcessing::Invert(ImageAccessor& image)
   {
     switch (image.GetFormat())
@@ -784,7 +1538,14 @@ namespace Orthanc
         {
           uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(y));
 
-          for (unsigned int x = 0; x < image.GetWidth(); x++, p++)
+          unsigned int x = 0;
+          if (simdEnabled_)
+          {
+            x = InvertRowSimd(p, image.GetWidth());
+            p += x;
+          }
+
+          for (; x < image.GetWidth(); x++, p++)
           {
             *p = 255 - (*p);
           }
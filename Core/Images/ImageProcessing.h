@@ -42,6 +42,16 @@ namespace Orthanc
   class ImageProcessing
   {
   public:
+    // Whether vectorized (SSE2) versions of the routines are built
+    static bool IsSimdAvailable();
+
+    // The vectorized routines are used by default if available. They
+    // give exactly the same results as the scalar routines: This can
+    // be disabled for testing and benchmarking.
+    static void SetSimdEnabled(bool enabled);
+
+    static bool IsSimdEnabled();
+
     static void Copy(ImageAccessor& target,
                      const ImageAccessor& source);
 
@@ -75,5 +85,11 @@ namespace Orthanc
                            float scaling);
 
     static void Invert(ImageAccessor& image);
+
+    // Adds the values of the row "y" to "sums", which contains one
+    // integer per channel and per column (used for area averaging)
+    static void AccumulateRow(int32_t* sums,
+                              const ImageAccessor& image,
+                              unsigned int y);
   };
 }
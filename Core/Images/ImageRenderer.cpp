@@ -0,0 +1,579 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "ImageRenderer.h"
+
+#include "Image.h"
+#include "ImageProcessing.h"
+#include "../Cache/LeastRecentlyUsedIndex.h"
+#include "../OrthancException.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace Orthanc
+{
+  // Column bounds of the source pixels that are averaged for each
+  // target pixel
+  static void ComputeBounds(std::vector<unsigned int>& bounds,
+                            unsigned int sourceSize,
+                            unsigned int targetSize)
+  {
+    assert(targetSize > 0 && targetSize <= sourceSize);
+
+    bounds.resize(targetSize + 1);
+    for (unsigned int i = 0; i <= targetSize; i++)
+    {
+      bounds[i] = static_cast<unsigned int>(static_cast<uint64_t>(i) * sourceSize / targetSize);
+    }
+  }
+
+
+  static uint8_t ToByte(float v)
+  {
+    if (v <= 0.0f)
+    {
+      return 0;
+    }
+    else if (v >= 255.0f)
+    {
+      return 255;
+    }
+    else
+    {
+      return static_cast<uint8_t>(v + 0.5f);
+    }
+  }
+
+
+  namespace
+  {
+    // Maps each stored value of a grayscale image to its 8bpp
+    // rendering. The values outside of the range of the table (that
+    // are not allowed by the bits stored) are computed on the fly.
+    class LookupTable : public boost::noncopyable
+    {
+    private:
+      int32_t               minValue_;
+      int32_t               maxValue_;
+      float                 scaling_;
+      float                 offset_;
+      bool                  invert_;
+      std::vector<uint8_t>  table_;
+
+      uint8_t Compute(int32_t value) const
+      {
+        uint8_t v = ToByte(scaling_ * static_cast<float>(value) + offset_);
+        return (invert_ ? 255 - v : v);
+      }
+
+    public:
+      LookupTable(int32_t minValue,
+                  int32_t maxValue,
+                  float scaling,
+                  float offset,
+                  bool invert) :
+        minValue_(minValue),
+        maxValue_(maxValue),
+        scaling_(scaling),
+        offset_(offset),
+        invert_(invert)
+      {
+        assert(minValue <= maxValue);
+        table_.resize(static_cast<size_t>(maxValue - minValue) + 1);
+
+        for (size_t i = 0; i < table_.size(); i++)
+        {
+          table_[i] = Compute(minValue + static_cast<int32_t>(i));
+        }
+      }
+
+      uint8_t Apply(int32_t value) const
+      {
+        if (value >= minValue_ &&
+            value <= maxValue_)
+        {
+          return table_[value - minValue_];
+        }
+        else
+        {
+          return Compute(value);
+        }
+      }
+    };
+
+
+    struct LookupTableKey
+    {
+      PixelFormat   format_;
+      unsigned int  bitsStored_;
+      float         scaling_;
+      float         offset_;
+      bool          invert_;
+
+      bool operator== (const LookupTableKey& other) const
+      {
+        return (format_ == other.format_ &&
+                bitsStored_ == other.bitsStored_ &&
+                scaling_ == other.scaling_ &&
+                offset_ == other.offset_ &&
+                invert_ == other.invert_);
+      }
+
+      bool operator< (const LookupTableKey& other) const
+      {
+        if (format_ != other.format_)
+        {
+          return format_ < other.format_;
+        }
+        else if (bitsStored_ != other.bitsStored_)
+        {
+          return bitsStored_ < other.bitsStored_;
+        }
+        else if (scaling_ != other.scaling_)
+        {
+          return scaling_ < other.scaling_;
+        }
+        else if (offset_ != other.offset_)
+        {
+          return offset_ < other.offset_;
+        }
+        else
+        {
+          return invert_ < other.invert_;
+        }
+      }
+    };
+
+
+    typedef boost::shared_ptr<const LookupTable>  LookupTablePointer;
+    typedef LeastRecentlyUsedIndex<LookupTableKey, LookupTablePointer>  LookupTables;
+
+    // The tables of 16bpp images take at most 64KB each
+    static const size_t MAX_LOOKUP_TABLES = 32;
+
+    static boost::mutex  lookupTablesMutex_;
+    static LookupTables  lookupTables_;
+  }
+
+
+  static void GetStoredRange(int32_t& minValue,
+                             int32_t& maxValue,
+                             PixelFormat format,
+                             unsigned int bitsStored)
+  {
+    switch (format)
+    {
+      case PixelFormat_Grayscale8:
+        minValue = 0;
+        maxValue = 255;
+        break;
+
+      case PixelFormat_Grayscale16:
+        if (bitsStored == 0 || bitsStored > 16)
+        {
+          bitsStored = 16;
+        }
+
+        minValue = 0;
+        maxValue = (1 << bitsStored) - 1;
+        break;
+
+      case PixelFormat_SignedGrayscale16:
+        if (bitsStored == 0 || bitsStored > 16)
+        {
+          bitsStored = 16;
+        }
+
+        minValue = -(1 << (bitsStored - 1));
+        maxValue = (1 << (bitsStored - 1)) - 1;
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  template <typename PixelType>
+  static void ApplyLookupTableInternal(ImageAccessor& target,
+                                       const ImageAccessor& source,
+                                       const LookupTable& table)
+  {
+    const unsigned int width = source.GetWidth();
+    const unsigned int height = source.GetHeight();
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+      const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(y));
+      uint8_t* q = reinterpret_cast<uint8_t*>(target.GetRow(y));
+
+      for (unsigned int x = 0; x < width; x++, p++, q++)
+      {
+        *q = table.Apply(static_cast<int32_t>(*p));
+      }
+    }
+  }
+
+
+  bool ImageRenderer::ApplyLookupTable(ImageAccessor& target,
+                                       const ImageAccessor& source,
+                                       float scaling,
+                                       float offset) const
+  {
+    assert(target.GetFormat() == PixelFormat_Grayscale8 &&
+           target.GetWidth() == source.GetWidth() &&
+           target.GetHeight() == source.GetHeight());
+
+    LookupTableKey key;
+    key.format_ = source.GetFormat();
+    key.bitsStored_ = (key.format_ == PixelFormat_Grayscale8 ? 8 : bitsStored_);
+    key.scaling_ = scaling;
+    key.offset_ = offset;
+    key.invert_ = invert_;
+
+    int32_t minValue, maxValue;
+    GetStoredRange(minValue, maxValue, key.format_, key.bitsStored_);
+
+    const size_t tableSize = static_cast<size_t>(maxValue - minValue) + 1;
+
+    LookupTablePointer table;
+
+    {
+      boost::mutex::scoped_lock lock(lookupTablesMutex_);
+
+      if (lookupTables_.Contains(key, table))
+      {
+        lookupTables_.MakeMostRecent(key);
+      }
+    }
+
+    if (table.get() == NULL)
+    {
+      if (static_cast<uint64_t>(source.GetWidth()) * static_cast<uint64_t>(source.GetHeight()) < tableSize)
+      {
+        // Building the table would be more expensive than rendering
+        // the pixels one by one
+        return false;
+      }
+
+      table.reset(new LookupTable(minValue, maxValue, scaling, offset, invert_));
+
+      boost::mutex::scoped_lock lock(lookupTablesMutex_);
+
+      if (!lookupTables_.Contains(key))
+      {
+        while (lookupTables_.GetSize() >= MAX_LOOKUP_TABLES)
+        {
+          lookupTables_.RemoveOldest();
+        }
+
+        lookupTables_.Add(key, table);
+      }
+    }
+
+    switch (source.GetFormat())
+    {
+      case PixelFormat_Grayscale8:
+        ApplyLookupTableInternal<uint8_t>(target, source, *table);
+        return true;
+
+      case PixelFormat_Grayscale16:
+        ApplyLookupTableInternal<uint16_t>(target, source, *table);
+        return true;
+
+      case PixelFormat_SignedGrayscale16:
+        ApplyLookupTableInternal<int16_t>(target, source, *table);
+        return true;
+
+      default:
+        throw OrthancException(ErrorCode_InternalError);
+    }
+  }
+
+
+  ImageRenderer::ImageRenderer() :
+    hasWindowing_(false),
+    windowCenter_(128),
+    windowWidth_(256),
+    rescaleSlope_(1),
+    rescaleIntercept_(0),
+    stretchDynamics_(false),
+    invert_(false),
+    bitsStored_(0),
+    maxWidth_(0),
+    maxHeight_(0)
+  {
+  }
+
+
+  void ImageRenderer::SetWindowing(float center,
+                                   float width)
+  {
+    if (width < 1.0f)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    hasWindowing_ = true;
+    windowCenter_ = center;
+    windowWidth_ = width;
+  }
+
+
+  void ImageRenderer::SetRescale(float slope,
+                                 float intercept)
+  {
+    rescaleSlope_ = slope;
+    rescaleIntercept_ = intercept;
+  }
+
+
+  void ImageRenderer::SetBitsStored(unsigned int bits)
+  {
+    if (bits > 16)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    bitsStored_ = bits;
+  }
+
+
+  void ImageRenderer::SetMaximumSize(unsigned int width,
+                                     unsigned int height)
+  {
+    maxWidth_ = width;
+    maxHeight_ = height;
+  }
+
+
+  void ImageRenderer::GetTargetSize(unsigned int& width,
+                                    unsigned int& height,
+                                    const ImageAccessor& source) const
+  {
+    width = source.GetWidth();
+    height = source.GetHeight();
+
+    if (width == 0 ||
+        height == 0)
+    {
+      return;
+    }
+
+    float ratio = 1.0f;
+
+    if (maxWidth_ != 0)
+    {
+      ratio = std::min(ratio, static_cast<float>(maxWidth_) / static_cast<float>(width));
+    }
+
+    if (maxHeight_ != 0)
+    {
+      ratio = std::min(ratio, static_cast<float>(maxHeight_) / static_cast<float>(height));
+    }
+
+    if (ratio < 1.0f)
+    {
+      width = std::max(1u, std::min(width, static_cast<unsigned int>(
+                                      std::floor(static_cast<float>(width) * ratio + 0.5f))));
+      height = std::max(1u, std::min(height, static_cast<unsigned int>(
+                                       std::floor(static_cast<float>(height) * ratio + 0.5f))));
+    }
+  }
+
+
+  void ImageRenderer::GetGrayscaleTransform(float& scaling,
+                                            float& offset,
+                                            const ImageAccessor& source) const
+  {
+    // The output value is "scaling * v + offset", where "v" is the
+    // (averaged) stored value
+    if (hasWindowing_)
+    {
+      const float low = windowCenter_ - windowWidth_ / 2.0f;
+      scaling = rescaleSlope_ * 255.0f / windowWidth_;
+      offset = (rescaleIntercept_ - low) * 255.0f / windowWidth_;
+    }
+    else if (stretchDynamics_)
+    {
+      // The range of the rescaled values is mapped to [0,255], which
+      // only matters if the rescale slope is negative
+      int64_t a, b;
+      ImageProcessing::GetMinMaxValue(a, b, source);
+
+      float low = rescaleSlope_ * static_cast<float>(a) + rescaleIntercept_;
+      float high = rescaleSlope_ * static_cast<float>(b) + rescaleIntercept_;
+      if (low > high)
+      {
+        std::swap(low, high);
+      }
+
+      if (low == high)
+      {
+        scaling = 0;
+        offset = 0;
+      }
+      else
+      {
+        scaling = rescaleSlope_ * 255.0f / (high - low);
+        offset = (rescaleIntercept_ - low) * 255.0f / (high - low);
+      }
+    }
+    else
+    {
+      // Truncation of the rescaled values
+      scaling = rescaleSlope_;
+      offset = rescaleIntercept_;
+    }
+  }
+
+
+  ImageAccessor* ImageRenderer::Render(const ImageAccessor& source) const
+  {
+    unsigned int channels;
+    PixelFormat targetFormat;
+
+    switch (source.GetFormat())
+    {
+      case PixelFormat_Grayscale8:
+      case PixelFormat_Grayscale16:
+      case PixelFormat_SignedGrayscale16:
+        channels = 1;
+        targetFormat = PixelFormat_Grayscale8;
+        break;
+
+      case PixelFormat_RGB24:
+        channels = 3;
+        targetFormat = PixelFormat_RGB24;
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    unsigned int width, height;
+    GetTargetSize(width, height, source);
+
+    std::auto_ptr<ImageAccessor> target(new Image(targetFormat, width, height, false));
+
+    if (width == 0 ||
+        height == 0)
+    {
+      return target.release();
+    }
+
+    float scaling = 1;
+    float offset = 0;
+    if (channels == 1)
+    {
+      GetGrayscaleTransform(scaling, offset, source);
+
+      if (width == source.GetWidth() &&
+          height == source.GetHeight() &&
+          ApplyLookupTable(*target, source, scaling, offset))
+      {
+        return target.release();
+      }
+    }
+
+    std::vector<unsigned int> columns, rows;
+    ComputeBounds(columns, source.GetWidth(), width);
+    ComputeBounds(rows, source.GetHeight(), height);
+
+    if (rows[1] - rows[0] > 32768)
+    {
+      // The 32-bit sums of 16bpp values could overflow
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    std::vector<int32_t> sums(source.GetWidth() * channels);
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+      // Vertical pass: Sum the band of source rows of this target row
+      std::fill(sums.begin(), sums.end(), 0);
+
+      for (unsigned int sy = rows[y]; sy < rows[y + 1]; sy++)
+      {
+        ImageProcessing::AccumulateRow(&sums[0], source, sy);
+      }
+
+      const unsigned int bandHeight = rows[y + 1] - rows[y];
+
+      // Horizontal pass, then transformation of the average
+      uint8_t* q = reinterpret_cast<uint8_t*>(target->GetRow(y));
+
+      for (unsigned int x = 0; x < width; x++)
+      {
+        const unsigned int count = bandHeight * (columns[x + 1] - columns[x]);
+
+        for (unsigned int c = 0; c < channels; c++, q++)
+        {
+          int64_t sum = 0;
+          for (unsigned int sx = columns[x]; sx < columns[x + 1]; sx++)
+          {
+            sum += sums[sx * channels + c];
+          }
+
+          float average = static_cast<float>(sum) / static_cast<float>(count);
+
+          if (channels == 1)
+          {
+            uint8_t v = ToByte(scaling * average + offset);
+            *q = (invert_ ? 255 - v : v);
+          }
+          else
+          {
+            *q = ToByte(average);
+          }
+        }
+      }
+    }
+
+    return target.release();
+  }
+
+
+  size_t ImageRenderer::GetLookupTablesCount()
+  {
+    boost::mutex::scoped_lock lock(lookupTablesMutex_);
+    return lookupTables_.GetSize();
+  }
+}
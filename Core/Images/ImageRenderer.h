@@ -0,0 +1,125 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ImageAccessor.h"
+
+#include <boost/noncopyable.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Renders a grayscale or RGB24 image to an 8bpp image in one fused
+   * pass, band of rows after band of rows: Area-averaging downscale,
+   * rescale slope/intercept, windowing and inversion. No intermediate
+   * image of the size of the source is allocated.
+   *
+   * If the grayscale image is not downscaled, each pixel goes through
+   * a lookup table of the stored values. The lookup tables are shared
+   * by all the renderers, and are kept in a small cache indexed by
+   * the bits stored and by the rescale/windowing/inversion parameters.
+   **/
+  class ImageRenderer : public boost::noncopyable
+  {
+  private:
+    bool          hasWindowing_;
+    float         windowCenter_;
+    float         windowWidth_;
+    float         rescaleSlope_;
+    float         rescaleIntercept_;
+    bool          stretchDynamics_;
+    bool          invert_;
+    unsigned int  bitsStored_;
+    unsigned int  maxWidth_;
+    unsigned int  maxHeight_;
+
+    void GetGrayscaleTransform(float& scaling,
+                               float& offset,
+                               const ImageAccessor& source) const;
+
+    bool ApplyLookupTable(ImageAccessor& target,
+                          const ImageAccessor& source,
+                          float scaling,
+                          float offset) const;
+
+  public:
+    ImageRenderer();
+
+    // Applies the windowing to the rescaled values. The default is
+    // to truncate the values to the [0,255] range.
+    void SetWindowing(float center,
+                      float width);
+
+    // The rescale is applied in all the cases, not only before the
+    // windowing: Without windowing, the rescaled values are either
+    // truncated or stretched to the [0,255] range.
+    void SetRescale(float slope,
+                    float intercept);
+
+    // Maps the minimum and maximum values of the source to the
+    // [0,255] range, if no windowing is set (this is the "preview")
+    void SetStretchDynamics(bool stretch)
+    {
+      stretchDynamics_ = stretch;
+    }
+
+    // Inverts the grayscale images (for MONOCHROME1)
+    void SetInvert(bool invert)
+    {
+      invert_ = invert;
+    }
+
+    // Number of significant bits of the grayscale values (the "Bits
+    // Stored" DICOM tag), that bounds the size of the lookup tables.
+    // "0" means that all the bits of the pixel format are used.
+    void SetBitsStored(unsigned int bits);
+
+    // The image is downscaled to fit in this size, preserving its
+    // aspect ratio. It is never upscaled. A zero value means no
+    // constraint on the corresponding dimension.
+    void SetMaximumSize(unsigned int width,
+                        unsigned int height);
+
+    void GetTargetSize(unsigned int& width,
+                       unsigned int& height,
+                       const ImageAccessor& source) const;
+
+    // Returns a Grayscale8 image, or a RGB24 image for color sources
+    // (the windowing only applies to grayscale images)
+    ImageAccessor* Render(const ImageAccessor& source) const;
+
+    // Number of lookup tables in the shared cache (for unit tests)
+    static size_t GetLookupTablesCount();
+  };
+}
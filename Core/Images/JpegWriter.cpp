@@ -74,7 +74,7 @@ namespace Orthanc
                        unsigned int width,
                        unsigned int height,
                        PixelFormat format,
-                       uint8_t quality)
+                       const JpegWriter& writer)
   {
     cinfo.image_width = width;
     cinfo.image_height = height;
@@ -96,7 +96,27 @@ namespace Orthanc
     }
 
     jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_set_quality(&cinfo, writer.GetQuality(), TRUE);
+
+    cinfo.dct_method = (writer.IsFastDct() ? JDCT_IFAST : JDCT_ISLOW);
+    cinfo.optimize_coding = (writer.IsOptimizeCoding() ? TRUE : FALSE);
+
+    if (format == PixelFormat_RGB24 &&
+        !writer.IsChromaSubsampling())
+    {
+      // 4:4:4 sampling (the default of "jpeg_set_defaults()" is 4:2:0)
+      for (int i = 0; i < cinfo.num_components; i++)
+      {
+        cinfo.comp_info[i].h_samp_factor = 1;
+        cinfo.comp_info[i].v_samp_factor = 1;
+      }
+    }
+
+    if (writer.IsProgressive())
+    {
+      jpeg_simple_progression(&cinfo);
+    }
+
     jpeg_start_compress(&cinfo, TRUE);
     jpeg_write_scanlines(&cinfo, &lines[0], height);
     jpeg_finish_compress(&cinfo);
@@ -115,6 +135,34 @@ namespace Orthanc
   }
 
 
+  void JpegWriter::SetProfile(ImageEncoderProfile profile)
+  {
+    switch (profile)
+    {
+      case ImageEncoderProfile_Fast:
+        fastDct_ = true;
+        progressive_ = false;
+        optimizeCoding_ = false;
+        break;
+
+      case ImageEncoderProfile_Balanced:
+        fastDct_ = false;
+        progressive_ = false;
+        optimizeCoding_ = false;
+        break;
+
+      case ImageEncoderProfile_Small:
+        fastDct_ = false;
+        progressive_ = true;
+        optimizeCoding_ = true;
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
 #if ORTHANC_SANDBOXED == 0
   void JpegWriter::WriteToFileInternal(const std::string& filename,
                                        unsigned int width,
@@ -153,7 +201,7 @@ namespace Orthanc
 
     jpeg_create_compress(&cinfo);
     jpeg_stdio_dest(&cinfo, fp);
-    Compress(cinfo, lines, width, height, format, quality_);
+    Compress(cinfo, lines, width, height, format, *this);
 
     // Everything went fine, "setjmp()" didn't get called
 
@@ -200,7 +248,7 @@ namespace Orthanc
     cinfo.err = jerr.GetPublic();
     jpeg_mem_dest(&cinfo, &data, &size);
 
-    Compress(cinfo, lines, width, height, format, quality_);
+    Compress(cinfo, lines, width, height, format, *this);
 
     // Everything went fine, "setjmp()" didn't get called
 
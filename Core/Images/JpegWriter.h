@@ -66,9 +66,18 @@ namespace Orthanc
 
   private:
     uint8_t  quality_;
+    bool     fastDct_;
+    bool     chromaSubsampling_;
+    bool     progressive_;
+    bool     optimizeCoding_;
 
   public:
-    JpegWriter() : quality_(90)
+    JpegWriter() : 
+      quality_(90),
+      fastDct_(false),
+      chromaSubsampling_(true),
+      progressive_(false),
+      optimizeCoding_(false)
     {
     }
 
@@ -78,5 +87,53 @@ namespace Orthanc
     {
       return quality_;
     }
+
+    // Use the fast, but less accurate, integer DCT of libjpeg
+    void SetFastDct(bool fast)
+    {
+      fastDct_ = fast;
+    }
+
+    bool IsFastDct() const
+    {
+      return fastDct_;
+    }
+
+    // Subsample the chrominance of color images by 2 in both
+    // directions (4:2:0), which is the default of libjpeg
+    void SetChromaSubsampling(bool subsampling)
+    {
+      chromaSubsampling_ = subsampling;
+    }
+
+    bool IsChromaSubsampling() const
+    {
+      return chromaSubsampling_;
+    }
+
+    void SetProgressive(bool progressive)
+    {
+      progressive_ = progressive;
+    }
+
+    bool IsProgressive() const
+    {
+      return progressive_;
+    }
+
+    // Compute optimal Huffman tables (smaller, but slower)
+    void SetOptimizeCoding(bool optimize)
+    {
+      optimizeCoding_ = optimize;
+    }
+
+    bool IsOptimizeCoding() const
+    {
+      return optimizeCoding_;
+    }
+
+    // Sets the DCT, the progressive mode and the Huffman coding, but
+    // neither the quality nor the chroma subsampling
+    void SetProfile(ImageEncoderProfile profile);
   };
 }
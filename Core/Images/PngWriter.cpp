@@ -92,7 +92,10 @@ namespace Orthanc
 
 
 
-  PngWriter::PngWriter() : pimpl_(new PImpl)
+  PngWriter::PngWriter() : 
+    pimpl_(new PImpl),
+    compressionLevel_(6),
+    adaptiveFiltering_(true)
   {
     pimpl_->png_ = NULL;
     pimpl_->info_ = NULL;
@@ -127,6 +130,42 @@ namespace Orthanc
 
 
 
+  void PngWriter::SetCompressionLevel(unsigned int level)
+  {
+    if (level > 9)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    compressionLevel_ = level;
+  }
+
+
+  void PngWriter::SetProfile(ImageEncoderProfile profile)
+  {
+    switch (profile)
+    {
+      case ImageEncoderProfile_Fast:
+        compressionLevel_ = 1;
+        adaptiveFiltering_ = false;
+        break;
+
+      case ImageEncoderProfile_Balanced:
+        compressionLevel_ = 3;
+        adaptiveFiltering_ = true;
+        break;
+
+      case ImageEncoderProfile_Small:
+        compressionLevel_ = 9;
+        adaptiveFiltering_ = true;
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
   void PngWriter::Prepare(unsigned int width,
                           unsigned int height,
                           unsigned int pitch,
@@ -173,6 +212,10 @@ namespace Orthanc
                            unsigned int pitch,
                            PixelFormat format)
   {
+    png_set_compression_level(pimpl_->png_, static_cast<int>(compressionLevel_));
+    png_set_filter(pimpl_->png_, PNG_FILTER_TYPE_BASE,
+                   adaptiveFiltering_ ? PNG_ALL_FILTERS : PNG_FILTER_SUB);
+
     png_set_IHDR(pimpl_->png_, pimpl_->info_, width, height,
                  pimpl_->bitDepth_, pimpl_->colorType_, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
@@ -70,6 +70,9 @@ namespace Orthanc
     struct PImpl;
     boost::shared_ptr<PImpl> pimpl_;
 
+    unsigned int  compressionLevel_;
+    bool          adaptiveFiltering_;
+
     void Compress(unsigned int width,
                   unsigned int height,
                   unsigned int pitch,
@@ -85,5 +88,29 @@ namespace Orthanc
     PngWriter();
 
     ~PngWriter();
+
+    // Compression level of zlib, between 0 (no compression) and 9
+    // (smallest and slowest). The default is 6.
+    void SetCompressionLevel(unsigned int level);
+
+    unsigned int GetCompressionLevel() const
+    {
+      return compressionLevel_;
+    }
+
+    // If "true" (the default), the best of the 5 PNG filters is
+    // chosen for each row. Otherwise, only the "Sub" filter is used,
+    // which is much faster.
+    void SetAdaptiveFiltering(bool adaptive)
+    {
+      adaptiveFiltering_ = adaptive;
+    }
+
+    bool IsAdaptiveFiltering() const
+    {
+      return adaptiveFiltering_;
+    }
+
+    void SetProfile(ImageEncoderProfile profile);
   };
 }
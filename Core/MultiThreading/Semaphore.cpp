@@ -60,6 +60,26 @@ namespace Orthanc
       condition_.wait(lock);
     }
 
-    count_++;
+    count_--;
+  }
+
+  bool Semaphore::TryAcquire(unsigned int timeout)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const boost::system_time deadline = (boost::get_system_time() +
+                                         boost::posix_time::milliseconds(timeout));
+
+    while (count_ == 0)
+    {
+      if (!condition_.timed_wait(lock, deadline) &&
+          count_ == 0)
+      {
+        return false;
+      }
+    }
+
+    count_--;
+    return true;
   }
 }
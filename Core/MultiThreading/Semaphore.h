@@ -52,6 +52,10 @@ namespace Orthanc
 
     void Acquire();
 
+    // Returns "false" if no resource became available within the
+    // given timeout (in milliseconds)
+    bool TryAcquire(unsigned int timeout);
+
     class Locker : public boost::noncopyable
     {
     private:
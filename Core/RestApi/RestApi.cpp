@@ -35,102 +35,73 @@
 #include "RestApi.h"
 
 #include "../Logging.h"
+#include "../OrthancException.h"
 
+#include <cassert>
 #include <stdlib.h>   // To define "_exit()" under Windows
 #include <stdio.h>
 
 namespace Orthanc
 {
-  namespace
+  static void HandleResource(const RestApiHierarchy::Resource& resource,
+                             RestApi& api,
+                             RestApiOutput& output,
+                             RequestOrigin origin,
+                             const char* remoteIp,
+                             const char* username,
+                             HttpMethod method,
+                             const IHttpHandler::Arguments& headers,
+                             const IHttpHandler::Arguments& getArguments,
+                             const RestApiRouteMatch& match,
+                             const char* bodyData,
+                             size_t bodySize)
   {
-    // Anonymous namespace to avoid clashes between compilation modules
-    class HttpHandlerVisitor : public RestApiHierarchy::IVisitor
+    // The trailing components are only copied for universal handlers
+    UriComponents trailing;
+    if (match.HasTrailing())
     {
-    private:
-      RestApi& api_;
-      RestApiOutput& output_;
-      RequestOrigin origin_;
-      const char* remoteIp_;
-      const char* username_;
-      HttpMethod method_;
-      const IHttpHandler::Arguments& headers_;
-      const IHttpHandler::Arguments& getArguments_;
-      const char* bodyData_;
-      size_t bodySize_;
-
-    public:
-      HttpHandlerVisitor(RestApi& api,
-                         RestApiOutput& output,
-                         RequestOrigin origin,
-                         const char* remoteIp,
-                         const char* username,
-                         HttpMethod method,
-                         const IHttpHandler::Arguments& headers,
-                         const IHttpHandler::Arguments& getArguments,
-                         const char* bodyData,
-                         size_t bodySize) :
-        api_(api),
-        output_(output),
-        origin_(origin),
-        remoteIp_(remoteIp),
-        username_(username),
-        method_(method),
-        headers_(headers),
-        getArguments_(getArguments),
-        bodyData_(bodyData),
-        bodySize_(bodySize)
+      match.GetTrailing(trailing);
+    }
+
+    const UriComponents& uri = match.GetUri();
+
+    switch (method)
+    {
+      case HttpMethod_Get:
       {
+        RestApiGetCall call(output, api, origin, remoteIp, username, 
+                            headers, match, trailing, uri, getArguments);
+        resource.Handle(call);
+        break;
       }
 
-      virtual bool Visit(const RestApiHierarchy::Resource& resource,
-                         const UriComponents& uri,
-                         const IHttpHandler::Arguments& components,
-                         const UriComponents& trailing)
+      case HttpMethod_Post:
       {
-        if (resource.HasHandler(method_))
-        {
-          switch (method_)
-          {
-            case HttpMethod_Get:
-            {
-              RestApiGetCall call(output_, api_, origin_, remoteIp_, username_, 
-                                  headers_, components, trailing, uri, getArguments_);
-              resource.Handle(call);
-              return true;
-            }
-
-            case HttpMethod_Post:
-            {
-              RestApiPostCall call(output_, api_, origin_, remoteIp_, username_, 
-                                   headers_, components, trailing, uri, bodyData_, bodySize_);
-              resource.Handle(call);
-              return true;
-            }
-
-            case HttpMethod_Delete:
-            {
-              RestApiDeleteCall call(output_, api_, origin_, remoteIp_, username_, 
-                                     headers_, components, trailing, uri);
-              resource.Handle(call);
-              return true;
-            }
-
-            case HttpMethod_Put:
-            {
-              RestApiPutCall call(output_, api_, origin_, remoteIp_, username_, 
-                                  headers_, components, trailing, uri, bodyData_, bodySize_);
-              resource.Handle(call);
-              return true;
-            }
-
-            default:
-              return false;
-          }
-        }
+        RestApiPostCall call(output, api, origin, remoteIp, username, 
+                             headers, match, trailing, uri, bodyData, bodySize);
+        resource.Handle(call);
+        break;
+      }
+
+      case HttpMethod_Delete:
+      {
+        RestApiDeleteCall call(output, api, origin, remoteIp, username, 
+                               headers, match, trailing, uri);
+        resource.Handle(call);
+        break;
+      }
 
-        return false;
+      case HttpMethod_Put:
+      {
+        RestApiPutCall call(output, api, origin, remoteIp, username, 
+                            headers, match, trailing, uri, bodyData, bodySize);
+        resource.Handle(call);
+        break;
       }
-    };
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
   }
 
 
@@ -211,20 +182,25 @@ namespace Orthanc
     }
 #endif
 
-    Arguments compiled;
-    HttpToolbox::CompileGetArguments(compiled, getArguments);
+    const RestApiHierarchy::Resource* resource = NULL;
+    RestApiRouteMatch match(uri);
 
-    HttpHandlerVisitor visitor(*this, wrappedOutput, origin, remoteIp, username, 
-                               method, headers, compiled, bodyData, bodySize);
-
-    if (root_.LookupResource(uri, visitor))
+    if (router_.Lookup(resource, match, method))
     {
+      assert(resource != NULL);
+
+      Arguments compiled;
+      HttpToolbox::CompileGetArguments(compiled, getArguments);
+
+      HandleResource(*resource, *this, wrappedOutput, origin, remoteIp, username,
+                     method, headers, compiled, match, bodyData, bodySize);
+
       wrappedOutput.Finalize();
       return true;
     }
 
     std::set<HttpMethod> methods;
-    root_.GetAcceptedMethods(methods, uri);
+    router_.GetAcceptedMethods(methods, uri);
 
     if (methods.empty())
     {
@@ -241,28 +217,48 @@ namespace Orthanc
     }
   }
 
+  bool RestApi::CreateChunkedRequestReader(std::auto_ptr<IChunkedRequestReader>& target,
+                                           RequestOrigin origin,
+                                           const char* remoteIp,
+                                           const char* username,
+                                           HttpMethod method,
+                                           const UriComponents& uri,
+                                           const Arguments& headers)
+  {
+    // The REST callbacks expect the full body in memory: No reader is
+    // created, but the URI is claimed if it is served by this REST API
+    std::set<HttpMethod> methods;
+    router_.GetAcceptedMethods(methods, uri);
+    return !methods.empty();
+  }
+
+
   void RestApi::Register(const std::string& path,
                          RestApiGetCall::Handler handler)
   {
     root_.Register(path, handler);
+    router_.Compile(root_);
   }
 
   void RestApi::Register(const std::string& path,
                          RestApiPutCall::Handler handler)
   {
     root_.Register(path, handler);
+    router_.Compile(root_);
   }
 
   void RestApi::Register(const std::string& path,
                          RestApiPostCall::Handler handler)
   {
     root_.Register(path, handler);
+    router_.Compile(root_);
   }
 
   void RestApi::Register(const std::string& path,
                          RestApiDeleteCall::Handler handler)
   {
     root_.Register(path, handler);
+    router_.Compile(root_);
   }
   
   void RestApi::AutoListChildren(RestApiGetCall& call)
@@ -34,6 +34,7 @@
 #pragma once
 
 #include "RestApiHierarchy.h"
+#include "RestApiRouter.h"
 
 #include <list>
 
@@ -44,6 +45,11 @@ namespace Orthanc
   private:
     RestApiHierarchy root_;
 
+    // Compiled version of "root_", used to dispatch the HTTP
+    // requests. It is rebuilt after each registration, as all the
+    // routes are registered before the HTTP server is started.
+    RestApiRouter    router_;
+
   public:
     static void AutoListChildren(RestApiGetCall& call);
 
@@ -58,6 +64,14 @@ namespace Orthanc
                         const char* bodyData,
                         size_t bodySize);
 
+    virtual bool CreateChunkedRequestReader(std::auto_ptr<IChunkedRequestReader>& target,
+                                            RequestOrigin origin,
+                                            const char* remoteIp,
+                                            const char* username,
+                                            HttpMethod method,
+                                            const UriComponents& uri,
+                                            const Arguments& headers);
+
     void Register(const std::string& path,
                   RestApiGetCall::Handler handler);
 
@@ -36,6 +36,7 @@
 #include "../HttpServer/IHttpHandler.h"
 #include "../HttpServer/HttpToolbox.h"
 #include "RestApiPath.h"
+#include "RestApiRouteMatch.h"
 #include "RestApiOutput.h"
 
 #include <boost/noncopyable.hpp>
@@ -53,7 +54,7 @@ namespace Orthanc
     const char* remoteIp_;
     const char* username_;
     const IHttpHandler::Arguments& httpHeaders_;
-    const IHttpHandler::Arguments& uriComponents_;
+    const RestApiRouteMatch& uriComponents_;
     const UriComponents& trailing_;
     const UriComponents& fullUri_;
 
@@ -68,7 +69,7 @@ namespace Orthanc
                 const char* remoteIp,
                 const char* username,
                 const IHttpHandler::Arguments& httpHeaders,
-                const IHttpHandler::Arguments& uriComponents,
+                const RestApiRouteMatch& uriComponents,
                 const UriComponents& trailing,
                 const UriComponents& fullUri) :
       output_(output),
@@ -106,7 +107,7 @@ namespace Orthanc
     std::string GetUriComponent(const std::string& name,
                                 const std::string& defaultValue) const
     {
-      return HttpToolbox::GetArgument(uriComponents_, name, defaultValue);
+      return uriComponents_.GetUriComponent(name, defaultValue);
     }
 
     std::string GetHttpHeader(const std::string& name,
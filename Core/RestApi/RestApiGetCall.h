@@ -51,7 +51,7 @@ namespace Orthanc
                    const char* remoteIp,
                    const char* username,
                    const IHttpHandler::Arguments& httpHeaders,
-                   const IHttpHandler::Arguments& uriComponents,
+                   const RestApiRouteMatch& uriComponents,
                    const UriComponents& trailing,
                    const UriComponents& fullUri,
                    const IHttpHandler::Arguments& getArguments) :
@@ -72,6 +72,11 @@ namespace Orthanc
       return getArguments_.find(name) != getArguments_.end();
     }
 
+    const IHttpHandler::Arguments& GetArguments() const
+    {
+      return getArguments_;
+    }
+
     virtual bool ParseJsonRequest(Json::Value& result) const;
   };
 }
@@ -42,8 +42,12 @@
 
 namespace Orthanc
 {
+  class RestApiRouter;
+
   class RestApiHierarchy : public boost::noncopyable
   {
+    friend class RestApiRouter;
+
   public:
     class Resource : public boost::noncopyable
     {
@@ -0,0 +1,315 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "RestApiJsonWriter.h"
+
+#include "../OrthancException.h"
+
+#include <cassert>
+#include <json/reader.h>
+#include <json/writer.h>
+
+namespace Orthanc
+{
+  RestApiJsonWriter::RestApiJsonWriter(RestApiOutput& output) :
+    output_(output),
+    isStreaming_(!output.IsConvertJsonToXml()),
+    isStarted_(false),
+    isDone_(false),
+    chunkSize_(64 * 1024),  // 64KB
+    contentType_("application/json; charset=utf-8"),
+    hasKey_(false)
+  {
+  }
+
+
+  void RestApiJsonWriter::SetChunkSize(size_t size)
+  {
+    if (size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    chunkSize_ = size;
+  }
+
+
+  void RestApiJsonWriter::SetContentType(const std::string& contentType)
+  {
+    if (isStarted_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    contentType_ = contentType;
+  }
+
+
+  void RestApiJsonWriter::BeginValue()
+  {
+    if (levels_.empty())
+    {
+      if (isDone_)
+      {
+        // There can be only one root value
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+    }
+    else if (levels_.back().isObject_)
+    {
+      if (!hasKey_)
+      {
+        // "WriteKey()" must be called before each value of an object
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+
+      hasKey_ = false;
+    }
+    else
+    {
+      if (!levels_.back().isEmpty_ &&
+          isStreaming_)
+      {
+        buffer_ += ',';
+      }
+
+      levels_.back().isEmpty_ = false;
+    }
+  }
+
+
+  void RestApiJsonWriter::EndValue()
+  {
+    if (levels_.empty())
+    {
+      isDone_ = true;
+    }
+
+    if (isStreaming_ &&
+        buffer_.size() >= chunkSize_)
+    {
+      Flush();
+    }
+  }
+
+
+  Json::Value& RestApiJsonWriter::InsertInTree(const Json::Value& value)
+  {
+    assert(!isStreaming_);
+
+    if (levels_.empty())
+    {
+      root_ = value;
+      return root_;
+    }
+    else
+    {
+      Json::Value& parent = *levels_.back().node_;
+
+      if (levels_.back().isObject_)
+      {
+        parent[key_] = value;
+        return parent[key_];
+      }
+      else
+      {
+        return parent.append(value);
+      }
+    }
+  }
+
+
+  void RestApiJsonWriter::StartContainer(bool isObject)
+  {
+    BeginValue();
+
+    Level level;
+    level.isObject_ = isObject;
+    level.isEmpty_ = true;
+    level.node_ = NULL;
+
+    if (isStreaming_)
+    {
+      buffer_ += (isObject ? '{' : '[');
+    }
+    else
+    {
+      level.node_ = &InsertInTree(isObject ? Json::objectValue : Json::arrayValue);
+    }
+
+    levels_.push_back(level);
+  }
+
+
+  void RestApiJsonWriter::EndContainer(bool isObject)
+  {
+    if (levels_.empty() ||
+        levels_.back().isObject_ != isObject ||
+        hasKey_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (isStreaming_)
+    {
+      buffer_ += (isObject ? '}' : ']');
+    }
+
+    levels_.pop_back();
+    EndValue();
+  }
+
+
+  void RestApiJsonWriter::WriteKey(const std::string& key)
+  {
+    if (levels_.empty() ||
+        !levels_.back().isObject_ ||
+        hasKey_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (isStreaming_)
+    {
+      if (!levels_.back().isEmpty_)
+      {
+        buffer_ += ',';
+      }
+
+      buffer_ += Json::valueToQuotedString(key.c_str());
+      buffer_ += ':';
+    }
+    else
+    {
+      key_ = key;
+    }
+
+    levels_.back().isEmpty_ = false;
+    hasKey_ = true;
+  }
+
+
+  void RestApiJsonWriter::WriteString(const std::string& value)
+  {
+    if (isStreaming_)
+    {
+      BeginValue();
+      buffer_ += Json::valueToQuotedString(value.c_str());
+      EndValue();
+    }
+    else
+    {
+      WriteValue(value);
+    }
+  }
+
+
+  void RestApiJsonWriter::WriteValue(const Json::Value& value)
+  {
+    BeginValue();
+
+    if (isStreaming_)
+    {
+      Json::FastWriter writer;
+      std::string s = writer.write(value);
+
+      // Remove the trailing newline that is added by JsonCpp
+      if (!s.empty() &&
+          s[s.size() - 1] == '\n')
+      {
+        s.resize(s.size() - 1);
+      }
+
+      buffer_ += s;
+    }
+    else
+    {
+      InsertInTree(value);
+    }
+
+    EndValue();
+  }
+
+
+  void RestApiJsonWriter::Flush()
+  {
+    if (isStreaming_ &&
+        !buffer_.empty())
+    {
+      if (!isStarted_)
+      {
+        output_.StartChunkedAnswer(contentType_, true /* compression */);
+        isStarted_ = true;
+      }
+
+      output_.SendChunk(buffer_.c_str(), buffer_.size());
+      buffer_.clear();
+    }
+  }
+
+
+  void RestApiJsonWriter::Close()
+  {
+    if (!isDone_)
+    {
+      // The root value is not complete
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (!isStreaming_)
+    {
+      output_.AnswerJson(root_);
+    }
+    else if (isStarted_)
+    {
+      Flush();
+      output_.CloseChunkedAnswer();
+    }
+    else
+    {
+      // The whole answer fits in one block: Send it at once, as
+      // styled JSON like "RestApiOutput::AnswerJson()", so that the
+      // small answers are unchanged for the existing clients
+      Json::Value root;
+      Json::Reader reader;
+      if (!reader.parse(buffer_, root))
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      Json::StyledWriter writer;
+      output_.AnswerBuffer(writer.write(root), contentType_);
+    }
+  }
+}
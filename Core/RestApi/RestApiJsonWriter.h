@@ -0,0 +1,128 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "RestApiOutput.h"
+
+#include <vector>
+
+namespace Orthanc
+{
+  /**
+   * Writes a JSON answer progressively, without building the whole
+   * Json::Value tree of the answer in memory. The JSON is compact
+   * (not styled), and is sent by blocks using the chunked transfer
+   * encoding, so that the memory usage does not depend on the size
+   * of the answer. The blocks are compressed on the fly if the HTTP
+   * client accepts it. Small answers that fit in one block are sent
+   * at once as styled JSON, with their "Content-Length".
+   *
+   * As XML cannot be generated this way, the tree is built in memory
+   * and sent at once if the client has requested XML.
+   **/
+  class RestApiJsonWriter : public boost::noncopyable
+  {
+  private:
+    struct Level
+    {
+      bool          isObject_;
+      bool          isEmpty_;
+      Json::Value*  node_;   // Only used if the tree is built in memory
+    };
+
+    RestApiOutput&      output_;
+    bool                isStreaming_;
+    bool                isStarted_;
+    bool                isDone_;
+    size_t              chunkSize_;
+    std::string         contentType_;
+    std::string         buffer_;
+    std::vector<Level>  levels_;
+    bool                hasKey_;
+    std::string         key_;
+    Json::Value         root_;
+
+    void BeginValue();
+
+    void EndValue();
+
+    Json::Value& InsertInTree(const Json::Value& value);
+
+    void StartContainer(bool isObject);
+
+    void EndContainer(bool isObject);
+
+  public:
+    RestApiJsonWriter(RestApiOutput& output);
+
+    // The size of the blocks that are sent to the HTTP client
+    void SetChunkSize(size_t size);
+
+    // Defaults to "application/json". Ignored if XML is generated.
+    void SetContentType(const std::string& contentType);
+
+    void StartObject()
+    {
+      StartContainer(true);
+    }
+
+    void EndObject()
+    {
+      EndContainer(true);
+    }
+
+    void StartArray()
+    {
+      StartContainer(false);
+    }
+
+    void EndArray()
+    {
+      EndContainer(false);
+    }
+
+    // Must be called before each value of an object
+    void WriteKey(const std::string& key);
+
+    void WriteString(const std::string& value);
+
+    // Writes a whole JSON subtree (e.g. the description of one resource)
+    void WriteValue(const Json::Value& value);
+
+    void Flush();
+
+    // Must be called once the root value is complete
+    void Close();
+  };
+}
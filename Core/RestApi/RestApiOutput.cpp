@@ -39,6 +39,7 @@
 #include "../Toolbox.h"
 
 #include <boost/lexical_cast.hpp>
+#include <cassert>
 
 
 namespace Orthanc
@@ -47,7 +48,9 @@ namespace Orthanc
                                HttpMethod method) : 
     output_(output),
     method_(method),
-    convertJsonToXml_(false)
+    convertJsonToXml_(false),
+    recordedContent_(NULL),
+    recordedContentType_(NULL)
   {
     alreadySent_ = false;
   }
@@ -80,6 +83,35 @@ namespace Orthanc
   }
 
 
+  void RestApiOutput::SetRecording(std::string& content,
+                                   std::string& contentType)
+  {
+    content.clear();
+    contentType.clear();
+    recordedContent_ = &content;
+    recordedContentType_ = &contentType;
+  }
+
+  void RestApiOutput::Record(const void* buffer,
+                             size_t length,
+                             const std::string& contentType)
+  {
+    if (recordedContent_ != NULL)
+    {
+      assert(recordedContentType_ != NULL);
+      if (length == 0)
+      {
+        recordedContent_->clear();
+      }
+      else
+      {
+        recordedContent_->assign(reinterpret_cast<const char*>(buffer), length);
+      }
+      *recordedContentType_ = contentType;
+    }
+  }
+
+
   void RestApiOutput::AnswerStream(IHttpStreamAnswer& stream)
   {
     CheckStatus();
@@ -87,6 +119,22 @@ namespace Orthanc
     alreadySent_ = true;
   }
 
+  bool RestApiOutput::AnswerNotModified(const std::string& etag)
+  {
+    CheckStatus();
+
+    if (method_ == HttpMethod_Get &&
+        output_.AnswerNotModified(etag))
+    {
+      alreadySent_ = true;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
   void RestApiOutput::AnswerJson(const Json::Value& value)
   {
     CheckStatus();
@@ -98,6 +146,7 @@ namespace Orthanc
       Toolbox::JsonToXml(s, value);
       output_.SetContentType("application/xml; charset=utf-8");
       output_.Answer(s);
+      Record(s.c_str(), s.size(), "application/xml; charset=utf-8");
 #else
       LOG(ERROR) << "Orthanc was compiled without XML support";
       throw OrthancException(ErrorCode_InternalError);
@@ -106,8 +155,10 @@ namespace Orthanc
     else
     {
       Json::StyledWriter writer;
+      std::string s = writer.write(value);
       output_.SetContentType("application/json; charset=utf-8");
-      output_.Answer(writer.write(value));
+      output_.Answer(s);
+      Record(s.c_str(), s.size(), "application/json; charset=utf-8");
     }
 
     alreadySent_ = true;
@@ -127,6 +178,30 @@ namespace Orthanc
     CheckStatus();
     output_.SetContentType(contentType.c_str());
     output_.Answer(buffer, length);
+    Record(buffer, length, contentType);
+    alreadySent_ = true;
+  }
+
+  void RestApiOutput::AnswerBuffer(const std::string& buffer,
+                                   const std::string& contentType,
+                                   HttpStatus status)
+  {
+    if (status == HttpStatus_200_Ok)
+    {
+      AnswerBuffer(buffer, contentType);
+      return;
+    }
+
+    if ((static_cast<int>(status) < 200 ||
+         static_cast<int>(status) >= 300) &&
+        status != HttpStatus_409_Conflict)
+    {
+      throw OrthancException(ErrorCode_BadHttpStatusInRest);
+    }
+
+    CheckStatus();
+    output_.SetContentType(contentType.c_str());
+    output_.SendStatus(status, buffer);
     alreadySent_ = true;
   }
 
@@ -137,6 +212,65 @@ namespace Orthanc
     alreadySent_ = true;
   }
 
+  void RestApiOutput::StartMultipart(const std::string& subType,
+                                     const std::string& contentType)
+  {
+    CheckStatus();
+    output_.StartMultipart(subType, contentType);
+    alreadySent_ = true;
+  }
+
+  void RestApiOutput::SendMultipartItem(const std::string& item,
+                                        const std::map<std::string, std::string>& headers)
+  {
+    if (!output_.IsWritingMultipart())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    output_.SendMultipartItem(item.empty() ? NULL : item.c_str(), item.size(), headers);
+  }
+
+  void RestApiOutput::CloseMultipart()
+  {
+    if (!output_.IsWritingMultipart())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    output_.CloseMultipart();
+  }
+
+  void RestApiOutput::StartChunkedAnswer(const std::string& contentType,
+                                         bool allowCompression)
+  {
+    CheckStatus();
+    output_.SetContentType(contentType.c_str());
+    output_.StartChunkedBody(allowCompression);
+    alreadySent_ = true;
+  }
+
+  void RestApiOutput::SendChunk(const void* buffer,
+                                size_t length)
+  {
+    if (!output_.IsWritingChunks())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    output_.SendChunk(buffer, length);
+  }
+
+  void RestApiOutput::CloseChunkedAnswer()
+  {
+    if (!output_.IsWritingChunks())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    output_.CloseChunkedBody();
+  }
+
   void RestApiOutput::SignalErrorInternal(HttpStatus status,
 					  const char* message,
 					  size_t messageSize)
@@ -47,6 +47,12 @@ namespace Orthanc
     HttpMethod   method_;
     bool         alreadySent_;
     bool         convertJsonToXml_;
+    std::string* recordedContent_;
+    std::string* recordedContentType_;
+
+    void Record(const void* buffer,
+                size_t length,
+                const std::string& contentType);
 
     void CheckStatus();
 
@@ -70,8 +76,18 @@ namespace Orthanc
       return convertJsonToXml_;
     }
 
+    // Keeps a copy of the body and of the content type of the answer
+    // if it is sent through "AnswerJson()" or "AnswerBuffer()". The
+    // content type stays empty if another kind of answer is sent.
+    void SetRecording(std::string& content,
+                      std::string& contentType);
+
     void AnswerStream(IHttpStreamAnswer& stream);
 
+    // Returns "true" iff "304 Not Modified" was sent, because the
+    // client already owns the content with the given ETag
+    bool AnswerNotModified(const std::string& etag);
+
     void AnswerJson(const Json::Value& value);
 
     void AnswerBuffer(const std::string& buffer,
@@ -81,6 +97,13 @@ namespace Orthanc
                       size_t length,
                       const std::string& contentType);
 
+    // Answers with a successful HTTP status other than "200 OK"
+    // (e.g. "202 Accepted"), or with "409 Conflict". Such answers
+    // are never recorded into the response cache.
+    void AnswerBuffer(const std::string& buffer,
+                      const std::string& contentType,
+                      HttpStatus status);
+
     void SignalError(HttpStatus status);
 
     void SignalError(HttpStatus status,
@@ -88,6 +111,32 @@ namespace Orthanc
 
     void Redirect(const std::string& path);
 
+    void StartMultipart(const std::string& subType,
+                        const std::string& contentType);
+
+    void SendMultipartItem(const std::string& item,
+                           const std::map<std::string, std::string>& headers);
+
+    void CloseMultipart();
+
+    // If "allowCompression" is "true", the chunks are compressed on
+    // the fly if the HTTP client accepts it
+    void StartChunkedAnswer(const std::string& contentType,
+                            bool allowCompression = false);
+
+    void SendChunk(const void* buffer,
+                   size_t length);
+
+    void CloseChunkedAnswer();
+
+    // To be called before throwing an exception once a multipart or
+    // chunked answer has started: The client must not wait for the
+    // end of the truncated answer on a keep-alive connection
+    void CloseConnection()
+    {
+      output_.CloseConnection();
+    }
+
     void SetCookie(const std::string& name,
                    const std::string& value,
                    unsigned int maxAge = 0);
@@ -52,7 +52,7 @@ namespace Orthanc
                    const char* remoteIp,
                    const char* username,
                    const IHttpHandler::Arguments& httpHeaders,
-                   const IHttpHandler::Arguments& uriComponents,
+                   const RestApiRouteMatch& uriComponents,
                    const UriComponents& trailing,
                    const UriComponents& fullUri,
                    const char* bodyData,
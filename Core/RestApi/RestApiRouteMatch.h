@@ -0,0 +1,159 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Toolbox.h"
+#include "../OrthancException.h"
+
+namespace Orthanc
+{
+  /**
+   * Result of the resolution of an URI by "RestApiRouter". This
+   * object only references the URI and the names of the wildcards
+   * stored in the router, so that it can be filled without any
+   * dynamic allocation.
+   **/
+  class RestApiRouteMatch
+  {
+  public:
+    // Maximum number of wildcards in one route, which is checked when
+    // the route is registered. The routes of the Orthanc REST API
+    // have at most 3 wildcards: The others are left for the plugins.
+    static const size_t MAX_WILDCARDS = 8;
+
+  private:
+    const UriComponents&  uri_;
+    size_t                wildcardsCount_;
+    const std::string*    wildcardNames_[MAX_WILDCARDS];
+    size_t                wildcardLevels_[MAX_WILDCARDS];
+    size_t                trailingStart_;
+
+  public:
+    explicit RestApiRouteMatch(const UriComponents& uri) :
+      uri_(uri),
+      wildcardsCount_(0),
+      trailingStart_(uri.size())
+    {
+    }
+
+    const UriComponents& GetUri() const
+    {
+      return uri_;
+    }
+
+    void PushWildcard(const std::string& name,
+                      size_t level)
+    {
+      if (wildcardsCount_ == MAX_WILDCARDS ||
+          level >= uri_.size())
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      wildcardNames_[wildcardsCount_] = &name;
+      wildcardLevels_[wildcardsCount_] = level;
+      wildcardsCount_++;
+    }
+
+    void PopWildcard()
+    {
+      if (wildcardsCount_ == 0)
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      wildcardsCount_--;
+    }
+
+    void SetTrailingStart(size_t level)
+    {
+      if (level > uri_.size())
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      trailingStart_ = level;
+    }
+
+    bool HasTrailing() const
+    {
+      return trailingStart_ < uri_.size();
+    }
+
+    size_t GetWildcardsCount() const
+    {
+      return wildcardsCount_;
+    }
+
+    const std::string& GetWildcardName(size_t index) const
+    {
+      if (index >= wildcardsCount_)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      return *wildcardNames_[index];
+    }
+
+    const std::string& GetWildcardValue(size_t index) const
+    {
+      if (index >= wildcardsCount_)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      return uri_[wildcardLevels_[index]];
+    }
+
+    std::string GetUriComponent(const std::string& name,
+                                const std::string& defaultValue) const
+    {
+      // Linear lookup, as there are only a few wildcards per route
+      for (size_t i = 0; i < wildcardsCount_; i++)
+      {
+        if (*wildcardNames_[i] == name)
+        {
+          return uri_[wildcardLevels_[i]];
+        }
+      }
+
+      return defaultValue;
+    }
+
+    void GetTrailing(UriComponents& target) const
+    {
+      target.assign(uri_.begin() + trailingStart_, uri_.end());
+    }
+  };
+}
@@ -0,0 +1,251 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "RestApiRouter.h"
+
+#include "../OrthancException.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace Orthanc
+{
+  namespace
+  {
+    // Anonymous namespace to avoid clashes between compilation modules
+    struct ChildComparator
+    {
+      bool operator() (const std::pair<std::string, size_t>& a,
+                       const std::string& b) const
+      {
+        return a.first < b;
+      }
+    };
+  }
+
+
+  static const RestApiHierarchy::Resource* GetResource(const RestApiHierarchy::Resource& resource)
+  {
+    return resource.IsEmpty() ? NULL : &resource;
+  }
+
+
+  size_t RestApiRouter::CompileNode(const RestApiHierarchy& hierarchy,
+                                    size_t wildcardsDepth)
+  {
+    if (wildcardsDepth > RestApiRouteMatch::MAX_WILDCARDS)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    const size_t index = nodes_.size();
+    nodes_.push_back(Node());
+    nodes_[index].handlers_ = GetResource(hierarchy.handlers_);
+    nodes_[index].universalHandlers_ = GetResource(hierarchy.universalHandlers_);
+
+    // Both "std::map" are sorted by name, which gives the sorted
+    // children, and preserves the order in which the wildcards are tried
+    Children children, wildcards;
+    children.reserve(hierarchy.children_.size());
+    wildcards.reserve(hierarchy.wildcardChildren_.size());
+
+    for (RestApiHierarchy::Children::const_iterator it = hierarchy.children_.begin();
+         it != hierarchy.children_.end(); ++it)
+    {
+      children.push_back(std::make_pair(it->first, CompileNode(*it->second, wildcardsDepth)));
+    }
+
+    for (RestApiHierarchy::Children::const_iterator it = hierarchy.wildcardChildren_.begin();
+         it != hierarchy.wildcardChildren_.end(); ++it)
+    {
+      wildcards.push_back(std::make_pair(it->first, CompileNode(*it->second, wildcardsDepth + 1)));
+    }
+
+    // "nodes_" may have been reallocated by the recursive calls
+    nodes_[index].children_.swap(children);
+    nodes_[index].wildcards_.swap(wildcards);
+
+    return index;
+  }
+
+
+  void RestApiRouter::Compile(const RestApiHierarchy& hierarchy)
+  {
+    nodes_.clear();
+    CompileNode(hierarchy, 0);
+  }
+
+
+  bool RestApiRouter::LookupInternal(const RestApiHierarchy::Resource*& resource,
+                                     RestApiRouteMatch& match,
+                                     HttpMethod method,
+                                     size_t node,
+                                     size_t level) const
+  {
+    assert(node < nodes_.size());
+    const Node& current = nodes_[node];
+    const UriComponents& uri = match.GetUri();
+
+    // Look for an exact match on the resource of interest
+    if (level == uri.size())
+    {
+      if (current.handlers_ != NULL &&
+          current.handlers_->HasHandler(method))
+      {
+        resource = current.handlers_;
+        match.SetTrailingStart(level);
+        return true;
+      }
+    }
+    else
+    {
+      // Go down in the hierarchy, using an exact match for the child
+      Children::const_iterator child = std::lower_bound(current.children_.begin(),
+                                                        current.children_.end(),
+                                                        uri[level], ChildComparator());
+      if (child != current.children_.end() &&
+          child->first == uri[level] &&
+          LookupInternal(resource, match, method, child->second, level + 1))
+      {
+        return true;
+      }
+
+      // Go down in the hierarchy, using the wildcard rules for children
+      for (child = current.wildcards_.begin(); child != current.wildcards_.end(); ++child)
+      {
+        match.PushWildcard(child->first, level);
+
+        if (LookupInternal(resource, match, method, child->second, level + 1))
+        {
+          return true;
+        }
+
+        match.PopWildcard();
+      }
+    }
+
+    // As a last resort, use the universal handlers, if any
+    if (current.universalHandlers_ != NULL &&
+        current.universalHandlers_->HasHandler(method))
+    {
+      resource = current.universalHandlers_;
+      match.SetTrailingStart(level);
+      return true;
+    }
+
+    return false;
+  }
+
+
+  bool RestApiRouter::Lookup(const RestApiHierarchy::Resource*& resource,
+                             RestApiRouteMatch& match,
+                             HttpMethod method) const
+  {
+    resource = NULL;
+    return (!nodes_.empty() &&
+            LookupInternal(resource, match, method, 0, 0));
+  }
+
+
+  static void AddMethods(std::set<HttpMethod>& methods,
+                         const RestApiHierarchy::Resource* resource)
+  {
+    if (resource != NULL)
+    {
+      if (resource->HasHandler(HttpMethod_Get))
+      {
+        methods.insert(HttpMethod_Get);
+      }
+
+      if (resource->HasHandler(HttpMethod_Post))
+      {
+        methods.insert(HttpMethod_Post);
+      }
+
+      if (resource->HasHandler(HttpMethod_Put))
+      {
+        methods.insert(HttpMethod_Put);
+      }
+
+      if (resource->HasHandler(HttpMethod_Delete))
+      {
+        methods.insert(HttpMethod_Delete);
+      }
+    }
+  }
+
+
+  void RestApiRouter::GetAcceptedMethodsInternal(std::set<HttpMethod>& methods,
+                                                 const UriComponents& uri,
+                                                 size_t node,
+                                                 size_t level) const
+  {
+    assert(node < nodes_.size());
+    const Node& current = nodes_[node];
+
+    if (level == uri.size())
+    {
+      // Universal handlers are ignored, except if there is no trailing
+      // part (same behavior as "RestApiHierarchy::GetAcceptedMethods()")
+      AddMethods(methods, current.handlers_);
+      AddMethods(methods, current.universalHandlers_);
+    }
+    else
+    {
+      Children::const_iterator child = std::lower_bound(current.children_.begin(),
+                                                        current.children_.end(),
+                                                        uri[level], ChildComparator());
+      if (child != current.children_.end() &&
+          child->first == uri[level])
+      {
+        GetAcceptedMethodsInternal(methods, uri, child->second, level + 1);
+      }
+
+      for (child = current.wildcards_.begin(); child != current.wildcards_.end(); ++child)
+      {
+        GetAcceptedMethodsInternal(methods, uri, child->second, level + 1);
+      }
+    }
+  }
+
+
+  void RestApiRouter::GetAcceptedMethods(std::set<HttpMethod>& methods,
+                                         const UriComponents& uri) const
+  {
+    if (!nodes_.empty())
+    {
+      GetAcceptedMethodsInternal(methods, uri, 0, 0);
+    }
+  }
+}
@@ -0,0 +1,101 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "RestApiHierarchy.h"
+#include "RestApiRouteMatch.h"
+
+namespace Orthanc
+{
+  /**
+   * Flat, read-only version of a "RestApiHierarchy", built once all
+   * the routes are registered. The nodes are stored contiguously, and
+   * the children of each node are sorted so that they can be looked
+   * up by dichotomy. Resolving an URI does not allocate memory.
+   **/
+  class RestApiRouter : public boost::noncopyable
+  {
+  private:
+    typedef std::pair<std::string, size_t>  Child;
+    typedef std::vector<Child>              Children;
+
+    struct Node
+    {
+      Children                          children_;   // Sorted by name
+      Children                          wildcards_;  // Sorted by name
+      const RestApiHierarchy::Resource* handlers_;
+      const RestApiHierarchy::Resource* universalHandlers_;
+    };
+
+    std::vector<Node>  nodes_;
+
+    size_t CompileNode(const RestApiHierarchy& hierarchy,
+                       size_t wildcardsDepth);
+
+    bool LookupInternal(const RestApiHierarchy::Resource*& resource,
+                        RestApiRouteMatch& match,
+                        HttpMethod method,
+                        size_t node,
+                        size_t level) const;
+
+    void GetAcceptedMethodsInternal(std::set<HttpMethod>& methods,
+                                    const UriComponents& uri,
+                                    size_t node,
+                                    size_t level) const;
+
+  public:
+    void Compile(const RestApiHierarchy& hierarchy);
+
+    bool IsCompiled() const
+    {
+      return !nodes_.empty();
+    }
+
+    size_t GetNodesCount() const
+    {
+      return nodes_.size();
+    }
+
+    // Follows the same precedence rules as
+    // "RestApiHierarchy::LookupResource()": exact match, then exact
+    // children, then wildcard children, then universal handlers. Only
+    // the resources having a handler for "method" are considered.
+    bool Lookup(const RestApiHierarchy::Resource*& resource,
+                RestApiRouteMatch& match,
+                HttpMethod method) const;
+
+    void GetAcceptedMethods(std::set<HttpMethod>& methods,
+                            const UriComponents& uri) const;
+  };
+}
@@ -0,0 +1,230 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "BulkContentReader.h"
+
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace Orthanc
+{
+  std::string BulkContentReader::Item::GetLocation() const
+  {
+    if (isFrame_)
+    {
+      return ("/instances/" + instanceId_ + "/frames/" + 
+              boost::lexical_cast<std::string>(frame_) + "/raw");
+    }
+    else
+    {
+      return "/instances/" + instanceId_ + "/file";
+    }
+  }
+
+
+  bool BulkContentReader::Enqueue(Item* item)
+  {
+    std::auto_ptr<Item> protection(item);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (!cancelled_ &&
+           pending_.size() >= maxPending_)
+    {
+      roomAvailable_.wait(lock);
+    }
+
+    if (cancelled_)
+    {
+      return false;
+    }
+
+    pending_.push_back(protection.release());
+    itemAvailable_.notify_one();
+
+    return true;
+  }
+
+
+  void BulkContentReader::ReadInstance(const std::string& instanceId)
+  {
+    if (frames_)
+    {
+      std::string dicom;
+      context_.ReadDicom(dicom, instanceId);
+
+      // Parse the file locally instead of going through the cache
+      // of the server context, so as not to evict the instances
+      // that are being used by the other clients
+      ParsedDicomFile parsed(dicom);
+      dicom.clear();
+
+      const unsigned int count = parsed.GetFramesCount();
+      for (unsigned int frame = 0; frame < count; frame++)
+      {
+        std::auto_ptr<Item> item(new Item(instanceId, frame));
+        parsed.GetRawFrame(item->GetContent(), item->GetContentType(), frame);
+
+        if (!Enqueue(item.release()))
+        {
+          return;
+        }
+      }
+    }
+    else
+    {
+      std::auto_ptr<Item> item(new Item(instanceId));
+      context_.ReadDicom(item->GetContent(), instanceId);
+      Enqueue(item.release());
+    }
+  }
+
+
+  void BulkContentReader::Worker(BulkContentReader* that)
+  {
+    bool success = true;
+
+    try
+    {
+      for (std::list<std::string>::const_iterator 
+             it = that->instances_.begin(); it != that->instances_.end(); ++it)
+      {
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          if (that->cancelled_)
+          {
+            break;
+          }
+        }
+
+        that->ReadInstance(*it);
+      }
+    }
+    catch (OrthancException& e)
+    {
+      LOG(ERROR) << "Error while reading instances in bulk: " << e.What();
+      success = false;
+    }
+    catch (std::bad_alloc&)
+    {
+      LOG(ERROR) << "Not enough memory while reading instances in bulk";
+      success = false;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Native exception while reading instances in bulk";
+      success = false;
+    }
+
+    boost::mutex::scoped_lock lock(that->mutex_);
+    that->done_ = true;
+    that->success_ = success;
+    that->itemAvailable_.notify_one();
+  }
+
+
+  BulkContentReader::BulkContentReader(ServerContext& context,
+                                       const std::list<std::string>& instances,
+                                       bool frames,
+                                       size_t maxPending) :
+    context_(context),
+    instances_(instances),
+    frames_(frames),
+    maxPending_(maxPending),
+    done_(false),
+    cancelled_(false),
+    success_(false)
+  {
+    if (maxPending_ == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    thread_ = boost::thread(Worker, this);
+  }
+
+
+  BulkContentReader::~BulkContentReader()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      cancelled_ = true;
+      roomAvailable_.notify_one();
+    }
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+
+    for (std::list<Item*>::iterator it = pending_.begin(); it != pending_.end(); ++it)
+    {
+      delete *it;
+    }
+  }
+
+
+  BulkContentReader::Item* BulkContentReader::Next()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (pending_.empty() &&
+           !done_)
+    {
+      itemAvailable_.wait(lock);
+    }
+
+    if (pending_.empty())
+    {
+      return NULL;
+    }
+
+    Item* item = pending_.front();
+    pending_.pop_front();
+    roomAvailable_.notify_one();
+
+    return item;
+  }
+
+
+  bool BulkContentReader::IsSuccess()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return success_;
+  }
+}
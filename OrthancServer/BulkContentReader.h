@@ -0,0 +1,154 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "ServerContext.h"
+
+#include <list>
+#include <string>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Reads the DICOM files (or the raw frames) of a list of instances
+   * in a background thread, ahead of the consumer that sends them to
+   * the network. At most "maxPending" items are kept in memory.
+   **/
+  class BulkContentReader : public boost::noncopyable
+  {
+  public:
+    class Item : public boost::noncopyable
+    {
+    private:
+      std::string   instanceId_;
+      bool          isFrame_;
+      unsigned int  frame_;
+      std::string   contentType_;
+      std::string   content_;
+
+    public:
+      explicit Item(const std::string& instanceId) :
+        instanceId_(instanceId),
+        isFrame_(false),
+        frame_(0),
+        contentType_("application/dicom")
+      {
+      }
+
+      Item(const std::string& instanceId,
+           unsigned int frame) :
+        instanceId_(instanceId),
+        isFrame_(true),
+        frame_(frame)
+      {
+      }
+
+      const std::string& GetInstanceId() const
+      {
+        return instanceId_;
+      }
+
+      bool IsFrame() const
+      {
+        return isFrame_;
+      }
+
+      unsigned int GetFrame() const
+      {
+        return frame_;
+      }
+
+      // URI of the REST API from which this item can be retrieved
+      std::string GetLocation() const;
+
+      std::string& GetContentType()
+      {
+        return contentType_;
+      }
+
+      const std::string& GetContentType() const
+      {
+        return contentType_;
+      }
+
+      std::string& GetContent()
+      {
+        return content_;
+      }
+
+      const std::string& GetContent() const
+      {
+        return content_;
+      }
+    };
+
+  private:
+    ServerContext&             context_;
+    std::list<std::string>     instances_;
+    bool                       frames_;
+    size_t                     maxPending_;
+
+    boost::mutex               mutex_;
+    boost::condition_variable  itemAvailable_;
+    boost::condition_variable  roomAvailable_;
+    std::list<Item*>           pending_;
+    bool                       done_;
+    bool                       cancelled_;
+    bool                       success_;
+    boost::thread              thread_;
+
+    bool Enqueue(Item* item);
+
+    void ReadInstance(const std::string& instanceId);
+
+    static void Worker(BulkContentReader* that);
+
+  public:
+    BulkContentReader(ServerContext& context,
+                      const std::list<std::string>& instances,
+                      bool frames,
+                      size_t maxPending);
+
+    ~BulkContentReader();
+
+    // Returns NULL once all the items have been read. The caller
+    // takes the ownership of the returned item.
+    Item* Next();
+
+    // Only meaningful once "Next()" has returned NULL
+    bool IsSuccess();
+  };
+}
@@ -0,0 +1,173 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "CineStreamer.h"
+
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+
+
+namespace Orthanc
+{
+  void CineStreamer::Worker(CineStreamer* that)
+  {
+    for (unsigned int frame = 0; frame < that->framesCount_; frame++)
+    {
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->cancelled_ &&
+               that->pending_.size() >= that->maxPending_)
+        {
+          that->consumed_.wait(lock);
+        }
+
+        if (that->cancelled_)
+        {
+          return;
+        }
+      }
+
+      std::string encoded;
+      bool success = true;
+
+      try
+      {
+        that->encoder_.Encode(encoded, frame);
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot encode frame " << frame << " of a cine loop: " << e.What();
+        success = false;
+      }
+      catch (std::bad_alloc&)
+      {
+        LOG(ERROR) << "Not enough memory to encode a cine loop";
+        success = false;
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Native exception while encoding frame " << frame << " of a cine loop";
+        success = false;
+      }
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      if (success)
+      {
+        that->pending_.push_back(std::string());
+        that->pending_.back().swap(encoded);
+      }
+      else
+      {
+        that->success_ = false;
+        that->done_ = true;
+        that->encoded_.notify_all();
+        return;
+      }
+
+      that->encoded_.notify_all();
+    }
+
+    boost::mutex::scoped_lock lock(that->mutex_);
+    that->done_ = true;
+    that->encoded_.notify_all();
+  }
+
+
+  CineStreamer::CineStreamer(IFrameEncoder& encoder,
+                             unsigned int framesCount,
+                             size_t maxPending) :
+    encoder_(encoder),
+    framesCount_(framesCount),
+    maxPending_(maxPending),
+    done_(false),
+    cancelled_(false),
+    success_(true)
+  {
+    if (maxPending == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    worker_.reset(new boost::thread(Worker, this));
+  }
+
+
+  CineStreamer::~CineStreamer()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      cancelled_ = true;
+      consumed_.notify_all();
+    }
+
+    if (worker_->joinable())
+    {
+      worker_->join();
+    }
+  }
+
+
+  bool CineStreamer::Next(std::string& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (pending_.empty() &&
+           !done_)
+    {
+      encoded_.wait(lock);
+    }
+
+    if (pending_.empty())
+    {
+      // All the frames have been read, or the worker has stopped
+      // because of an error
+      return false;
+    }
+
+    target.swap(pending_.front());
+    pending_.pop_front();
+    consumed_.notify_all();
+
+    return true;
+  }
+
+
+  bool CineStreamer::IsSuccess()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return success_;
+  }
+}
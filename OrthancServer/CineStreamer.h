@@ -0,0 +1,96 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Encodes the successive frames of a cine loop in a background
+   * thread, so that the decoding and the rendering of the next frames
+   * overlap with the sending of the current frame to the network. At
+   * most "maxPending" encoded frames are kept ahead of the consumer.
+   **/
+  class CineStreamer : public boost::noncopyable
+  {
+  public:
+    class IFrameEncoder : public boost::noncopyable
+    {
+    public:
+      virtual ~IFrameEncoder()
+      {
+      }
+
+      // Invoked from the worker thread, in the order of the frames
+      virtual void Encode(std::string& target,
+                          unsigned int frame) = 0;
+    };
+
+  private:
+    IFrameEncoder&            encoder_;
+    unsigned int              framesCount_;
+    size_t                    maxPending_;
+
+    boost::mutex              mutex_;
+    boost::condition_variable encoded_;
+    boost::condition_variable consumed_;
+    std::list<std::string>    pending_;
+    bool                      done_;
+    bool                      cancelled_;
+    bool                      success_;
+    std::auto_ptr<boost::thread>  worker_;
+
+    static void Worker(CineStreamer* that);
+
+  public:
+    CineStreamer(IFrameEncoder& encoder,
+                 unsigned int framesCount,
+                 size_t maxPending);
+
+    ~CineStreamer();
+
+    // Returns "false" once all the frames have been read. If some
+    // frame cannot be encoded, the stream stops after the frames that
+    // precede it.
+    bool Next(std::string& target);
+
+    // Only meaningful once "Next()" has returned "false"
+    bool IsSuccess();
+  };
+}
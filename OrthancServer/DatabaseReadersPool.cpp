@@ -0,0 +1,102 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "DatabaseReadersPool.h"
+
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+
+namespace Orthanc
+{
+  IDatabaseWrapper& DatabaseReadersPool::Acquire()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (readers_.empty())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    while (free_.empty())
+    {
+      available_.wait(lock);
+    }
+
+    IDatabaseWrapper* reader = free_.back();
+    free_.pop_back();
+
+    return *reader;
+  }
+
+
+  void DatabaseReadersPool::Release(IDatabaseWrapper& reader)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      free_.push_back(&reader);
+    }
+
+    available_.notify_one();
+  }
+
+
+  DatabaseReadersPool::~DatabaseReadersPool()
+  {
+    if (free_.size() != readers_.size())
+    {
+      LOG(ERROR) << "Some database readers are still in use";
+    }
+
+    for (size_t i = 0; i < readers_.size(); i++)
+    {
+      assert(readers_[i] != NULL);
+      readers_[i]->Close();
+      delete readers_[i];
+    }
+  }
+
+
+  void DatabaseReadersPool::Add(IDatabaseWrapper* reader)
+  {
+    if (reader == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    readers_.push_back(reader);
+    free_.push_back(reader);
+  }
+}
@@ -0,0 +1,97 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "IDatabaseWrapper.h"
+
+#include <boost/thread.hpp>
+#include <vector>
+
+namespace Orthanc
+{
+  /**
+   * Pool of read-only connections to the database. Each connection
+   * is used by at most one thread at any time, which allows
+   * read-only requests to be served in parallel with the writer
+   * connection that is owned by ServerIndex.
+   **/
+  class DatabaseReadersPool : public boost::noncopyable
+  {
+  private:
+    boost::mutex                    mutex_;
+    boost::condition_variable       available_;
+    std::vector<IDatabaseWrapper*>  readers_;
+    std::vector<IDatabaseWrapper*>  free_;
+
+    IDatabaseWrapper& Acquire();
+
+    void Release(IDatabaseWrapper& reader);
+
+  public:
+    ~DatabaseReadersPool();
+
+    // Takes the ownership of the reader, that must be opened
+    void Add(IDatabaseWrapper* reader);
+
+    size_t GetSize() const
+    {
+      return readers_.size();
+    }
+
+    class Accessor : public boost::noncopyable
+    {
+    private:
+      DatabaseReadersPool&  that_;
+      IDatabaseWrapper&     reader_;
+
+    public:
+      explicit Accessor(DatabaseReadersPool& that) :
+        that_(that),
+        reader_(that.Acquire())
+      {
+      }
+
+      ~Accessor()
+      {
+        that_.Release(reader_);
+      }
+
+      IDatabaseWrapper& GetDatabase()
+      {
+        return reader_;
+      }
+    };
+  };
+}
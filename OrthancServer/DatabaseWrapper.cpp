@@ -38,6 +38,8 @@
 #include "../Core/Logging.h"
 #include "EmbeddedResources.h"
 #include "ServerToolbox.h"
+#include "ResourcesContent.h"
+#include "Search/LookupIdentifierQuery.h"
 
 #include <stdio.h>
 #include <boost/lexical_cast.hpp>
@@ -260,7 +262,9 @@ namespace Orthanc
     listener_(NULL), 
     base_(db_),
     signalRemainingAncestor_(NULL),
-    version_(0)
+    version_(0),
+    exclusiveLocking_(true),
+    readOnly_(false)
   {
     db_.Open(path);
   }
@@ -269,24 +273,68 @@ namespace Orthanc
     listener_(NULL), 
     base_(db_),
     signalRemainingAncestor_(NULL),
-    version_(0)
+    version_(0),
+    exclusiveLocking_(true),
+    readOnly_(false)
   {
     db_.OpenInMemory();
   }
 
+  void DatabaseWrapper::SetExclusiveLocking(bool exclusive)
+  {
+    if (signalRemainingAncestor_ != NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);  // Already opened
+    }
+
+    exclusiveLocking_ = exclusive;
+  }
+
+
+  void DatabaseWrapper::SetReadOnly(bool readOnly)
+  {
+    if (signalRemainingAncestor_ != NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);  // Already opened
+    }
+
+    readOnly_ = readOnly;
+  }
+
+
   void DatabaseWrapper::Open()
   {
-    db_.Execute("PRAGMA ENCODING=\"UTF-8\";");
+    if (readOnly_)
+    {
+      // The database is shared with the writer connection, that has
+      // already created it and set its journal mode to WAL
+      db_.Execute("PRAGMA QUERY_ONLY=1;");
+      db_.Execute("PRAGMA BUSY_TIMEOUT=10000;");
+    }
+    else
+    {
+      db_.Execute("PRAGMA ENCODING=\"UTF-8\";");
 
-    // Performance tuning of SQLite with PRAGMAs
-    // http://www.sqlite.org/pragma.html
-    db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
-    db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
-    db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
-    db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
-    //db_.Execute("PRAGMA TEMP_STORE=memory");
+      // Performance tuning of SQLite with PRAGMAs
+      // http://www.sqlite.org/pragma.html
+      db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
+      db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
 
-    if (!db_.DoesTableExist("GlobalProperties"))
+      if (exclusiveLocking_)
+      {
+        db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+      }
+      else
+      {
+        db_.Execute("PRAGMA BUSY_TIMEOUT=10000;");
+      }
+
+      db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
+      //db_.Execute("PRAGMA TEMP_STORE=memory");
+    }
+
+    if (!readOnly_ &&
+        !db_.DoesTableExist("GlobalProperties"))
     {
       LOG(INFO) << "Creating the database";
       std::string query;
@@ -399,6 +447,49 @@ namespace Orthanc
   }
 
 
+  unsigned int DatabaseWrapper::PruneTable(const std::string& tableName,
+                                           int64_t maxSeq,
+                                           const std::string& olderThan,
+                                           unsigned int maxCount)
+  {
+    // The sequence numbers and the dates both grow over time: Walk
+    // through the oldest entries using the primary key, and stop at
+    // the first entry that must be kept. This avoids a scan of the
+    // entire table.
+    int64_t lastSeq = -1;
+    unsigned int count = 0;
+
+    {
+      SQLite::Statement s(db_, "SELECT seq, date FROM " + tableName + " ORDER BY seq LIMIT ?");
+      s.BindInt(0, maxCount);
+
+      while (s.Step())
+      {
+        int64_t seq = s.ColumnInt64(0);
+        if (seq <= maxSeq ||
+            (!olderThan.empty() && s.ColumnString(1) < olderThan))
+        {
+          lastSeq = seq;
+          count++;
+        }
+        else
+        {
+          break;
+        }
+      }
+    }
+
+    if (count > 0)
+    {
+      SQLite::Statement s(db_, "DELETE FROM " + tableName + " WHERE seq<=?");
+      s.BindInt64(0, lastSeq);
+      s.Run();
+    }
+
+    return count;
+  }
+
+
   bool DatabaseWrapper::LookupParent(int64_t& parentId,
                                      int64_t resourceId)
   {
@@ -487,4 +578,30 @@ namespace Orthanc
     }
   }
 
+
+  bool DatabaseWrapper::CreateInstance(CreateInstanceResult& result,
+                                       int64_t& instanceId,
+                                       const std::string& patient,
+                                       const std::string& study,
+                                       const std::string& series,
+                                       const std::string& instance)
+  {
+    // SQLite runs in-process, so there is no round-trip to save:
+    // Simply chain the low-level primitives
+    return ServerToolbox::CreateInstance(result, instanceId, *this,
+                                         patient, study, series, instance);
+  }
+
+
+  void DatabaseWrapper::SetResourcesContent(const ResourcesContent& content)
+  {
+    content.Store(*this);
+  }
+
+
+  void DatabaseWrapper::LookupIdentifiers(std::list<int64_t>& result,
+                                          const LookupIdentifierQuery& query)
+  {
+    query.ApplyWithPrimitives(result, *this);
+  }
 }
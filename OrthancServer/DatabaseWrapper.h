@@ -59,14 +59,30 @@ namespace Orthanc
     DatabaseWrapperBase base_;
     Internals::SignalRemainingAncestor* signalRemainingAncestor_;
     unsigned int version_;
+    bool exclusiveLocking_;
+    bool readOnly_;
 
     void ClearTable(const std::string& tableName);
 
+    unsigned int PruneTable(const std::string& tableName,
+                            int64_t maxSeq,
+                            const std::string& olderThan,
+                            unsigned int maxCount);
+
   public:
     DatabaseWrapper(const std::string& path);
 
     DatabaseWrapper();
 
+    // Must be called before "Open()". If set to "false", the SQLite
+    // file is opened in shared locking mode, so that additional
+    // read-only connections can be opened onto the same file.
+    void SetExclusiveLocking(bool exclusive);
+
+    // Must be called before "Open()". A read-only connection neither
+    // creates nor upgrades the database schema, and rejects writes.
+    void SetReadOnly(bool readOnly);
+
     virtual void Open();
 
     virtual void Close()
@@ -307,6 +323,25 @@ namespace Orthanc
       return true;
     }
 
+    virtual bool HasHistoryPruning() const
+    {
+      return true;
+    }
+
+    virtual unsigned int PruneChanges(int64_t maxSeq,
+                                      const std::string& olderThan,
+                                      unsigned int maxCount)
+    {
+      return PruneTable("Changes", maxSeq, olderThan, maxCount);
+    }
+
+    virtual unsigned int PruneExportedResources(int64_t maxSeq,
+                                                const std::string& olderThan,
+                                                unsigned int maxCount)
+    {
+      return PruneTable("ExportedResources", maxSeq, olderThan, maxCount);
+    }
+
     virtual void ClearChanges()
     {
       ClearTable("Changes");
@@ -342,6 +377,18 @@ namespace Orthanc
     virtual void Upgrade(unsigned int targetVersion,
                          IStorageArea& storageArea);
 
+    virtual bool CreateInstance(CreateInstanceResult& result,
+                                int64_t& instanceId,
+                                const std::string& patient,
+                                const std::string& study,
+                                const std::string& series,
+                                const std::string& instance);
+
+    virtual void SetResourcesContent(const ResourcesContent& content);
+
+    virtual void LookupIdentifiers(std::list<int64_t>& result,
+                                   const LookupIdentifierQuery& query);
+
 
 
     /**
@@ -0,0 +1,276 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "DecodedFramesCache.h"
+
+#include "../Core/OrthancException.h"
+
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+
+namespace Orthanc
+{
+  static std::string GetIndexKey(const std::string& instanceId,
+                                 unsigned int frameIndex)
+  {
+    return instanceId + "|" + boost::lexical_cast<std::string>(frameIndex);
+  }
+
+
+  DecodedFramesCache::Frame::Frame(ImageAccessor* image,
+                                   unsigned int bitsStored,
+                                   bool isMonochrome1,
+                                   float rescaleSlope,
+                                   float rescaleIntercept) :
+    image_(image),
+    bitsStored_(bitsStored),
+    isMonochrome1_(isMonochrome1),
+    rescaleSlope_(rescaleSlope),
+    rescaleIntercept_(rescaleIntercept)
+  {
+    if (image == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+  }
+
+
+  size_t DecodedFramesCache::Frame::GetMemorySize() const
+  {
+    return sizeof(Frame) + image_->GetPitch() * image_->GetHeight();
+  }
+
+
+  void DecodedFramesCache::RemoveInternal(const std::string& key)
+  {
+    // WARNING: "mutex_" must be locked
+    std::auto_ptr<Item> item(index_.Invalidate(key));
+
+    assert(currentSize_ >= item->size_);
+    currentSize_ -= item->size_;
+
+    Instances::iterator instance = instances_.find(item->instanceId_);
+    assert(instance != instances_.end());
+
+    instance->second.erase(key);
+    if (instance->second.empty())
+    {
+      instances_.erase(instance);
+    }
+  }
+
+
+  void DecodedFramesCache::ClearInternal()
+  {
+    // WARNING: "mutex_" must be locked
+    generation_++;
+
+    while (!index_.IsEmpty())
+    {
+      Item* item = NULL;
+      index_.RemoveOldest(item);
+      delete item;
+    }
+
+    instances_.clear();
+    currentSize_ = 0;
+  }
+
+
+  DecodedFramesCache::DecodedFramesCache() :
+    maximumSize_(0),
+    currentSize_(0),
+    generation_(0),
+    countHits_(0),
+    countMisses_(0)
+  {
+  }
+
+
+  DecodedFramesCache::~DecodedFramesCache()
+  {
+    ClearInternal();
+  }
+
+
+  void DecodedFramesCache::SetMaximumSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    maximumSize_ = size;
+
+    while (currentSize_ > maximumSize_)
+    {
+      RemoveInternal(index_.GetOldest());
+    }
+  }
+
+
+  bool DecodedFramesCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maximumSize_ > 0;
+  }
+
+
+  bool DecodedFramesCache::Lookup(FramePointer& frame,
+                                  const std::string& instanceId,
+                                  unsigned int frameIndex)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const std::string key = GetIndexKey(instanceId, frameIndex);
+
+    Item* item = NULL;
+    if (index_.Contains(key, item))
+    {
+      assert(item != NULL);
+      index_.MakeMostRecent(key);
+      frame = item->frame_;
+      countHits_++;
+      return true;
+    }
+    else
+    {
+      countMisses_++;
+      return false;
+    }
+  }
+
+
+  uint64_t DecodedFramesCache::GetGeneration()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return generation_;
+  }
+
+
+  void DecodedFramesCache::Store(uint64_t generation,
+                                 const std::string& instanceId,
+                                 unsigned int frameIndex,
+                                 const FramePointer& frame)
+  {
+    if (frame.get() == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (generation != generation_)
+    {
+      return;  // Some instance was invalidated during the decoding
+    }
+
+    const std::string key = GetIndexKey(instanceId, frameIndex);
+
+    const size_t size = key.size() + frame->GetMemorySize();
+    if (size > maximumSize_)
+    {
+      return;  // Too large to fit in the cache
+    }
+
+    if (index_.Contains(key))
+    {
+      // Concurrent decoding of the same frame
+      RemoveInternal(key);
+    }
+
+    while (currentSize_ + size > maximumSize_)
+    {
+      RemoveInternal(index_.GetOldest());
+    }
+
+    std::auto_ptr<Item> item(new Item);
+    item->instanceId_ = instanceId;
+    item->frame_ = frame;
+    item->size_ = size;
+
+    index_.Add(key, item.release());
+    instances_[instanceId].insert(key);
+    currentSize_ += size;
+  }
+
+
+  void DecodedFramesCache::Invalidate(const std::string& instanceId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    generation_++;
+
+    Instances::iterator found = instances_.find(instanceId);
+    if (found != instances_.end())
+    {
+      // Copy the keys, as "RemoveInternal()" modifies "instances_"
+      std::set<std::string> keys = found->second;
+      for (std::set<std::string>::const_iterator
+             it = keys.begin(); it != keys.end(); ++it)
+      {
+        RemoveInternal(*it);
+      }
+    }
+  }
+
+
+  void DecodedFramesCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ClearInternal();
+  }
+
+
+  void DecodedFramesCache::SignalChange(const ServerIndexChange& change)
+  {
+    // The deletion of a patient, study or series signals a change
+    // for each of its instances, which is enough to invalidate them
+    if (change.GetChangeType() == ChangeType_Deleted &&
+        change.GetResourceType() == ResourceType_Instance)
+    {
+      Invalidate(change.GetPublicId());
+    }
+  }
+
+
+  void DecodedFramesCache::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["MaximumSize"] = boost::lexical_cast<std::string>(maximumSize_);
+    target["CurrentSize"] = boost::lexical_cast<std::string>(currentSize_);
+    target["CountFrames"] = static_cast<unsigned int>(index_.GetSize());
+    target["CountHits"] = boost::lexical_cast<std::string>(countHits_);
+    target["CountMisses"] = boost::lexical_cast<std::string>(countMisses_);
+  }
+}
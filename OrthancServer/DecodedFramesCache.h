@@ -0,0 +1,170 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ServerIndexChange.h"
+#include "../Core/Cache/LeastRecentlyUsedIndex.h"
+#include "../Core/Images/ImageAccessor.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <map>
+#include <memory>
+#include <set>
+
+namespace Orthanc
+{
+  /**
+   * Cache of the decoded frames of the DICOM instances, together with
+   * the parameters that are needed to render them. This avoids the
+   * decompression of the pixel data if a viewer requests several
+   * times the same frame (e.g. while scrolling, or while changing the
+   * windowing). Contrarily to the cache of "ParsedDicomFile" in
+   * "ServerContext", this cache is limited by its size in bytes.
+   *
+   * This class is thread-safe. The cached frames are shared with the
+   * callers, and must not be modified.
+   **/
+  class DecodedFramesCache : public boost::noncopyable
+  {
+  public:
+    class Frame : public boost::noncopyable
+    {
+    private:
+      std::auto_ptr<ImageAccessor>  image_;
+      unsigned int                  bitsStored_;
+      bool                          isMonochrome1_;
+      float                         rescaleSlope_;
+      float                         rescaleIntercept_;
+
+    public:
+      // Takes the ownership of "image"
+      Frame(ImageAccessor* image,
+            unsigned int bitsStored,
+            bool isMonochrome1,
+            float rescaleSlope,
+            float rescaleIntercept);
+
+      const ImageAccessor& GetImage() const
+      {
+        return *image_;
+      }
+
+      // "0" if unknown
+      unsigned int GetBitsStored() const
+      {
+        return bitsStored_;
+      }
+
+      bool IsMonochrome1() const
+      {
+        return isMonochrome1_;
+      }
+
+      float GetRescaleSlope() const
+      {
+        return rescaleSlope_;
+      }
+
+      float GetRescaleIntercept() const
+      {
+        return rescaleIntercept_;
+      }
+
+      size_t GetMemorySize() const;
+    };
+
+    typedef boost::shared_ptr<const Frame>  FramePointer;
+
+  private:
+    struct Item
+    {
+      std::string   instanceId_;
+      FramePointer  frame_;
+      size_t        size_;
+    };
+
+    typedef LeastRecentlyUsedIndex<std::string, Item*>      Index;
+    typedef std::map<std::string, std::set<std::string> >  Instances;
+
+    boost::mutex   mutex_;
+    size_t         maximumSize_;
+    size_t         currentSize_;
+    Index          index_;
+    Instances      instances_;
+
+    // Incremented at each invalidation, to prevent a frame that was
+    // decoded concurrently with a change from being stored
+    uint64_t       generation_;
+
+    uint64_t       countHits_;
+    uint64_t       countMisses_;
+
+    void RemoveInternal(const std::string& key);
+
+    void ClearInternal();
+
+  public:
+    DecodedFramesCache();
+
+    ~DecodedFramesCache();
+
+    // The size is in bytes, "0" means that the cache is disabled
+    void SetMaximumSize(size_t size);
+
+    bool IsEnabled();
+
+    bool Lookup(FramePointer& frame,
+                const std::string& instanceId,
+                unsigned int frameIndex);
+
+    // Must be called before decoding a frame that is to be stored in
+    // the cache. Returns the generation to be provided to "Store()".
+    uint64_t GetGeneration();
+
+    void Store(uint64_t generation,
+               const std::string& instanceId,
+               unsigned int frameIndex,
+               const FramePointer& frame);
+
+    void Invalidate(const std::string& instanceId);
+
+    void Clear();
+
+    void SignalChange(const ServerIndexChange& change);
+
+    void GetStatistics(Json::Value& target);
+  };
+}
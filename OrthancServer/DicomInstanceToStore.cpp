@@ -97,7 +97,9 @@ namespace Orthanc
 
     if (!parsed_.HasContent())
     {
-      parsed_.TakeOwnership(new ParsedDicomFile(buffer_.GetConstContent()));
+      // The pixel data is not needed to compute the summary and the
+      // JSON version: Avoid parsing it
+      parsed_.TakeOwnership(new ParsedDicomFile(buffer_.GetConstContent(), true /* lazy pixel data */));
     }
 
     // At this point, we have parsed the DICOM file
@@ -105,8 +107,7 @@ namespace Orthanc
     if (!summary_.HasContent())
     {
       summary_.Allocate();
-      FromDcmtkBridge::ExtractDicomSummary(summary_.GetContent(), 
-                                           *parsed_.GetContent().GetDcmtkObject().getDataset());
+      parsed_.GetContent().ExtractDicomSummary(summary_.GetContent());
     }
     
     if (!json_.HasContent())
@@ -114,9 +115,7 @@ namespace Orthanc
       json_.Allocate();
 
       std::set<DicomTag> ignoreTagLength;
-      FromDcmtkBridge::ExtractDicomAsJson(json_.GetContent(), 
-                                          *parsed_.GetContent().GetDcmtkObject().getDataset(),
-                                          ignoreTagLength);
+      parsed_.GetContent().DatasetToJson(json_.GetContent(), ignoreTagLength);
     }
   }
 
@@ -45,9 +45,22 @@
 
 namespace Orthanc
 {
+  class LookupIdentifierQuery;
+  class ResourcesContent;
+
   class IDatabaseWrapper : public boost::noncopyable
   {
   public:
+    struct CreateInstanceResult
+    {
+      bool     isNewPatient_;
+      bool     isNewStudy_;
+      bool     isNewSeries_;
+      int64_t  patientId_;
+      int64_t  studyId_;
+      int64_t  seriesId_;
+    };
+
     virtual ~IDatabaseWrapper()
     {
     }
@@ -81,6 +94,21 @@ namespace Orthanc
 
     virtual bool HasFlushToDisk() const = 0;
 
+    virtual bool HasHistoryPruning() const = 0;
+
+    // Removes at most "maxCount" of the oldest entries of the log of
+    // changes, whose sequence number is below or equal to "maxSeq",
+    // or whose date is before "olderThan" (if not empty). Returns the
+    // number of removed entries.
+    virtual unsigned int PruneChanges(int64_t maxSeq,
+                                      const std::string& olderThan,
+                                      unsigned int maxCount) = 0;
+
+    // Same as "PruneChanges()", for the log of exported resources
+    virtual unsigned int PruneExportedResources(int64_t maxSeq,
+                                                const std::string& olderThan,
+                                                unsigned int maxCount) = 0;
+
     virtual void GetAllMetadata(std::map<MetadataType, std::string>& target,
                                 int64_t id) = 0;
 
@@ -200,5 +228,31 @@ namespace Orthanc
 
     virtual void Upgrade(unsigned int targetVersion,
                          IStorageArea& storageArea) = 0;
+
+
+    /**
+     * The high-level primitives below group several of the low-level
+     * primitives above into one single call to the database
+     * back-end. They are introduced to reduce the number of
+     * round-trips to network-backed database plugins.
+     **/
+
+    // Creates the instance, together with its parent series, study
+    // and patient if they do not exist yet. Returns "false" iff. the
+    // instance was already stored, in which case "result" is left
+    // unchanged and "instanceId" is set to its internal ID.
+    virtual bool CreateInstance(CreateInstanceResult& result,
+                                int64_t& instanceId,
+                                const std::string& patient,
+                                const std::string& study,
+                                const std::string& series,
+                                const std::string& instance) = 0;
+
+    virtual void SetResourcesContent(const ResourcesContent& content) = 0;
+
+    // Returns the internal IDs of the resources matching all the
+    // disjunctions of the query
+    virtual void LookupIdentifiers(std::list<int64_t>& result,
+                                   const LookupIdentifierQuery& query) = 0;
   };
 }
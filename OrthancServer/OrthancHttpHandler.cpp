@@ -34,11 +34,169 @@
 #include "PrecompiledHeadersServer.h"
 #include "OrthancHttpHandler.h"
 
+#include "../Core/Logging.h"
+#include "../Core/MultiThreading/Semaphore.h"
 #include "../Core/OrthancException.h"
+#include "../Core/Toolbox.h"
+
+#include <boost/regex.hpp>
 
 
 namespace Orthanc
 {
+  class OrthancHttpHandler::ConcurrencyLimit : public boost::noncopyable
+  {
+  private:
+    std::string   pattern_;
+    boost::regex  regex_;
+    Semaphore     semaphore_;
+
+  public:
+    ConcurrencyLimit(const std::string& pattern,
+                     unsigned int maxConcurrentRequests) :
+      pattern_(pattern),
+      regex_(Toolbox::WildcardToRegularExpression(pattern)),
+      semaphore_(maxConcurrentRequests)
+    {
+    }
+
+    const std::string& GetPattern() const
+    {
+      return pattern_;
+    }
+
+    bool Match(const std::string& uri) const
+    {
+      return boost::regex_match(uri, regex_);
+    }
+
+    Semaphore& GetSemaphore()
+    {
+      return semaphore_;
+    }
+  };
+
+
+  class OrthancHttpHandler::ConcurrencySlot : public boost::noncopyable
+  {
+  private:
+    Semaphore*  semaphore_;
+
+  public:
+    ConcurrencySlot() : semaphore_(NULL)
+    {
+    }
+
+    ~ConcurrencySlot()
+    {
+      if (semaphore_ != NULL)
+      {
+        semaphore_->Release();
+      }
+    }
+
+    bool Acquire(Semaphore& semaphore,
+                 unsigned int timeout)
+    {
+      assert(semaphore_ == NULL);
+
+      if (semaphore.TryAcquire(timeout))
+      {
+        semaphore_ = &semaphore;
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+  };
+
+
+  /**
+   * Applies the concurrency limits to the requests whose body is
+   * streamed to a reader. As in "Handle()", the slot is only acquired
+   * once the body is fully received, right before answering.
+   **/
+  class OrthancHttpHandler::ThrottledReader : public IHttpHandler::IChunkedRequestReader
+  {
+  private:
+    const OrthancHttpHandler&              handler_;
+    RequestOrigin                          origin_;
+    UriComponents                          uri_;
+    std::auto_ptr<IChunkedRequestReader>   reader_;
+
+  public:
+    ThrottledReader(const OrthancHttpHandler& handler,
+                    RequestOrigin origin,
+                    const UriComponents& uri,
+                    std::auto_ptr<IChunkedRequestReader>& reader) :
+      handler_(handler),
+      origin_(origin),
+      uri_(uri),
+      reader_(reader)
+    {
+      assert(reader_.get() != NULL);
+    }
+
+    virtual void AddBodyChunk(const void* data,
+                              size_t size)
+    {
+      reader_->AddBodyChunk(data, size);
+    }
+
+    virtual void Execute(HttpOutput& output)
+    {
+      ConcurrencySlot slot;
+      handler_.AcquireConcurrencySlot(slot, origin_, uri_);
+      reader_->Execute(output);
+    }
+  };
+
+
+  OrthancHttpHandler::ConcurrencyLimit* 
+  OrthancHttpHandler::LookupConcurrencyLimit(RequestOrigin origin,
+                                             const UriComponents& uri) const
+  {
+    // Only the requests coming from the network are throttled, in
+    // order to avoid deadlocks if Lua scripts or plugins call the
+    // REST API while they are themselves handling an HTTP request
+    if (origin != RequestOrigin_RestApi ||
+        concurrencyLimits_.empty())
+    {
+      return NULL;
+    }
+
+    std::string flat = Toolbox::FlattenUri(uri);
+
+    for (ConcurrencyLimits::const_iterator it = concurrencyLimits_.begin();
+         it != concurrencyLimits_.end(); ++it)
+    {
+      if ((*it)->Match(flat))
+      {
+        return it->get();
+      }
+    }
+
+    return NULL;
+  }
+
+
+  void OrthancHttpHandler::AcquireConcurrencySlot(ConcurrencySlot& slot,
+                                                  RequestOrigin origin,
+                                                  const UriComponents& uri) const
+  {
+    ConcurrencyLimit* limit = LookupConcurrencyLimit(origin, uri);
+    if (limit != NULL &&
+        !slot.Acquire(limit->GetSemaphore(), concurrencyQueueTimeout_ * 1000))
+    {
+      LOG(WARNING) << "Too many concurrent HTTP requests matching \""
+                   << limit->GetPattern() << "\", rejecting: " << Toolbox::FlattenUri(uri);
+      throw OrthancException(ErrorCode_Timeout, HttpStatus_503_ServiceUnavailable);
+    }
+  }
+
+
   bool OrthancHttpHandler::Handle(HttpOutput& output,
                                   RequestOrigin origin,
                                   const char* remoteIp,
@@ -50,6 +208,9 @@ namespace Orthanc
                                   const char* bodyData,
                                   size_t bodySize)
   {
+    ConcurrencySlot slot;
+    AcquireConcurrencySlot(slot, origin, uri);
+
     bool found = false;
 
     for (Handlers::const_iterator it = handlers_.begin(); 
@@ -63,6 +224,36 @@ namespace Orthanc
   }
 
 
+  bool OrthancHttpHandler::CreateChunkedRequestReader(std::auto_ptr<IChunkedRequestReader>& target,
+                                                      RequestOrigin origin,
+                                                      const char* remoteIp,
+                                                      const char* username,
+                                                      HttpMethod method,
+                                                      const UriComponents& uri,
+                                                      const Arguments& headers)
+  {
+    // Same precedence between the handlers as in "Handle()"
+    for (Handlers::const_iterator it = handlers_.begin(); it != handlers_.end(); ++it) 
+    {
+      std::auto_ptr<IChunkedRequestReader> reader;
+
+      if ((*it)->CreateChunkedRequestReader(reader, origin, remoteIp, username, method, uri, headers))
+      {
+        if (reader.get() != NULL)
+        {
+          // The streamed requests are subject to the same concurrency
+          // limits as the requests whose body is read before "Handle()"
+          target.reset(new ThrottledReader(*this, origin, uri, reader));
+        }
+
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
   void OrthancHttpHandler::Register(IHttpHandler& handler,
                                     bool isOrthancRestApi)
   {
@@ -91,4 +282,20 @@ namespace Orthanc
       return *this;
     }
   }
+
+
+  void OrthancHttpHandler::SetConcurrencyLimit(const std::string& pattern,
+                                               unsigned int maxConcurrentRequests)
+  {
+    if (maxConcurrentRequests == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    LOG(INFO) << "At most " << maxConcurrentRequests << " concurrent HTTP request(s) "
+              << "will be handled for URIs matching: " << pattern;
+
+    concurrencyLimits_.push_back(boost::shared_ptr<ConcurrencyLimit>
+                                 (new ConcurrencyLimit(pattern, maxConcurrentRequests)));
+  }
 }
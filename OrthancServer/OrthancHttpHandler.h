@@ -35,6 +35,8 @@
 
 #include "../Core/HttpServer/IHttpHandler.h"
 
+#include <boost/shared_ptr.hpp>
+
 namespace Orthanc
 {
   class OrthancHttpHandler : public IHttpHandler
@@ -42,11 +44,27 @@ namespace Orthanc
   private:
     typedef std::list<IHttpHandler*> Handlers;
 
-    Handlers      handlers_;
-    IHttpHandler *orthancRestApi_;
+    class ConcurrencyLimit;
+    class ConcurrencySlot;
+    class ThrottledReader;
+    typedef std::list< boost::shared_ptr<ConcurrencyLimit> > ConcurrencyLimits;
+
+    Handlers           handlers_;
+    IHttpHandler      *orthancRestApi_;
+    ConcurrencyLimits  concurrencyLimits_;
+    unsigned int       concurrencyQueueTimeout_;
+
+    ConcurrencyLimit* LookupConcurrencyLimit(RequestOrigin origin,
+                                             const UriComponents& uri) const;
+
+    void AcquireConcurrencySlot(ConcurrencySlot& slot,
+                                RequestOrigin origin,
+                                const UriComponents& uri) const;
 
   public:
-    OrthancHttpHandler() : orthancRestApi_(NULL)
+    OrthancHttpHandler() : 
+      orthancRestApi_(NULL),
+      concurrencyQueueTimeout_(60)
     {
     }
 
@@ -61,6 +79,14 @@ namespace Orthanc
                         const char* bodyData,
                         size_t bodySize);
 
+    virtual bool CreateChunkedRequestReader(std::auto_ptr<IChunkedRequestReader>& target,
+                                            RequestOrigin origin,
+                                            const char* remoteIp,
+                                            const char* username,
+                                            HttpMethod method,
+                                            const UriComponents& uri,
+                                            const Arguments& headers);
+
     void Register(IHttpHandler& handler,
                   bool isOrthancRestApi);
 
@@ -70,5 +96,29 @@ namespace Orthanc
     }
 
     IHttpHandler& RestrictToOrthancRestApi(bool restrict);
+
+    // At most "maxConcurrentRequests" HTTP requests whose URI matches
+    // the given wildcard pattern (e.g. "/studies/*/archive") are
+    // handled simultaneously. The other ones are queued. This must be
+    // configured before the HTTP server is started.
+    void SetConcurrencyLimit(const std::string& pattern,
+                             unsigned int maxConcurrentRequests);
+
+    void ClearConcurrencyLimits()
+    {
+      concurrencyLimits_.clear();
+    }
+
+    unsigned int GetConcurrencyQueueTimeout() const
+    {
+      return concurrencyQueueTimeout_;
+    }
+
+    // Time (in seconds) a queued request waits for a free slot before
+    // being rejected with "503 Service Unavailable"
+    void SetConcurrencyQueueTimeout(unsigned int timeout)
+    {
+      concurrencyQueueTimeout_ = timeout;
+    }
   };
 }
@@ -41,7 +41,10 @@
 #include "../Core/FileStorage/FilesystemStorage.h"
 
 #include "ServerEnumerations.h"
+#include "DatabaseReadersPool.h"
 #include "DatabaseWrapper.h"
+#include "OrthancHttpHandler.h"
+#include "TranscodingService.h"
 #include "../Core/DicomParsing/FromDcmtkBridge.h"
 
 #include <boost/lexical_cast.hpp>
@@ -729,6 +732,91 @@ namespace Orthanc
   }
 
 
+  void Configuration::SetupHttpConcurrencyLimits(OrthancHttpHandler& handler)
+  {
+    boost::recursive_mutex::scoped_lock lock(globalMutex_);
+
+    handler.ClearConcurrencyLimits();
+    handler.SetConcurrencyQueueTimeout(GetGlobalUnsignedIntegerParameter("HttpConcurrencyQueueTimeout", 60));
+
+    if (!configuration_.isMember("HttpConcurrencyLimits"))
+    {
+      return;
+    }
+
+    const Json::Value& limits = configuration_["HttpConcurrencyLimits"];
+    if (limits.type() != Json::objectValue)
+    {
+      LOG(ERROR) << "Badly formatted list of HTTP concurrency limits";
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    Json::Value::Members patterns = limits.getMemberNames();
+    for (size_t i = 0; i < patterns.size(); i++)
+    {
+      const std::string& pattern = patterns[i];
+
+      if (!limits[pattern].isInt() ||
+          limits[pattern].asInt() <= 0)
+      {
+        LOG(ERROR) << "The HTTP concurrency limit must be a positive integer for URI: " << pattern;
+        throw OrthancException(ErrorCode_BadParameterType);
+      }
+
+      handler.SetConcurrencyLimit(pattern, static_cast<unsigned int>(limits[pattern].asInt()));
+    }
+  }
+
+
+  void Configuration::SetupTranscodingPolicies(TranscodingService& service)
+  {
+    boost::recursive_mutex::scoped_lock lock(globalMutex_);
+
+    if (!configuration_.isMember("TranscodingPolicies"))
+    {
+      return;
+    }
+
+    const Json::Value& policies = configuration_["TranscodingPolicies"];
+    if (policies.type() != Json::arrayValue)
+    {
+      LOG(ERROR) << "Badly formatted list of transcoding policies";
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < policies.size(); i++)
+    {
+      const Json::Value& policy = policies[i];
+
+      if (policy.type() != Json::objectValue ||
+          !policy.isMember("TransferSyntax") ||
+          policy["TransferSyntax"].type() != Json::stringValue ||
+          (policy.isMember("MinimumAge") && 
+           (!policy["MinimumAge"].isInt() || policy["MinimumAge"].asInt() < 0)) ||
+          (policy.isMember("Modalities") &&
+           policy["Modalities"].type() != Json::arrayValue))
+      {
+        LOG(ERROR) << "Badly formatted transcoding policy: " << policy.toStyledString();
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+
+      std::set<std::string> modalities;
+      if (policy.isMember("Modalities"))
+      {
+        for (Json::Value::ArrayIndex j = 0; j < policy["Modalities"].size(); j++)
+        {
+          modalities.insert(policy["Modalities"][j].asString());
+        }
+      }
+
+      unsigned int minimumAge = (policy.isMember("MinimumAge") ?
+                                 static_cast<unsigned int>(policy["MinimumAge"].asInt()) : 0);
+
+      service.AddPolicy(modalities, minimumAge, policy["TransferSyntax"].asString());
+    }
+  }
+
+
   std::string Configuration::InterpretRelativePath(const std::string& baseDirectory,
                                                    const std::string& relativePath)
   {
@@ -987,13 +1075,19 @@ namespace Orthanc
   }
 
 
-  static IDatabaseWrapper* CreateSQLiteWrapper()
+  static boost::filesystem::path GetSQLiteIndexDirectory()
   {
     std::string storageDirectoryStr = Configuration::GetGlobalStringParameter("StorageDirectory", "OrthancStorage");
 
-    // Open the database
-    boost::filesystem::path indexDirectory = Configuration::InterpretStringParameterAsPath(
+    return Configuration::InterpretStringParameterAsPath(
       Configuration::GetGlobalStringParameter("IndexDirectory", storageDirectoryStr));
+  }
+
+
+  static IDatabaseWrapper* CreateSQLiteWrapper()
+  {
+    // Open the database
+    boost::filesystem::path indexDirectory = GetSQLiteIndexDirectory();
 
     LOG(WARNING) << "SQLite index directory: " << indexDirectory;
 
@@ -1005,7 +1099,16 @@ namespace Orthanc
     {
     }
 
-    return new DatabaseWrapper(indexDirectory.string() + "/index");
+    std::auto_ptr<DatabaseWrapper> database(new DatabaseWrapper(indexDirectory.string() + "/index"));
+
+    // The exclusive locking mode of SQLite must be disabled if
+    // read-only connections are to be opened on the same file
+    if (Configuration::GetGlobalUnsignedIntegerParameter("SQLiteReadConnections", 0) > 0)
+    {
+      database->SetExclusiveLocking(false);
+    }
+
+    return database.release();
   }
 
 
@@ -1085,6 +1188,30 @@ namespace Orthanc
   }
 
 
+  DatabaseReadersPool* Configuration::CreateDatabaseReadersPool()
+  {
+    unsigned int count = Configuration::GetGlobalUnsignedIntegerParameter("SQLiteReadConnections", 0);
+    if (count == 0)
+    {
+      return NULL;
+    }
+
+    std::string path = GetSQLiteIndexDirectory().string() + "/index";
+
+    std::auto_ptr<DatabaseReadersPool> pool(new DatabaseReadersPool);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+      std::auto_ptr<DatabaseWrapper> reader(new DatabaseWrapper(path));
+      reader->SetReadOnly(true);
+      reader->Open();
+      pool->Add(reader.release());
+    }
+
+    return pool.release();
+  }
+
+
   IStorageArea* Configuration::CreateStorageArea()
   {
     return CreateFilesystemStorage();
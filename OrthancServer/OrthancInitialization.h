@@ -50,6 +50,10 @@
 
 namespace Orthanc
 {
+  class DatabaseReadersPool;
+  class OrthancHttpHandler;
+  class TranscodingService;
+
   void OrthancInitialize(const char* configurationFile = NULL);
 
   void OrthancFinalize();
@@ -87,6 +91,10 @@ namespace Orthanc
 
     static void SetupRegisteredUsers(MongooseServer& httpServer);
 
+    static void SetupHttpConcurrencyLimits(OrthancHttpHandler& handler);
+
+    static void SetupTranscodingPolicies(TranscodingService& service);
+
     static std::string InterpretRelativePath(const std::string& baseDirectory,
                                              const std::string& relativePath);
 
@@ -119,6 +127,10 @@ namespace Orthanc
 
     static IDatabaseWrapper* CreateDatabaseWrapper();
 
+    // Returns NULL if the read-only connections to the built-in
+    // SQLite index are disabled (option "SQLiteReadConnections")
+    static DatabaseReadersPool* CreateDatabaseReadersPool();
+
     static IStorageArea* CreateStorageArea();
 
     static void GetConfiguration(Json::Value& result);
@@ -668,7 +668,7 @@ namespace Orthanc
       if (context.GetIndex().LookupParent(series, someInstance))
       {
         Json::Value dummy;
-        context.GetIndex().DeleteResource(dummy, series, ResourceType_Series);
+        context.DeleteResource(dummy, series, ResourceType_Series);
       }
 
       throw;
@@ -118,6 +118,7 @@ namespace Orthanc
     RegisterModalities();
     RegisterAnonymizeModify();
     RegisterArchive();
+    RegisterDicomWeb();
 
     Register("/instances", UploadDicomFile);
 
@@ -129,6 +130,66 @@ namespace Orthanc
   }
 
 
+  OrthancRestApi::CachedAnswer::CachedAnswer(RestApiGetCall& call) :
+    cache_(GetContext(call).GetResponseCache()),
+    resource_(call.GetUriComponent("id", "")),
+    isHit_(false),
+    isComputing_(false),
+    generation_(0)
+  {
+    if (!cache_.IsEnabled())
+    {
+      return;
+    }
+
+    // The key contains the GET arguments, and the "Accept" HTTP header
+    // that selects the format of the answer (JSON/XML, PNG/JPEG...)
+    key_ = call.FlattenUri();
+
+    const IHttpHandler::Arguments& arguments = call.GetArguments();
+    for (IHttpHandler::Arguments::const_iterator 
+           it = arguments.begin(); it != arguments.end(); ++it)
+    {
+      key_ += (it == arguments.begin() ? "?" : "&") + it->first + "=" + it->second;
+    }
+
+    key_ += "|" + call.GetHttpHeader("accept", "");
+
+    if (cache_.Lookup(content_, contentType_, resource_, key_))
+    {
+      call.GetOutput().AnswerBuffer(content_, contentType_);
+      isHit_ = true;
+    }
+    else
+    {
+      generation_ = cache_.StartComputation();
+      isComputing_ = true;
+      call.GetOutput().SetRecording(content_, contentType_);
+    }
+  }
+
+
+  OrthancRestApi::CachedAnswer::~CachedAnswer()
+  {
+    if (isComputing_)
+    {
+      try
+      {
+        if (!contentType_.empty())
+        {
+          cache_.Store(generation_, resource_, key_, content_, contentType_);
+        }
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Cannot store an answer in the response cache";
+      }
+
+      cache_.EndComputation();
+    }
+  }
+
+
   ServerContext& OrthancRestApi::GetContext(RestApiCall& call)
   {
     return GetApi(call).context_;
@@ -43,6 +43,7 @@ namespace Orthanc
 {
   class ServerContext;
   class ServerIndex;
+  class ResponseCache;
 
   class OrthancRestApi : public RestApi
   {
@@ -66,11 +67,45 @@ namespace Orthanc
 
     void RegisterArchive();
 
+    void RegisterDicomWeb();
+
     static void ResetOrthanc(RestApiPostCall& call);
 
     static void ShutdownOrthanc(RestApiPostCall& call);
 
   public:
+    /**
+     * Helper to serve a GET request from the response cache of the
+     * server context. It must be created at the beginning of the
+     * handler: If the answer is available in the cache, it is sent
+     * and "IsHit()" returns "true". Otherwise, the answer that is
+     * then sent by the handler is stored in the cache on destruction.
+     * The answer is attached to the resource given by the "id"
+     * component of the URI.
+     **/
+    class CachedAnswer : public boost::noncopyable
+    {
+    private:
+      ResponseCache&  cache_;
+      std::string     resource_;
+      std::string     key_;
+      bool            isHit_;
+      bool            isComputing_;
+      uint64_t        generation_;
+      std::string     content_;
+      std::string     contentType_;
+
+    public:
+      CachedAnswer(RestApiGetCall& call);
+
+      ~CachedAnswer();
+
+      bool IsHit() const
+      {
+        return isHit_;
+      }
+    };
+
     OrthancRestApi(ServerContext& context);
 
     const bool& LeaveBarrierFlag() const
@@ -81,6 +81,28 @@ namespace Orthanc
     bool last;
     GetSinceAndLimit(since, limit, last, call);
 
+    // Long-polling: The "timeout" argument (in seconds) makes the
+    // request wait for new changes if none is available after "since".
+    // The waiting request holds one HTTP thread, hence the low cap.
+    // For the same reason, the changes are not streamed to the client.
+    static const unsigned int MAX_TIMEOUT = 30;
+
+    unsigned int timeout = 0;
+
+    try
+    {
+      timeout = boost::lexical_cast<unsigned int>(call.GetArgument("timeout", "0"));
+    }
+    catch (boost::bad_lexical_cast)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (timeout > MAX_TIMEOUT)
+    {
+      timeout = MAX_TIMEOUT;
+    }
+
     Json::Value result;
     if (last)
     {
@@ -88,7 +110,7 @@ namespace Orthanc
     }
     else
     {
-      context.GetIndex().GetChanges(result, since, limit);
+      context.GetIndex().GetChanges(result, since, limit, timeout * 1000);
     }
 
     call.GetOutput().AnswerJson(result);
@@ -0,0 +1,581 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeadersServer.h"
+#include "OrthancRestApi.h"
+
+#include "../../Core/DicomParsing/DicomWebFormatter.h"
+#include "../../Core/DicomParsing/FromDcmtkBridge.h"
+#include "../../Core/HttpServer/HttpToolbox.h"
+#include "../../Core/Logging.h"
+#include "../../Core/RestApi/RestApiJsonWriter.h"
+#include "../BulkContentReader.h"
+#include "../OrthancInitialization.h"
+#include "../Search/LookupResource.h"
+#include "../ServerContext.h"
+
+#include <boost/lexical_cast.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Native implementation of the DICOMweb services (QIDO-RS, WADO-RS
+   * and STOW-RS) below the "/dicom-web" URI. The resources are
+   * identified by their DICOM UIDs, and are served directly from the
+   * index and from the storage area.
+   **/
+
+  static const char* const DICOM_JSON_CONTENT_TYPE = "application/dicom+json";
+
+  static const DicomTag DICOM_TAG_REFERENCED_SOP_CLASS_UID(0x0008, 0x1150);
+  static const DicomTag DICOM_TAG_REFERENCED_SOP_INSTANCE_UID(0x0008, 0x1155);
+  static const DicomTag DICOM_TAG_FAILURE_REASON(0x0008, 0x1197);
+
+  // Status code of STOW-RS for the instances that cannot be stored
+  static const unsigned int FAILURE_PROCESSING = 0x0110;
+
+
+  static const DicomTag& GetIdentifierTag(ResourceType level)
+  {
+    switch (level)
+    {
+      case ResourceType_Study:
+        return DICOM_TAG_STUDY_INSTANCE_UID;
+
+      case ResourceType_Series:
+        return DICOM_TAG_SERIES_INSTANCE_UID;
+
+      case ResourceType_Instance:
+        return DICOM_TAG_SOP_INSTANCE_UID;
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  // Converts a DICOM UID to the public identifier of Orthanc. If
+  // "parentId" is not empty, the resource must be one of its children.
+  static bool LookupResourceByUid(std::string& publicId,
+                                  ServerIndex& index,
+                                  ResourceType level,
+                                  const std::string& uid,
+                                  const std::string& parentId)
+  {
+    std::list<std::string> candidates;
+    index.LookupIdentifierExact(candidates, level, GetIdentifierTag(level), uid);
+
+    for (std::list<std::string>::const_iterator
+           it = candidates.begin(); it != candidates.end(); ++it)
+    {
+      std::string parent;
+      if (parentId.empty() ||
+          (index.LookupParent(parent, *it) &&
+           parent == parentId))
+      {
+        publicId = *it;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  // Resolves the UIDs in the URI, down to the given level
+  static bool LookupResourceFromUri(std::string& publicId,
+                                    RestApiCall& call,
+                                    ResourceType level)
+  {
+    ServerIndex& index = OrthancRestApi::GetIndex(call);
+
+    std::string study;
+    if (!LookupResourceByUid(study, index, ResourceType_Study,
+                             call.GetUriComponent("study", ""), ""))
+    {
+      return false;
+    }
+
+    if (level == ResourceType_Study)
+    {
+      publicId = study;
+      return true;
+    }
+
+    std::string series;
+    if (!LookupResourceByUid(series, index, ResourceType_Series,
+                             call.GetUriComponent("series", ""), study))
+    {
+      return false;
+    }
+
+    if (level == ResourceType_Series)
+    {
+      publicId = series;
+      return true;
+    }
+
+    return LookupResourceByUid(publicId, index, ResourceType_Instance,
+                               call.GetUriComponent("instance", ""), series);
+  }
+
+
+  static void GetInstancesOfResource(std::list<std::string>& instances,
+                                     ServerIndex& index,
+                                     const std::string& publicId,
+                                     ResourceType level)
+  {
+    if (level == ResourceType_Instance)
+    {
+      instances.push_back(publicId);
+    }
+    else
+    {
+      index.GetChildInstances(instances, publicId);
+    }
+  }
+
+
+
+  // QIDO-RS ------------------------------------------------------------------
+
+  static size_t ParseCount(const std::string& value)
+  {
+    try
+    {
+      int tmp = boost::lexical_cast<int>(value);
+      if (tmp >= 0)
+      {
+        return static_cast<size_t>(tmp);
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+
+    throw OrthancException(ErrorCode_BadRequest);
+  }
+
+
+  // Formats the main DICOM tags of the resource and of its parents,
+  // down to the study level
+  static bool FormatQidoAnswer(Json::Value& target,
+                               ServerIndex& index,
+                               const std::string& publicId,
+                               ResourceType level)
+  {
+    target = Json::objectValue;
+
+    std::string current = publicId;
+    ResourceType type = level;
+
+    for (;;)
+    {
+      DicomMap tags;
+      if (!index.GetMainDicomTags(tags, current, type, type))
+      {
+        return false;
+      }
+
+      DicomWebFormatter::Apply(target, tags);
+
+      if (type == ResourceType_Study)
+      {
+        // The studies also store the main DICOM tags of their patient
+        if (!index.GetMainDicomTags(tags, current, type, ResourceType_Patient))
+        {
+          return false;
+        }
+
+        DicomWebFormatter::Apply(target, tags);
+        return true;
+      }
+
+      std::string parent;
+      if (!index.LookupParent(parent, current))
+      {
+        return false;
+      }
+
+      current = parent;
+      type = GetParentResourceType(type);
+    }
+  }
+
+
+  template <enum ResourceType level>
+  static void SearchForResources(RestApiGetCall& call)
+  {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    LookupResource query(level);
+
+    // The UIDs of the parent resources in the URI restrict the query
+    std::string study = call.GetUriComponent("study", "");
+    if (!study.empty())
+    {
+      query.AddDicomConstraint(DICOM_TAG_STUDY_INSTANCE_UID, study, true);
+    }
+
+    std::string series = call.GetUriComponent("series", "");
+    if (!series.empty())
+    {
+      query.AddDicomConstraint(DICOM_TAG_SERIES_INSTANCE_UID, series, true);
+    }
+
+    const bool caseSensitivePN = Configuration::GetGlobalBoolParameter("CaseSensitivePN", false);
+
+    size_t limit = 0;
+    size_t offset = 0;
+
+    const IHttpHandler::Arguments& arguments = call.GetArguments();
+    for (IHttpHandler::Arguments::const_iterator
+           it = arguments.begin(); it != arguments.end(); ++it)
+    {
+      if (it->first == "limit")
+      {
+        limit = ParseCount(it->second);
+      }
+      else if (it->first == "offset")
+      {
+        offset = ParseCount(it->second);
+      }
+      else if (it->first == "fuzzymatching" ||
+               it->first == "includefield")
+      {
+        // Not supported: The answers always contain all the main
+        // DICOM tags that are stored in the index
+      }
+      else if (!it->second.empty())
+      {
+        DicomTag tag(0, 0);
+        if (!DicomWebFormatter::ParseTag(tag, it->first))
+        {
+          LOG(ERROR) << "QIDO-RS: Unknown DICOM tag: " << it->first;
+          throw OrthancException(ErrorCode_BadRequest);
+        }
+
+        // DICOM specifies that searches must be case sensitive, except
+        // for tags with a PN value representation
+        bool sensitive = true;
+        if (FromDcmtkBridge::LookupValueRepresentation(tag) == ValueRepresentation_PersonName)
+        {
+          sensitive = caseSensitivePN;
+        }
+
+        query.AddDicomConstraint(tag, it->second, sensitive);
+      }
+    }
+
+    std::list<std::string> resources;
+    context.Apply(resources, query, offset, limit);
+
+    RestApiJsonWriter writer(call.GetOutput());
+    writer.SetContentType(DICOM_JSON_CONTENT_TYPE);
+    writer.StartArray();
+
+    for (std::list<std::string>::const_iterator
+           it = resources.begin(); it != resources.end(); ++it)
+    {
+      Json::Value item;
+      if (FormatQidoAnswer(item, context.GetIndex(), *it, level))
+      {
+        writer.WriteValue(item);
+      }
+    }
+
+    writer.EndArray();
+    writer.Close();
+  }
+
+
+
+  // WADO-RS ------------------------------------------------------------------
+
+  template <enum ResourceType level>
+  static void RetrieveResource(RestApiGetCall& call)
+  {
+    // Number of DICOM files that are read from the storage area ahead
+    // of the network
+    static const size_t MAX_PENDING_ITEMS = 16;
+
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    std::string publicId;
+    if (!LookupResourceFromUri(publicId, call, level))
+    {
+      return;   // Unknown resource (404)
+    }
+
+    std::list<std::string> instances;
+    GetInstancesOfResource(instances, context.GetIndex(), publicId, level);
+
+    BulkContentReader reader(context, instances, false, MAX_PENDING_ITEMS);
+
+    RestApiOutput& output = call.GetOutput();
+    output.StartMultipart("related", "application/dicom");
+
+    for (;;)
+    {
+      std::auto_ptr<BulkContentReader::Item> item(reader.Next());
+      if (item.get() == NULL)
+      {
+        break;
+      }
+
+      std::map<std::string, std::string> headers;
+      headers["Content-Type"] = item->GetContentType();
+      headers["Content-Location"] = item->GetLocation();
+
+      output.SendMultipartItem(item->GetContent(), headers);
+    }
+
+    if (!reader.IsSuccess())
+    {
+      // The HTTP status has already been sent: Abort the connection
+      // without writing the closing boundary, so that the client
+      // cannot mistake the truncated answer for a complete one
+      LOG(ERROR) << "WADO-RS: Incomplete retrieval of " << EnumerationToString(level) << " " << publicId;
+      output.CloseConnection();
+      throw OrthancException(ErrorCode_NetworkProtocol);
+    }
+
+    output.CloseMultipart();
+  }
+
+
+  template <enum ResourceType level>
+  static void RetrieveMetadata(RestApiGetCall& call)
+  {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    std::string publicId;
+    if (!LookupResourceFromUri(publicId, call, level))
+    {
+      return;   // Unknown resource (404)
+    }
+
+    std::list<std::string> instances;
+    GetInstancesOfResource(instances, context.GetIndex(), publicId, level);
+
+    RestApiJsonWriter writer(call.GetOutput());
+    writer.SetContentType(DICOM_JSON_CONTENT_TYPE);
+    writer.StartArray();
+
+    for (std::list<std::string>::const_iterator
+           it = instances.begin(); it != instances.end(); ++it)
+    {
+      // The tags are read from the "dicom-as-json" attachment, which
+      // avoids parsing the DICOM files
+      Json::Value full;
+      context.ReadDicomAsJson(full, *it);
+
+      Json::Value item;
+      DicomWebFormatter::ApplyFullJson(item, full);
+      writer.WriteValue(item);
+    }
+
+    writer.EndArray();
+    writer.Close();
+  }
+
+
+
+  // STOW-RS ------------------------------------------------------------------
+
+  static void AddStowItem(Json::Value& sequence,
+                          const std::string& sopClassUid,
+                          const std::string& sopInstanceUid,
+                          bool success)
+  {
+    DicomMap tags;
+    tags.SetValue(DICOM_TAG_REFERENCED_SOP_CLASS_UID, sopClassUid, false);
+    tags.SetValue(DICOM_TAG_REFERENCED_SOP_INSTANCE_UID, sopInstanceUid, false);
+
+    if (!success)
+    {
+      tags.SetValue(DICOM_TAG_FAILURE_REASON, 
+                    boost::lexical_cast<std::string>(FAILURE_PROCESSING), false);
+    }
+
+    Json::Value item;
+    DicomWebFormatter::Apply(item, tags);
+
+    if (sequence.type() == Json::nullValue)
+    {
+      sequence["vr"] = "SQ";
+      sequence["Value"] = Json::arrayValue;
+    }
+
+    sequence["Value"].append(item);
+  }
+
+
+  static void StoreInstances(RestApiPostCall& call)
+  {
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    std::string boundary;
+    if (!HttpToolbox::LookupMultipartBoundary(boundary, call.GetHttpHeader("content-type", "")))
+    {
+      LOG(ERROR) << "STOW-RS: The body must be of type multipart/related";
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+
+    std::vector<HttpToolbox::MultipartPart> parts;
+    HttpToolbox::ParseMultipartBody(parts, call.GetBodyData(), call.GetBodySize(), boundary);
+
+    // If the URI contains a study, all the instances must belong to it
+    const std::string expectedStudy = call.GetUriComponent("study", "");
+
+    Json::Value referenced, failed;
+
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+      IHttpHandler::Arguments::const_iterator found = parts[i].headers.find("content-type");
+      if (found != parts[i].headers.end())
+      {
+        std::string mime = Toolbox::StripSpaces(found->second.substr(0, found->second.find(';')));
+        Toolbox::ToLowerCase(mime);
+
+        if (mime != "application/dicom")
+        {
+          LOG(WARNING) << "STOW-RS: Ignoring a part of type " << found->second;
+          continue;
+        }
+      }
+
+      std::string sopClassUid, sopInstanceUid;
+      bool success = false;
+
+      try
+      {
+        std::string dicom(parts[i].content, parts[i].size);
+
+        DicomInstanceToStore toStore;
+        toStore.SetRestOrigin(call);
+        toStore.SetBuffer(dicom);
+
+        const DicomMap& summary = toStore.GetSummary();
+        summary.CopyToString(sopClassUid, DICOM_TAG_SOP_CLASS_UID, false);
+        summary.CopyToString(sopInstanceUid, DICOM_TAG_SOP_INSTANCE_UID, false);
+
+        std::string study;
+        if (expectedStudy.empty() ||
+            (summary.CopyToString(study, DICOM_TAG_STUDY_INSTANCE_UID, false) &&
+             study == expectedStudy))
+        {
+          std::string publicId;
+          StoreStatus status = context.Store(publicId, toStore);
+          success = (status == StoreStatus_Success ||
+                     status == StoreStatus_AlreadyStored);
+        }
+        else
+        {
+          LOG(ERROR) << "STOW-RS: Instance " << sopInstanceUid 
+                     << " does not belong to study " << expectedStudy;
+        }
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "STOW-RS: Cannot store an instance: " << e.What();
+      }
+
+      AddStowItem(success ? referenced : failed, sopClassUid, sopInstanceUid, success);
+    }
+
+    // "200 OK" if all the instances were stored, "202 Accepted" if
+    // only some of them were stored, and "409 Conflict" if none was
+    // stored (PS3.18, Section 10.5.3)
+    HttpStatus status;
+    if (failed.type() == Json::nullValue)
+    {
+      status = HttpStatus_200_Ok;
+    }
+    else if (referenced.type() == Json::nullValue)
+    {
+      status = HttpStatus_409_Conflict;
+    }
+    else
+    {
+      status = HttpStatus_202_Accepted;
+    }
+
+    Json::Value result = Json::objectValue;
+
+    if (referenced.type() != Json::nullValue)
+    {
+      result["00081199"] = referenced;  // ReferencedSOPSequence
+    }
+
+    if (failed.type() != Json::nullValue)
+    {
+      result["00081198"] = failed;      // FailedSOPSequence
+    }
+
+    std::string s = result.toStyledString();
+    call.GetOutput().AnswerBuffer(s, DICOM_JSON_CONTENT_TYPE, status);
+  }
+
+
+
+  void OrthancRestApi::RegisterDicomWeb()
+  {
+    // These routes would shadow the ones of the DICOMweb plugin if
+    // it is configured with the same root, hence the opt-in
+    if (!Configuration::GetGlobalBoolParameter("DicomWebServices", false))
+    {
+      return;
+    }
+
+    // QIDO-RS
+    Register("/dicom-web/studies", SearchForResources<ResourceType_Study>);
+    Register("/dicom-web/series", SearchForResources<ResourceType_Series>);
+    Register("/dicom-web/instances", SearchForResources<ResourceType_Instance>);
+    Register("/dicom-web/studies/{study}/series", SearchForResources<ResourceType_Series>);
+    Register("/dicom-web/studies/{study}/instances", SearchForResources<ResourceType_Instance>);
+    Register("/dicom-web/studies/{study}/series/{series}/instances", SearchForResources<ResourceType_Instance>);
+
+    // WADO-RS
+    Register("/dicom-web/studies/{study}", RetrieveResource<ResourceType_Study>);
+    Register("/dicom-web/studies/{study}/series/{series}", RetrieveResource<ResourceType_Series>);
+    Register("/dicom-web/studies/{study}/series/{series}/instances/{instance}", RetrieveResource<ResourceType_Instance>);
+    Register("/dicom-web/studies/{study}/metadata", RetrieveMetadata<ResourceType_Study>);
+    Register("/dicom-web/studies/{study}/series/{series}/metadata", RetrieveMetadata<ResourceType_Series>);
+    Register("/dicom-web/studies/{study}/series/{series}/instances/{instance}/metadata", RetrieveMetadata<ResourceType_Instance>);
+
+    // STOW-RS
+    Register("/dicom-web/studies", StoreInstances);
+    Register("/dicom-web/studies/{study}", StoreInstances);
+  }
+}
@@ -35,15 +35,25 @@
 #include "OrthancRestApi.h"
 
 #include "../../Core/Compression/GzipCompressor.h"
+#include "../../Core/DicomFormat/DicomImageInformation.h"
 #include "../../Core/DicomParsing/FromDcmtkBridge.h"
 #include "../../Core/DicomParsing/Internals/DicomImageDecoder.h"
+#include "../../Core/HttpServer/BufferHttpSender.h"
 #include "../../Core/HttpServer/HttpContentNegociation.h"
+#include "../../Core/Images/Image.h"
+#include "../../Core/Images/ImageRenderer.h"
 #include "../../Core/Logging.h"
+#include "../../Core/RestApi/RestApiJsonWriter.h"
+#include "../BulkContentReader.h"
+#include "../CineStreamer.h"
 #include "../OrthancInitialization.h"
 #include "../Search/LookupResource.h"
 #include "../ServerContext.h"
 #include "../ServerToolbox.h"
 #include "../SliceOrdering.h"
+#include "../VolumeReader.h"
+
+#include <cmath>
 
 
 namespace Orthanc
@@ -92,7 +102,9 @@ namespace Orthanc
                                     ResourceType level,
                                     bool expand)
   {
-    Json::Value answer = Json::arrayValue;
+    // The answer is streamed, as it can be huge on large archives
+    RestApiJsonWriter writer(output);
+    writer.StartArray();
 
     for (std::list<std::string>::const_iterator
            resource = resources.begin(); resource != resources.end(); ++resource)
@@ -102,16 +114,17 @@ namespace Orthanc
         Json::Value item;
         if (index.LookupResource(item, *resource, level))
         {
-          answer.append(item);
+          writer.WriteValue(item);
         }
       }
       else
       {
-        answer.append(*resource);
+        writer.WriteString(*resource);
       }
     }
 
-    output.AnswerJson(answer);
+    writer.EndArray();
+    writer.Close();
   }
 
 
@@ -303,22 +316,71 @@ namespace Orthanc
 
   namespace
   {
+    unsigned int GetJpegQuality(const RestApiGetCall& call)
+    {
+      std::string v = call.GetArgument("quality", "90" /* default JPEG quality */);
+
+      try
+      {
+        unsigned int quality = boost::lexical_cast<unsigned int>(v);
+        if (quality >= 1 && quality <= 100)
+        {
+          return quality;
+        }
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+      }
+
+      LOG(ERROR) << "Bad quality for a JPEG encoding (must be a number between 0 and 100): " << v;
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+
+
+    bool IsJpegChromaSubsampling(const RestApiGetCall& call,
+                                 const ServerContext& context)
+    {
+      if (!call.HasArgument("chroma-subsampling"))
+      {
+        return context.IsJpegChromaSubsampling();
+      }
+
+      std::string v = call.GetArgument("chroma-subsampling", "");
+      if (v == "true")
+      {
+        return true;
+      }
+      else if (v == "false")
+      {
+        return false;
+      }
+      else
+      {
+        LOG(ERROR) << "Bad value for argument \"chroma-subsampling\" (must be \"true\" or \"false\"): " << v;
+        throw OrthancException(ErrorCode_BadRequest);
+      }
+    }
+
+
     class ImageToEncode
     {
     private:
       std::auto_ptr<ImageAccessor>&  image_;
       ImageExtractionMode            mode_;
       bool                           invert_;
+      ImageEncoderProfile            profile_;
       std::string                    format_;
       std::string                    answer_;
 
     public:
       ImageToEncode(std::auto_ptr<ImageAccessor>& image,
                     ImageExtractionMode mode,
-                    bool invert) :
+                    bool invert,
+                    ImageEncoderProfile profile) :
         image_(image),
         mode_(mode),
-        invert_(invert)
+        invert_(invert),
+        profile_(profile)
       {
       }
 
@@ -330,13 +392,14 @@ namespace Orthanc
       void EncodeUsingPng()
       {
         format_ = "image/png";
-        DicomImageDecoder::ExtractPngImage(answer_, image_, mode_, invert_);
+        DicomImageDecoder::ExtractPngImage(answer_, image_, mode_, invert_, profile_);
       }
 
-      void EncodeUsingJpeg(uint8_t quality)
+      void EncodeUsingJpeg(uint8_t quality,
+                           bool chromaSubsampling)
       {
         format_ = "image/jpeg";
-        DicomImageDecoder::ExtractJpegImage(answer_, image_, mode_, invert_, quality);
+        DicomImageDecoder::ExtractJpegImage(answer_, image_, mode_, invert_, quality, profile_, chromaSubsampling);
       }
     };
 
@@ -364,45 +427,379 @@ namespace Orthanc
     private:
       ImageToEncode&  image_;
       unsigned int    quality_;
+      bool            chromaSubsampling_;
 
     public:
       EncodeJpeg(ImageToEncode& image,
-                 const RestApiGetCall& call) :
-        image_(image)
+                 const RestApiGetCall& call,
+                 const ServerContext& context) :
+        image_(image),
+        quality_(GetJpegQuality(call)),
+        chromaSubsampling_(IsJpegChromaSubsampling(call, context))
       {
-        std::string v = call.GetArgument("quality", "90" /* default JPEG quality */);
-        bool ok = false;
+      }
+
+      virtual void Handle(const std::string& type,
+                          const std::string& subtype)
+      {
+        assert(type == "image");
+        assert(subtype == "jpeg");
+        image_.EncodeUsingJpeg(quality_, chromaSubsampling_);
+      }
+    };
+
+
+    class RenderingParameters
+    {
+    private:
+      bool          hasWindowing_;
+      float         windowCenter_;
+      float         windowWidth_;
+      bool          hasRescale_;
+      float         rescaleSlope_;
+      float         rescaleIntercept_;
+      unsigned int  maxWidth_;
+      unsigned int  maxHeight_;
+
+      static bool LookupFloatArgument(float& target,
+                                      const RestApiGetCall& call,
+                                      const std::string& name)
+      {
+        if (!call.HasArgument(name))
+        {
+          return false;
+        }
+
+        std::string v = call.GetArgument(name, "");
 
         try
         {
-          quality_ = boost::lexical_cast<unsigned int>(v);
-          ok = (quality_ >= 1 && quality_ <= 100);
+          target = boost::lexical_cast<float>(v);
+          return true;
         }
         catch (boost::bad_lexical_cast&)
         {
+          LOG(ERROR) << "Bad value for argument \"" << name << "\" (must be a number): " << v;
+          throw OrthancException(ErrorCode_BadRequest);
+        }
+      }
+
+      static unsigned int GetSizeArgument(const RestApiGetCall& call,
+                                          const std::string& name)
+      {
+        std::string v = call.GetArgument(name, "0");
+
+        try
+        {
+          return boost::lexical_cast<unsigned int>(v);
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+          LOG(ERROR) << "Bad value for argument \"" << name << "\" (must be a positive integer): " << v;
+          throw OrthancException(ErrorCode_BadRequest);
+        }
+      }
+
+    public:
+      explicit RenderingParameters(const RestApiGetCall& call) :
+        hasWindowing_(false),
+        windowCenter_(0),
+        windowWidth_(0),
+        hasRescale_(false),
+        rescaleSlope_(1),
+        rescaleIntercept_(0)
+      {
+        bool hasCenter = LookupFloatArgument(windowCenter_, call, "window-center");
+        bool hasWidth = LookupFloatArgument(windowWidth_, call, "window-width");
+
+        if (hasCenter != hasWidth)
+        {
+          LOG(ERROR) << "Both \"window-center\" and \"window-width\" must be provided";
+          throw OrthancException(ErrorCode_BadRequest);
         }
 
-        if (!ok)
+        if (hasWidth &&
+            windowWidth_ < 1.0f)
         {
-          LOG(ERROR) << "Bad quality for a JPEG encoding (must be a number between 0 and 100): " << v;
+          LOG(ERROR) << "The window width must be at least 1";
           throw OrthancException(ErrorCode_BadRequest);
         }
+
+        hasWindowing_ = hasWidth;
+
+        bool hasSlope = LookupFloatArgument(rescaleSlope_, call, "rescale-slope");
+        bool hasIntercept = LookupFloatArgument(rescaleIntercept_, call, "rescale-intercept");
+        hasRescale_ = (hasSlope || hasIntercept);
+
+        maxWidth_ = GetSizeArgument(call, "width");
+        maxHeight_ = GetSizeArgument(call, "height");
+      }
+
+      bool IsActive() const
+      {
+        return (hasWindowing_ || 
+                hasRescale_ ||
+                maxWidth_ != 0 ||
+                maxHeight_ != 0);
+      }
+
+      // Tells whether the request corresponds to the thumbnails that
+      // are rendered in the background, whose size is "size"
+      bool IsThumbnail(unsigned int size) const
+      {
+        return (size != 0 &&
+                !hasWindowing_ &&
+                !hasRescale_ &&
+                maxWidth_ == size &&
+                maxHeight_ == size);
+      }
+
+      ImageAccessor* Render(const DecodedFramesCache::Frame& frame,
+                            ImageExtractionMode mode) const
+      {
+        ImageRenderer renderer;
+
+        if (hasWindowing_ &&
+            !hasRescale_)
+        {
+          // The rescale is only read from the DICOM file if a
+          // windowing is requested, as the window is expressed in
+          // rescaled values
+          renderer.SetRescale(frame.GetRescaleSlope(), frame.GetRescaleIntercept());
+        }
+        else
+        {
+          renderer.SetRescale(rescaleSlope_, rescaleIntercept_);
+        }
+
+        renderer.SetStretchDynamics(mode == ImageExtractionMode_Preview);
+        renderer.SetInvert(mode == ImageExtractionMode_Preview && frame.IsMonochrome1());
+        renderer.SetBitsStored(frame.GetBitsStored());
+        renderer.SetMaximumSize(maxWidth_, maxHeight_);
+
+        if (hasWindowing_)
+        {
+          renderer.SetWindowing(windowCenter_, windowWidth_);
+        }
+
+        return renderer.Render(frame.GetImage());
+      }
+    };
+
+
+    class SelectFormat : public HttpContentNegociation::IHandler
+    {
+    private:
+      std::string&  format_;
+
+    public:
+      SelectFormat(std::string& format) : format_(format)
+      {
       }
 
       virtual void Handle(const std::string& type,
                           const std::string& subtype)
       {
-        assert(type == "image");
-        assert(subtype == "jpeg");
-        image_.EncodeUsingJpeg(quality_);
+        format_ = type + "/" + subtype;
       }
     };
   }
 
 
+  static bool AnswerThumbnail(RestApiGetCall& call,
+                              ServerContext& context,
+                              const std::string& publicId)
+  {
+    // The thumbnails are JPEG images, that are preferred over PNG if
+    // the client accepts both formats
+    std::string format;
+    SelectFormat handler(format);
+
+    HttpContentNegociation negociation;
+    negociation.Register("image/jpeg", handler);
+    negociation.Register("image/png", handler);
+
+    FileInfo attachment;
+    if (!negociation.Apply(call.GetHttpHeaders()) ||
+        format != "image/jpeg" ||
+        !context.GetIndex().LookupAttachment(attachment, publicId, FileContentType_Thumbnail))
+    {
+      return false;
+    }
+
+    std::string jpeg;
+    context.ReadAttachment(jpeg, attachment);
+    call.GetOutput().AnswerBuffer(jpeg, "image/jpeg");
+    return true;
+  }
+
+
+  static bool LookupFloatTag(float& target,
+                             ParsedDicomFile& dicom,
+                             const DicomTag& tag)
+  {
+    std::string v;
+    if (dicom.GetTagValue(v, tag))
+    {
+      try
+      {
+        // Only keep the first value of a multi-valued tag
+        std::vector<std::string> tokens;
+        Toolbox::TokenizeString(tokens, v, '\\');
+        if (!tokens.empty())
+        {
+          target = boost::lexical_cast<float>(Toolbox::StripSpaces(tokens[0]));
+          return true;
+        }
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+      }
+    }
+
+    return false;
+  }
+
+
+  static DecodedFramesCache::Frame* CreateDecodedFrame(ImageAccessor* image,
+                                                       ParsedDicomFile& dicom)
+  {
+    std::auto_ptr<ImageAccessor> protection(image);
+
+    unsigned int bitsStored = 0;
+
+    std::string v;
+    if (dicom.GetTagValue(v, DICOM_TAG_BITS_STORED))
+    {
+      try
+      {
+        bitsStored = boost::lexical_cast<unsigned int>(Toolbox::StripSpaces(v));
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+      }
+
+      if (bitsStored > 16)
+      {
+        bitsStored = 0;
+      }
+    }
+
+    PhotometricInterpretation photometric;
+    bool isMonochrome1 = (dicom.LookupPhotometricInterpretation(photometric) &&
+                          photometric == PhotometricInterpretation_Monochrome1);
+
+    float slope = 1;
+    float intercept = 0;
+    LookupFloatTag(slope, dicom, DICOM_TAG_RESCALE_SLOPE);
+    LookupFloatTag(intercept, dicom, DICOM_TAG_RESCALE_INTERCEPT);
+
+    return new DecodedFramesCache::Frame(protection.release(), bitsStored, isMonochrome1, slope, intercept);
+  }
+
+
+  // Returns an empty pointer if the frame cannot be decoded
+  static DecodedFramesCache::FramePointer DecodeFrame(ServerContext& context,
+                                                      const std::string& publicId,
+                                                      unsigned int frame)
+  {
+    DecodedFramesCache& cache = context.GetDecodedFramesCache();
+
+    DecodedFramesCache::FramePointer result;
+    if (cache.Lookup(result, publicId, frame))
+    {
+      return result;
+    }
+
+    const uint64_t generation = cache.GetGeneration();
+
+#if ORTHANC_ENABLE_PLUGINS == 1
+    if (context.GetPlugins().HasCustomImageDecoder())
+    {
+      std::string dicomContent;
+      context.ReadDicom(dicomContent, publicId);
+
+      /**
+       * Note that we call "DecodeUnsafe()": We do not fallback to
+       * the builtin decoder if no installed decoder plugin is able
+       * to decode the image. This allows us to take advantage of
+       * the cache of the parsed DICOM files below.
+       **/
+      std::auto_ptr<ImageAccessor> decoded(
+        context.GetPlugins().DecodeUnsafe(dicomContent.c_str(), dicomContent.size(), frame));
+
+      if (decoded.get() != NULL)
+      {
+        // TODO Optimize this lookup for the rendering parameters: It
+        // should be implemented by the plugin to avoid parsing twice
+        // the DICOM file
+        ParsedDicomFile parsed(dicomContent, true /* lazy pixel data */);
+        result.reset(CreateDecodedFrame(decoded.release(), parsed));
+      }
+    }
+#endif
+
+    if (result.get() == NULL)
+    {
+      // Use Orthanc's built-in decoder, using the cache to speed-up
+      // things on multi-frame images
+      ServerContext::DicomCacheLocker locker(context, publicId);
+
+      std::auto_ptr<ImageAccessor> decoded(DicomImageDecoder::Decode(locker.GetDicom(), frame));
+      if (decoded.get() == NULL)
+      {
+        return result;
+      }
+
+      result.reset(CreateDecodedFrame(decoded.release(), locker.GetDicom()));
+    }
+
+    cache.Store(generation, publicId, frame, result);
+    return result;
+  }
+
+
+  static ImageEncoderProfile GetEncoderProfile(const RestApiGetCall& call,
+                                               ServerContext& context)
+  {
+    if (!call.HasArgument("profile"))
+    {
+      return context.GetImageEncoderProfile();
+    }
+
+    std::string v = call.GetArgument("profile", "");
+
+    try
+    {
+      return StringToImageEncoderProfile(v.c_str());
+    }
+    catch (OrthancException&)
+    {
+      LOG(ERROR) << "Bad encoder profile (must be \"fast\", \"balanced\" or \"small\"): " << v;
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+  }
+
+
+  static bool IsRenderable(PixelFormat format)
+  {
+    // The pixel formats that are supported by "ImageRenderer"
+    return (format == PixelFormat_Grayscale8 ||
+            format == PixelFormat_Grayscale16 ||
+            format == PixelFormat_SignedGrayscale16 ||
+            format == PixelFormat_RGB24);
+  }
+
+
   template <enum ImageExtractionMode mode>
   static void GetImage(RestApiGetCall& call)
   {
+    OrthancRestApi::CachedAnswer cached(call);
+    if (cached.IsHit())
+    {
+      return;
+    }
+
     ServerContext& context = OrthancRestApi::GetContext(call);
 
     std::string frameId = call.GetUriComponent("frame", "0");
@@ -417,89 +814,351 @@ namespace Orthanc
       return;
     }
 
+    RenderingParameters rendering(call);
+    ImageEncoderProfile profile = GetEncoderProfile(call, context);
+
+    if (mode == ImageExtractionMode_Preview &&
+        frame == 0 &&
+        !call.HasArgument("quality") &&
+        !call.HasArgument("chroma-subsampling") &&
+        rendering.IsThumbnail(context.GetThumbnailsSize()) &&
+        AnswerThumbnail(call, context, call.GetUriComponent("id", "")))
+    {
+      return;
+    }
+
+    DecodedFramesCache::FramePointer decodedFrame;
+
+    try
+    {
+      decodedFrame = DecodeFrame(context, call.GetUriComponent("id", ""), frame);
+    }
+    catch (OrthancException& e)
+    {
+      if (e.GetErrorCode() == ErrorCode_ParameterOutOfRange)
+      {
+        // The frame number is out of the range for this DICOM
+        // instance, the resource is not existent
+      }
+      else
+      {
+        std::string root = "";
+        for (size_t i = 1; i < call.GetFullUri().size(); i++)
+        {
+          root += "../";
+        }
+
+        call.GetOutput().Redirect(root + "app/images/unsupported.png");
+      }
+    }
+
+    ImageExtractionMode encoding = mode;
     bool invert = false;
     std::auto_ptr<ImageAccessor> decoded;
 
-    try
+    if (decodedFrame.get() != NULL)
+    {
+      if ((mode == ImageExtractionMode_Preview ||
+           mode == ImageExtractionMode_UInt8) &&
+          (rendering.IsActive() ||
+           IsRenderable(decodedFrame->GetImage().GetFormat())))
+      {
+        // Fused windowing, downscaling and inversion, through a
+        // lookup table if the frame is not downscaled: The rendered
+        // image is already 8bpp and needs no further conversion
+        decoded.reset(rendering.Render(*decodedFrame, mode));
+
+        if (decoded->GetFormat() == PixelFormat_Grayscale8)
+        {
+          encoding = ImageExtractionMode_UInt8;
+        }
+      }
+      else
+      {
+        // The decoded frame is shared with the cache, and is modified
+        // by the encoding: Work on a copy
+        decoded.reset(Image::Clone(decodedFrame->GetImage()));
+        invert = (mode == ImageExtractionMode_Preview && decodedFrame->IsMonochrome1());
+      }
+    }
+
+    ImageToEncode image(decoded, encoding, invert, profile);
+
+    HttpContentNegociation negociation;
+    EncodePng png(image);          negociation.Register("image/png", png);
+    EncodeJpeg jpeg(image, call, context);  negociation.Register("image/jpeg", jpeg);
+
+    if (negociation.Apply(call.GetHttpHeaders()))
     {
-      std::string publicId = call.GetUriComponent("id", "");
+      image.Answer(call.GetOutput());
+    }
+  }
+
+
+  static bool LookupFrameRate(float& target,
+                              ParsedDicomFile& dicom)
+  {
+    float rate;
+    if ((LookupFloatTag(rate, dicom, DICOM_TAG_RECOMMENDED_DISPLAY_FRAME_RATE) && rate > 0) ||
+        (LookupFloatTag(rate, dicom, DICOM_TAG_CINE_RATE) && rate > 0))
+    {
+      target = rate;
+      return true;
+    }
+
+    float frameTime;  // In milliseconds
+    if (LookupFloatTag(frameTime, dicom, DICOM_TAG_FRAME_TIME) &&
+        frameTime > 0)
+    {
+      target = 1000.0f / frameTime;
+      return true;
+    }
+
+    return false;
+  }
+
+
+  namespace
+  {
+    class CineFrameEncoder : public CineStreamer::IFrameEncoder
+    {
+    private:
+      ServerContext&              context_;
+      const std::string&          publicId_;
+      const std::string&          dicomContent_;
+      ParsedDicomFile&            dicom_;
+      const RenderingParameters&  rendering_;
+      uint8_t                     quality_;
+      ImageEncoderProfile         profile_;
+      bool                        chromaSubsampling_;
+
+      DecodedFramesCache::FramePointer DecodeFrame(unsigned int frame)
+      {
+        // Reuse the frames that were already decoded by
+        // "/instances/.../frames/.../preview". The frames of the loop
+        // are not stored in the cache, as they would evict its whole
+        // content.
+        DecodedFramesCache::FramePointer result;
+        if (context_.GetDecodedFramesCache().Lookup(result, publicId_, frame))
+        {
+          return result;
+        }
+
+        std::auto_ptr<ImageAccessor> decoded;
 
 #if ORTHANC_ENABLE_PLUGINS == 1
-      if (context.GetPlugins().HasCustomImageDecoder())
-      {
-        // TODO create a cache of file
-        std::string dicomContent;
-        context.ReadDicom(dicomContent, publicId);
-        decoded.reset(context.GetPlugins().DecodeUnsafe(dicomContent.c_str(), dicomContent.size(), frame));
-
-        /**
-         * Note that we call "DecodeUnsafe()": We do not fallback to
-         * the builtin decoder if no installed decoder plugin is able
-         * to decode the image. This allows us to take advantage of
-         * the cache below.
-         **/
-
-        if (mode == ImageExtractionMode_Preview &&
-            decoded.get() != NULL)
+        if (context_.HasPlugins() &&
+            context_.GetPlugins().HasCustomImageDecoder())
+        {
+          decoded.reset(context_.GetPlugins().DecodeUnsafe(dicomContent_.c_str(), dicomContent_.size(), frame));
+        }
+#endif
+
+        if (decoded.get() == NULL)
         {
-          // TODO Optimize this lookup for photometric interpretation:
-          // It should be implemented by the plugin to avoid parsing
-          // twice the DICOM file
-          ParsedDicomFile parsed(dicomContent);
-          
-          PhotometricInterpretation photometric;
-          if (parsed.LookupPhotometricInterpretation(photometric))
+          // The index of the frames is computed once by the parsed
+          // file, and is shared by all the frames of the loop
+          decoded.reset(DicomImageDecoder::Decode(dicom_, frame));
+          if (decoded.get() == NULL)
           {
-            invert = (photometric == PhotometricInterpretation_Monochrome1);
+            throw OrthancException(ErrorCode_NotImplemented);
           }
         }
+
+        result.reset(CreateDecodedFrame(decoded.release(), dicom_));
+        return result;
       }
-#endif
 
-      if (decoded.get() == NULL)
+    public:
+      CineFrameEncoder(ServerContext& context,
+                       const std::string& publicId,
+                       const std::string& dicomContent,
+                       ParsedDicomFile& dicom,
+                       const RenderingParameters& rendering,
+                       uint8_t quality,
+                       ImageEncoderProfile profile,
+                       bool chromaSubsampling) :
+        context_(context),
+        publicId_(publicId),
+        dicomContent_(dicomContent),
+        dicom_(dicom),
+        rendering_(rendering),
+        quality_(quality),
+        profile_(profile),
+        chromaSubsampling_(chromaSubsampling)
+      {
+      }
+
+      virtual void Encode(std::string& target,
+                          unsigned int frame)
       {
-        // Use Orthanc's built-in decoder, using the cache to speed-up
-        // things on multi-frame images
-        ServerContext::DicomCacheLocker locker(context, publicId);        
-        decoded.reset(DicomImageDecoder::Decode(locker.GetDicom(), frame));
+        DecodedFramesCache::FramePointer decodedFrame = DecodeFrame(frame);
+
+        ImageExtractionMode encoding = ImageExtractionMode_Preview;
+        bool invert = false;
+        std::auto_ptr<ImageAccessor> image;
+
+        // Same rendering as "/instances/.../frames/.../preview"
+        if (rendering_.IsActive() ||
+            IsRenderable(decodedFrame->GetImage().GetFormat()))
+        {
+          image.reset(rendering_.Render(*decodedFrame, ImageExtractionMode_Preview));
 
-        PhotometricInterpretation photometric;
-        if (mode == ImageExtractionMode_Preview &&
-            locker.GetDicom().LookupPhotometricInterpretation(photometric))
+          if (image->GetFormat() == PixelFormat_Grayscale8)
+          {
+            encoding = ImageExtractionMode_UInt8;
+          }
+        }
+        else
         {
-          invert = (photometric == PhotometricInterpretation_Monochrome1);
+          image.reset(Image::Clone(decodedFrame->GetImage()));
+          invert = decodedFrame->IsMonochrome1();
         }
+
+        DicomImageDecoder::ExtractJpegImage(target, image, encoding, invert, quality_, profile_, chromaSubsampling_);
       }
+    };
+  }
+
+
+  static void GetCine(RestApiGetCall& call)
+  {
+    // Number of frames that are encoded ahead of the network
+    static const size_t MAX_PENDING_FRAMES = 16;
+
+    // The MJPEG stream is paced by sleeping in the HTTP thread, which
+    // is pinned for the whole loop: If the loop lasts longer than
+    // this number of seconds, its pace is increased accordingly
+    static const float MAX_PACED_DURATION = 60;
+
+    ServerContext& context = OrthancRestApi::GetContext(call);
+    const std::string publicId = call.GetUriComponent("id", "");
+
+    bool replace;
+    std::string format = call.GetArgument("format", "mjpeg");
+    if (format == "mjpeg")
+    {
+      replace = true;
     }
-    catch (OrthancException& e)
+    else if (format == "multipart")
     {
-      if (e.GetErrorCode() == ErrorCode_ParameterOutOfRange)
+      replace = false;
+    }
+    else
+    {
+      LOG(ERROR) << "Unknown format for a cine loop, must be \"mjpeg\" or \"multipart\": " << format;
+      throw OrthancException(ErrorCode_BadRequest);
+    }
+
+    RenderingParameters rendering(call);
+    ImageEncoderProfile profile = GetEncoderProfile(call, context);
+    uint8_t quality = static_cast<uint8_t>(GetJpegQuality(call));
+    bool chromaSubsampling = IsJpegChromaSubsampling(call, context);
+
+    float frameRate = 0;  // Unknown
+    if (call.HasArgument("fps"))
+    {
+      std::string v = call.GetArgument("fps", "");
+
+      try
       {
-        // The frame number is out of the range for this DICOM
-        // instance, the resource is not existent
+        frameRate = boost::lexical_cast<float>(v);
       }
-      else
+      catch (boost::bad_lexical_cast&)
       {
-        std::string root = "";
-        for (size_t i = 1; i < call.GetFullUri().size(); i++)
+      }
+
+      if (!(frameRate > 0))
+      {
+        LOG(ERROR) << "Bad frame rate (must be a positive number): " << v;
+        throw OrthancException(ErrorCode_BadRequest);
+      }
+    }
+
+    // The DICOM file is parsed once for the whole loop, without
+    // locking the cache of the server context (as in "VolumeReader")
+    std::string dicomContent;
+    context.ReadDicom(dicomContent, publicId);
+
+    ParsedDicomFile dicom(dicomContent);
+    const unsigned int count = dicom.GetFramesCount();
+
+    if (!call.HasArgument("fps"))
+    {
+      LookupFrameRate(frameRate, dicom);
+    }
+
+    CineFrameEncoder encoder(context, publicId, dicomContent, dicom, rendering, quality, profile, chromaSubsampling);
+    CineStreamer streamer(encoder, count, MAX_PENDING_FRAMES);
+
+    // Wait for the first frame before sending the HTTP status
+    std::string jpeg;
+    if (!streamer.Next(jpeg))
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    std::map<std::string, std::string> headers;
+    headers["Content-Type"] = "image/jpeg";
+
+    if (frameRate > 0)
+    {
+      headers["X-Orthanc-Frame-Rate"] = boost::lexical_cast<std::string>(frameRate);
+    }
+
+    RestApiOutput& output = call.GetOutput();
+    output.StartMultipart(replace ? "x-mixed-replace" : "mixed", "image/jpeg");
+
+    float pace = frameRate;
+    if (replace &&
+        frameRate > 0 &&
+        static_cast<float>(count) / frameRate > MAX_PACED_DURATION)
+    {
+      pace = static_cast<float>(count) / MAX_PACED_DURATION;
+      LOG(WARNING) << "The cine loop of instance " << publicId << " is streamed at "
+                   << pace << " fps instead of " << frameRate << " fps, so as not to exceed "
+                   << MAX_PACED_DURATION << " seconds";
+    }
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    unsigned int frame = 0;
+
+    do
+    {
+      if (replace &&
+          pace > 0 &&
+          frame > 0)
+      {
+        // The MJPEG clients display each part as soon as it is
+        // received: Pace the stream according to the frame rate
+        const boost::posix_time::ptime deadline = start + boost::posix_time::microseconds
+          (static_cast<int64_t>(1000000.0 * static_cast<double>(frame) / pace));
+
+        const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        if (now < deadline)
         {
-          root += "../";
+          boost::this_thread::sleep(deadline - now);
         }
-
-        call.GetOutput().Redirect(root + "app/images/unsupported.png");
       }
-    }
-
-    ImageToEncode image(decoded, mode, invert);
 
-    HttpContentNegociation negociation;
-    EncodePng png(image);          negociation.Register("image/png", png);
-    EncodeJpeg jpeg(image, call);  negociation.Register("image/jpeg", jpeg);
+      headers["X-Orthanc-Frame"] = boost::lexical_cast<std::string>(frame);
+      output.SendMultipartItem(jpeg, headers);
+      frame++;
+    }
+    while (streamer.Next(jpeg));
 
-    if (negociation.Apply(call.GetHttpHeaders()))
+    if (!streamer.IsSuccess() ||
+        frame != count)
     {
-      image.Answer(call.GetOutput());
+      // The HTTP status has already been sent: Abort the connection
+      // without writing the closing boundary, so that the client
+      // cannot mistake the truncated loop for a complete one
+      LOG(ERROR) << "Incomplete cine loop for instance " << publicId;
+      output.CloseConnection();
+      throw OrthancException(ErrorCode_NetworkProtocol);
     }
+
+    output.CloseMultipart();
   }
 
 
@@ -554,24 +1213,49 @@ namespace Orthanc
     }
 
     std::string publicId = call.GetUriComponent("id", "");
-    std::string raw, mime;
+
+    // As DICOM instances are immutable, the frames can be validated
+    // using the UUID of the DICOM file, which avoids parsing it if
+    // the client already has the frame in its cache
+    std::string etag;
+
+    FileInfo dicom;
+    if (OrthancRestApi::GetIndex(call).LookupAttachment(dicom, publicId, FileContentType_Dicom))
+    {
+      etag = ("\"" + dicom.GetUuid() + "-frame" + frameId + 
+              (GzipCompression ? "-gz" : "") + "\"");
+
+      if (call.GetOutput().AnswerNotModified(etag))
+      {
+        return;
+      }
+    }
+
+    BufferHttpSender sender;
+    sender.SetETag(etag);
+
+    std::string mime;
 
     {
       ServerContext::DicomCacheLocker locker(OrthancRestApi::GetContext(call), publicId);
-      locker.GetDicom().GetRawFrame(raw, mime, frame);
+      locker.GetDicom().GetRawFrame(sender.GetBuffer(), mime, frame);
     }
 
     if (GzipCompression)
     {
       GzipCompressor gzip;
       std::string compressed;
-      gzip.Compress(compressed, raw.empty() ? NULL : raw.c_str(), raw.size());
-      call.GetOutput().AnswerBuffer(compressed, "application/gzip");
+      gzip.Compress(compressed, sender.GetBuffer().empty() ? NULL : sender.GetBuffer().c_str(),
+                    sender.GetBuffer().size());
+      sender.GetBuffer().swap(compressed);
+      sender.SetContentType("application/gzip");
     }
     else
     {
-      call.GetOutput().AnswerBuffer(raw, mime);
+      sender.SetContentType(mime);
     }
+
+    call.GetOutput().AnswerStream(sender);
   }
 
 
@@ -907,6 +1591,11 @@ namespace Orthanc
     {
       allowed = true;
     }
+    else if (contentType == FileContentType_Thumbnail)
+    {
+      // The thumbnails are only a cache of the rendered previews
+      allowed = true;
+    }
     else
     {
       // It is forbidden to delete internal attachments, except for
@@ -1042,6 +1731,12 @@ namespace Orthanc
 
   static void GetSharedTags(RestApiGetCall& call)
   {
+    OrthancRestApi::CachedAnswer cached(call);
+    if (cached.IsHit())
+    {
+      return;
+    }
+
     ServerContext& context = OrthancRestApi::GetContext(call);
     std::string publicId = call.GetUriComponent("id", "");
     bool simplify = call.HasArgument("simplify");
@@ -1304,6 +1999,12 @@ namespace Orthanc
 
   static void GetChildInstancesTags(RestApiGetCall& call)
   {
+    OrthancRestApi::CachedAnswer cached(call);
+    if (cached.IsHit())
+    {
+      return;
+    }
+
     ServerContext& context = OrthancRestApi::GetContext(call);
     std::string publicId = call.GetUriComponent("id", "");
     bool simplify = call.HasArgument("simplify");
@@ -1393,6 +2094,12 @@ namespace Orthanc
 
   static void OrderSlices(RestApiGetCall& call)
   {
+    OrthancRestApi::CachedAnswer cached(call);
+    if (cached.IsHit())
+    {
+      return;
+    }
+
     const std::string id = call.GetUriComponent("id", "");
 
     ServerIndex& index = OrthancRestApi::GetIndex(call);
@@ -1404,6 +2111,443 @@ namespace Orthanc
   }
 
 
+  static void GetOrderedInstances(std::list<std::string>& target,
+                                  ServerIndex& index,
+                                  const std::string& seriesId)
+  {
+    try
+    {
+      SliceOrdering ordering(index, seriesId);
+
+      for (size_t i = 0; i < ordering.GetInstancesCount(); i++)
+      {
+        target.push_back(ordering.GetInstanceId(i));
+      }
+    }
+    catch (OrthancException&)
+    {
+      // The slices cannot be ordered (e.g. not a volume): Use the
+      // order of the index
+      std::list<std::string> instances;
+      index.GetChildInstances(instances, seriesId);
+      target.splice(target.end(), instances);
+    }
+  }
+
+
+  template <enum ResourceType resourceType,
+            bool frames>
+  static void GetBulkContent(RestApiGetCall& call)
+  {
+    // Number of items that are read from the storage area ahead of
+    // the network
+    static const size_t MAX_PENDING_ITEMS = 16;
+
+    ServerContext& context = OrthancRestApi::GetContext(call);
+    ServerIndex& index = context.GetIndex();
+
+    const std::string id = call.GetUriComponent("id", "");
+
+    ResourceType type;
+    if (!index.LookupResourceType(type, id) ||
+        type != resourceType)
+    {
+      return;   // Unknown resource (404)
+    }
+
+    std::list<std::string> instances;
+
+    if (resourceType == ResourceType_Series)
+    {
+      GetOrderedInstances(instances, index, id);
+    }
+    else
+    {
+      std::list<std::string> series;
+      index.GetChildren(series, id);
+
+      for (std::list<std::string>::const_iterator
+             it = series.begin(); it != series.end(); ++it)
+      {
+        GetOrderedInstances(instances, index, *it);
+      }
+    }
+
+    BulkContentReader reader(context, instances, frames, MAX_PENDING_ITEMS);
+
+    RestApiOutput& output = call.GetOutput();
+    output.StartMultipart("related", frames ? "application/octet-stream" : "application/dicom");
+
+    for (;;)
+    {
+      std::auto_ptr<BulkContentReader::Item> item(reader.Next());
+      if (item.get() == NULL)
+      {
+        break;
+      }
+
+      std::map<std::string, std::string> headers;
+      headers["Content-Type"] = item->GetContentType();
+      headers["Content-Location"] = item->GetLocation();
+
+      output.SendMultipartItem(item->GetContent(), headers);
+    }
+
+    if (!reader.IsSuccess())
+    {
+      // The HTTP status has already been sent: Abort the connection
+      // without writing the closing boundary, so that the client
+      // cannot mistake the truncated answer for a complete one
+      LOG(ERROR) << "Incomplete bulk retrieval of " << EnumerationToString(resourceType) << " " << id;
+      output.CloseConnection();
+      throw OrthancException(ErrorCode_NetworkProtocol);
+    }
+
+    output.CloseMultipart();
+  }
+
+
+  static bool ParseVector(std::vector<double>& result,
+                          const std::string& value,
+                          size_t expectedSize)
+  {
+    std::vector<std::string> tokens;
+    Toolbox::TokenizeString(tokens, value, '\\');
+
+    if (tokens.size() != expectedSize)
+    {
+      return false;
+    }
+
+    result.resize(tokens.size());
+
+    try
+    {
+      for (size_t i = 0; i < tokens.size(); i++)
+      {
+        result[i] = boost::lexical_cast<double>(Toolbox::StripSpaces(tokens[i]));
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+
+    return true;
+  }
+
+
+  static bool LookupVector(std::vector<double>& result,
+                           const DicomMap& tags,
+                           const DicomTag& tag,
+                           size_t expectedSize)
+  {
+    const DicomValue* value = tags.TestAndGetValue(tag);
+
+    return (value != NULL &&
+            !value->IsNull() &&
+            !value->IsBinary() &&
+            ParseVector(result, value->GetContent(), expectedSize));
+  }
+
+
+  static Json::Value FormatVector(const std::vector<double>& v)
+  {
+    Json::Value result = Json::arrayValue;
+
+    for (size_t i = 0; i < v.size(); i++)
+    {
+      result.append(v[i]);
+    }
+
+    return result;
+  }
+
+
+  static void GetSeriesVolumeHeader(RestApiGetCall& call)
+  {
+    OrthancRestApi::CachedAnswer cached(call);
+    if (cached.IsHit())
+    {
+      return;
+    }
+
+    ServerContext& context = OrthancRestApi::GetContext(call);
+    ServerIndex& index = context.GetIndex();
+
+    const std::string id = call.GetUriComponent("id", "");
+
+    ResourceType type;
+    if (!index.LookupResourceType(type, id) ||
+        type != ResourceType_Series)
+    {
+      return;   // Unknown resource (404)
+    }
+
+    SliceOrdering ordering(index, id);
+
+    if (ordering.GetInstancesCount() == 0)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    Json::Value slices = Json::arrayValue;
+
+    for (size_t i = 0; i < ordering.GetInstancesCount(); i++)
+    {
+      for (unsigned int frame = 0; frame < ordering.GetFramesCount(i); frame++)
+      {
+        Json::Value slice = Json::objectValue;
+        slice["Instance"] = ordering.GetInstanceId(i);
+        slice["Frame"] = frame;
+        slices.append(slice);
+      }
+    }
+
+    // The pixel spacing and the rescaling parameters are read from
+    // the first slice, as they are not part of the main DICOM tags
+    DicomMap first;
+
+    {
+      ServerContext::DicomCacheLocker locker(context, ordering.GetInstanceId(0));
+      locker.GetDicom().ExtractDicomSummary(first);
+    }
+
+    Json::Value result = Json::objectValue;
+    result["Slices"] = slices;
+    result["Depth"] = slices.size();
+
+    DicomImageInformation info(first);
+    result["Width"] = info.GetWidth();
+    result["Height"] = info.GetHeight();
+
+    PixelFormat format;
+    if (info.ExtractPixelFormat(format, false))
+    {
+      result["PixelFormat"] = EnumerationToString(format);
+    }
+
+    std::vector<double> spacing, tmp;
+    if (LookupVector(spacing, first, DICOM_TAG_PIXEL_SPACING, 2))
+    {
+      // "PixelSpacing" is stored as (row spacing, column spacing)
+      std::swap(spacing[0], spacing[1]);
+    }
+    else
+    {
+      spacing.resize(2);
+      spacing[0] = 1;
+      spacing[1] = 1;
+    }
+
+    // The spacing between the slices is derived from the positions
+    // of the first and of the last slices, as ordered by
+    // "SliceOrdering". Fallback to the slice thickness.
+    double z = 1;
+
+    DicomMap firstTags, lastTags;
+    std::vector<double> firstPosition, lastPosition;
+
+    if (ordering.GetInstancesCount() > 1 &&
+        index.GetMainDicomTags(firstTags, ordering.GetInstanceId(0),
+                               ResourceType_Instance, ResourceType_Instance) &&
+        index.GetMainDicomTags(lastTags, ordering.GetInstanceId(ordering.GetInstancesCount() - 1),
+                               ResourceType_Instance, ResourceType_Instance) &&
+        LookupVector(firstPosition, firstTags, DICOM_TAG_IMAGE_POSITION_PATIENT, 3) &&
+        LookupVector(lastPosition, lastTags, DICOM_TAG_IMAGE_POSITION_PATIENT, 3))
+    {
+      double d = 0;
+      for (size_t i = 0; i < 3; i++)
+      {
+        d += (lastPosition[i] - firstPosition[i]) * (lastPosition[i] - firstPosition[i]);
+      }
+
+      z = std::sqrt(d) / static_cast<double>(ordering.GetInstancesCount() - 1);
+      result["Origin"] = FormatVector(firstPosition);
+    }
+    else
+    {
+      if (LookupVector(tmp, first, DICOM_TAG_SLICE_THICKNESS, 1))
+      {
+        z = tmp[0];
+      }
+
+      if (LookupVector(tmp, first, DICOM_TAG_IMAGE_POSITION_PATIENT, 3))
+      {
+        result["Origin"] = FormatVector(tmp);
+      }
+    }
+
+    spacing.push_back(z);
+    result["Spacing"] = FormatVector(spacing);
+
+    if (LookupVector(tmp, first, DICOM_TAG_IMAGE_ORIENTATION_PATIENT, 6))
+    {
+      result["Orientation"] = FormatVector(tmp);
+    }
+
+    if (LookupVector(tmp, first, DICOM_TAG_RESCALE_SLOPE, 1))
+    {
+      result["RescaleSlope"] = tmp[0];
+    }
+
+    if (LookupVector(tmp, first, DICOM_TAG_RESCALE_INTERCEPT, 1))
+    {
+      result["RescaleIntercept"] = tmp[0];
+    }
+
+    call.GetOutput().AnswerJson(result);
+  }
+
+
+  static void GetSeriesVolume(RestApiGetCall& call)
+  {
+    // Number of instances that are decoded ahead of the network
+    static const size_t MAX_PENDING_INSTANCES = 16;
+    static const unsigned int MAX_DECODING_THREADS = 8;
+
+    ServerContext& context = OrthancRestApi::GetContext(call);
+    ServerIndex& index = context.GetIndex();
+
+    const std::string id = call.GetUriComponent("id", "");
+
+    ResourceType type;
+    if (!index.LookupResourceType(type, id) ||
+        type != ResourceType_Series)
+    {
+      return;   // Unknown resource (404)
+    }
+
+    bool numpy;
+    std::string format = call.GetArgument("format", "npy");
+    if (format == "npy")
+    {
+      numpy = true;
+    }
+    else if (format == "raw")
+    {
+      numpy = false;
+    }
+    else
+    {
+      LOG(ERROR) << "Unknown format for a volume, must be \"npy\" or \"raw\": " << format;
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (Toolbox::DetectEndianness() != Endianness_Little)
+    {
+      // The frames are written as they lie in memory
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    SliceOrdering ordering(index, id);
+
+    std::vector<std::string> instances;
+    unsigned int depth = 0;
+
+    for (size_t i = 0; i < ordering.GetInstancesCount(); i++)
+    {
+      instances.push_back(ordering.GetInstanceId(i));
+      depth += ordering.GetFramesCount(i);
+    }
+
+    if (depth == 0)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    unsigned int threads = boost::thread::hardware_concurrency();
+    if (threads == 0)
+    {
+      threads = 1;
+    }
+    else if (threads > MAX_DECODING_THREADS)
+    {
+      threads = MAX_DECODING_THREADS;
+    }
+
+    VolumeReader reader(context, instances, threads, MAX_PENDING_INSTANCES);
+
+    // The first frame gives the pixel format and the size of the
+    // volume, which are needed to format the header of the answer
+    std::auto_ptr<ImageAccessor> frame(reader.Next());
+    if (frame.get() == NULL)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    const PixelFormat pixelFormat = frame->GetFormat();
+    const unsigned int width = frame->GetWidth();
+    const unsigned int height = frame->GetHeight();
+    const size_t lineSize = GetBytesPerPixel(pixelFormat) * width;
+
+    std::string header;
+    if (numpy)
+    {
+      VolumeReader::FormatNumpyHeader(header, pixelFormat, width, height, depth);
+    }
+
+    RestApiOutput& output = call.GetOutput();
+    output.StartChunkedAnswer("application/octet-stream");
+
+    if (!header.empty())
+    {
+      output.SendChunk(header.c_str(), header.size());
+    }
+
+    // The frames may be padded at the end of their lines: Copy them
+    // into a contiguous buffer before sending
+    std::string buffer;
+    buffer.resize(lineSize * height);
+
+    unsigned int count = 0;
+    bool success = true;
+
+    while (frame.get() != NULL)
+    {
+      if (frame->GetFormat() != pixelFormat ||
+          frame->GetWidth() != width ||
+          frame->GetHeight() != height)
+      {
+        LOG(ERROR) << "The slices of series " << id << " do not share the same size or pixel format";
+        success = false;
+        break;
+      }
+
+      if (lineSize > 0)
+      {
+        for (unsigned int y = 0; y < height; y++)
+        {
+          memcpy(&buffer[y * lineSize], frame->GetConstRow(y), lineSize);
+        }
+
+        output.SendChunk(buffer.c_str(), buffer.size());
+      }
+
+      count++;
+      frame.reset(reader.Next());
+    }
+
+    if (success &&
+        (!reader.IsSuccess() || count != depth))
+    {
+      success = false;
+    }
+
+    if (!success)
+    {
+      // The HTTP status has already been sent: Abort the connection
+      // without writing the terminating chunk, so that the client
+      // cannot mistake the truncated volume for a complete one
+      LOG(ERROR) << "Incomplete volume export of series " << id;
+      output.CloseConnection();
+      throw OrthancException(ErrorCode_NetworkProtocol);
+    }
+
+    output.CloseChunkedAnswer();
+  }
+
+
   static void GetInstanceHeader(RestApiGetCall& call)
   {
     ServerContext& context = OrthancRestApi::GetContext(call);
@@ -1417,7 +2561,7 @@ namespace Orthanc
     // TODO Consider using "DicomMap::ParseDicomMetaInformation()" to
     // speed up things here
 
-    ParsedDicomFile dicom(dicomContent);
+    ParsedDicomFile dicom(dicomContent, true /* lazy pixel data */);
 
     Json::Value header;
     dicom.HeaderToJson(header, DicomToJsonFormat_Full);
@@ -1512,6 +2656,7 @@ namespace Orthanc
     Register("/instances/{id}/image-int16", GetImage<ImageExtractionMode_Int16>);
     Register("/instances/{id}/matlab", GetMatlabImage);
     Register("/instances/{id}/header", GetInstanceHeader);
+    Register("/instances/{id}/cine", GetCine);
 
     Register("/patients/{id}/protected", IsProtectedPatient);
     Register("/patients/{id}/protected", SetPatientProtection);
@@ -1561,6 +2706,12 @@ namespace Orthanc
     Register("/instances/{id}/content/*", GetRawContent);
 
     Register("/series/{id}/ordered-slices", OrderSlices);
+    Register("/series/{id}/bulk-files", GetBulkContent<ResourceType_Series, false>);
+    Register("/series/{id}/bulk-frames", GetBulkContent<ResourceType_Series, true>);
+    Register("/studies/{id}/bulk-files", GetBulkContent<ResourceType_Study, false>);
+    Register("/studies/{id}/bulk-frames", GetBulkContent<ResourceType_Study, true>);
+    Register("/series/{id}/volume", GetSeriesVolume);
+    Register("/series/{id}/volume-header", GetSeriesVolumeHeader);
 
     Register("/patients/{id}/reconstruct", ReconstructResource<ResourceType_Patient>);
     Register("/studies/{id}/reconstruct", ReconstructResource<ResourceType_Study>);
@@ -36,6 +36,7 @@
 
 #include "../OrthancInitialization.h"
 #include "../../Core/DicomParsing/FromDcmtkBridge.h"
+#include "../../Core/HttpServer/HttpStreamTranscoder.h"
 #include "../../Plugins/Engine/PluginsManager.h"
 #include "../../Plugins/Engine/OrthancPlugins.h"
 #include "../ServerContext.h"
@@ -90,6 +91,33 @@ namespace Orthanc
   {
     Json::Value result = Json::objectValue;
     OrthancRestApi::GetIndex(call).ComputeStatistics(result);
+
+    Json::Value transcoding = Json::objectValue;
+    HttpStreamTranscoder::GetStatistics(transcoding);
+    result["HttpTranscoding"] = transcoding;
+
+    Json::Value responseCache = Json::objectValue;
+    OrthancRestApi::GetContext(call).GetResponseCache().GetStatistics(responseCache);
+    result["ResponseCache"] = responseCache;
+
+    Json::Value decodedFrames = Json::objectValue;
+    OrthancRestApi::GetContext(call).GetDecodedFramesCache().GetStatistics(decodedFrames);
+    result["DecodedFramesCache"] = decodedFrames;
+
+    if (OrthancRestApi::GetContext(call).HasTranscodingService())
+    {
+      Json::Value storageTranscoding = Json::objectValue;
+      OrthancRestApi::GetContext(call).GetTranscodingService().GetStatistics(storageTranscoding);
+      result["StorageTranscoding"] = storageTranscoding;
+    }
+
+    call.GetOutput().AnswerJson(result);
+  }
+
+  static void GetPendingDeletions(RestApiGetCall& call)
+  {
+    Json::Value result;
+    OrthancRestApi::GetIndex(call).GetPendingDeletions(result);
     call.GetOutput().AnswerJson(result);
   }
 
@@ -272,6 +300,7 @@ namespace Orthanc
     Register("/system", GetSystemInformation);
     Register("/statistics", GetStatistics);
     Register("/tools/generate-uid", GenerateUid);
+    Register("/tools/pending-deletions", GetPendingDeletions);
     Register("/tools/execute-script", ExecuteScript);
     Register("/tools/now", GetNowIsoString);
     Register("/tools/dicom-conformance", GetDicomConformanceStatement);
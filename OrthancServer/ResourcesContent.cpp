@@ -0,0 +1,146 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "ResourcesContent.h"
+
+#include "IDatabaseWrapper.h"
+#include "ServerToolbox.h"
+#include "../Core/DicomFormat/DicomArray.h"
+#include "../Core/OrthancException.h"
+
+namespace Orthanc
+{
+  void ResourcesContent::AddMainDicomTagsInternal(int64_t resourceId,
+                                                  const DicomMap& tags)
+  {
+    DicomArray flattened(tags);
+
+    for (size_t i = 0; i < flattened.GetSize(); i++)
+    {
+      const DicomElement& element = flattened.GetElement(i);
+      const DicomTag& tag = element.GetTag();
+      const DicomValue& value = element.GetValue();
+      if (!value.IsNull() && 
+          !value.IsBinary())
+      {
+        AddMainDicomTag(resourceId, tag, value.GetContent());
+      }
+    }
+  }
+
+
+  void ResourcesContent::AddResource(int64_t resourceId,
+                                     ResourceType level,
+                                     const DicomMap& dicomSummary)
+  {
+    // Store the identifiers of the resource
+    {
+      const DicomTag* tags;
+      size_t size;
+
+      ServerToolbox::LoadIdentifiers(tags, size, level);
+
+      for (size_t i = 0; i < size; i++)
+      {
+        const DicomValue* value = dicomSummary.TestAndGetValue(tags[i]);
+        if (value != NULL &&
+            !value->IsNull() &&
+            !value->IsBinary())
+        {
+          std::string s = ServerToolbox::NormalizeIdentifier(value->GetContent());
+          AddIdentifierTag(resourceId, tags[i], s);
+        }
+      }
+    }
+
+    DicomMap tags;
+
+    switch (level)
+    {
+      case ResourceType_Patient:
+        dicomSummary.ExtractPatientInformation(tags);
+        break;
+
+      case ResourceType_Study:
+        // Duplicate the patient tags at the study level (new in Orthanc 0.9.5 - db v6)
+        dicomSummary.ExtractPatientInformation(tags);
+        AddMainDicomTagsInternal(resourceId, tags);
+
+        dicomSummary.ExtractStudyInformation(tags);
+        break;
+
+      case ResourceType_Series:
+        dicomSummary.ExtractSeriesInformation(tags);
+        break;
+
+      case ResourceType_Instance:
+        dicomSummary.ExtractInstanceInformation(tags);
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_InternalError);
+    }
+
+    AddMainDicomTagsInternal(resourceId, tags);
+  }
+
+
+  void ResourcesContent::Store(IDatabaseWrapper& database) const
+  {
+    for (ListTags::const_iterator it = identifierTags_.begin();
+         it != identifierTags_.end(); ++it)
+    {
+      database.SetIdentifierTag(it->GetResourceId(), it->GetTag(), it->GetValue());
+    }
+
+    for (ListTags::const_iterator it = mainDicomTags_.begin();
+         it != mainDicomTags_.end(); ++it)
+    {
+      database.SetMainDicomTag(it->GetResourceId(), it->GetTag(), it->GetValue());
+    }
+
+    for (ListMetadata::const_iterator it = metadata_.begin();
+         it != metadata_.end(); ++it)
+    {
+      database.SetMetadata(it->GetResourceId(), it->GetType(), it->GetValue());
+    }
+
+    for (ListAttachments::const_iterator it = attachments_.begin();
+         it != attachments_.end(); ++it)
+    {
+      database.AddAttachment(it->GetResourceId(), it->GetAttachment());
+    }
+  }
+}
@@ -0,0 +1,222 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "../Core/DicomFormat/DicomMap.h"
+#include "../Core/FileStorage/FileInfo.h"
+#include "ServerEnumerations.h"
+
+#include <list>
+#include <boost/noncopyable.hpp>
+
+namespace Orthanc
+{
+  class IDatabaseWrapper;
+
+  /**
+   * This class accumulates all the content (main DICOM tags,
+   * identifiers, metadata and attachments) that must be written into
+   * the index for a set of resources, so that it can be sent in one
+   * single call to the database back-end. This avoids one round-trip
+   * per primitive for network-backed index plugins.
+   **/
+  class ResourcesContent : public boost::noncopyable
+  {
+  public:
+    class TagValue
+    {
+    private:
+      int64_t      resourceId_;
+      DicomTag     tag_;
+      std::string  value_;
+
+    public:
+      TagValue(int64_t resourceId,
+               const DicomTag& tag,
+               const std::string& value) :
+        resourceId_(resourceId),
+        tag_(tag),
+        value_(value)
+      {
+      }
+
+      int64_t GetResourceId() const
+      {
+        return resourceId_;
+      }
+
+      const DicomTag& GetTag() const
+      {
+        return tag_;
+      }
+
+      const std::string& GetValue() const
+      {
+        return value_;
+      }
+    };
+
+    class Metadata
+    {
+    private:
+      int64_t       resourceId_;
+      MetadataType  metadata_;
+      std::string   value_;
+
+    public:
+      Metadata(int64_t resourceId,
+               MetadataType metadata,
+               const std::string& value) :
+        resourceId_(resourceId),
+        metadata_(metadata),
+        value_(value)
+      {
+      }
+
+      int64_t GetResourceId() const
+      {
+        return resourceId_;
+      }
+
+      MetadataType GetType() const
+      {
+        return metadata_;
+      }
+
+      const std::string& GetValue() const
+      {
+        return value_;
+      }
+    };
+
+    class Attachment
+    {
+    private:
+      int64_t   resourceId_;
+      FileInfo  attachment_;
+
+    public:
+      Attachment(int64_t resourceId,
+                 const FileInfo& attachment) :
+        resourceId_(resourceId),
+        attachment_(attachment)
+      {
+      }
+
+      int64_t GetResourceId() const
+      {
+        return resourceId_;
+      }
+
+      const FileInfo& GetAttachment() const
+      {
+        return attachment_;
+      }
+    };
+
+    typedef std::list<TagValue>    ListTags;
+    typedef std::list<Metadata>    ListMetadata;
+    typedef std::list<Attachment>  ListAttachments;
+
+  private:
+    ListTags         mainDicomTags_;
+    ListTags         identifierTags_;
+    ListMetadata     metadata_;
+    ListAttachments  attachments_;
+
+    void AddMainDicomTagsInternal(int64_t resourceId,
+                                  const DicomMap& tags);
+
+  public:
+    void AddMainDicomTag(int64_t resourceId,
+                         const DicomTag& tag,
+                         const std::string& value)
+    {
+      mainDicomTags_.push_back(TagValue(resourceId, tag, value));
+    }
+
+    void AddIdentifierTag(int64_t resourceId,
+                          const DicomTag& tag,
+                          const std::string& value)
+    {
+      identifierTags_.push_back(TagValue(resourceId, tag, value));
+    }
+
+    void AddMetadata(int64_t resourceId,
+                     MetadataType metadata,
+                     const std::string& value)
+    {
+      metadata_.push_back(Metadata(resourceId, metadata, value));
+    }
+
+    void AddAttachment(int64_t resourceId,
+                       const FileInfo& attachment)
+    {
+      attachments_.push_back(Attachment(resourceId, attachment));
+    }
+
+    // Adds the main DICOM tags and the identifiers of the resource,
+    // as extracted from the summary of one of its instances
+    void AddResource(int64_t resourceId,
+                     ResourceType level,
+                     const DicomMap& dicomSummary);
+
+    const ListTags& GetMainDicomTags() const
+    {
+      return mainDicomTags_;
+    }
+
+    const ListTags& GetIdentifierTags() const
+    {
+      return identifierTags_;
+    }
+
+    const ListMetadata& GetMetadata() const
+    {
+      return metadata_;
+    }
+
+    const ListAttachments& GetAttachments() const
+    {
+      return attachments_;
+    }
+
+    // Fallback implementation for database back-ends that have no
+    // native support for "IDatabaseWrapper::SetResourcesContent()":
+    // The content is written one primitive at a time.
+    // WARNING: The database should be locked with a transaction!
+    void Store(IDatabaseWrapper& database) const;
+  };
+}
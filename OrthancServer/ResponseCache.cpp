@@ -0,0 +1,309 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "ResponseCache.h"
+
+#include "../Core/Logging.h"
+
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+
+namespace Orthanc
+{
+  static std::string GetIndexKey(const std::string& resource,
+                                 const std::string& key)
+  {
+    return resource + "|" + key;
+  }
+
+
+  size_t ResponseCache::GetAnswerSize(const std::string& key,
+                                      const Answer& answer)
+  {
+    return key.size() + answer.content_.size() + answer.contentType_.size();
+  }
+
+
+  void ResponseCache::RemoveInternal(const std::string& key)
+  {
+    // WARNING: "mutex_" must be locked
+    std::auto_ptr<Answer> answer(index_.Invalidate(key));
+
+    assert(currentSize_ >= GetAnswerSize(key, *answer));
+    currentSize_ -= GetAnswerSize(key, *answer);
+
+    Resources::iterator resource = resources_.find(answer->resource_);
+    assert(resource != resources_.end());
+
+    resource->second.erase(key);
+    if (resource->second.empty())
+    {
+      resources_.erase(resource);
+    }
+  }
+
+
+  void ResponseCache::InvalidateInternal(const std::string& resource)
+  {
+    // WARNING: "mutex_" must be locked
+    generation_++;
+
+    if (pendingComputations_ > 0)
+    {
+      invalidations_[resource] = generation_;
+    }
+
+    Resources::iterator found = resources_.find(resource);
+    if (found != resources_.end())
+    {
+      // Copy the keys, as "RemoveInternal()" modifies "resources_"
+      std::set<std::string> keys = found->second;
+      for (std::set<std::string>::const_iterator 
+             it = keys.begin(); it != keys.end(); ++it)
+      {
+        RemoveInternal(*it);
+      }
+    }
+  }
+
+
+  void ResponseCache::ClearInternal()
+  {
+    // WARNING: "mutex_" must be locked
+    generation_++;
+    lastClear_ = generation_;
+    invalidations_.clear();
+
+    while (!index_.IsEmpty())
+    {
+      Answer* answer = NULL;
+      index_.RemoveOldest(answer);
+      delete answer;
+    }
+
+    resources_.clear();
+    currentSize_ = 0;
+  }
+
+
+  ResponseCache::ResponseCache() :
+    maximumSize_(0),
+    currentSize_(0),
+    generation_(0),
+    lastClear_(0),
+    pendingComputations_(0),
+    countHits_(0),
+    countMisses_(0)
+  {
+  }
+
+
+  ResponseCache::~ResponseCache()
+  {
+    ClearInternal();
+  }
+
+
+  void ResponseCache::SetMaximumSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    maximumSize_ = size;
+
+    while (currentSize_ > maximumSize_)
+    {
+      RemoveInternal(index_.GetOldest());
+    }
+  }
+
+
+  bool ResponseCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maximumSize_ > 0;
+  }
+
+
+  bool ResponseCache::Lookup(std::string& content,
+                             std::string& contentType,
+                             const std::string& resource,
+                             const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const std::string indexKey = GetIndexKey(resource, key);
+
+    Answer* answer = NULL;
+    if (index_.Contains(indexKey, answer))
+    {
+      assert(answer != NULL);
+      index_.MakeMostRecent(indexKey);
+      content = answer->content_;
+      contentType = answer->contentType_;
+      countHits_++;
+      return true;
+    }
+    else
+    {
+      countMisses_++;
+      return false;
+    }
+  }
+
+
+  uint64_t ResponseCache::StartComputation()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    pendingComputations_++;
+    return generation_;
+  }
+
+
+  void ResponseCache::EndComputation()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    assert(pendingComputations_ > 0);
+    pendingComputations_--;
+
+    if (pendingComputations_ == 0)
+    {
+      invalidations_.clear();
+    }
+  }
+
+
+  void ResponseCache::Store(uint64_t generation,
+                            const std::string& resource,
+                            const std::string& key,
+                            const std::string& content,
+                            const std::string& contentType)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (lastClear_ > generation)
+    {
+      return;  // The cache was cleared during the computation
+    }
+
+    Invalidations::const_iterator invalidation = invalidations_.find(resource);
+    if (invalidation != invalidations_.end() &&
+        invalidation->second > generation)
+    {
+      return;  // The resource has changed during the computation
+    }
+
+    const std::string indexKey = GetIndexKey(resource, key);
+
+    std::auto_ptr<Answer> answer(new Answer);
+    answer->resource_ = resource;
+    answer->content_ = content;
+    answer->contentType_ = contentType;
+
+    const size_t size = GetAnswerSize(indexKey, *answer);
+    if (size > maximumSize_)
+    {
+      return;  // Too large to fit in the cache
+    }
+
+    if (index_.Contains(indexKey))
+    {
+      // Concurrent computation of the same answer
+      RemoveInternal(indexKey);
+    }
+
+    while (currentSize_ + size > maximumSize_)
+    {
+      RemoveInternal(index_.GetOldest());
+    }
+
+    index_.Add(indexKey, answer.release());
+    resources_[resource].insert(indexKey);
+    currentSize_ += size;
+  }
+
+
+  void ResponseCache::Invalidate(const std::string& resource)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    InvalidateInternal(resource);
+  }
+
+
+  void ResponseCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ClearInternal();
+  }
+
+
+  void ResponseCache::SignalChange(const ServerIndexChange& change)
+  {
+    switch (change.GetChangeType())
+    {
+      case ChangeType_Deleted:
+        // The ancestors of a deleted resource are not signaled, which
+        // prevents a targeted invalidation. Deletions are rare enough
+        // for the whole cache to be cleared.
+        Clear();
+        break;
+
+      case ChangeType_StablePatient:
+      case ChangeType_StableStudy:
+      case ChangeType_StableSeries:
+      case ChangeType_CompletedSeries:
+        // These changes do not modify the content of the resource
+        break;
+
+      default:
+        // The parents of a new instance are signaled through
+        // "ChangeType_NewChildInstance"
+        Invalidate(change.GetPublicId());
+        break;
+    }
+  }
+
+
+  void ResponseCache::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["MaximumSize"] = boost::lexical_cast<std::string>(maximumSize_);
+    target["CurrentSize"] = boost::lexical_cast<std::string>(currentSize_);
+    target["CountAnswers"] = static_cast<unsigned int>(index_.GetSize());
+    target["CountHits"] = boost::lexical_cast<std::string>(countHits_);
+    target["CountMisses"] = boost::lexical_cast<std::string>(countMisses_);
+  }
+}
@@ -0,0 +1,133 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ServerIndexChange.h"
+#include "../Core/Cache/LeastRecentlyUsedIndex.h"
+
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <map>
+#include <set>
+
+namespace Orthanc
+{
+  /**
+   * Cache of the answers to REST calls that are expensive to compute,
+   * but that only depend on the content of one resource (e.g. the
+   * ordering of the slices of a series). Each answer is attached to
+   * a resource, and is invalidated as soon as a change is signaled
+   * on this resource. The cache is limited by its size in bytes.
+   *
+   * This class is thread-safe.
+   **/
+  class ResponseCache : public boost::noncopyable
+  {
+  private:
+    struct Answer
+    {
+      std::string  resource_;
+      std::string  content_;
+      std::string  contentType_;
+    };
+
+    typedef LeastRecentlyUsedIndex<std::string, Answer*>  Index;
+    typedef std::map<std::string, std::set<std::string> > Resources;
+    typedef std::map<std::string, uint64_t>               Invalidations;
+
+    boost::mutex   mutex_;
+    size_t         maximumSize_;
+    size_t         currentSize_;
+    Index          index_;
+    Resources      resources_;
+    
+    // To prevent an answer that was computed concurrently with a
+    // change from being stored, the generation of the last
+    // invalidation of each resource is kept while some answer is
+    // being computed
+    uint64_t       generation_;
+    uint64_t       lastClear_;
+    unsigned int   pendingComputations_;
+    Invalidations  invalidations_;
+
+    uint64_t       countHits_;
+    uint64_t       countMisses_;
+
+    void RemoveInternal(const std::string& key);
+
+    void InvalidateInternal(const std::string& resource);
+
+    void ClearInternal();
+
+    static size_t GetAnswerSize(const std::string& key,
+                                const Answer& answer);
+
+  public:
+    ResponseCache();
+
+    ~ResponseCache();
+
+    // The size is in bytes, "0" means that the cache is disabled
+    void SetMaximumSize(size_t size);
+
+    bool IsEnabled();
+
+    bool Lookup(std::string& content,
+                std::string& contentType,
+                const std::string& resource,
+                const std::string& key);
+
+    // Must be called before computing an answer that is to be stored
+    // in the cache. Returns the generation to be provided to "Store()".
+    uint64_t StartComputation();
+
+    // Must be called after each call to "StartComputation()", even if
+    // the computation has failed
+    void EndComputation();
+
+    void Store(uint64_t generation,
+               const std::string& resource,
+               const std::string& key,
+               const std::string& content,
+               const std::string& contentType);
+
+    void Invalidate(const std::string& resource);
+
+    void Clear();
+
+    void SignalChange(const ServerIndexChange& change);
+
+    void GetStatistics(Json::Value& target);
+  };
+}
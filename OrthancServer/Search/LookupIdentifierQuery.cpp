@@ -101,6 +101,21 @@ namespace Orthanc
   void LookupIdentifierQuery::Apply(SetOfResources& result,
                                     IDatabaseWrapper& database)
   {
+    if (GetSize() != 0)
+    {
+      // The whole query is sent at once to the database back-end
+      std::list<int64_t> a;
+      database.LookupIdentifiers(a, *this);
+      result.Intersect(a);
+    }
+  }
+
+
+  void LookupIdentifierQuery::ApplyWithPrimitives(std::list<int64_t>& result,
+                                                  IDatabaseWrapper& database) const
+  {
+    SetOfResources resources(database, level_);
+
     for (size_t i = 0; i < GetSize(); i++)
     {
       std::list<int64_t> a;
@@ -114,8 +129,10 @@ namespace Orthanc
         a.splice(a.end(), b);
       }
 
-      result.Intersect(a);
+      resources.Intersect(a);
     }
+
+    resources.Flatten(result);
   }
 
 
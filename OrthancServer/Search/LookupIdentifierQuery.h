@@ -158,6 +158,11 @@ namespace Orthanc
       return constraints_.size();
     }
 
+    const Disjunction& GetDisjunction(size_t index) const
+    {
+      return *constraints_[index];
+    }
+
     // The database must be locked
     void Apply(std::list<std::string>& result,
                IDatabaseWrapper& database);
@@ -165,6 +170,12 @@ namespace Orthanc
     void Apply(SetOfResources& result,
                IDatabaseWrapper& database);
 
+    // Fallback implementation for database back-ends that have no
+    // native support for "IDatabaseWrapper::LookupIdentifiers()":
+    // One "LookupIdentifier()" is issued per elementary constraint
+    void ApplyWithPrimitives(std::list<int64_t>& result,
+                             IDatabaseWrapper& database) const;
+
     void Print(std::ostream& s) const;
   };
 }
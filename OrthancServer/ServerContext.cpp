@@ -39,11 +39,13 @@
 #include "../Core/HttpServer/HttpStreamTranscoder.h"
 #include "../Core/Logging.h"
 #include "../Core/DicomParsing/FromDcmtkBridge.h"
+#include "../Core/DicomParsing/Internals/DicomImageDecoder.h"
 #include "ServerToolbox.h"
 #include "OrthancInitialization.h"
 
 #include <EmbeddedResources.h>
 #include <dcmtk/dcmdata/dcfilefo.h>
+#include <string.h>
 
 
 #include "Scheduler/CallSystemCommand.h"
@@ -60,6 +62,13 @@
 
 static const size_t DICOM_CACHE_SIZE = 2;
 
+// Maximum number of thumbnails waiting to be rendered, beyond which
+// the newly received instances get no thumbnail
+static const unsigned int MAX_PENDING_THUMBNAILS = 10000;
+
+// Maximum number of series waiting to be transcoded
+static const unsigned int MAX_PENDING_TRANSCODINGS = 10000;
+
 /**
  * IMPORTANT: We make the assumption that the same instance of
  * FileStorage can be accessed from multiple threads. This seems OK
@@ -127,13 +136,51 @@ namespace Orthanc
 #endif
     done_(false),
     queryRetrieveArchive_(Configuration::GetGlobalUnsignedIntegerParameter("QueryRetrieveSize", 10)),
-    defaultLocalAet_(Configuration::GetGlobalStringParameter("DicomAet", "ORTHANC"))
+    defaultLocalAet_(Configuration::GetGlobalStringParameter("DicomAet", "ORTHANC")),
+    imageEncoderProfile_(StringToImageEncoderProfile(
+                           Configuration::GetGlobalStringParameter("ImageEncoderProfile", "Balanced").c_str())),
+    jpegChromaSubsampling_(Configuration::GetGlobalBoolParameter("JpegChromaSubsampling", true))
   {
     uint64_t s = Configuration::GetGlobalUnsignedIntegerParameter("DicomAssociationCloseDelay", 5);  // In seconds
     scu_.SetMillisecondsBeforeClose(s * 1000);  // Milliseconds are expected here
 
+    // The size of the cache of REST answers is specified in MB
+    responseCache_.SetMaximumSize(static_cast<size_t>(
+      Configuration::GetGlobalUnsignedIntegerParameter("ResponseCacheSize", 16)) * 1024 * 1024);
+
+    // Idem for the cache of the decoded frames
+    decodedFrames_.SetMaximumSize(static_cast<size_t>(
+      Configuration::GetGlobalUnsignedIntegerParameter("DecodedFramesCacheSize", 64)) * 1024 * 1024);
+
+    if (Configuration::GetGlobalBoolParameter("Thumbnails", false))
+    {
+      unsigned int size = Configuration::GetGlobalUnsignedIntegerParameter("ThumbnailsSize", 128);
+      unsigned int threads = Configuration::GetGlobalUnsignedIntegerParameter("ThumbnailsThreads", 2);
+      LOG(WARNING) << "Rendering thumbnails of size " << size << " using " << threads << " threads";
+      thumbnails_.reset(new ThumbnailGenerator(*this, size, threads, MAX_PENDING_THUMBNAILS));
+    }
+
+    if (Configuration::GetGlobalBoolParameter("Transcoding", false))
+    {
+      unsigned int threads = Configuration::GetGlobalUnsignedIntegerParameter("TranscodingThreads", 1);
+      LOG(WARNING) << "Transcoding the stored instances in the background using " << threads << " threads";
+      transcoding_.reset(new TranscodingService(*this, threads, MAX_PENDING_TRANSCODINGS));
+      Configuration::SetupTranscodingPolicies(*transcoding_);
+      transcoding_->Start();
+    }
+
     listeners_.push_back(ServerListener(lua_, "Lua"));
 
+    if (thumbnails_.get() != NULL)
+    {
+      listeners_.push_back(ServerListener(*thumbnails_, "thumbnails"));
+    }
+
+    if (transcoding_.get() != NULL)
+    {
+      listeners_.push_back(ServerListener(*transcoding_, "transcoding"));
+    }
+
     changeThread_ = boost::thread(ChangeThread, this);
   }
 
@@ -165,6 +212,12 @@ namespace Orthanc
         changeThread_.join();
       }
 
+      // Wait for the thumbnails being rendered
+      thumbnails_.reset(NULL);
+
+      // Wait for the instances being transcoded
+      transcoding_.reset(NULL);
+
       scu_.Finalize();
 
       // Do not change the order below!
@@ -401,7 +454,7 @@ namespace Orthanc
       LOG(INFO) << "Reconstructing the missing DICOM-as-JSON summary for instance: "
                 << instancePublicId;
     
-      ParsedDicomFile parsed(dicom);
+      ParsedDicomFile parsed(dicom, true /* lazy pixel data */);
 
       Json::Value summary;
       parsed.DatasetToJson(summary);
@@ -457,7 +510,7 @@ namespace Orthanc
       std::string dicom;
       ReadDicom(dicom, instancePublicId);
 
-      ParsedDicomFile parsed(dicom);
+      ParsedDicomFile parsed(dicom, true /* lazy pixel data */);
       parsed.DatasetToJson(result, ignoreTagLength);
     }
   }
@@ -501,7 +554,10 @@ namespace Orthanc
   {
     std::string content;
     context_.ReadDicom(content, instancePublicId);
-    return new ParsedDicomFile(content);
+
+    // The pixel data is only parsed once it is accessed, as many
+    // users of the cache only need the DICOM tags or raw frames
+    return new ParsedDicomFile(content, true /* lazy pixel data */);
   }
 
 
@@ -558,16 +614,131 @@ namespace Orthanc
   }
 
 
+  bool ServerContext::SetThumbnail(const std::string& resourceId,
+                                   const std::string& jpeg,
+                                   bool replace)
+  {
+    // The JPEG files are not compressed any further
+    StorageAccessor accessor(area_);
+    FileInfo attachment = accessor.Write(jpeg, FileContentType_Thumbnail, CompressionType_None, storeMD5_);
+
+    if (index_.SetThumbnail(attachment, resourceId, replace))
+    {
+      return true;
+    }
+    else
+    {
+      accessor.Remove(attachment);
+      return false;
+    }
+  }
+
+
+  static bool HasSamePixels(const std::string& source,
+                            const std::string& target)
+  {
+    ParsedDicomFile a(source);
+    ParsedDicomFile b(target);
+
+    const unsigned int count = a.GetFramesCount();
+    if (b.GetFramesCount() != count)
+    {
+      return false;
+    }
+
+    for (unsigned int frame = 0; frame < count; frame++)
+    {
+      std::auto_ptr<ImageAccessor> x(DicomImageDecoder::Decode(a, frame));
+      std::auto_ptr<ImageAccessor> y(DicomImageDecoder::Decode(b, frame));
+
+      if (x->GetFormat() != y->GetFormat() ||
+          x->GetWidth() != y->GetWidth() ||
+          x->GetHeight() != y->GetHeight())
+      {
+        return false;
+      }
+
+      const size_t lineSize = x->GetWidth() * x->GetBytesPerPixel();
+
+      for (unsigned int row = 0; row < x->GetHeight(); row++)
+      {
+        if (memcmp(x->GetConstRow(row), y->GetConstRow(row), lineSize) != 0)
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+
+  void ServerContext::ReplaceDicom(const std::string& instancePublicId,
+                                   const std::string& source,
+                                   const std::string& target,
+                                   const std::string& transferSyntax)
+  {
+    // Make sure that the transcoding is lossless before dropping the
+    // original file
+    if (!HasSamePixels(source, target))
+    {
+      LOG(ERROR) << "The transcoding of instance " << instancePublicId
+                 << " to transfer syntax " << transferSyntax << " has modified its pixels";
+      throw OrthancException(ErrorCode_InternalError);
+    }
+
+    CompressionType compression = (compressionEnabled_ ? CompressionType_ZlibWithSize : CompressionType_None);
+
+    StorageAccessor accessor(area_);
+    FileInfo attachment = accessor.Write(target, FileContentType_Dicom, compression, storeMD5_);
+
+    if (!index_.ReplaceDicom(attachment, instancePublicId, transferSyntax))
+    {
+      accessor.Remove(attachment);
+      throw OrthancException(ErrorCode_UnknownResource);
+    }
+
+    boost::mutex::scoped_lock lock(dicomCacheMutex_);
+    dicomCache_.Invalidate(instancePublicId);
+  }
+
+
+  TranscodingService& ServerContext::GetTranscodingService()
+  {
+    if (transcoding_.get() == NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    return *transcoding_;
+  }
+
+
   bool ServerContext::DeleteResource(Json::Value& target,
                                      const std::string& uuid,
                                      ResourceType expectedType)
   {
-    return index_.DeleteResource(target, uuid, expectedType);
+    if (index_.DeleteResource(target, uuid, expectedType))
+    {
+      // The resource is hidden at once, but the "Deleted" changes
+      // are only signaled once its instances are reclaimed
+      responseCache_.Clear();
+      return true;
+    }
+    else
+    {
+      return false;
+    }
   }
 
 
   void ServerContext::SignalChange(const ServerIndexChange& change)
   {
+    // The cached REST answers and decoded frames are invalidated
+    // synchronously, so that they never get out of sync with the index
+    responseCache_.SignalChange(change);
+    decodedFrames_.SignalChange(change);
+
     pendingChanges_.Enqueue(change.Clone());
   }
 
@@ -583,6 +754,16 @@ namespace Orthanc
     listeners_.clear();
     listeners_.push_back(ServerListener(lua_, "Lua"));
     listeners_.push_back(ServerListener(plugins, "plugin"));
+
+    if (thumbnails_.get() != NULL)
+    {
+      listeners_.push_back(ServerListener(*thumbnails_, "thumbnails"));
+    }
+
+    if (transcoding_.get() != NULL)
+    {
+      listeners_.push_back(ServerListener(*transcoding_, "transcoding"));
+    }
   }
 
 
@@ -595,6 +776,16 @@ namespace Orthanc
     // TODO REFACTOR THIS
     listeners_.clear();
     listeners_.push_back(ServerListener(lua_, "Lua"));
+
+    if (thumbnails_.get() != NULL)
+    {
+      listeners_.push_back(ServerListener(*thumbnails_, "thumbnails"));
+    }
+
+    if (transcoding_.get() != NULL)
+    {
+      listeners_.push_back(ServerListener(*transcoding_, "transcoding"));
+    }
   }
 
 
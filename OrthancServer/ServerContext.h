@@ -40,13 +40,17 @@
 #include "../Core/Lua/LuaContext.h"
 #include "../Core/RestApi/RestApiOutput.h"
 #include "../Plugins/Engine/OrthancPlugins.h"
+#include "DecodedFramesCache.h"
 #include "DicomInstanceToStore.h"
 #include "../Core/DicomNetworking/ReusableDicomUserConnection.h"
 #include "IServerListener.h"
+#include "ResponseCache.h"
 #include "LuaScripting.h"
 #include "../Core/DicomParsing/ParsedDicomFile.h"
 #include "Scheduler/ServerScheduler.h"
 #include "ServerIndex.h"
+#include "ThumbnailGenerator.h"
+#include "TranscodingService.h"
 #include "OrthancHttpHandler.h"
 
 #include <boost/filesystem.hpp>
@@ -109,6 +113,8 @@ namespace Orthanc
     void ReadDicomAsJsonInternal(std::string& result,
                                  const std::string& instancePublicId);
 
+    ResponseCache responseCache_;  // Must be constructed before "index_"
+    DecodedFramesCache decodedFrames_;  // Idem
     ServerIndex index_;
     IStorageArea& area_;
 
@@ -130,6 +136,9 @@ namespace Orthanc
     ServerListeners listeners_;
     boost::recursive_mutex listenersMutex_;
 
+    std::auto_ptr<ThumbnailGenerator>  thumbnails_;
+    std::auto_ptr<TranscodingService>  transcoding_;
+
     bool done_;
     SharedMessageQueue  pendingChanges_;
     boost::thread  changeThread_;
@@ -137,6 +146,8 @@ namespace Orthanc
     SharedArchive  queryRetrieveArchive_;
     std::string defaultLocalAet_;
     OrthancHttpHandler  httpHandler_;
+    ImageEncoderProfile  imageEncoderProfile_;
+    bool                 jpegChromaSubsampling_;
 
   public:
     class DicomCacheLocker : public boost::noncopyable
@@ -183,9 +194,24 @@ namespace Orthanc
                        const void* data,
                        size_t size);
 
+    // Returns "false" if the resource does not exist, or if it
+    // already has a thumbnail and "replace" is "false"
+    bool SetThumbnail(const std::string& resourceId,
+                      const std::string& jpeg,
+                      bool replace);
+
     StoreStatus Store(std::string& resultPublicId,
                       DicomInstanceToStore& dicom);
 
+    // Replaces the DICOM file of an instance by another encoding of
+    // the same instance, using the given transfer syntax. The pixels
+    // of "target" must be identical to those of "source", that is the
+    // current DICOM file of the instance.
+    void ReplaceDicom(const std::string& instancePublicId,
+                      const std::string& source,
+                      const std::string& target,
+                      const std::string& transferSyntax);
+
     void AnswerAttachment(RestApiOutput& output,
                           const std::string& resourceId,
                           FileContentType content);
@@ -269,11 +295,48 @@ namespace Orthanc
       return lua_;
     }
 
+    ResponseCache& GetResponseCache()
+    {
+      return responseCache_;
+    }
+
+    DecodedFramesCache& GetDecodedFramesCache()
+    {
+      return decodedFrames_;
+    }
+
     OrthancHttpHandler& GetHttpHandler()
     {
       return httpHandler_;
     }
 
+    // Default profile of the PNG/JPEG encoders of the rendered images
+    ImageEncoderProfile GetImageEncoderProfile() const
+    {
+      return imageEncoderProfile_;
+    }
+
+    // Whether the chrominance of the rendered color JPEG images is
+    // subsampled (4:2:0) by default
+    bool IsJpegChromaSubsampling() const
+    {
+      return jpegChromaSubsampling_;
+    }
+
+    // Size of the thumbnails that are rendered in the background, or
+    // 0 if this feature is disabled
+    unsigned int GetThumbnailsSize() const
+    {
+      return (thumbnails_.get() == NULL ? 0 : thumbnails_->GetSize());
+    }
+
+    bool HasTranscodingService() const
+    {
+      return transcoding_.get() != NULL;
+    }
+
+    TranscodingService& GetTranscodingService();
+
     void Stop();
 
     void Apply(std::list<std::string>& result,
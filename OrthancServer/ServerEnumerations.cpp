@@ -70,6 +70,7 @@ namespace Orthanc
 
     dictContentType_.Add(FileContentType_Dicom, "dicom");
     dictContentType_.Add(FileContentType_DicomAsJson, "dicom-as-json");
+    dictContentType_.Add(FileContentType_Thumbnail, "thumbnail");
   }
 
   void RegisterUserMetadata(int metadata,
@@ -178,6 +179,9 @@ namespace Orthanc
       case FileContentType_DicomAsJson:
         return "application/json";
 
+      case FileContentType_Thumbnail:
+        return "image/jpeg";
+
       default:
         return "application/octet-stream";
     }
@@ -76,7 +76,10 @@ namespace Orthanc
     GlobalProperty_DatabaseSchemaVersion = 1,   // Unused in the Orthanc core as of Orthanc 0.9.5
     GlobalProperty_FlushSleep = 2,
     GlobalProperty_AnonymizationSequence = 3,
-    GlobalProperty_DatabasePatchLevel = 4       // Reserved for internal use of the database plugins
+    GlobalProperty_DatabasePatchLevel = 4,      // Reserved for internal use of the database plugins
+    GlobalProperty_PendingDeletions = 5,        // Resources whose deletion is not completed yet
+    GlobalProperty_FilesToRemove = 6,           // Files that are not referenced by the index anymore
+    GlobalProperty_ThumbnailsSize = 7           // Total size of the thumbnails, excluded from the quota
   };
 
   enum MetadataType
@@ -50,61 +50,155 @@
 #include "../Core/DicomParsing/FromDcmtkBridge.h"
 #include "ServerContext.h"
 #include "DicomInstanceToStore.h"
+#include "DatabaseReadersPool.h"
+#include "ResourcesContent.h"
 #include "Search/LookupResource.h"
 
+#include <algorithm>
+#include <stack>
 #include <boost/lexical_cast.hpp>
 #include <stdio.h>
 
 static const uint64_t MEGA_BYTES = 1024 * 1024;
 
+// Maximum number of instances that are reclaimed within one single
+// transaction, while deleting a large resource
+static const size_t DELETION_BATCH_SIZE = 100;
+
+// Maximum number of files that are removed from the storage area
+// before their journal is updated
+static const size_t FILES_REMOVAL_BATCH_SIZE = 100;
+
+// Default number of clients that can long-poll the changes at once
+static const unsigned int DEFAULT_MAX_CHANGES_WAITERS = 4;
+
+// Maximum number of entries that are removed from the logs of changes
+// and of exported resources within one single transaction
+static const unsigned int HISTORY_PRUNING_BATCH_SIZE = 1000;
+
 namespace Orthanc
 {
-  class ServerIndex::Listener : public IDatabaseListener
+  class ServerIndex::PendingDeletion : public boost::noncopyable
   {
   private:
-    struct FileToRemove
+    uint64_t      sequence_;
+    int64_t       internalId_;
+    ResourceType  type_;
+    std::string   publicId_;
+    bool          hasCountInstances_;
+    size_t        countInstances_;
+    size_t        removedInstances_;
+
+  public:
+    // Only the top-level resource is recorded: Its descendants are
+    // hidden through their ancestors, and they are only explored by
+    // the background thread that reclaims them
+    PendingDeletion(uint64_t sequence,
+                    int64_t internalId,
+                    ResourceType type,
+                    const std::string& publicId) :
+      sequence_(sequence),
+      internalId_(internalId),
+      type_(type),
+      publicId_(publicId),
+      hasCountInstances_(false),
+      countInstances_(0),
+      removedInstances_(0)
+    {
+    }
+
+    uint64_t GetSequence() const
+    {
+      return sequence_;
+    }
+
+    int64_t GetInternalId() const
+    {
+      return internalId_;
+    }
+
+    ResourceType GetResourceType() const
+    {
+      return type_;
+    }
+
+    const std::string& GetPublicId() const
+    {
+      return publicId_;
+    }
+
+    bool HasCountInstances() const
+    {
+      return hasCountInstances_;
+    }
+
+    void SetCountInstances(size_t count)
+    {
+      hasCountInstances_ = true;
+      countInstances_ = count;
+    }
+
+    void SignalRemovedInstances(size_t count)
     {
-    private:
-      std::string  uuid_;
-      FileContentType  type_;
+      removedInstances_ += count;
 
-    public:
-      FileToRemove(const FileInfo& info) : uuid_(info.GetUuid()), 
-                                           type_(info.GetContentType())
+      if (hasCountInstances_)
       {
+        removedInstances_ = std::min(countInstances_, removedInstances_);
       }
+    }
+
+    void Format(Json::Value& target) const
+    {
+      target = Json::objectValue;
+      target["ID"] = publicId_;
+      target["Type"] = EnumerationToString(type_);
+      target["RemovedInstances"] = static_cast<unsigned int>(removedInstances_);
 
-      const std::string& GetUuid() const
+      if (hasCountInstances_)
       {
-        return uuid_;
+        target["CountInstances"] = static_cast<unsigned int>(countInstances_);
       }
-
-      FileContentType GetContentType() const 
+      else
       {
-        return type_;
+        // Not counted yet by the background thread
+        target["CountInstances"] = Json::nullValue;
       }
-    };
+    }
+  };
 
+
+  class ServerIndex::Listener : public IDatabaseListener
+  {
+  private:
+    ServerIndex& index_;
     ServerContext& context_;
     bool hasRemainingLevel_;
     ResourceType remainingType_;
     std::string remainingPublicId_;
-    std::list<FileToRemove> pendingFilesToRemove_;
+    std::list<FileInfo> pendingFilesToRemove_;
     std::list<ServerIndexChange> pendingChanges_;
+    std::set<std::string> removedFiles_;
     uint64_t sizeOfFilesToRemove_;
+    uint64_t sizeOfThumbnailsToRemove_;
     bool insideTransaction_;
 
     void Reset()
     {
       sizeOfFilesToRemove_ = 0;
+      sizeOfThumbnailsToRemove_ = 0;
       hasRemainingLevel_ = false;
       pendingFilesToRemove_.clear();
       pendingChanges_.clear();
+      removedFiles_.clear();
     }
 
   public:
-    Listener(ServerContext& context) : context_(context),
-                                       insideTransaction_(false)      
+    Listener(ServerIndex& index,
+             ServerContext& context) : 
+      index_(index),
+      context_(context),
+      insideTransaction_(false)      
     {
       Reset();
       assert(ResourceType_Patient < ResourceType_Study &&
@@ -128,13 +222,34 @@ namespace Orthanc
       return sizeOfFilesToRemove_;
     }
 
+    uint64_t GetSizeOfThumbnailsToRemove()
+    {
+      return sizeOfThumbnailsToRemove_;
+    }
+
+    // The files that have already been removed from the storage area
+    // before the current transaction (while reclaiming a deleted
+    // resource) are not put into the journal
+    void SetRemovedFiles(const std::set<std::string>& uuids)
+    {
+      removedFiles_ = uuids;
+    }
+
+    const std::list<FileInfo>& GetPendingFilesToRemove() const
+    {
+      return pendingFilesToRemove_;
+    }
+
     void CommitFilesToRemove()
     {
-      for (std::list<FileToRemove>::const_iterator 
+      // The files are not referenced by the index anymore: They are
+      // removed from the storage area by a background thread, so that
+      // the global mutex is not held while accessing the filesystem
+      for (std::list<FileInfo>::const_iterator 
              it = pendingFilesToRemove_.begin();
            it != pendingFilesToRemove_.end(); ++it)
       {
-        context_.RemoveFile(it->GetUuid(), it->GetContentType());
+        index_.filesToRemove_[it->GetUuid()] = *it;
       }
     }
 
@@ -146,6 +261,11 @@ namespace Orthanc
       {
         context_.SignalChange(*it);
       }
+
+      if (!pendingChanges_.empty())
+      {
+        index_.SignalNewChanges();
+      }
     }
 
     virtual void SignalRemainingAncestor(ResourceType parentType,
@@ -172,8 +292,17 @@ namespace Orthanc
     virtual void SignalFileDeleted(const FileInfo& info)
     {
       assert(Toolbox::IsUuid(info.GetUuid()));
-      pendingFilesToRemove_.push_back(FileToRemove(info));
       sizeOfFilesToRemove_ += info.GetCompressedSize();
+
+      if (info.GetContentType() == FileContentType_Thumbnail)
+      {
+        sizeOfThumbnailsToRemove_ += info.GetCompressedSize();
+      }
+
+      if (removedFiles_.find(info.GetUuid()) == removedFiles_.end())
+      {
+        pendingFilesToRemove_.push_back(info);
+      }
     }
 
     virtual void SignalChange(const ServerIndexChange& change)
@@ -189,6 +318,7 @@ namespace Orthanc
       else
       {
         context_.SignalChange(change);
+        index_.SignalNewChanges();
       }
     }
 
@@ -217,11 +347,13 @@ namespace Orthanc
     ServerIndex& index_;
     std::auto_ptr<SQLite::ITransaction> transaction_;
     bool isCommitted_;
+    uint64_t sizeOfAddedThumbnails_;
 
   public:
     Transaction(ServerIndex& index) : 
       index_(index),
-      isCommitted_(false)
+      isCommitted_(false),
+      sizeOfAddedThumbnails_(0)
     {
       transaction_.reset(index_.db_.StartTransaction());
       transaction_->Begin();
@@ -241,10 +373,35 @@ namespace Orthanc
       }
     }
 
+    // The added thumbnails must also be part of "sizeOfAddedFiles"
+    void AddThumbnail(uint64_t size)
+    {
+      sizeOfAddedThumbnails_ += size;
+    }
+
     void Commit(uint64_t sizeOfAddedFiles)
     {
       if (!isCommitted_)
       {
+        // The files that are released by this transaction are
+        // journaled within the transaction itself, so that they are
+        // not lost if Orthanc stops before removing them
+        const std::list<FileInfo>& files = index_.listener_->GetPendingFilesToRemove();
+        if (!files.empty())
+        {
+          index_.SaveFilesToRemove(files, std::set<std::string>());
+        }
+
+        uint64_t thumbnailsSize = index_.thumbnailsSize_ + sizeOfAddedThumbnails_;
+        uint64_t removedThumbnails = index_.listener_->GetSizeOfThumbnailsToRemove();
+        thumbnailsSize = (thumbnailsSize >= removedThumbnails ? thumbnailsSize - removedThumbnails : 0);
+
+        if (thumbnailsSize != index_.thumbnailsSize_)
+        {
+          index_.db_.SetGlobalProperty(GlobalProperty_ThumbnailsSize,
+                                       boost::lexical_cast<std::string>(thumbnailsSize));
+        }
+
         transaction_->Commit();
 
         // We can remove the files once the SQLite transaction has
@@ -257,6 +414,8 @@ namespace Orthanc
         assert(index_.currentStorageSize_ >= index_.listener_->GetSizeOfFilesToRemove());
         index_.currentStorageSize_ -= index_.listener_->GetSizeOfFilesToRemove();
 
+        index_.thumbnailsSize_ = thumbnailsSize;
+
         // Send all the pending changes to the Orthanc plugins
         index_.listener_->CommitChanges();
 
@@ -266,6 +425,70 @@ namespace Orthanc
   };
 
 
+  /**
+   * Gives access to the database for read-only requests. If a pool of
+   * read-only connections is available, one of them is borrowed and
+   * the global mutex is left free for the writer. Otherwise, the
+   * global mutex is locked and the main connection is used.
+   **/
+  class ServerIndex::ReadOnlyAccessor : public boost::noncopyable
+  {
+  private:
+    ServerIndex&  index_;
+    std::auto_ptr<boost::mutex::scoped_lock>      lock_;
+    std::auto_ptr<DatabaseReadersPool::Accessor>  reader_;
+
+  public:
+    explicit ReadOnlyAccessor(ServerIndex& index) :
+      index_(index)
+    {
+      DatabaseReadersPool* readers;
+
+      {
+        // The pool is set once, and is never released before the
+        // destruction of the index: The pointer can be used after the
+        // mutex is unlocked
+        boost::mutex::scoped_lock lock(index.readersMutex_);
+        readers = index.readers_.get();
+      }
+
+      if (readers == NULL)
+      {
+        lock_.reset(new boost::mutex::scoped_lock(index.mutex_));
+      }
+      else
+      {
+        reader_.reset(new DatabaseReadersPool::Accessor(*readers));
+      }
+    }
+
+    IDatabaseWrapper& GetDatabase()
+    {
+      if (reader_.get() == NULL)
+      {
+        return index_.db_;
+      }
+      else
+      {
+        return reader_->GetDatabase();
+      }
+    }
+
+    bool IsUnstableResource(int64_t id)
+    {
+      if (lock_.get() != NULL)
+      {
+        return index_.unstableResources_.Contains(id);
+      }
+      else
+      {
+        boost::mutex::scoped_lock lock(index_.mutex_);
+        return index_.unstableResources_.Contains(id);
+      }
+    }
+  };
+
+
   class ServerIndex::UnstableResourcePayload
   {
   private:
@@ -303,251 +526,1101 @@ namespace Orthanc
   };
 
 
-  bool ServerIndex::DeleteResource(Json::Value& target,
-                                   const std::string& uuid,
-                                   ResourceType expectedType)
+  static void CollectInstancesToDelete(std::list<int64_t>& instances,
+                                       IDatabaseWrapper& db,
+                                       int64_t resource,
+                                       ResourceType type,
+                                       size_t maxCount)
   {
-    boost::mutex::scoped_lock lock(mutex_);
-
-    Transaction t(*this);
+    // Depth-first exploration of the children of "resource", that
+    // stops as soon as more than "maxCount" instances are found
+    instances.clear();
 
-    int64_t id;
-    ResourceType type;
-    if (!db_.LookupResource(id, type, uuid) ||
-        expectedType != type)
+    if (type == ResourceType_Instance)
     {
-      return false;
+      instances.push_back(resource);
+      return;
     }
-      
-    db_.DeleteResource(id);
 
-    if (listener_->HasRemainingLevel())
-    {
-      ResourceType type = listener_->GetRemainingType();
-      const std::string& uuid = listener_->GetRemainingPublicId();
+    std::stack< std::pair<int64_t, ResourceType> > toExplore;
+    toExplore.push(std::make_pair(resource, type));
 
-      target["RemainingAncestor"] = Json::Value(Json::objectValue);
-      target["RemainingAncestor"]["Path"] = GetBasePath(type, uuid);
-      target["RemainingAncestor"]["Type"] = EnumerationToString(type);
-      target["RemainingAncestor"]["ID"] = uuid;
-    }
-    else
+    while (!toExplore.empty() &&
+           instances.size() <= maxCount)
     {
-      target["RemainingAncestor"] = Json::nullValue;
-    }
-
-    t.Commit(0);
-
-    return true;
-  }
-
+      std::pair<int64_t, ResourceType> current = toExplore.top();
+      toExplore.pop();
 
-  void ServerIndex::FlushThread(ServerIndex* that)
-  {
-    // By default, wait for 10 seconds before flushing
-    unsigned int sleep = 10;
+      std::list<int64_t> children;
+      db.GetChildrenInternalId(children, current.first);
 
-    try
-    {
-      boost::mutex::scoped_lock lock(that->mutex_);
-      std::string sleepString;
+      ResourceType childType = GetChildResourceType(current.second);
 
-      if (that->db_.LookupGlobalProperty(sleepString, GlobalProperty_FlushSleep) &&
-          Toolbox::IsInteger(sleepString))
+      for (std::list<int64_t>::const_iterator 
+             it = children.begin(); it != children.end(); ++it)
       {
-        sleep = boost::lexical_cast<unsigned int>(sleepString);
+        if (childType == ResourceType_Instance)
+        {
+          instances.push_back(*it);
+        }
+        else
+        {
+          toExplore.push(std::make_pair(*it, childType));
+        }
       }
     }
-    catch (boost::bad_lexical_cast&)
+  }
+
+
+  static size_t CountInstancesToDelete(IDatabaseWrapper& db,
+                                       int64_t resource,
+                                       ResourceType type)
+  {
+    // The children of the series are counted without being listed
+    // individually, so the cost depends on the number of series
+    if (type == ResourceType_Instance)
     {
+      return 1;
     }
 
-    LOG(INFO) << "Starting the database flushing thread (sleep = " << sleep << ")";
+    size_t count = 0;
 
-    unsigned int count = 0;
+    std::stack< std::pair<int64_t, ResourceType> > toExplore;
+    toExplore.push(std::make_pair(resource, type));
 
-    while (!that->done_)
+    while (!toExplore.empty())
     {
-      boost::this_thread::sleep(boost::posix_time::seconds(1));
-      count++;
-      if (count < sleep)
+      std::pair<int64_t, ResourceType> current = toExplore.top();
+      toExplore.pop();
+
+      std::list<int64_t> children;
+      db.GetChildrenInternalId(children, current.first);
+
+      if (current.second == ResourceType_Series)
       {
-        continue;
+        count += children.size();
       }
+      else
+      {
+        ResourceType childType = GetChildResourceType(current.second);
 
-      Logging::Flush();
-
-      boost::mutex::scoped_lock lock(that->mutex_);
-      that->db_.FlushToDisk();
-      count = 0;
+        for (std::list<int64_t>::const_iterator 
+               it = children.begin(); it != children.end(); ++it)
+        {
+          toExplore.push(std::make_pair(*it, childType));
+        }
+      }
     }
 
-    LOG(INFO) << "Stopping the database flushing thread";
+    return count;
   }
 
 
-  static void ComputeExpectedNumberOfInstances(IDatabaseWrapper& db,
-                                               int64_t series,
-                                               const DicomMap& dicomSummary)
+  static void FormatFileToRemove(std::string& target,
+                                 const FileInfo& info)
   {
-    try
+    target += (info.GetUuid() + " " +
+               boost::lexical_cast<std::string>(static_cast<int>(info.GetContentType())) + " " +
+               boost::lexical_cast<std::string>(info.GetCompressedSize()) + "\n");
+  }
+
+
+  void ServerIndex::LoadFilesToRemove()
+  {
+    // WARNING: Before calling this method, "mutex_" must be locked.
+
+    filesToRemove_.clear();
+
+    std::string journal;
+    if (!db_.LookupGlobalProperty(journal, GlobalProperty_FilesToRemove))
     {
-      const DicomValue* value;
-      const DicomValue* value2;
-          
-      if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_IMAGES_IN_ACQUISITION)) != NULL &&
-          (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TEMPORAL_POSITIONS)) != NULL)
-      {
-        // Patch for series with temporal positions thanks to Will Ryder
-        int64_t imagesInAcquisition = boost::lexical_cast<int64_t>(value->GetContent());
-        int64_t countTemporalPositions = boost::lexical_cast<int64_t>(value2->GetContent());
-        std::string expected = boost::lexical_cast<std::string>(imagesInAcquisition * countTemporalPositions);
-        db.SetMetadata(series, MetadataType_Series_ExpectedNumberOfInstances, expected);
-      }
+      return;
+    }
 
-      else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_SLICES)) != NULL &&
-               (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TIME_SLICES)) != NULL)
+    std::vector<std::string> lines;
+    Toolbox::TokenizeString(lines, journal, '\n');
+
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+      std::vector<std::string> tokens;
+      Toolbox::TokenizeString(tokens, lines[i], ' ');
+
+      if (tokens.size() == 3 &&
+          Toolbox::IsUuid(tokens[0]))
       {
-        // Support of Cardio-PET images
-        int64_t numberOfSlices = boost::lexical_cast<int64_t>(value->GetContent());
-        int64_t numberOfTimeSlices = boost::lexical_cast<int64_t>(value2->GetContent());
-        std::string expected = boost::lexical_cast<std::string>(numberOfSlices * numberOfTimeSlices);
-        db.SetMetadata(series, MetadataType_Series_ExpectedNumberOfInstances, expected);
+        try
+        {
+          FileContentType type = static_cast<FileContentType>(boost::lexical_cast<int>(tokens[1]));
+          uint64_t size = boost::lexical_cast<uint64_t>(tokens[2]);
+          filesToRemove_[tokens[0]] = FileInfo(tokens[0], type, size, "");
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+          LOG(ERROR) << "Corrupted entry in the journal of the files to remove: " << lines[i];
+        }
       }
-
-      else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_CARDIAC_NUMBER_OF_IMAGES)) != NULL)
+      else if (!lines[i].empty())
       {
-        db.SetMetadata(series, MetadataType_Series_ExpectedNumberOfInstances, value->GetContent());
+        LOG(ERROR) << "Corrupted entry in the journal of the files to remove: " << lines[i];
       }
     }
-    catch (OrthancException&)
-    {
-    }
-    catch (boost::bad_lexical_cast&)
+
+    if (!filesToRemove_.empty())
     {
+      LOG(WARNING) << "Resuming the removal of " << filesToRemove_.size()
+                   << " file(s) from the storage area";
     }
   }
 
 
+  void ServerIndex::SaveFilesToRemove(const std::list<FileInfo>& added,
+                                      const std::set<std::string>& removed)
+  {
+    // WARNING: Before calling this method, "mutex_" must be locked,
+    // and a transaction must be active.
 
+    std::string journal;
 
-  bool ServerIndex::GetMetadataAsInteger(int64_t& result,
-                                         int64_t id,
-                                         MetadataType type)
-  {
-    std::string s;
-    if (!db_.LookupMetadata(s, id, type))
+    for (FilesToRemove::const_iterator 
+           it = filesToRemove_.begin(); it != filesToRemove_.end(); ++it)
     {
-      return false;
+      if (removed.find(it->first) == removed.end())
+      {
+        FormatFileToRemove(journal, it->second);
+      }
     }
 
-    try
-    {
-      result = boost::lexical_cast<int64_t>(s);
-      return true;
-    }
-    catch (boost::bad_lexical_cast&)
+    for (std::list<FileInfo>::const_iterator
+           it = added.begin(); it != added.end(); ++it)
     {
-      return false;
+      FormatFileToRemove(journal, *it);
     }
+
+    db_.SetGlobalProperty(GlobalProperty_FilesToRemove, journal);
   }
 
 
-  void ServerIndex::LogChange(int64_t internalId,
-                              ChangeType changeType,
-                              ResourceType resourceType,
-                              const std::string& publicId)
+  void ServerIndex::LoadPendingDeletions()
   {
-    ServerIndexChange change(changeType, resourceType, publicId);
+    // WARNING: Before calling this method, "mutex_" must be locked.
 
-    if (changeType <= ChangeType_INTERNAL_LastLogged)
+    std::string s;
+    if (!db_.LookupGlobalProperty(s, GlobalProperty_PendingDeletions))
     {
-      db_.LogChange(internalId, change);
+      return;
     }
 
-    assert(listener_.get() != NULL);
-    listener_->SignalChange(change);
-  }
+    std::vector<std::string> lines;
+    Toolbox::TokenizeString(lines, s, '\n');
 
+    std::set<std::string> obsolete;
 
-  uint64_t ServerIndex::IncrementGlobalSequenceInternal(GlobalProperty property)
-  {
-    std::string oldValue;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+      std::vector<std::string> tokens;
+      Toolbox::TokenizeString(tokens, lines[i], ' ');
+
+      if (tokens.size() != 2)
+      {
+        continue;
+      }
+
+      int64_t id;
+      ResourceType type;
+      if (db_.LookupResource(id, type, tokens[1]) &&
+          tokens[0] == EnumerationToString(type))
+      {
+        boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+        if (pendingDeletions_.find(tokens[1]) == pendingDeletions_.end())
+        {
+          pendingDeletions_[tokens[1]] = new PendingDeletion
+            (pendingDeletionsSequence_++, id, type, tokens[1]);
+        }
+      }
+      else
+      {
+        // The resource has disappeared, or its identifier is now
+        // used by another resource
+        obsolete.insert(tokens[1]);
+      }
+    }
+
+    if (!obsolete.empty())
+    {
+      Transaction t(*this);
+      SavePendingDeletions(NULL, obsolete);
+      t.Commit(0);
+    }
+
+    if (!pendingDeletions_.empty())
+    {
+      LOG(WARNING) << "Resuming the deletion of " << pendingDeletions_.size() << " resource(s)";
+    }
+  }
+
+
+  void ServerIndex::SavePendingDeletions(const PendingDeletion* added,
+                                         const std::set<std::string>& removed)
+  {
+    // WARNING: Before calling this method, "mutex_" must be locked,
+    // and a transaction must be active.
+
+    std::string s;
+
+    {
+      boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+
+      for (PendingDeletions::const_iterator
+             it = pendingDeletions_.begin(); it != pendingDeletions_.end(); ++it)
+      {
+        if (removed.find(it->first) == removed.end())
+        {
+          s += std::string(EnumerationToString(it->second->GetResourceType())) + " " + it->first + "\n";
+        }
+      }
+    }
+
+    if (added != NULL)
+    {
+      s += std::string(EnumerationToString(added->GetResourceType())) + " " + added->GetPublicId() + "\n";
+    }
+
+    db_.SetGlobalProperty(GlobalProperty_PendingDeletions, s);
+  }
+
+
+  void ServerIndex::ErasePendingDeletions(const std::set<std::string>& removed)
+  {
+    // WARNING: Before calling this method, "mutex_" must be locked.
+
+    boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+
+    for (std::set<std::string>::const_iterator
+           it = removed.begin(); it != removed.end(); ++it)
+    {
+      PendingDeletions::iterator found = pendingDeletions_.find(*it);
+      if (found != pendingDeletions_.end())
+      {
+        delete found->second;
+        pendingDeletions_.erase(found);
+      }
+    }
+  }
+
+
+  bool ServerIndex::HasPendingDeletions()
+  {
+    boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+    return !pendingDeletions_.empty();
+  }
+
+
+  bool ServerIndex::IsPendingDeletion(const std::string& publicId)
+  {
+    boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+    return pendingDeletions_.find(publicId) != pendingDeletions_.end();
+  }
+
+
+  bool ServerIndex::IsPendingDeletion(int64_t internalId)
+  {
+    boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+
+    for (PendingDeletions::const_iterator
+           it = pendingDeletions_.begin(); it != pendingDeletions_.end(); ++it)
+    {
+      if (it->second->GetInternalId() == internalId)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  bool ServerIndex::IsHiddenResource(IDatabaseWrapper& db,
+                                     int64_t internalId,
+                                     HiddenResourcesCache* cache)
+  {
+    // A resource is hidden if it, or one of its (at most 3) ancestors,
+    // is pending deletion
+    std::list<int64_t> visited;
+    bool hidden = false;
+
+    for (;;)
+    {
+      if (cache != NULL)
+      {
+        HiddenResourcesCache::const_iterator found = cache->find(internalId);
+        if (found != cache->end())
+        {
+          hidden = found->second;
+          break;
+        }
+      }
+
+      visited.push_back(internalId);
+
+      int64_t parentId;
+      if (IsPendingDeletion(internalId))
+      {
+        hidden = true;
+        break;
+      }
+      else if (db.LookupParent(parentId, internalId))
+      {
+        internalId = parentId;
+      }
+      else
+      {
+        break;
+      }
+    }
+
+    if (cache != NULL)
+    {
+      for (std::list<int64_t>::const_iterator
+             it = visited.begin(); it != visited.end(); ++it)
+      {
+        (*cache) [*it] = hidden;
+      }
+    }
+
+    return hidden;
+  }
+
+
+  void ServerIndex::RemovePendingDeletions(std::list<std::string>& children)
+  {
+    // The parent of these resources is visible, so they are hidden
+    // iff they are themselves pending deletion
+    if (!HasPendingDeletions())
+    {
+      return;
+    }
+
+    std::list<std::string>::iterator it = children.begin();
+    while (it != children.end())
+    {
+      if (IsPendingDeletion(*it))
+      {
+        it = children.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
+
+  void ServerIndex::RemoveHiddenResources(IDatabaseWrapper& db,
+                                          std::list<std::string>& publicIds)
+  {
+    if (!HasPendingDeletions())
+    {
+      return;
+    }
+
+    // The resources of the list mostly share their ancestors
+    HiddenResourcesCache cache;
+
+    std::list<std::string>::iterator it = publicIds.begin();
+    while (it != publicIds.end())
+    {
+      int64_t id;
+      ResourceType type;
+      if (IsPendingDeletion(*it) ||
+          (db.LookupResource(id, type, *it) &&
+           IsHiddenResource(db, id, &cache)))
+      {
+        it = publicIds.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
+
+  bool ServerIndex::LookupVisibleResource(int64_t& id,
+                                          ResourceType& type,
+                                          IDatabaseWrapper& db,
+                                          const std::string& publicId)
+  {
+    return (db.LookupResource(id, type, publicId) &&
+            (!HasPendingDeletions() ||
+             !IsHiddenResource(db, id, NULL)));
+  }
+
+
+  bool ServerIndex::FindOneVisibleChildInstance(int64_t& result,
+                                                IDatabaseWrapper& db,
+                                                int64_t resource,
+                                                ResourceType type)
+  {
+    if (!HasPendingDeletions())
+    {
+      return ServerToolbox::FindOneChildInstance(result, db, resource, type);
+    }
+
+    // Skip the children that are pending deletion, as their files
+    // might already have been removed
+    while (type != ResourceType_Instance)
+    {
+      std::list<int64_t> children;
+      db.GetChildrenInternalId(children, resource);
+
+      bool found = false;
+      for (std::list<int64_t>::const_iterator
+             it = children.begin(); it != children.end() && !found; ++it)
+      {
+        if (!IsPendingDeletion(*it))
+        {
+          resource = *it;
+          found = true;
+        }
+      }
+
+      if (!found)
+      {
+        return false;
+      }
+
+      type = GetChildResourceType(type);
+    }
+
+    result = resource;
+    return true;
+  }
+
+
+  void ServerIndex::PurgePendingDeletions(DicomInstanceHasher& hasher)
+  {
+    // WARNING: Before calling this method, "mutex_" must be locked.
+
+    // The hashes of the new instance are the public identifiers of
+    // its ancestors: It is attached to a hidden resource iff one of
+    // them is pending deletion
+    std::set<std::string> purged;
+
+    {
+      boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+
+      const std::string hashes[] = {
+        hasher.HashPatient(),
+        hasher.HashStudy(),
+        hasher.HashSeries(),
+        hasher.HashInstance()
+      };
+
+      for (size_t i = 0; i < sizeof(hashes) / sizeof(std::string); i++)
+      {
+        if (pendingDeletions_.find(hashes[i]) != pendingDeletions_.end())
+        {
+          purged.insert(hashes[i]);
+        }
+      }
+    }
+
+    if (purged.empty())
+    {
+      return;
+    }
+
+    // A new instance cannot be attached to a resource that is pending
+    // deletion: The deletion is completed synchronously
+    Transaction t(*this);
+
+    for (std::set<std::string>::const_iterator
+           it = purged.begin(); it != purged.end(); ++it)
+    {
+      int64_t id;
+      ResourceType type;
+      if (db_.LookupResource(id, type, *it))
+      {
+        db_.DeleteResource(id);
+      }
+    }
+
+    SavePendingDeletions(NULL, purged);
+    t.Commit(0);
+
+    ErasePendingDeletions(purged);
+  }
+
+
+  bool ServerIndex::DeleteResource(Json::Value& target,
+                                   const std::string& uuid,
+                                   ResourceType expectedType)
+  {
+    /**
+     * The deletion is logical: The resource is recorded as pending
+     * deletion in one single transaction, which hides it (together
+     * with its descendants) from all the accesses to the index. Its
+     * instances and their files are then reclaimed by batches by the
+     * "RemoveFilesThread()" background thread, that does not hold the
+     * global mutex while accessing the storage area. As the pending
+     * deletions are stored as a global property, an interrupted
+     * deletion is resumed at the next startup of Orthanc.
+     **/
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Transaction t(*this);
+
+    int64_t id;
+    ResourceType type;
+    if (!LookupVisibleResource(id, type, db_, uuid) ||
+        expectedType != type)
+    {
+      return false;
+    }
+
+    // Hide the highest ancestor that would be left empty by the
+    // deletion of this resource
+    int64_t topId = id;
+    ResourceType topType = type;
+    std::string topPublicId = uuid;
+
+    target["RemainingAncestor"] = Json::nullValue;
+
+    int64_t parentId;
+    while (db_.LookupParent(parentId, topId))
+    {
+      std::list<std::string> siblings;
+      db_.GetChildrenPublicId(siblings, parentId);
+      RemovePendingDeletions(siblings);
+
+      ResourceType parentType = GetParentResourceType(topType);
+      std::string parentPublicId = db_.GetPublicId(parentId);
+
+      if (siblings.size() > 1)
+      {
+        target["RemainingAncestor"] = Json::Value(Json::objectValue);
+        target["RemainingAncestor"]["Path"] = GetBasePath(parentType, parentPublicId);
+        target["RemainingAncestor"]["Type"] = EnumerationToString(parentType);
+        target["RemainingAncestor"]["ID"] = parentPublicId;
+        break;
+      }
+
+      topId = parentId;
+      topType = parentType;
+      topPublicId = parentPublicId;
+    }
+
+    std::auto_ptr<PendingDeletion> deletion
+      (new PendingDeletion(pendingDeletionsSequence_++, topId, topType, topPublicId));
+
+    SavePendingDeletions(deletion.get(), std::set<std::string>());
+    t.Commit(0);
+
+    {
+      boost::mutex::scoped_lock lock2(pendingDeletionsMutex_);
+      pendingDeletions_[topPublicId] = deletion.release();
+    }
+
+    return true;
+  }
+
+
+  void ServerIndex::GetPendingDeletions(Json::Value& target)
+  {
+    target = Json::arrayValue;
+
+    boost::mutex::scoped_lock lock(pendingDeletionsMutex_);
+
+    for (PendingDeletions::const_iterator
+           it = pendingDeletions_.begin(); it != pendingDeletions_.end(); ++it)
+    {
+      Json::Value item;
+      it->second->Format(item);
+      target.append(item);
+    }
+  }
+
+
+  bool ServerIndex::RemovePendingFiles(ServerContext& context)
+  {
+    std::list<FileInfo> files;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (FilesToRemove::const_iterator it = filesToRemove_.begin(); 
+           it != filesToRemove_.end() && files.size() < FILES_REMOVAL_BATCH_SIZE; ++it)
+      {
+        files.push_back(it->second);
+      }
+    }
+
+    if (files.empty())
+    {
+      return false;
+    }
+
+    std::set<std::string> removed;
+
+    for (std::list<FileInfo>::const_iterator
+           it = files.begin(); it != files.end(); ++it)
+    {
+      try
+      {
+        context.RemoveFile(it->GetUuid(), it->GetContentType());
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot remove file " << it->GetUuid() 
+                   << " from the storage area: " << e.What();
+      }
+
+      // The removal is not retried, as the file might not exist
+      removed.insert(it->GetUuid());
+    }
+
+    // Update the journal once the files are actually removed
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Transaction t(*this);
+    SaveFilesToRemove(std::list<FileInfo>(), removed);
+    t.Commit(0);
+
+    for (std::set<std::string>::const_iterator
+           it = removed.begin(); it != removed.end(); ++it)
+    {
+      filesToRemove_.erase(*it);
+    }
+
+    return true;
+  }
+
+
+  bool ServerIndex::ReclaimPendingDeletion(ServerContext& context)
+  {
+    std::string publicId;
+    uint64_t sequence;
+    std::list<int64_t> instances;
+    std::list<FileInfo> files;
+    bool isLastBatch;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      ResourceType expectedType;
+      bool isCounted;
+
+      {
+        boost::mutex::scoped_lock lock2(pendingDeletionsMutex_);
+        if (pendingDeletions_.empty())
+        {
+          return false;
+        }
 
-    if (db_.LookupGlobalProperty(oldValue, property))
-    {
-      uint64_t oldNumber;
+        const PendingDeletion& deletion = *pendingDeletions_.begin()->second;
+        publicId = deletion.GetPublicId();
+        sequence = deletion.GetSequence();
+        expectedType = deletion.GetResourceType();
+        isCounted = deletion.HasCountInstances();
+      }
+
+      int64_t id;
+      ResourceType type;
+      if (!db_.LookupResource(id, type, publicId) ||
+          type != expectedType)
+      {
+        // The resource has been removed in the meantime (e.g. by the
+        // recycling mechanism)
+        std::set<std::string> removed;
+        removed.insert(publicId);
+
+        Transaction t(*this);
+        SavePendingDeletions(NULL, removed);
+        t.Commit(0);
+
+        ErasePendingDeletions(removed);
+        return true;
+      }
+
+      if (!isCounted)
+      {
+        // The descendants of the resource are only explored here, in
+        // the background, not while handling the DELETE request
+        size_t count = CountInstancesToDelete(db_, id, type);
+
+        boost::mutex::scoped_lock lock2(pendingDeletionsMutex_);
+        pendingDeletions_[publicId]->SetCountInstances(count);
+      }
+
+      CollectInstancesToDelete(instances, db_, id, type, DELETION_BATCH_SIZE);
+
+      isLastBatch = (instances.size() <= DELETION_BATCH_SIZE);
+      if (!isLastBatch)
+      {
+        instances.resize(DELETION_BATCH_SIZE);
+      }
+
+      for (std::list<int64_t>::const_iterator 
+             it = instances.begin(); it != instances.end(); ++it)
+      {
+        std::list<FileContentType> attachments;
+        db_.ListAvailableAttachments(attachments, *it);
+
+        for (std::list<FileContentType>::const_iterator
+               attachment = attachments.begin(); attachment != attachments.end(); ++attachment)
+        {
+          FileInfo info;
+          if (db_.LookupAttachment(info, *it, *attachment))
+          {
+            files.push_back(info);
+          }
+        }
+      }
+    }
+
+    // Remove the files of this batch before their rows in the index:
+    // A hidden resource can outlive its files, but no file must
+    // outlive its row, otherwise it could be orphaned
+    std::set<std::string> removed;
 
+    for (std::list<FileInfo>::const_iterator
+           it = files.begin(); it != files.end(); ++it)
+    {
       try
       {
-        oldNumber = boost::lexical_cast<uint64_t>(oldValue);
-        db_.SetGlobalProperty(property, boost::lexical_cast<std::string>(oldNumber + 1));
-        return oldNumber + 1;
+        context.RemoveFile(it->GetUuid(), it->GetContentType());
+        removed.insert(it->GetUuid());
       }
-      catch (boost::bad_lexical_cast&)
+      catch (OrthancException& e)
       {
-        throw OrthancException(ErrorCode_InternalError);
+        // The file will be put into the journal of the files to remove
+        LOG(ERROR) << "Cannot remove file " << it->GetUuid() 
+                   << " from the storage area: " << e.What();
+      }
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    {
+      boost::mutex::scoped_lock lock2(pendingDeletionsMutex_);
+
+      PendingDeletions::const_iterator found = pendingDeletions_.find(publicId);
+      if (found == pendingDeletions_.end() ||
+          found->second->GetSequence() != sequence)
+      {
+        // The deletion has been completed by "Store()" in the meantime
+        return true;
+      }
+    }
+
+    Transaction t(*this);
+    listener_->SetRemovedFiles(removed);
+
+    for (std::list<int64_t>::const_iterator 
+           it = instances.begin(); it != instances.end(); ++it)
+    {
+      // The empty parent resources are automatically cleaned
+      if (db_.IsExistingResource(*it))
+      {
+        db_.DeleteResource(*it);
+      }
+    }
+
+    std::set<std::string> completed;
+
+    if (isLastBatch)
+    {
+      int64_t id;
+      ResourceType type;
+      if (db_.LookupResource(id, type, publicId))
+      {
+        db_.DeleteResource(id);
       }
+
+      completed.insert(publicId);
+      SavePendingDeletions(NULL, completed);
+    }
+
+    t.Commit(0);
+
+    if (isLastBatch)
+    {
+      ErasePendingDeletions(completed);
     }
     else
     {
-      // Initialize the sequence at "1"
-      db_.SetGlobalProperty(property, "1");
-      return 1;
+      boost::mutex::scoped_lock lock2(pendingDeletionsMutex_);
+      pendingDeletions_[publicId]->SignalRemovedInstances(instances.size());
     }
+
+    return true;
   }
 
 
+  void ServerIndex::FlushThread(ServerIndex* that)
+  {
+    // By default, wait for 10 seconds before flushing
+    unsigned int sleep = 10;
+
+    try
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+      std::string sleepString;
+
+      if (that->db_.LookupGlobalProperty(sleepString, GlobalProperty_FlushSleep) &&
+          Toolbox::IsInteger(sleepString))
+      {
+        sleep = boost::lexical_cast<unsigned int>(sleepString);
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+
+    LOG(INFO) << "Starting the database flushing thread (sleep = " << sleep << ")";
+
+    unsigned int count = 0;
+
+    while (!that->done_)
+    {
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+      count++;
+      if (count < sleep)
+      {
+        continue;
+      }
+
+      Logging::Flush();
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+      that->db_.FlushToDisk();
+      count = 0;
+    }
+
+    LOG(INFO) << "Stopping the database flushing thread";
+  }
 
-  int64_t ServerIndex::CreateResource(const std::string& publicId,
-                                      ResourceType type)
+
+  void ServerIndex::HistoryPruningThread(ServerIndex* that)
   {
-    int64_t id = db_.CreateResource(publicId, type);
+    // Apply the retention policy every 10 seconds
+    static const unsigned int SLEEP = 10;
 
-    ChangeType changeType;
-    switch (type)
+    LOG(INFO) << "Starting the thread that prunes the logs of changes and exports";
+
+    unsigned int count = 0;
+
+    while (!that->done_)
+    {
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+      count++;
+      if (count < SLEEP)
+      {
+        continue;
+      }
+
+      try
+      {
+        that->PruneHistory();
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot prune the logs of changes and exports: " << e.What();
+      }
+
+      count = 0;
+    }
+
+    LOG(INFO) << "Stopping the thread that prunes the logs of changes and exports";
+  }
+
+
+  void ServerIndex::RemoveFilesThread(ServerIndex* that,
+                                      ServerContext* context)
+  {
+    LOG(INFO) << "Starting the thread that removes the deleted files";
+
+    for (;;)
     {
-    case ResourceType_Patient: 
-      changeType = ChangeType_NewPatient; 
-      break;
+      try
+      {
+        // The journal of the files to remove is flushed before
+        // exiting, but the pending deletions are resumed at the next
+        // startup of Orthanc
+        if (that->RemovePendingFiles(*context) ||
+            (!that->done_ && that->ReclaimPendingDeletion(*context)))
+        {
+          continue;
+        }
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Error while reclaiming the deleted resources: " << e.What();
+      }
+
+      if (that->done_)
+      {
+        break;
+      }
 
-    case ResourceType_Study: 
-      changeType = ChangeType_NewStudy; 
-      break;
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    }
 
-    case ResourceType_Series: 
-      changeType = ChangeType_NewSeries; 
-      break;
+    LOG(INFO) << "Stopping the thread that removes the deleted files";
+  }
 
-    case ResourceType_Instance: 
-      changeType = ChangeType_NewInstance; 
-      break;
 
-    default:
-      throw OrthancException(ErrorCode_InternalError);
+  static void ComputeExpectedNumberOfInstances(ResourcesContent& content,
+                                               int64_t series,
+                                               const DicomMap& dicomSummary)
+  {
+    try
+    {
+      const DicomValue* value;
+      const DicomValue* value2;
+          
+      if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_IMAGES_IN_ACQUISITION)) != NULL &&
+          (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TEMPORAL_POSITIONS)) != NULL)
+      {
+        // Patch for series with temporal positions thanks to Will Ryder
+        int64_t imagesInAcquisition = boost::lexical_cast<int64_t>(value->GetContent());
+        int64_t countTemporalPositions = boost::lexical_cast<int64_t>(value2->GetContent());
+        std::string expected = boost::lexical_cast<std::string>(imagesInAcquisition * countTemporalPositions);
+        content.AddMetadata(series, MetadataType_Series_ExpectedNumberOfInstances, expected);
+      }
+
+      else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_SLICES)) != NULL &&
+               (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TIME_SLICES)) != NULL)
+      {
+        // Support of Cardio-PET images
+        int64_t numberOfSlices = boost::lexical_cast<int64_t>(value->GetContent());
+        int64_t numberOfTimeSlices = boost::lexical_cast<int64_t>(value2->GetContent());
+        std::string expected = boost::lexical_cast<std::string>(numberOfSlices * numberOfTimeSlices);
+        content.AddMetadata(series, MetadataType_Series_ExpectedNumberOfInstances, expected);
+      }
+
+      else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_CARDIAC_NUMBER_OF_IMAGES)) != NULL)
+      {
+        content.AddMetadata(series, MetadataType_Series_ExpectedNumberOfInstances, value->GetContent());
+      }
+    }
+    catch (OrthancException&)
+    {
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+  }
+
+
+
+
+  bool ServerIndex::GetMetadataAsInteger(int64_t& result,
+                                         IDatabaseWrapper& db,
+                                         int64_t id,
+                                         MetadataType type)
+  {
+    std::string s;
+    if (!db.LookupMetadata(s, id, type))
+    {
+      return false;
+    }
+
+    try
+    {
+      result = boost::lexical_cast<int64_t>(s);
+      return true;
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
     }
+  }
+
+
+  void ServerIndex::LogChange(int64_t internalId,
+                              ChangeType changeType,
+                              ResourceType resourceType,
+                              const std::string& publicId)
+  {
+    ServerIndexChange change(changeType, resourceType, publicId);
 
-    ServerIndexChange change(changeType, type, publicId);
-    db_.LogChange(id, change);
+    if (changeType <= ChangeType_INTERNAL_LastLogged)
+    {
+      db_.LogChange(internalId, change);
+    }
 
     assert(listener_.get() != NULL);
     listener_->SignalChange(change);
+  }
 
-    return id;
+
+  uint64_t ServerIndex::IncrementGlobalSequenceInternal(GlobalProperty property)
+  {
+    std::string oldValue;
+
+    if (db_.LookupGlobalProperty(oldValue, property))
+    {
+      uint64_t oldNumber;
+
+      try
+      {
+        oldNumber = boost::lexical_cast<uint64_t>(oldValue);
+        db_.SetGlobalProperty(property, boost::lexical_cast<std::string>(oldNumber + 1));
+        return oldNumber + 1;
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+    }
+    else
+    {
+      // Initialize the sequence at "1"
+      db_.SetGlobalProperty(property, "1");
+      return 1;
+    }
   }
 
 
+
   ServerIndex::ServerIndex(ServerContext& context,
                            IDatabaseWrapper& db) : 
     done_(false),
     db_(db),
+    thumbnailsSize_(0),
     maximumStorageSize_(0),
-    maximumPatients_(0)
-  {
-    listener_.reset(new Listener(context));
+    maximumPatients_(0),
+    maximumHistorySize_(0),
+    maximumHistoryAge_(0),
+    pendingDeletionsSequence_(0),
+    changesGeneration_(0),
+    countChangesWaiters_(0),
+    maximumChangesWaiters_(DEFAULT_MAX_CHANGES_WAITERS)
+  {
+    listener_.reset(new Listener(*this, context));
     db_.SetListener(*listener_);
 
-    currentStorageSize_ = db_.GetTotalCompressedSize();
+    currentStorageSize_ = db_.GetTotalCompressedSize();
+
+    std::string thumbnailsSize;
+    if (db_.LookupGlobalProperty(thumbnailsSize, GlobalProperty_ThumbnailsSize))
+    {
+      try
+      {
+        thumbnailsSize_ = std::min(boost::lexical_cast<uint64_t>(thumbnailsSize), currentStorageSize_);
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        LOG(ERROR) << "Corrupted size of the thumbnails in the database: " << thumbnailsSize;
+      }
+    }
+
+    // Resume the deletions that were interrupted by the last stop of
+    // Orthanc (no other thread is running at this point)
+    LoadFilesToRemove();
+    LoadPendingDeletions();
 
     // Initial recycling if the parameters have changed since the last
     // execution of Orthanc
@@ -559,6 +1632,12 @@ namespace Orthanc
     }
 
     unstableResourcesMonitorThread_ = boost::thread(UnstableResourcesMonitorThread, this);
+    removeFilesThread_ = boost::thread(RemoveFilesThread, this, &context);
+
+    if (db.HasHistoryPruning())
+    {
+      historyPruningThread_ = boost::thread(HistoryPruningThread, this);
+    }
   }
 
 
@@ -570,6 +1649,12 @@ namespace Orthanc
       LOG(ERROR) << "INTERNAL ERROR: ServerIndex::Stop() should be invoked manually to avoid mess in the destruction order!";
       Stop();
     }
+
+    for (PendingDeletions::iterator 
+           it = pendingDeletions_.begin(); it != pendingDeletions_.end(); ++it)
+    {
+      delete it->second;
+    }
   }
 
 
@@ -578,7 +1663,12 @@ namespace Orthanc
   {
     if (!done_)
     {
-      done_ = true;
+      {
+        // Wake up the clients that are long-polling the changes
+        boost::mutex::scoped_lock lock(changesMutex_);
+        done_ = true;
+        changesCondition_.notify_all();
+      }
 
       if (db_.HasFlushToDisk() &&
           flushThread_.joinable())
@@ -590,17 +1680,29 @@ namespace Orthanc
       {
         unstableResourcesMonitorThread_.join();
       }
+
+      if (historyPruningThread_.joinable())
+      {
+        historyPruningThread_.join();
+      }
+
+      // This thread flushes all the pending files before exiting
+      if (removeFilesThread_.joinable())
+      {
+        removeFilesThread_.join();
+      }
     }
   }
 
 
 
-  void ServerIndex::SetInstanceMetadata(std::map<MetadataType, std::string>& instanceMetadata,
+  void ServerIndex::SetInstanceMetadata(ResourcesContent& content,
+                                        std::map<MetadataType, std::string>& instanceMetadata,
                                         int64_t instance,
                                         MetadataType metadata,
                                         const std::string& value)
   {
-    db_.SetMetadata(instance, metadata, value);
+    content.AddMetadata(instance, metadata, value);
     instanceMetadata[metadata] = value;
   }
 
@@ -621,21 +1723,26 @@ namespace Orthanc
 
     try
     {
+      PurgePendingDeletions(hasher);
+
       Transaction t(*this);
 
-      // Do nothing if the instance already exists
+      // Create the instance, together with its missing parent
+      // resources, in one single call to the database back-end
+      IDatabaseWrapper::CreateInstanceResult status;
+      int64_t instance;
+
+      if (!db_.CreateInstance(status, instance, hasher.HashPatient(),
+                              hasher.HashStudy(), hasher.HashSeries(), hasher.HashInstance()))
       {
-        ResourceType type;
-        int64_t tmp;
-        if (db_.LookupResource(tmp, type, hasher.HashInstance()))
-        {
-          assert(type == ResourceType_Instance);
-          db_.GetAllMetadata(instanceMetadata, tmp);
-          return StoreStatus_AlreadyStored;
-        }
+        // Do nothing if the instance already exists
+        db_.GetAllMetadata(instanceMetadata, instance);
+        return StoreStatus_AlreadyStored;
       }
 
-      // Ensure there is enough room in the storage for the new instance
+      // Ensure there is enough room in the storage for the new
+      // instance. The patient of this instance now exists in the
+      // database, so it cannot be recycled.
       uint64_t instanceSize = 0;
       for (Attachments::const_iterator it = attachments.begin();
            it != attachments.end(); ++it)
@@ -645,101 +1752,49 @@ namespace Orthanc
 
       Recycle(instanceSize, hasher.HashPatient());
 
-      // Create the instance
-      int64_t instance = CreateResource(hasher.HashInstance(), ResourceType_Instance);
-      ServerToolbox::StoreMainDicomTags(db_, instance, ResourceType_Instance, dicomSummary);
-
-      // Detect up to which level the patient/study/series/instance
-      // hierarchy must be created
-      int64_t patient = -1, study = -1, series = -1;
-      bool isNewPatient = false;
-      bool isNewStudy = false;
-      bool isNewSeries = false;
+      // Log the newly created resources
+      LogChange(instance, ChangeType_NewInstance, ResourceType_Instance, hasher.HashInstance());
 
+      if (status.isNewSeries_)
       {
-        ResourceType dummy;
-
-        if (db_.LookupResource(series, dummy, hasher.HashSeries()))
-        {
-          assert(dummy == ResourceType_Series);
-          // The patient, the study and the series already exist
-
-          bool ok = (db_.LookupResource(patient, dummy, hasher.HashPatient()) &&
-                     db_.LookupResource(study, dummy, hasher.HashStudy()));
-          assert(ok);
-        }
-        else if (db_.LookupResource(study, dummy, hasher.HashStudy()))
-        {
-          assert(dummy == ResourceType_Study);
-
-          // New series: The patient and the study already exist
-          isNewSeries = true;
-
-          bool ok = db_.LookupResource(patient, dummy, hasher.HashPatient());
-          assert(ok);
-        }
-        else if (db_.LookupResource(patient, dummy, hasher.HashPatient()))
-        {
-          assert(dummy == ResourceType_Patient);
-
-          // New study and series: The patient already exist
-          isNewStudy = true;
-          isNewSeries = true;
-        }
-        else
-        {
-          // New patient, study and series: Nothing exists
-          isNewPatient = true;
-          isNewStudy = true;
-          isNewSeries = true;
-        }
+        LogChange(status.seriesId_, ChangeType_NewSeries, ResourceType_Series, hasher.HashSeries());
       }
 
-      // Create the series if needed
-      if (isNewSeries)
+      if (status.isNewStudy_)
       {
-        series = CreateResource(hasher.HashSeries(), ResourceType_Series);
-        ServerToolbox::StoreMainDicomTags(db_, series, ResourceType_Series, dicomSummary);
+        LogChange(status.studyId_, ChangeType_NewStudy, ResourceType_Study, hasher.HashStudy());
       }
 
-      // Create the study if needed
-      if (isNewStudy)
+      if (status.isNewPatient_)
       {
-        study = CreateResource(hasher.HashStudy(), ResourceType_Study);
-        ServerToolbox::StoreMainDicomTags(db_, study, ResourceType_Study, dicomSummary);
+        LogChange(status.patientId_, ChangeType_NewPatient, ResourceType_Patient, hasher.HashPatient());
       }
 
-      // Create the patient if needed
-      if (isNewPatient)
+      // Accumulate the main DICOM tags, the attachments and the
+      // metadata, that will be written at once into the database
+      ResourcesContent content;
+      content.AddResource(instance, ResourceType_Instance, dicomSummary);
+
+      if (status.isNewSeries_)
       {
-        patient = CreateResource(hasher.HashPatient(), ResourceType_Patient);
-        ServerToolbox::StoreMainDicomTags(db_, patient, ResourceType_Patient, dicomSummary);
+        content.AddResource(status.seriesId_, ResourceType_Series, dicomSummary);
       }
 
-      // Create the parent-to-child links
-      db_.AttachChild(series, instance);
-
-      if (isNewSeries)
+      if (status.isNewStudy_)
       {
-        db_.AttachChild(study, series);
+        content.AddResource(status.studyId_, ResourceType_Study, dicomSummary);
       }
 
-      if (isNewStudy)
+      if (status.isNewPatient_)
       {
-        db_.AttachChild(patient, study);
+        content.AddResource(status.patientId_, ResourceType_Patient, dicomSummary);
       }
 
-      // Sanity checks
-      assert(patient != -1);
-      assert(study != -1);
-      assert(series != -1);
-      assert(instance != -1);
-
       // Attach the files to the newly created instance
       for (Attachments::const_iterator it = attachments.begin();
            it != attachments.end(); ++it)
       {
-        db_.AddAttachment(instance, *it);
+        content.AddAttachment(instance, *it);
       }
 
       // Attach the user-specified metadata
@@ -749,19 +1804,19 @@ namespace Orthanc
         switch (it->first.first)
         {
           case ResourceType_Patient:
-            db_.SetMetadata(patient, it->first.second, it->second);
+            content.AddMetadata(status.patientId_, it->first.second, it->second);
             break;
 
           case ResourceType_Study:
-            db_.SetMetadata(study, it->first.second, it->second);
+            content.AddMetadata(status.studyId_, it->first.second, it->second);
             break;
 
           case ResourceType_Series:
-            db_.SetMetadata(series, it->first.second, it->second);
+            content.AddMetadata(status.seriesId_, it->first.second, it->second);
             break;
 
           case ResourceType_Instance:
-            SetInstanceMetadata(instanceMetadata, instance, it->first.second, it->second);
+            SetInstanceMetadata(content, instanceMetadata, instance, it->first.second, it->second);
             break;
 
           default:
@@ -771,22 +1826,22 @@ namespace Orthanc
 
       // Attach the auto-computed metadata for the patient/study/series levels
       std::string now = SystemToolbox::GetNowIsoString();
-      db_.SetMetadata(series, MetadataType_LastUpdate, now);
-      db_.SetMetadata(study, MetadataType_LastUpdate, now);
-      db_.SetMetadata(patient, MetadataType_LastUpdate, now);
+      content.AddMetadata(status.seriesId_, MetadataType_LastUpdate, now);
+      content.AddMetadata(status.studyId_, MetadataType_LastUpdate, now);
+      content.AddMetadata(status.patientId_, MetadataType_LastUpdate, now);
 
       // Attach the auto-computed metadata for the instance level,
       // reflecting these additions into the input metadata map
-      SetInstanceMetadata(instanceMetadata, instance, MetadataType_Instance_ReceptionDate, now);
-      SetInstanceMetadata(instanceMetadata, instance, MetadataType_Instance_RemoteAet, instanceToStore.GetRemoteAet());
-      SetInstanceMetadata(instanceMetadata, instance, MetadataType_Instance_Origin, 
+      SetInstanceMetadata(content, instanceMetadata, instance, MetadataType_Instance_ReceptionDate, now);
+      SetInstanceMetadata(content, instanceMetadata, instance, MetadataType_Instance_RemoteAet, instanceToStore.GetRemoteAet());
+      SetInstanceMetadata(content, instanceMetadata, instance, MetadataType_Instance_Origin, 
                           EnumerationToString(instanceToStore.GetRequestOrigin()));
         
       {
         std::string s;
         if (instanceToStore.LookupTransferSyntax(s))
         {
-          SetInstanceMetadata(instanceMetadata, instance, MetadataType_Instance_TransferSyntax, s);
+          SetInstanceMetadata(content, instanceMetadata, instance, MetadataType_Instance_TransferSyntax, s);
         }
       }
 
@@ -795,7 +1850,7 @@ namespace Orthanc
           !value->IsNull() &&
           !value->IsBinary())
       {
-        SetInstanceMetadata(instanceMetadata, instance, MetadataType_Instance_SopClassUid, value->GetContent());
+        SetInstanceMetadata(content, instanceMetadata, instance, MetadataType_Instance_SopClassUid, value->GetContent());
       }
 
       if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_INSTANCE_NUMBER)) != NULL ||
@@ -804,26 +1859,28 @@ namespace Orthanc
         if (!value->IsNull() && 
             !value->IsBinary())
         {
-          SetInstanceMetadata(instanceMetadata, instance, MetadataType_Instance_IndexInSeries, value->GetContent());
+          SetInstanceMetadata(content, instanceMetadata, instance, MetadataType_Instance_IndexInSeries, value->GetContent());
         }
       }
 
-      // Check whether the series of this new instance is now completed
-      if (isNewSeries)
+      if (status.isNewSeries_)
       {
-        ComputeExpectedNumberOfInstances(db_, series, dicomSummary);
+        ComputeExpectedNumberOfInstances(content, status.seriesId_, dicomSummary);
       }
 
-      SeriesStatus seriesStatus = GetSeriesStatus(series);
+      db_.SetResourcesContent(content);
+
+      // Check whether the series of this new instance is now completed
+      SeriesStatus seriesStatus = GetSeriesStatus(db_, status.seriesId_);
       if (seriesStatus == SeriesStatus_Complete)
       {
-        LogChange(series, ChangeType_CompletedSeries, ResourceType_Series, hasher.HashSeries());
+        LogChange(status.seriesId_, ChangeType_CompletedSeries, ResourceType_Series, hasher.HashSeries());
       }
 
       // Mark the parent resources of this instance as unstable
-      MarkAsUnstable(series, ResourceType_Series, hasher.HashSeries());
-      MarkAsUnstable(study, ResourceType_Study, hasher.HashStudy());
-      MarkAsUnstable(patient, ResourceType_Patient, hasher.HashPatient());
+      MarkAsUnstable(status.seriesId_, ResourceType_Series, hasher.HashSeries());
+      MarkAsUnstable(status.studyId_, ResourceType_Study, hasher.HashStudy());
+      MarkAsUnstable(status.patientId_, ResourceType_Patient, hasher.HashPatient());
 
       t.Commit(instanceSize);
 
@@ -855,22 +1912,32 @@ namespace Orthanc
     target["CountStudies"] = static_cast<unsigned int>(db_.GetResourceCount(ResourceType_Study));
     target["CountSeries"] = static_cast<unsigned int>(db_.GetResourceCount(ResourceType_Series));
     target["CountInstances"] = static_cast<unsigned int>(db_.GetResourceCount(ResourceType_Instance));
+
+    // The resources that are pending deletion are still accounted
+    // for, until they are reclaimed
+    target["CountPendingFilesToRemove"] = static_cast<unsigned int>(filesToRemove_.size());
+
+    {
+      boost::mutex::scoped_lock lock2(pendingDeletionsMutex_);
+      target["CountPendingDeletions"] = static_cast<unsigned int>(pendingDeletions_.size());
+    }
   }          
 
 
 
-  SeriesStatus ServerIndex::GetSeriesStatus(int64_t id)
+  SeriesStatus ServerIndex::GetSeriesStatus(IDatabaseWrapper& db,
+                                            int64_t id)
   {
     // Get the expected number of instances in this series (from the metadata)
     int64_t expected;
-    if (!GetMetadataAsInteger(expected, id, MetadataType_Series_ExpectedNumberOfInstances))
+    if (!GetMetadataAsInteger(expected, db, id, MetadataType_Series_ExpectedNumberOfInstances))
     {
       return SeriesStatus_Unknown;
     }
 
     // Loop over the instances of this series
     std::list<int64_t> children;
-    db_.GetChildrenInternalId(children, id);
+    db.GetChildrenInternalId(children, id);
 
     std::set<int64_t> instances;
     for (std::list<int64_t>::const_iterator 
@@ -878,7 +1945,7 @@ namespace Orthanc
     {
       // Get the index of this instance in the series
       int64_t index;
-      if (!GetMetadataAsInteger(index, *it, MetadataType_Instance_IndexInSeries))
+      if (!GetMetadataAsInteger(index, db, *it, MetadataType_Instance_IndexInSeries))
       {
         return SeriesStatus_Unknown;
       }
@@ -910,11 +1977,12 @@ namespace Orthanc
 
 
   void ServerIndex::MainDicomTagsToJson(Json::Value& target,
+                                        IDatabaseWrapper& db,
                                         int64_t resourceId,
                                         ResourceType resourceType)
   {
     DicomMap tags;
-    db_.GetMainDicomTags(tags, resourceId);
+    db.GetMainDicomTags(tags, resourceId);
 
     if (resourceType == ResourceType_Study)
     {
@@ -941,12 +2009,13 @@ namespace Orthanc
   {
     result = Json::objectValue;
 
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     // Lookup for the requested resource
     int64_t id;
     ResourceType type;
-    if (!db_.LookupResource(id, type, publicId) ||
+    if (!LookupVisibleResource(id, type, db, publicId) ||
         type != expectedType)
     {
       return false;
@@ -956,12 +2025,12 @@ namespace Orthanc
     if (type != ResourceType_Patient)
     {
       int64_t parentId;
-      if (!db_.LookupParent(parentId, id))
+      if (!db.LookupParent(parentId, id))
       {
         throw OrthancException(ErrorCode_InternalError);
       }
 
-      std::string parent = db_.GetPublicId(parentId);
+      std::string parent = db.GetPublicId(parentId);
 
       switch (type)
       {
@@ -984,7 +2053,8 @@ namespace Orthanc
 
     // List the children resources
     std::list<std::string> children;
-    db_.GetChildrenPublicId(children, id);
+    db.GetChildrenPublicId(children, id);
+    RemovePendingDeletions(children);
 
     if (type != ResourceType_Instance)
     {
@@ -1029,10 +2099,10 @@ namespace Orthanc
       case ResourceType_Series:
       {
         result["Type"] = "Series";
-        result["Status"] = EnumerationToString(GetSeriesStatus(id));
+        result["Status"] = EnumerationToString(GetSeriesStatus(db, id));
 
         int64_t i;
-        if (GetMetadataAsInteger(i, id, MetadataType_Series_ExpectedNumberOfInstances))
+        if (GetMetadataAsInteger(i, db, id, MetadataType_Series_ExpectedNumberOfInstances))
           result["ExpectedNumberOfInstances"] = static_cast<int>(i);
         else
           result["ExpectedNumberOfInstances"] = Json::nullValue;
@@ -1045,7 +2115,7 @@ namespace Orthanc
         result["Type"] = "Instance";
 
         FileInfo attachment;
-        if (!db_.LookupAttachment(attachment, id, FileContentType_Dicom))
+        if (!db.LookupAttachment(attachment, id, FileContentType_Dicom))
         {
           throw OrthancException(ErrorCode_InternalError);
         }
@@ -1054,7 +2124,7 @@ namespace Orthanc
         result["FileUuid"] = attachment.GetUuid();
 
         int64_t i;
-        if (GetMetadataAsInteger(i, id, MetadataType_Instance_IndexInSeries))
+        if (GetMetadataAsInteger(i, db, id, MetadataType_Instance_IndexInSeries))
           result["IndexInSeries"] = static_cast<int>(i);
         else
           result["IndexInSeries"] = Json::nullValue;
@@ -1068,16 +2138,16 @@ namespace Orthanc
 
     // Record the remaining information
     result["ID"] = publicId;
-    MainDicomTagsToJson(result, id, type);
+    MainDicomTagsToJson(result, db, id, type);
 
     std::string tmp;
 
-    if (db_.LookupMetadata(tmp, id, MetadataType_AnonymizedFrom))
+    if (db.LookupMetadata(tmp, id, MetadataType_AnonymizedFrom))
     {
       result["AnonymizedFrom"] = tmp;
     }
 
-    if (db_.LookupMetadata(tmp, id, MetadataType_ModifiedFrom))
+    if (db.LookupMetadata(tmp, id, MetadataType_ModifiedFrom))
     {
       result["ModifiedFrom"] = tmp;
     }
@@ -1086,9 +2156,9 @@ namespace Orthanc
         type == ResourceType_Study ||
         type == ResourceType_Series)
     {
-      result["IsStable"] = !unstableResources_.Contains(id);
+      result["IsStable"] = !accessor.IsUnstableResource(id);
 
-      if (db_.LookupMetadata(tmp, id, MetadataType_LastUpdate))
+      if (db.LookupMetadata(tmp, id, MetadataType_LastUpdate))
       {
         result["LastUpdate"] = tmp;
       }
@@ -1102,16 +2172,17 @@ namespace Orthanc
                                      const std::string& instanceUuid,
                                      FileContentType contentType)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     int64_t id;
     ResourceType type;
-    if (!db_.LookupResource(id, type, instanceUuid))
+    if (!LookupVisibleResource(id, type, db, instanceUuid))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
 
-    if (db_.LookupAttachment(attachment, id, contentType))
+    if (db.LookupAttachment(attachment, id, contentType))
     {
       assert(attachment.GetContentType() == contentType);
       return true;
@@ -1127,8 +2198,10 @@ namespace Orthanc
   void ServerIndex::GetAllUuids(std::list<std::string>& target,
                                 ResourceType resourceType)
   {
-    boost::mutex::scoped_lock lock(mutex_);
-    db_.GetAllPublicIds(target, resourceType);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
+    db.GetAllPublicIds(target, resourceType);
+    RemoveHiddenResources(db, target);
   }
 
 
@@ -1143,8 +2216,31 @@ namespace Orthanc
       return;
     }
 
-    boost::mutex::scoped_lock lock(mutex_);
-    db_.GetAllPublicIds(target, resourceType, since, limit);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
+
+    if (!HasPendingDeletions())
+    {
+      db.GetAllPublicIds(target, resourceType, since, limit);
+      return;
+    }
+
+    // The paging must skip the resources that are pending deletion
+    std::list<std::string> all;
+    db.GetAllPublicIds(all, resourceType);
+    RemoveHiddenResources(db, all);
+
+    target.clear();
+
+    size_t pos = 0;
+    for (std::list<std::string>::const_iterator
+           it = all.begin(); it != all.end() && target.size() < limit; ++it, pos++)
+    {
+      if (pos >= since)
+      {
+        target.push_back(*it);
+      }
+    }
   }
 
 
@@ -1173,16 +2269,80 @@ namespace Orthanc
   }
 
 
+  void ServerIndex::SignalNewChanges()
+  {
+    boost::mutex::scoped_lock lock(changesMutex_);
+    changesGeneration_++;
+    changesCondition_.notify_all();
+  }
+
+
   void ServerIndex::GetChanges(Json::Value& target,
                                int64_t since,                               
-                               unsigned int maxResults)
+                               unsigned int maxResults,
+                               unsigned int timeout)
   {
     std::list<ServerIndexChange> changes;
     bool done;
 
+    uint64_t generation;
+
     {
-      boost::mutex::scoped_lock lock(mutex_);
-      db_.GetChanges(changes, done, since, maxResults);
+      // The generation must be read before accessing the database,
+      // otherwise a change committed in between would be missed
+      boost::mutex::scoped_lock lock(changesMutex_);
+      generation = changesGeneration_;
+    }
+
+    {
+      ReadOnlyAccessor accessor(*this);
+      accessor.GetDatabase().GetChanges(changes, done, since, maxResults);
+    }
+
+    if (changes.empty() &&
+        timeout > 0)
+    {
+      bool hasNewChanges;
+
+      {
+        // No change is available yet: Wait without holding any lock
+        // on the database, until some transaction commits new changes
+        boost::mutex::scoped_lock lock(changesMutex_);
+
+        if (countChangesWaiters_ < maximumChangesWaiters_)
+        {
+          countChangesWaiters_++;
+
+          const boost::system_time deadline = 
+            boost::get_system_time() + boost::posix_time::milliseconds(timeout);
+
+          while (!done_ &&
+                 changesGeneration_ == generation)
+          {
+            if (!changesCondition_.timed_wait(lock, deadline))
+            {
+              break;  // Timeout
+            }
+          }
+
+          assert(countChangesWaiters_ > 0);
+          countChangesWaiters_--;
+        }
+        else
+        {
+          // Too many clients are waiting: Answer at once, so as not to
+          // exhaust the threads of the HTTP server
+          VLOG(1) << "Too many clients are long-polling the changes, answering at once";
+        }
+
+        hasNewChanges = (changesGeneration_ != generation);
+      }
+
+      if (hasNewChanges)
+      {
+        ReadOnlyAccessor accessor(*this);
+        accessor.GetDatabase().GetChanges(changes, done, since, maxResults);
+      }
     }
 
     FormatLog(target, changes, "Changes", done, since);
@@ -1194,8 +2354,8 @@ namespace Orthanc
     std::list<ServerIndexChange> changes;
 
     {
-      boost::mutex::scoped_lock lock(mutex_);
-      db_.GetLastChange(changes);
+      ReadOnlyAccessor accessor(*this);
+      accessor.GetDatabase().GetLastChange(changes);
     }
 
     FormatLog(target, changes, "Changes", true, 0);
@@ -1210,7 +2370,7 @@ namespace Orthanc
 
     int64_t id;
     ResourceType type;
-    if (!db_.LookupResource(id, type, publicId))
+    if (!LookupVisibleResource(id, type, db_, publicId))
     {
       throw OrthancException(ErrorCode_InternalError);
     }
@@ -1328,6 +2488,19 @@ namespace Orthanc
       uint64_t currentSize = currentStorageSize_ - listener_->GetSizeOfFilesToRemove();
       assert(db_.GetTotalCompressedSize() == currentSize);
 
+      // The thumbnails are excluded from the quota
+      uint64_t thumbnailsSize = thumbnailsSize_;
+      if (thumbnailsSize >= listener_->GetSizeOfThumbnailsToRemove())
+      {
+        thumbnailsSize -= listener_->GetSizeOfThumbnailsToRemove();
+      }
+      else
+      {
+        thumbnailsSize = 0;
+      }
+
+      currentSize -= std::min(thumbnailsSize, currentSize);
+
       if (currentSize + instanceSize > maximumStorageSize_)
       {
         return true;
@@ -1427,6 +2600,126 @@ namespace Orthanc
     StandaloneRecycling();
   }
 
+  void ServerIndex::SetMaximumHistorySize(uint64_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maximumHistorySize_ = size;
+
+    if (size != 0)
+    {
+      LOG(WARNING) << "At most " << size << " entries will be kept in the logs of changes and exports";
+    }
+  }
+
+
+  void ServerIndex::SetMaximumChangesWaiters(unsigned int count)
+  {
+    boost::mutex::scoped_lock lock(changesMutex_);
+    maximumChangesWaiters_ = count;
+  }
+
+
+  void ServerIndex::SetMaximumHistoryAge(unsigned int days)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maximumHistoryAge_ = days;
+
+    if (days != 0)
+    {
+      LOG(WARNING) << "The entries of the logs of changes and exports will be kept for " << days << " days";
+    }
+  }
+
+
+  void ServerIndex::PruneHistory()
+  {
+    unsigned int total = 0;
+
+    while (!done_)
+    {
+      // The global mutex is released between two batches
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (maximumHistorySize_ == 0 &&
+          maximumHistoryAge_ == 0)
+      {
+        break;
+      }
+
+      std::string olderThan;
+      if (maximumHistoryAge_ != 0)
+      {
+        boost::posix_time::ptime limit = (boost::posix_time::second_clock::local_time() - 
+                                          boost::posix_time::hours(24 * maximumHistoryAge_));
+        olderThan = boost::posix_time::to_iso_string(limit);
+      }
+
+      // As the sequence numbers are not necessarily contiguous, the
+      // number of kept entries is an upper bound
+      int64_t maxChange = -1;
+      int64_t maxExport = -1;
+
+      if (maximumHistorySize_ != 0)
+      {
+        std::list<ServerIndexChange> lastChange;
+        db_.GetLastChange(lastChange);
+        if (!lastChange.empty())
+        {
+          maxChange = lastChange.back().GetSeq() - static_cast<int64_t>(maximumHistorySize_);
+        }
+
+        std::list<ExportedResource> lastExport;
+        db_.GetLastExportedResource(lastExport);
+        if (!lastExport.empty())
+        {
+          maxExport = lastExport.back().GetSeq() - static_cast<int64_t>(maximumHistorySize_);
+        }
+      }
+
+      Transaction t(*this);
+      unsigned int changes = db_.PruneChanges(maxChange, olderThan, HISTORY_PRUNING_BATCH_SIZE);
+      unsigned int exports = db_.PruneExportedResources(maxExport, olderThan, HISTORY_PRUNING_BATCH_SIZE);
+      t.Commit(0);
+
+      total += changes + exports;
+
+      if (changes < HISTORY_PRUNING_BATCH_SIZE &&
+          exports < HISTORY_PRUNING_BATCH_SIZE)
+      {
+        break;
+      }
+    }
+
+    if (total > 0)
+    {
+      LOG(INFO) << "Number of entries removed from the logs of changes and exports: " << total;
+    }
+  }
+
+
+  void ServerIndex::SetReadersPool(DatabaseReadersPool* readers)
+  {
+    if (readers == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    std::auto_ptr<DatabaseReadersPool> protection(readers);
+
+    boost::mutex::scoped_lock lock(readersMutex_);
+
+    if (readers_.get() != NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    readers_ = protection;
+
+    LOG(WARNING) << "Using " << readers_->GetSize() 
+                 << " read-only connection(s) to the database";
+  }
+
+
   void ServerIndex::StandaloneRecycling()
   {
     // WARNING: No mutex here, do not include this as a public method
@@ -1443,7 +2736,7 @@ namespace Orthanc
     // Lookup for the requested resource
     int64_t id;
     ResourceType type;
-    if (!db_.LookupResource(id, type, publicId) ||
+    if (!LookupVisibleResource(id, type, db_, publicId) ||
         type != ResourceType_Patient)
     {
       throw OrthancException(ErrorCode_ParameterOutOfRange);
@@ -1462,7 +2755,7 @@ namespace Orthanc
     // Lookup for the requested resource
     int64_t id;
     ResourceType type;
-    if (!db_.LookupResource(id, type, publicId) ||
+    if (!LookupVisibleResource(id, type, db_, publicId) ||
         type != ResourceType_Patient)
     {
       throw OrthancException(ErrorCode_ParameterOutOfRange);
@@ -1483,11 +2776,12 @@ namespace Orthanc
   {
     result.clear();
 
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     ResourceType type;
     int64_t resource;
-    if (!db_.LookupResource(resource, type, publicId))
+    if (!LookupVisibleResource(resource, type, db, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -1499,13 +2793,15 @@ namespace Orthanc
     }
 
     std::list<int64_t> tmp;
-    db_.GetChildrenInternalId(tmp, resource);
+    db.GetChildrenInternalId(tmp, resource);
 
     for (std::list<int64_t>::const_iterator 
            it = tmp.begin(); it != tmp.end(); ++it)
     {
-      result.push_back(db_.GetPublicId(*it));
+      result.push_back(db.GetPublicId(*it));
     }
+
+    RemovePendingDeletions(result);
   }
 
 
@@ -1514,11 +2810,12 @@ namespace Orthanc
   {
     result.clear();
 
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     ResourceType type;
     int64_t top;
-    if (!db_.LookupResource(top, type, publicId))
+    if (!LookupVisibleResource(top, type, db, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -1530,6 +2827,8 @@ namespace Orthanc
       return;
     }
 
+    bool hasPendingDeletions = HasPendingDeletions();
+
     std::stack<int64_t> toExplore;
     toExplore.push(top);
 
@@ -1541,18 +2840,24 @@ namespace Orthanc
       int64_t resource = toExplore.top();
       toExplore.pop();
 
-      if (db_.GetResourceType(resource) == ResourceType_Instance)
+      if (db.GetResourceType(resource) == ResourceType_Instance)
       {
-        result.push_back(db_.GetPublicId(resource));
+        result.push_back(db.GetPublicId(resource));
       }
       else
       {
-        // Tag all the children of this resource as to be explored
-        db_.GetChildrenInternalId(tmp, resource);
+        // Tag all the children of this resource as to be explored,
+        // except those that are pending deletion (together with
+        // their descendants)
+        db.GetChildrenInternalId(tmp, resource);
         for (std::list<int64_t>::const_iterator 
                it = tmp.begin(); it != tmp.end(); ++it)
         {
-          toExplore.push(*it);
+          if (!hasPendingDeletions ||
+              !IsPendingDeletion(*it))
+          {
+            toExplore.push(*it);
+          }
         }
       }
     }
@@ -1568,7 +2873,7 @@ namespace Orthanc
 
     ResourceType rtype;
     int64_t id;
-    if (!db_.LookupResource(id, rtype, publicId))
+    if (!LookupVisibleResource(id, rtype, db_, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -1592,7 +2897,7 @@ namespace Orthanc
 
     ResourceType rtype;
     int64_t id;
-    if (!db_.LookupResource(id, rtype, publicId))
+    if (!LookupVisibleResource(id, rtype, db_, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -1612,32 +2917,34 @@ namespace Orthanc
                                    const std::string& publicId,
                                    MetadataType type)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     ResourceType rtype;
     int64_t id;
-    if (!db_.LookupResource(id, rtype, publicId))
+    if (!LookupVisibleResource(id, rtype, db, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
 
-    return db_.LookupMetadata(target, id, type);
+    return db.LookupMetadata(target, id, type);
   }
 
 
   void ServerIndex::ListAvailableMetadata(std::list<MetadataType>& target,
                                           const std::string& publicId)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     ResourceType rtype;
     int64_t id;
-    if (!db_.LookupResource(id, rtype, publicId))
+    if (!LookupVisibleResource(id, rtype, db, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
 
-    db_.ListAvailableMetadata(target, id);
+    db.ListAvailableMetadata(target, id);
   }
 
 
@@ -1645,36 +2952,38 @@ namespace Orthanc
                                              const std::string& publicId,
                                              ResourceType expectedType)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     ResourceType type;
     int64_t id;
-    if (!db_.LookupResource(id, type, publicId) ||
+    if (!LookupVisibleResource(id, type, db, publicId) ||
         expectedType != type)
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
 
-    db_.ListAvailableAttachments(target, id);
+    db.ListAvailableAttachments(target, id);
   }
 
 
   bool ServerIndex::LookupParent(std::string& target,
                                  const std::string& publicId)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     ResourceType type;
     int64_t id;
-    if (!db_.LookupResource(id, type, publicId))
+    if (!LookupVisibleResource(id, type, db, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
 
     int64_t parentId;
-    if (db_.LookupParent(parentId, id))
+    if (db.LookupParent(parentId, id))
     {
-      target = db_.GetPublicId(parentId);
+      target = db.GetPublicId(parentId);
       return true;
     }
     else
@@ -1705,7 +3014,7 @@ namespace Orthanc
 
     int64_t id;
     ResourceType type;
-    if (!db_.LookupResource(id, type, publicId))
+    if (!LookupVisibleResource(id, type, db_, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -1745,6 +3054,8 @@ namespace Orthanc
     compressedSize = 0;
     uncompressedSize = 0;
 
+    bool hasPendingDeletions = HasPendingDeletions();
+
     while (!toExplore.empty())
     {
       // Get the internal ID of the current resource
@@ -1787,13 +3098,18 @@ namespace Orthanc
             break;
         }
 
-        // Tag all the children of this resource as to be explored
+        // Tag all the children of this resource as to be explored,
+        // except those that are pending deletion
         std::list<int64_t> tmp;
         db_.GetChildrenInternalId(tmp, resource);
         for (std::list<int64_t>::const_iterator 
                it = tmp.begin(); it != tmp.end(); ++it)
         {
-          toExplore.push(*it);
+          if (!hasPendingDeletions ||
+              !IsPendingDeletion(*it))
+          {
+            toExplore.push(*it);
+          }
         }
       }
     }
@@ -1818,7 +3134,7 @@ namespace Orthanc
 
     ResourceType type;
     int64_t top;
-    if (!db_.LookupResource(top, type, publicId))
+    if (!LookupVisibleResource(top, type, db_, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -1867,7 +3183,7 @@ namespace Orthanc
 
     ResourceType type;
     int64_t top;
-    if (!db_.LookupResource(top, type, publicId))
+    if (!LookupVisibleResource(top, type, db_, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -1904,7 +3220,9 @@ namespace Orthanc
         int64_t id = that->unstableResources_.RemoveOldest(payload);
 
         // Ensure that the resource is still existing before logging the change
-        if (that->db_.IsExistingResource(id))
+        if (that->db_.IsExistingResource(id) &&
+            (!that->HasPendingDeletions() ||
+             !that->IsHiddenResource(that->db_, id, NULL)))
         {
           switch (payload.GetResourceType())
           {
@@ -1965,11 +3283,14 @@ namespace Orthanc
     
     result.clear();
 
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     LookupIdentifierQuery query(level);
     query.AddConstraint(tag, IdentifierConstraintType_Equal, value);
-    query.Apply(result, db_);
+    query.Apply(result, db);
+
+    RemoveHiddenResources(db, result);
   }
 
 
@@ -1982,7 +3303,7 @@ namespace Orthanc
 
     ResourceType resourceType;
     int64_t resourceId;
-    if (!db_.LookupResource(resourceId, resourceType, publicId))
+    if (!LookupVisibleResource(resourceId, resourceType, db_, publicId))
     {
       return StoreStatus_Failure;  // Inexistent resource
     }
@@ -2007,9 +3328,17 @@ namespace Orthanc
       }
     }
 
-    // Possibly apply the recycling mechanism while preserving this patient
-    assert(db_.GetResourceType(patientId) == ResourceType_Patient);
-    Recycle(attachment.GetCompressedSize(), db_.GetPublicId(patientId));
+    if (attachment.GetContentType() == FileContentType_Thumbnail)
+    {
+      // The thumbnails are excluded from the quota
+      t.AddThumbnail(attachment.GetCompressedSize());
+    }
+    else
+    {
+      // Possibly apply the recycling mechanism while preserving this patient
+      assert(db_.GetResourceType(patientId) == ResourceType_Patient);
+      Recycle(attachment.GetCompressedSize(), db_.GetPublicId(patientId));
+    }
 
     db_.AddAttachment(resourceId, attachment);
 
@@ -2024,6 +3353,80 @@ namespace Orthanc
   }
 
 
+  bool ServerIndex::SetThumbnail(const FileInfo& thumbnail,
+                                 const std::string& publicId,
+                                 bool replace)
+  {
+    if (thumbnail.GetContentType() != FileContentType_Thumbnail)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Transaction t(*this);
+
+    ResourceType resourceType;
+    int64_t resourceId;
+    if (!LookupVisibleResource(resourceId, resourceType, db_, publicId))
+    {
+      return false;  // Inexistent resource
+    }
+
+    // The lookup and the replacement are done within the same
+    // transaction, so that concurrent writers are serialized
+    FileInfo previous;
+    if (db_.LookupAttachment(previous, resourceId, FileContentType_Thumbnail))
+    {
+      if (!replace)
+      {
+        return false;
+      }
+
+      db_.DeleteAttachment(resourceId, FileContentType_Thumbnail);
+    }
+
+    // No change is logged, as the thumbnails are an internal cache
+    db_.AddAttachment(resourceId, thumbnail);
+
+    t.AddThumbnail(thumbnail.GetCompressedSize());
+    t.Commit(thumbnail.GetCompressedSize());
+
+    return true;
+  }
+
+
+  bool ServerIndex::ReplaceDicom(const FileInfo& dicom,
+                                 const std::string& instancePublicId,
+                                 const std::string& transferSyntax)
+  {
+    if (dicom.GetContentType() != FileContentType_Dicom)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Transaction t(*this);
+
+    ResourceType resourceType;
+    int64_t resourceId;
+    if (!LookupVisibleResource(resourceId, resourceType, db_, instancePublicId) ||
+        resourceType != ResourceType_Instance)
+    {
+      return false;
+    }
+
+    db_.DeleteAttachment(resourceId, FileContentType_Dicom);
+    db_.AddAttachment(resourceId, dicom);
+    db_.SetMetadata(resourceId, MetadataType_Instance_TransferSyntax, transferSyntax);
+
+    t.Commit(dicom.GetCompressedSize());
+
+    return true;
+  }
+
+
   void ServerIndex::DeleteAttachment(const std::string& publicId,
                                      FileContentType type)
   {
@@ -2032,7 +3435,7 @@ namespace Orthanc
 
     ResourceType rtype;
     int64_t id;
-    if (!db_.LookupResource(id, rtype, publicId))
+    if (!LookupVisibleResource(id, rtype, db_, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -2051,19 +3454,20 @@ namespace Orthanc
   bool ServerIndex::GetMetadata(Json::Value& target,
                                 const std::string& publicId)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     target = Json::objectValue;
 
     ResourceType type;
     int64_t id;
-    if (!db_.LookupResource(id, type, publicId))
+    if (!LookupVisibleResource(id, type, db, publicId))
     {
       return false;
     }
 
     std::list<MetadataType> metadata;
-    db_.ListAvailableMetadata(metadata, id);
+    db.ListAvailableMetadata(metadata, id);
 
     for (std::list<MetadataType>::const_iterator
            it = metadata.begin(); it != metadata.end(); ++it)
@@ -2071,7 +3475,7 @@ namespace Orthanc
       std::string key = EnumerationToString(*it);
 
       std::string value;
-      if (!db_.LookupMetadata(value, id, *it))
+      if (!db.LookupMetadata(value, id, *it))
       {
         value.clear();
       }
@@ -2125,12 +3529,13 @@ namespace Orthanc
 
     result.Clear();
 
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     // Lookup for the requested resource
     int64_t id;
     ResourceType type;
-    if (!db_.LookupResource(id, type, publicId) ||
+    if (!LookupVisibleResource(id, type, db, publicId) ||
         type != expectedType)
     {
       return false;
@@ -2139,7 +3544,7 @@ namespace Orthanc
     if (type == ResourceType_Study)
     {
       DicomMap tmp;
-      db_.GetMainDicomTags(tmp, id);
+      db.GetMainDicomTags(tmp, id);
 
       switch (levelOfInterest)
       {
@@ -2157,7 +3562,7 @@ namespace Orthanc
     }
     else
     {
-      db_.GetMainDicomTags(result, id);
+      db.GetMainDicomTags(result, id);
       return true;
     }    
   }
@@ -2166,10 +3571,11 @@ namespace Orthanc
   bool ServerIndex::LookupResourceType(ResourceType& type,
                                        const std::string& publicId)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     int64_t id;
-    return db_.LookupResource(id, type, publicId);
+    return LookupVisibleResource(id, type, db, publicId);
   }
 
 
@@ -2184,28 +3590,41 @@ namespace Orthanc
                                    std::vector<std::string>& instances,
                                    const ::Orthanc::LookupResource& lookup)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
    
     std::list<int64_t> tmp;
-    lookup.FindCandidates(tmp, db_);
+    lookup.FindCandidates(tmp, db);
 
-    resources.resize(tmp.size());
-    instances.resize(tmp.size());
+    resources.clear();
+    instances.clear();
+    resources.reserve(tmp.size());
+    instances.reserve(tmp.size());
+
+    bool hasPendingDeletions = HasPendingDeletions();
+    HiddenResourcesCache cache;
 
-    size_t pos = 0;
     for (std::list<int64_t>::const_iterator
-           it = tmp.begin(); it != tmp.end(); ++it, pos++)
+           it = tmp.begin(); it != tmp.end(); ++it)
     {
-      assert(db_.GetResourceType(*it) == lookup.GetLevel());
+      assert(db.GetResourceType(*it) == lookup.GetLevel());
+
+      if (hasPendingDeletions &&
+          IsHiddenResource(db, *it, &cache))
+      {
+        continue;
+      }
+
+      std::string resource = db.GetPublicId(*it);
       
       int64_t instance;
-      if (!ServerToolbox::FindOneChildInstance(instance, db_, *it, lookup.GetLevel()))
+      if (!FindOneVisibleChildInstance(instance, db, *it, lookup.GetLevel()))
       {
         throw OrthancException(ErrorCode_InternalError);
       }
 
-      resources[pos] = db_.GetPublicId(*it);
-      instances[pos] = db_.GetPublicId(instance);
+      resources.push_back(resource);
+      instances.push_back(db.GetPublicId(instance));
     }
   }
 
@@ -2214,11 +3633,12 @@ namespace Orthanc
                                  const std::string& publicId,
                                  ResourceType parentType)
   {
-    boost::mutex::scoped_lock lock(mutex_);
+    ReadOnlyAccessor accessor(*this);
+    IDatabaseWrapper& db = accessor.GetDatabase();
 
     ResourceType type;
     int64_t id;
-    if (!db_.LookupResource(id, type, publicId))
+    if (!LookupVisibleResource(id, type, db, publicId))
     {
       throw OrthancException(ErrorCode_UnknownResource);
     }
@@ -2228,7 +3648,7 @@ namespace Orthanc
       int64_t parentId;
 
       if (type == ResourceType_Patient ||    // Cannot further go up in hierarchy
-          !db_.LookupParent(parentId, id))
+          !db.LookupParent(parentId, id))
       {
         return false;
       }
@@ -2237,7 +3657,7 @@ namespace Orthanc
       type = GetParentResourceType(type);
     }
 
-    target = db_.GetPublicId(id);
+    target = db.GetPublicId(id);
     return true;
   }
 
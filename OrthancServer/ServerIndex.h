@@ -35,6 +35,7 @@
 
 #include <boost/thread.hpp>
 #include <boost/noncopyable.hpp>
+#include <set>
 #include "../Core/Cache/LeastRecentlyUsedIndex.h"
 #include "../Core/SQLite/Connection.h"
 #include "../Core/DicomFormat/DicomMap.h"
@@ -49,6 +50,8 @@ namespace Orthanc
   class ServerContext;
   class DicomInstanceToStore;
   class ParsedDicomFile;
+  class ResourcesContent;
+  class DatabaseReadersPool;
 
   class ServerIndex : public boost::noncopyable
   {
@@ -59,30 +62,113 @@ namespace Orthanc
   private:
     class Listener;
     class Transaction;
+    class ReadOnlyAccessor;
     class UnstableResourcePayload;
+    class PendingDeletion;
+
+    typedef std::map<std::string, FileInfo>           FilesToRemove;
+    typedef std::map<std::string, PendingDeletion*>   PendingDeletions;
+    typedef std::map<int64_t, bool>                   HiddenResourcesCache;
 
     bool done_;
     boost::mutex mutex_;
     boost::thread flushThread_;
     boost::thread unstableResourcesMonitorThread_;
+    boost::thread removeFilesThread_;
+    boost::thread historyPruningThread_;
 
     std::auto_ptr<Listener> listener_;
     IDatabaseWrapper& db_;
+    boost::mutex                        readersMutex_;
+    std::auto_ptr<DatabaseReadersPool>  readers_;
     LeastRecentlyUsedIndex<int64_t, UnstableResourcePayload>  unstableResources_;
 
+    // Files that are not referenced by the index anymore, but that
+    // are still in the storage area. This is a copy of the journal
+    // that is stored as a global property, protected by "mutex_".
+    FilesToRemove  filesToRemove_;
+
+    // Top-level resources that are hidden, but whose instances are
+    // not reclaimed yet: Their descendants are hidden through their
+    // ancestors. Any modification is done with "mutex_" locked.
+    boost::mutex      pendingDeletionsMutex_;
+    PendingDeletions  pendingDeletions_;
+    uint64_t          pendingDeletionsSequence_;
+
+    boost::mutex                changesMutex_;
+    boost::condition_variable   changesCondition_;
+    uint64_t                    changesGeneration_;
+    unsigned int                countChangesWaiters_;
+    unsigned int                maximumChangesWaiters_;
+
     uint64_t currentStorageSize_;
+    uint64_t thumbnailsSize_;  // Part of "currentStorageSize_" out of the quota
     uint64_t maximumStorageSize_;
     unsigned int maximumPatients_;
+    uint64_t maximumHistorySize_;
+    unsigned int maximumHistoryAge_;
 
     static void FlushThread(ServerIndex* that);
 
     static void UnstableResourcesMonitorThread(ServerIndex* that);
 
+    static void RemoveFilesThread(ServerIndex* that,
+                                  ServerContext* context);
+
+    static void HistoryPruningThread(ServerIndex* that);
+
+    void LoadFilesToRemove();
+
+    void SaveFilesToRemove(const std::list<FileInfo>& added,
+                           const std::set<std::string>& removed);
+
+    void LoadPendingDeletions();
+
+    void SavePendingDeletions(const PendingDeletion* added,
+                              const std::set<std::string>& removed);
+
+    void ErasePendingDeletions(const std::set<std::string>& removed);
+
+    bool HasPendingDeletions();
+
+    bool IsPendingDeletion(const std::string& publicId);
+
+    bool IsPendingDeletion(int64_t internalId);
+
+    bool IsHiddenResource(IDatabaseWrapper& db,
+                          int64_t internalId,
+                          HiddenResourcesCache* cache);
+
+    void RemovePendingDeletions(std::list<std::string>& children);
+
+    void RemoveHiddenResources(IDatabaseWrapper& db,
+                               std::list<std::string>& publicIds);
+
+    bool LookupVisibleResource(int64_t& id,
+                               ResourceType& type,
+                               IDatabaseWrapper& db,
+                               const std::string& publicId);
+
+    bool FindOneVisibleChildInstance(int64_t& result,
+                                     IDatabaseWrapper& db,
+                                     int64_t resource,
+                                     ResourceType type);
+
+    void PurgePendingDeletions(DicomInstanceHasher& hasher);
+
+    bool RemovePendingFiles(ServerContext& context);
+
+    bool ReclaimPendingDeletion(ServerContext& context);
+
+    void SignalNewChanges();
+
     void MainDicomTagsToJson(Json::Value& result,
+                             IDatabaseWrapper& db,
                              int64_t resourceId,
                              ResourceType resourceType);
 
-    SeriesStatus GetSeriesStatus(int64_t id);
+    SeriesStatus GetSeriesStatus(IDatabaseWrapper& db,
+                                 int64_t id);
 
     bool IsRecyclingNeeded(uint64_t instanceSize);
 
@@ -104,6 +190,7 @@ namespace Orthanc
                                /* in  */ ResourceType type);
 
     bool GetMetadataAsInteger(int64_t& result,
+                              IDatabaseWrapper& db,
                               int64_t id,
                               MetadataType type);
 
@@ -114,10 +201,8 @@ namespace Orthanc
 
     uint64_t IncrementGlobalSequenceInternal(GlobalProperty property);
 
-    int64_t CreateResource(const std::string& publicId,
-                           ResourceType type);
-
-    void SetInstanceMetadata(std::map<MetadataType, std::string>& instanceMetadata,
+    void SetInstanceMetadata(ResourcesContent& content,
+                             std::map<MetadataType, std::string>& instanceMetadata,
                              int64_t instance,
                              MetadataType metadata,
                              const std::string& value);
@@ -146,6 +231,30 @@ namespace Orthanc
     // "count == 0" means no limit on the number of patients
     void SetMaximumPatientCount(unsigned int count);
 
+    // "size == 0" means no limit on the number of entries in the logs
+    // of changes and of exported resources
+    void SetMaximumHistorySize(uint64_t size);
+
+    // "days == 0" means no limit on the age of the entries in the logs
+    // of changes and of exported resources
+    void SetMaximumHistoryAge(unsigned int days);
+
+    // Each request that long-polls the changes holds one HTTP thread:
+    // At most "count" of them wait at the same time, the others are
+    // answered at once. "count == 0" disables long-polling.
+    void SetMaximumChangesWaiters(unsigned int count);
+
+    // Applies the retention policy to the logs. The oldest entries
+    // are removed by batches, in separate transactions.
+    void PruneHistory();
+
+    // Takes the ownership of the pool. The read-only requests (such
+    // as lookups, listings and C-FIND) are then served by the pooled
+    // connections, in parallel with the writer. The pool can only be
+    // set once, but possibly while other threads access the index (the
+    // background threads are started by the constructor).
+    void SetReadersPool(DatabaseReadersPool* readers);
+
     StoreStatus Store(std::map<MetadataType, std::string>& instanceMetadata,
                       DicomInstanceToStore& instance,
                       const Attachments& attachments);
@@ -168,13 +277,28 @@ namespace Orthanc
                      size_t since,
                      size_t limit);
 
+    // The resource is immediately hidden, but its instances and
+    // files are reclaimed in the background: The progress is
+    // reported by "GetPendingDeletions()"
     bool DeleteResource(Json::Value& target /* out */,
                         const std::string& uuid,
                         ResourceType expectedType);
 
+    void GetPendingDeletions(Json::Value& target);
+
     void GetChanges(Json::Value& target,
                     int64_t since,
-                    unsigned int maxResults);
+                    unsigned int maxResults)
+    {
+      GetChanges(target, since, maxResults, 0);
+    }
+
+    // Long-polling: If no change is available after "since", wait for
+    // at most "timeout" milliseconds for new changes to be committed
+    void GetChanges(Json::Value& target,
+                    int64_t since,
+                    unsigned int maxResults,
+                    unsigned int timeout);
 
     void GetLastChange(Json::Value& target);
 
@@ -249,6 +373,21 @@ namespace Orthanc
     StoreStatus AddAttachment(const FileInfo& attachment,
                               const std::string& publicId);
 
+    // Stores the thumbnail of a resource. The thumbnails neither
+    // count towards the maximum storage size, nor trigger the
+    // recycling. Returns "false" if the resource does not exist, or
+    // if it already has a thumbnail and "replace" is "false".
+    bool SetThumbnail(const FileInfo& thumbnail,
+                      const std::string& publicId,
+                      bool replace);
+
+    // Replaces the DICOM file of an instance and its transfer syntax
+    // in one transaction. No change is logged, and the recycling is
+    // not applied. Returns "false" if the instance does not exist.
+    bool ReplaceDicom(const FileInfo& dicom,
+                      const std::string& instancePublicId,
+                      const std::string& transferSyntax);
+
     void DeleteAttachment(const std::string& publicId,
                           FileContentType type);
 
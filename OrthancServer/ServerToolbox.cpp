@@ -34,10 +34,10 @@
 #include "PrecompiledHeadersServer.h"
 #include "ServerToolbox.h"
 
-#include "../Core/DicomFormat/DicomArray.h"
 #include "../Core/FileStorage/StorageAccessor.h"
 #include "../Core/Logging.h"
 #include "../Core/OrthancException.h"
+#include "ResourcesContent.h"
 
 #include <cassert>
 
@@ -135,88 +135,131 @@ namespace Orthanc
     }
 
 
-    static void StoreMainDicomTagsInternal(IDatabaseWrapper& database,
-                                           int64_t resource,
-                                           const DicomMap& tags)
+    void StoreMainDicomTags(IDatabaseWrapper& database,
+                            int64_t resource,
+                            ResourceType level,
+                            const DicomMap& dicomSummary)
     {
-      DicomArray flattened(tags);
+      // WARNING: The database should be locked with a transaction!
+
+      ResourcesContent content;
+      content.AddResource(resource, level, dicomSummary);
+      database.SetResourcesContent(content);
+    }
+
+
+    bool CreateInstance(IDatabaseWrapper::CreateInstanceResult& result,
+                        int64_t& instanceId,
+                        IDatabaseWrapper& database,
+                        const std::string& hashPatient,
+                        const std::string& hashStudy,
+                        const std::string& hashSeries,
+                        const std::string& hashInstance)
+    {
+      // WARNING: The database should be locked with a transaction!
 
-      for (size_t i = 0; i < flattened.GetSize(); i++)
       {
-        const DicomElement& element = flattened.GetElement(i);
-        const DicomTag& tag = element.GetTag();
-        const DicomValue& value = element.GetValue();
-        if (!value.IsNull() && 
-            !value.IsBinary())
+        ResourceType type;
+        int64_t tmp;
+
+        if (database.LookupResource(tmp, type, hashInstance))
         {
-          database.SetMainDicomTag(resource, tag, element.GetValue().GetContent());
+          // The instance already exists
+          assert(type == ResourceType_Instance);
+          instanceId = tmp;
+          return false;
         }
       }
-    }
 
+      instanceId = database.CreateResource(hashInstance, ResourceType_Instance);
 
-    static void StoreIdentifiers(IDatabaseWrapper& database,
-                                 int64_t resource,
-                                 ResourceType level,
-                                 const DicomMap& map)
-    {
-      const DicomTag* tags;
-      size_t size;
+      result.isNewPatient_ = false;
+      result.isNewStudy_ = false;
+      result.isNewSeries_ = false;
+      result.patientId_ = -1;
+      result.studyId_ = -1;
+      result.seriesId_ = -1;
 
-      LoadIdentifiers(tags, size, level);
+      // Detect up to which level the patient/study/series/instance
+      // hierarchy must be created
 
-      for (size_t i = 0; i < size; i++)
       {
-        const DicomValue* value = map.TestAndGetValue(tags[i]);
-        if (value != NULL &&
-            !value->IsNull() &&
-            !value->IsBinary())
+        ResourceType dummy;
+
+        if (database.LookupResource(result.seriesId_, dummy, hashSeries))
         {
-          std::string s = NormalizeIdentifier(value->GetContent());
-          database.SetIdentifierTag(resource, tags[i], s);
-        }
-      }
-    }
+          assert(dummy == ResourceType_Series);
+          // The patient, the study and the series already exist
 
+          bool ok = (database.LookupResource(result.patientId_, dummy, hashPatient) &&
+                     database.LookupResource(result.studyId_, dummy, hashStudy));
+          assert(ok);
+        }
+        else if (database.LookupResource(result.studyId_, dummy, hashStudy))
+        {
+          assert(dummy == ResourceType_Study);
 
-    void StoreMainDicomTags(IDatabaseWrapper& database,
-                            int64_t resource,
-                            ResourceType level,
-                            const DicomMap& dicomSummary)
-    {
-      // WARNING: The database should be locked with a transaction!
+          // New series: The patient and the study already exist
+          result.isNewSeries_ = true;
 
-      StoreIdentifiers(database, resource, level, dicomSummary);
+          bool ok = database.LookupResource(result.patientId_, dummy, hashPatient);
+          assert(ok);
+        }
+        else if (database.LookupResource(result.patientId_, dummy, hashPatient))
+        {
+          assert(dummy == ResourceType_Patient);
 
-      DicomMap tags;
+          // New study and series: The patient already exist
+          result.isNewStudy_ = true;
+          result.isNewSeries_ = true;
+        }
+        else
+        {
+          // New patient, study and series: Nothing exists
+          result.isNewPatient_ = true;
+          result.isNewStudy_ = true;
+          result.isNewSeries_ = true;
+        }
+      }
 
-      switch (level)
+      // Create the series if needed
+      if (result.isNewSeries_)
       {
-        case ResourceType_Patient:
-          dicomSummary.ExtractPatientInformation(tags);
-          break;
+        result.seriesId_ = database.CreateResource(hashSeries, ResourceType_Series);
+      }
 
-        case ResourceType_Study:
-          // Duplicate the patient tags at the study level (new in Orthanc 0.9.5 - db v6)
-          dicomSummary.ExtractPatientInformation(tags);
-          StoreMainDicomTagsInternal(database, resource, tags);
+      // Create the study if needed
+      if (result.isNewStudy_)
+      {
+        result.studyId_ = database.CreateResource(hashStudy, ResourceType_Study);
+      }
 
-          dicomSummary.ExtractStudyInformation(tags);
-          break;
+      // Create the patient if needed
+      if (result.isNewPatient_)
+      {
+        result.patientId_ = database.CreateResource(hashPatient, ResourceType_Patient);
+      }
 
-        case ResourceType_Series:
-          dicomSummary.ExtractSeriesInformation(tags);
-          break;
+      // Create the parent-to-child links
+      database.AttachChild(result.seriesId_, instanceId);
 
-        case ResourceType_Instance:
-          dicomSummary.ExtractInstanceInformation(tags);
-          break;
+      if (result.isNewSeries_)
+      {
+        database.AttachChild(result.studyId_, result.seriesId_);
+      }
 
-        default:
-          throw OrthancException(ErrorCode_InternalError);
+      if (result.isNewStudy_)
+      {
+        database.AttachChild(result.patientId_, result.studyId_);
       }
 
-      StoreMainDicomTagsInternal(database, resource, tags);
+      // Sanity checks
+      assert(result.patientId_ != -1);
+      assert(result.studyId_ != -1);
+      assert(result.seriesId_ != -1);
+      assert(instanceId != -1);
+
+      return true;
     }
 
 
@@ -320,7 +363,7 @@ namespace Orthanc
           std::string content;
           accessor.Read(content, attachment);
 
-          ParsedDicomFile dicom(content);
+          ParsedDicomFile dicom(content, true /* lazy pixel data */);
 
           // Update the tags of this resource
           DicomMap dicomSummary;
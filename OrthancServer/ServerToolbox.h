@@ -50,6 +50,16 @@ namespace Orthanc
                             ResourceType level,
                             const DicomMap& dicomSummary);
 
+    // Fallback implementation for database back-ends that have no
+    // native support for "IDatabaseWrapper::CreateInstance()"
+    bool CreateInstance(IDatabaseWrapper::CreateInstanceResult& result,
+                        int64_t& instanceId,
+                        IDatabaseWrapper& database,
+                        const std::string& hashPatient,
+                        const std::string& hashStudy,
+                        const std::string& hashSeries,
+                        const std::string& hashInstance);
+
     bool FindOneChildInstance(int64_t& result,
                               IDatabaseWrapper& database,
                               int64_t resource,
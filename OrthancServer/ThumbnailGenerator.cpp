@@ -0,0 +1,263 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "ThumbnailGenerator.h"
+
+#include "../Core/DicomParsing/Internals/DicomImageDecoder.h"
+#include "../Core/Images/ImageRenderer.h"
+#include "../Core/Images/JpegWriter.h"
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+#include "ServerContext.h"
+#include "SliceOrdering.h"
+
+#include <cassert>
+
+namespace Orthanc
+{
+  // Same as the default quality of "/instances/.../preview", so that
+  // the thumbnails are identical to the images rendered on the fly
+  static const uint8_t THUMBNAIL_QUALITY = 90;
+
+
+  class ThumbnailGenerator::Job : public IRunnableBySteps
+  {
+  private:
+    ThumbnailGenerator&  that_;
+    std::string          resourceId_;
+    ResourceType         level_;
+
+  public:
+    Job(ThumbnailGenerator& that,
+        const std::string& resourceId,
+        ResourceType level) :
+      that_(that),
+      resourceId_(resourceId),
+      level_(level)
+    {
+    }
+
+    virtual ~Job()
+    {
+      that_.SignalJobDone();
+    }
+
+    virtual bool Step()
+    {
+      try
+      {
+        if (level_ == ResourceType_Series)
+        {
+          that_.GenerateSeries(resourceId_);
+        }
+        else
+        {
+          that_.GenerateInstance(resourceId_);
+        }
+      }
+      catch (OrthancException& e)
+      {
+        // This is not an error, as many instances have no image
+        // (e.g. structured reports) or are deleted in the meantime
+        LOG(INFO) << "Cannot generate the thumbnail of " << EnumerationToString(level_)
+                  << " " << resourceId_ << ": " << e.What();
+      }
+
+      return false;  // The job is done
+    }
+  };
+
+
+  void ThumbnailGenerator::Schedule(const std::string& resourceId,
+                                    ResourceType level)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (pending_ >= maxPending_)
+      {
+        // The thumbnail will be rendered on the fly if ever requested
+        LOG(WARNING) << "Too many pending thumbnails, skipping " 
+                     << EnumerationToString(level) << " " << resourceId;
+        return;
+      }
+
+      pending_++;
+    }
+
+    pool_->Add(new Job(*this, resourceId, level));
+  }
+
+
+  void ThumbnailGenerator::SignalJobDone()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    assert(pending_ > 0);
+    pending_--;
+  }
+
+
+  void ThumbnailGenerator::GenerateInstance(const std::string& instanceId)
+  {
+    std::string jpeg;
+    Render(jpeg, instanceId);
+    context_.SetThumbnail(instanceId, jpeg, true);
+
+    // The first thumbnail of a series is used for this series until
+    // it becomes stable, at which time its middle slice is chosen. The
+    // index checks atomically that the series has no thumbnail yet.
+    std::string seriesId;
+    if (context_.GetIndex().LookupParent(seriesId, instanceId))
+    {
+      context_.SetThumbnail(seriesId, jpeg, false);
+    }
+  }
+
+
+  void ThumbnailGenerator::GenerateSeries(const std::string& seriesId)
+  {
+    std::string instanceId;
+
+    {
+      SliceOrdering ordering(context_.GetIndex(), seriesId);
+      if (ordering.GetInstancesCount() == 0)
+      {
+        return;
+      }
+
+      instanceId = ordering.GetInstanceId(ordering.GetInstancesCount() / 2);
+    }
+
+    std::string jpeg;
+
+    FileInfo attachment;
+    if (context_.GetIndex().LookupAttachment(attachment, instanceId, FileContentType_Thumbnail))
+    {
+      context_.ReadAttachment(jpeg, attachment);
+    }
+    else
+    {
+      Render(jpeg, instanceId);
+    }
+
+    context_.SetThumbnail(seriesId, jpeg, true);
+  }
+
+
+  ThumbnailGenerator::ThumbnailGenerator(ServerContext& context,
+                                         unsigned int size,
+                                         unsigned int countThreads,
+                                         unsigned int maxPending) :
+    context_(context),
+    size_(size),
+    maxPending_(maxPending),
+    pending_(0)
+  {
+    if (size == 0 ||
+        countThreads == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    pool_.reset(new RunnableWorkersPool(countThreads));
+  }
+
+
+  ThumbnailGenerator::~ThumbnailGenerator()
+  {
+    // Wait for the workers to finish their current job, and discard
+    // the pending jobs
+    pool_.reset(NULL);
+  }
+
+
+  void ThumbnailGenerator::Render(std::string& jpeg,
+                                  const std::string& instanceId)
+  {
+    std::string dicom;
+    context_.ReadDicom(dicom, instanceId);
+
+    std::auto_ptr<ImageAccessor> decoded;
+
+#if ORTHANC_ENABLE_PLUGINS == 1
+    if (context_.HasPlugins() &&
+        context_.GetPlugins().HasCustomImageDecoder())
+    {
+      decoded.reset(context_.GetPlugins().DecodeUnsafe(dicom.c_str(), dicom.size(), 0));
+    }
+#endif
+
+    ParsedDicomFile parsed(dicom);
+
+    if (decoded.get() == NULL)
+    {
+      decoded.reset(DicomImageDecoder::Decode(parsed, 0));
+    }
+
+    PhotometricInterpretation photometric;
+    bool invert = (parsed.LookupPhotometricInterpretation(photometric) &&
+                   photometric == PhotometricInterpretation_Monochrome1);
+
+    ImageRenderer renderer;
+    renderer.SetStretchDynamics(true);
+    renderer.SetInvert(invert);
+    renderer.SetMaximumSize(size_, size_);
+
+    std::auto_ptr<ImageAccessor> rendered(renderer.Render(*decoded));
+
+    // The thumbnails are stored: Favor their size over the speed
+    JpegWriter writer;
+    writer.SetQuality(THUMBNAIL_QUALITY);
+    writer.SetProfile(ImageEncoderProfile_Small);
+    writer.SetChromaSubsampling(context_.IsJpegChromaSubsampling());
+    writer.WriteToMemory(jpeg, *rendered);
+  }
+
+
+  void ThumbnailGenerator::SignalStoredInstance(const std::string& publicId,
+                                                DicomInstanceToStore& instance,
+                                                const Json::Value& simplifiedTags)
+  {
+    Schedule(publicId, ResourceType_Instance);
+  }
+
+
+  void ThumbnailGenerator::SignalChange(const ServerIndexChange& change)
+  {
+    if (change.GetChangeType() == ChangeType_StableSeries)
+    {
+      Schedule(change.GetPublicId(), ResourceType_Series);
+    }
+  }
+}
@@ -0,0 +1,109 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "IServerListener.h"
+#include "../Core/MultiThreading/IRunnableBySteps.h"
+#include "../Core/MultiThreading/RunnableWorkersPool.h"
+
+#include <memory>
+#include <boost/thread/mutex.hpp>
+
+namespace Orthanc
+{
+  class ServerContext;
+
+  /**
+   * Renders the JPEG thumbnails of the received instances in a pool
+   * of background threads, so that the previews of a study can be
+   * served without decoding its images. Each stable series also gets
+   * the thumbnail of its middle slice. The thumbnails are stored as
+   * attachments of type "FileContentType_Thumbnail", out of the quota
+   * of the storage area (cf. "ServerIndex::SetThumbnail()").
+   **/
+  class ThumbnailGenerator : public IServerListener
+  {
+  private:
+    class Job;
+
+    ServerContext&  context_;
+    unsigned int    size_;
+    unsigned int    maxPending_;
+    boost::mutex    mutex_;
+    unsigned int    pending_;
+
+    // Must be the last member, as its destruction stops the workers
+    std::auto_ptr<RunnableWorkersPool>  pool_;
+
+    void Schedule(const std::string& resourceId,
+                  ResourceType level);
+
+    void SignalJobDone();
+
+    void GenerateInstance(const std::string& instanceId);
+
+    void GenerateSeries(const std::string& seriesId);
+
+  public:
+    ThumbnailGenerator(ServerContext& context,
+                       unsigned int size,
+                       unsigned int countThreads,
+                       unsigned int maxPending);
+
+    ~ThumbnailGenerator();
+
+    // The thumbnails fit in a square of this size
+    unsigned int GetSize() const
+    {
+      return size_;
+    }
+
+    // Renders the thumbnail of the first frame of an instance, using
+    // the same rendering as "/instances/.../preview"
+    void Render(std::string& jpeg,
+                const std::string& instanceId);
+
+    virtual void SignalStoredInstance(const std::string& publicId,
+                                      DicomInstanceToStore& instance,
+                                      const Json::Value& simplifiedTags);
+
+    virtual void SignalChange(const ServerIndexChange& change);
+
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance,
+                                        const Json::Value& simplified)
+    {
+      return true;
+    }
+  };
+}
@@ -0,0 +1,485 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "TranscodingService.h"
+
+#include "../Core/DicomParsing/ParsedDicomFile.h"
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+#include "ServerContext.h"
+
+#include <cassert>
+#include <boost/lexical_cast.hpp>
+
+namespace Orthanc
+{
+  // The series that match a policy are looked for every hour
+  static const unsigned int SWEEP_INTERVAL = 3600;  // In seconds
+
+
+  class TranscodingService::Job : public IRunnableBySteps
+  {
+  private:
+    TranscodingService&  that_;
+    std::string          seriesId_;
+    std::string          transferSyntax_;
+
+  public:
+    Job(TranscodingService& that,
+        const std::string& seriesId,
+        const std::string& transferSyntax) :
+      that_(that),
+      seriesId_(seriesId),
+      transferSyntax_(transferSyntax)
+    {
+    }
+
+    virtual ~Job()
+    {
+      that_.SignalJobDone(seriesId_);
+    }
+
+    virtual bool Step()
+    {
+      that_.SignalJobStarted(seriesId_);
+
+      try
+      {
+        that_.TranscodeSeries(seriesId_, transferSyntax_);
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot transcode series " << seriesId_ << ": " << e.What();
+      }
+
+      return false;  // The job is done
+    }
+  };
+
+
+  void TranscodingService::SweepThread(TranscodingService* that)
+  {
+    LOG(INFO) << "Starting the thread that looks for the series to be transcoded";
+
+    unsigned int count = SWEEP_INTERVAL;  // Sweep once at startup
+
+    while (!that->done_)
+    {
+      if (count < SWEEP_INTERVAL)
+      {
+        boost::this_thread::sleep(boost::posix_time::seconds(1));
+        count++;
+        continue;
+      }
+
+      try
+      {
+        that->Sweep();
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot look for the series to be transcoded: " << e.What();
+      }
+
+      count = 0;
+    }
+
+    LOG(INFO) << "Stopping the thread that looks for the series to be transcoded";
+  }
+
+
+  void TranscodingService::Sweep()
+  {
+    std::list<std::string> series;
+    context_.GetIndex().GetAllUuids(series, ResourceType_Series);
+
+    {
+      // Forget about the series that have been deleted
+      std::set<std::string> existing(series.begin(), series.end());
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      std::map<std::string, std::string>::iterator it = transcoded_.begin();
+      while (it != transcoded_.end())
+      {
+        if (existing.find(it->first) == existing.end())
+        {
+          transcoded_.erase(it++);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    for (std::list<std::string>::const_iterator
+           it = series.begin(); it != series.end() && !done_; ++it)
+    {
+      std::string transferSyntax;
+      if (LookupPolicy(transferSyntax, *it))
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          std::map<std::string, std::string>::const_iterator found = transcoded_.find(*it);
+          if (found != transcoded_.end() &&
+              found->second == transferSyntax)
+          {
+            continue;   // This series was already transcoded
+          }
+        }
+
+        Schedule(*it, transferSyntax);
+      }
+    }
+  }
+
+
+  bool TranscodingService::LookupPolicy(std::string& transferSyntax,
+                                        const std::string& seriesId)
+  {
+    DicomMap tags;
+    if (!context_.GetIndex().GetMainDicomTags(tags, seriesId, ResourceType_Series, ResourceType_Series))
+    {
+      return false;  // The series was deleted in the meantime
+    }
+
+    std::string modality;
+    if (!tags.CopyToString(modality, DICOM_TAG_MODALITY, false))
+    {
+      modality.clear();
+    }
+
+    // The dates are compared as ISO strings, as in "ServerIndex::PruneHistory()"
+    std::string lastUpdate;
+    if (!context_.GetIndex().LookupMetadata(lastUpdate, seriesId, MetadataType_LastUpdate))
+    {
+      lastUpdate.clear();
+    }
+
+    const boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+
+    for (size_t i = 0; i < policies_.size(); i++)
+    {
+      const Policy& policy = policies_[i];
+
+      if (!policy.modalities_.empty() &&
+          policy.modalities_.find(modality) == policy.modalities_.end())
+      {
+        continue;
+      }
+
+      if (policy.minimumAge_ > 0)
+      {
+        const std::string limit = boost::posix_time::to_iso_string
+          (now - boost::posix_time::hours(24 * policy.minimumAge_));
+
+        if (lastUpdate.empty() ||
+            lastUpdate > limit)
+        {
+          continue;  // The series is too recent for this policy
+        }
+      }
+
+      transferSyntax = policy.transferSyntax_;
+      return true;
+    }
+
+    return false;
+  }
+
+
+  void TranscodingService::Schedule(const std::string& seriesId,
+                                    const std::string& transferSyntax)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (queued_.find(seriesId) != queued_.end())
+      {
+        return;  // This series is already waiting in the queue
+      }
+
+      if (running_.find(seriesId) != running_.end())
+      {
+        // Instances might have been received after the running job
+        // has listed the series: Run it again once it is done
+        requeued_[seriesId] = transferSyntax;
+        return;
+      }
+
+      if (queued_.size() >= maxPending_)
+      {
+        // The series will be considered again at the next sweep
+        LOG(WARNING) << "Too many pending transcodings, skipping series " << seriesId;
+        return;
+      }
+
+      queued_.insert(seriesId);
+    }
+
+    pool_->Add(new Job(*this, seriesId, transferSyntax));
+  }
+
+
+  void TranscodingService::SignalJobStarted(const std::string& seriesId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    assert(queued_.find(seriesId) != queued_.end());
+    queued_.erase(seriesId);
+    running_.insert(seriesId);
+  }
+
+
+  void TranscodingService::SignalJobDone(const std::string& seriesId)
+  {
+    std::string transferSyntax;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (running_.erase(seriesId) == 0)
+      {
+        // The job is discarded before it was started
+        queued_.erase(seriesId);
+        return;
+      }
+
+      std::map<std::string, std::string>::iterator found = requeued_.find(seriesId);
+      if (found == requeued_.end())
+      {
+        return;
+      }
+
+      transferSyntax = found->second;
+      requeued_.erase(found);
+    }
+
+    if (!done_)
+    {
+      Schedule(seriesId, transferSyntax);
+    }
+  }
+
+
+  void TranscodingService::TranscodeSeries(const std::string& seriesId,
+                                           const std::string& transferSyntax)
+  {
+    std::list<std::string> instances;
+    context_.GetIndex().GetChildren(instances, seriesId);
+
+    for (std::list<std::string>::const_iterator
+           it = instances.begin(); it != instances.end() && !done_; ++it)
+    {
+      try
+      {
+        TranscodeInstance(*it, transferSyntax);
+      }
+      catch (OrthancException& e)
+      {
+        LOG(WARNING) << "Cannot transcode instance " << *it << " to transfer syntax "
+                     << transferSyntax << ": " << e.What();
+
+        boost::mutex::scoped_lock lock(mutex_);
+        countFailures_++;
+      }
+    }
+
+    if (!done_)
+    {
+      // The failed instances are not retried until the series is
+      // modified, or until Orthanc is restarted
+      boost::mutex::scoped_lock lock(mutex_);
+      transcoded_[seriesId] = transferSyntax;
+    }
+  }
+
+
+  void TranscodingService::TranscodeInstance(const std::string& instanceId,
+                                             const std::string& transferSyntax)
+  {
+    std::string current;
+    if (context_.GetIndex().LookupMetadata(current, instanceId, MetadataType_Instance_TransferSyntax) &&
+        current == transferSyntax)
+    {
+      return;  // Nothing to do
+    }
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    std::string source, target;
+    context_.ReadDicom(source, instanceId);
+
+    {
+      ParsedDicomFile dicom(source);
+      if (!dicom.Transcode(target, transferSyntax))
+      {
+        throw OrthancException(ErrorCode_NotImplemented);
+      }
+    }
+
+    context_.ReplaceDicom(instanceId, source, target, transferSyntax);
+
+    const boost::posix_time::time_duration elapsed = 
+      boost::posix_time::microsec_clock::universal_time() - start;
+
+    LOG(INFO) << "Instance " << instanceId << " transcoded to transfer syntax "
+              << transferSyntax << " (" << source.size() << " -> " << target.size() << " bytes)";
+
+    boost::mutex::scoped_lock lock(mutex_);
+    countInstances_++;
+    sourceBytes_ += source.size();
+    targetBytes_ += target.size();
+    microseconds_ += static_cast<uint64_t>(elapsed.total_microseconds());
+  }
+
+
+  TranscodingService::TranscodingService(ServerContext& context,
+                                         unsigned int countThreads,
+                                         unsigned int maxPending) :
+    context_(context),
+    maxPending_(maxPending),
+    done_(false),
+    countInstances_(0),
+    countFailures_(0),
+    sourceBytes_(0),
+    targetBytes_(0),
+    microseconds_(0)
+  {
+    if (countThreads == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    pool_.reset(new RunnableWorkersPool(countThreads));
+  }
+
+
+  TranscodingService::~TranscodingService()
+  {
+    done_ = true;
+
+    if (sweepThread_.joinable())
+    {
+      sweepThread_.join();
+    }
+
+    // Wait for the workers to finish their current job, and discard
+    // the pending jobs
+    pool_.reset(NULL);
+  }
+
+
+  bool TranscodingService::IsSupportedTransferSyntax(const std::string& transferSyntax)
+  {
+    return (transferSyntax == "1.2.840.10008.1.2" ||       // Little Endian Implicit
+            transferSyntax == "1.2.840.10008.1.2.1" ||     // Little Endian Explicit
+            transferSyntax == "1.2.840.10008.1.2.2" ||     // Big Endian Explicit
+            transferSyntax == "1.2.840.10008.1.2.5" ||     // RLE Lossless
+            transferSyntax == "1.2.840.10008.1.2.4.57" ||  // JPEG Lossless
+            transferSyntax == "1.2.840.10008.1.2.4.70" ||  // JPEG Lossless, first-order prediction
+            transferSyntax == "1.2.840.10008.1.2.4.80");   // JPEG-LS Lossless
+  }
+
+
+  void TranscodingService::AddPolicy(const std::set<std::string>& modalities,
+                                     unsigned int minimumAge,
+                                     const std::string& transferSyntax)
+  {
+    if (!IsSupportedTransferSyntax(transferSyntax))
+    {
+      LOG(ERROR) << "Cannot transcode to this transfer syntax: " << transferSyntax;
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    Policy policy;
+    policy.modalities_ = modalities;
+    policy.minimumAge_ = minimumAge;
+    policy.transferSyntax_ = transferSyntax;
+    policies_.push_back(policy);
+  }
+
+
+  void TranscodingService::Start()
+  {
+    // The sweep is needed even if no policy has a minimum age, in
+    // order to process the series that have not been scheduled when
+    // they became stable
+    if (!policies_.empty())
+    {
+      sweepThread_ = boost::thread(SweepThread, this);
+    }
+  }
+
+
+  void TranscodingService::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // Use strings, as "Json::Value" cannot store 64bit integers
+    target = Json::objectValue;
+    target["CountInstances"] = boost::lexical_cast<std::string>(countInstances_);
+    target["CountFailures"] = boost::lexical_cast<std::string>(countFailures_);
+    target["CountPendingSeries"] = static_cast<unsigned int>(queued_.size());
+    target["CountRunningSeries"] = static_cast<unsigned int>(running_.size());
+    target["SourceBytes"] = boost::lexical_cast<std::string>(sourceBytes_);
+    target["TargetBytes"] = boost::lexical_cast<std::string>(targetBytes_);
+    target["Milliseconds"] = boost::lexical_cast<std::string>(microseconds_ / 1000);
+
+    // Throughput of the transcoding, in instances per second of work
+    target["InstancesPerSecond"] = (microseconds_ == 0 ? 0.0 :
+                                    static_cast<double>(countInstances_) * 1000000.0 /
+                                    static_cast<double>(microseconds_));
+  }
+
+
+  void TranscodingService::SignalChange(const ServerIndexChange& change)
+  {
+    if (change.GetChangeType() == ChangeType_StableSeries)
+    {
+      {
+        // New instances might have been received since the last transcoding
+        boost::mutex::scoped_lock lock(mutex_);
+        transcoded_.erase(change.GetPublicId());
+      }
+
+      std::string transferSyntax;
+      if (LookupPolicy(transferSyntax, change.GetPublicId()))
+      {
+        Schedule(change.GetPublicId(), transferSyntax);
+      }
+    }
+  }
+}
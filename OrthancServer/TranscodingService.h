@@ -0,0 +1,145 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "IServerListener.h"
+#include "../Core/MultiThreading/IRunnableBySteps.h"
+#include "../Core/MultiThreading/RunnableWorkersPool.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  class ServerContext;
+
+  /**
+   * Converts the stored DICOM instances to another lossless transfer
+   * syntax (uncompressed, RLE, JPEG Lossless or JPEG-LS) in a pool
+   * of background threads. The target transfer syntax of a series is
+   * given by the first policy that matches its modality and its age,
+   * i.e. the time since it was last updated. The policies without
+   * minimum age are applied as soon as the series becomes stable, the
+   * others are applied by a periodic sweep over the series. The sweep
+   * also catches up with the series that were skipped while the queue
+   * was full, or that were stored before Orthanc was started.
+   **/
+  class TranscodingService : public IServerListener
+  {
+  private:
+    class Job;
+
+    struct Policy
+    {
+      std::set<std::string>  modalities_;  // Empty means "all the modalities"
+      unsigned int           minimumAge_;  // In days
+      std::string            transferSyntax_;
+    };
+
+    ServerContext&         context_;
+    unsigned int           maxPending_;
+    std::vector<Policy>    policies_;
+    bool                   done_;
+    boost::thread          sweepThread_;
+
+    boost::mutex           mutex_;
+    std::set<std::string>  queued_;
+    std::set<std::string>  running_;
+    std::map<std::string, std::string>  requeued_;    // Series => transfer syntax
+    std::map<std::string, std::string>  transcoded_;  // Series => transfer syntax
+    uint64_t               countInstances_;
+    uint64_t               countFailures_;
+    uint64_t               sourceBytes_;
+    uint64_t               targetBytes_;
+    uint64_t               microseconds_;
+
+    // Must be the last member, as its destruction stops the workers
+    std::auto_ptr<RunnableWorkersPool>  pool_;
+
+    static void SweepThread(TranscodingService* that);
+
+    void Sweep();
+
+    bool LookupPolicy(std::string& transferSyntax,
+                      const std::string& seriesId);
+
+    void Schedule(const std::string& seriesId,
+                  const std::string& transferSyntax);
+
+    void SignalJobStarted(const std::string& seriesId);
+
+    void SignalJobDone(const std::string& seriesId);
+
+    void TranscodeSeries(const std::string& seriesId,
+                         const std::string& transferSyntax);
+
+    void TranscodeInstance(const std::string& instanceId,
+                           const std::string& transferSyntax);
+
+  public:
+    TranscodingService(ServerContext& context,
+                       unsigned int countThreads,
+                       unsigned int maxPending);
+
+    ~TranscodingService();
+
+    static bool IsSupportedTransferSyntax(const std::string& transferSyntax);
+
+    // Must be invoked before "Start()"
+    void AddPolicy(const std::set<std::string>& modalities,
+                   unsigned int minimumAge,
+                   const std::string& transferSyntax);
+
+    void Start();
+
+    void GetStatistics(Json::Value& target);
+
+    virtual void SignalStoredInstance(const std::string& publicId,
+                                      DicomInstanceToStore& instance,
+                                      const Json::Value& simplifiedTags)
+    {
+    }
+
+    virtual void SignalChange(const ServerIndexChange& change);
+
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance,
+                                        const Json::Value& simplified)
+    {
+      return true;
+    }
+  };
+}
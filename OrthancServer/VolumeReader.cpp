@@ -0,0 +1,440 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "VolumeReader.h"
+
+#include "../Core/DicomParsing/Internals/DicomImageDecoder.h"
+#include "../Core/Logging.h"
+#include "../Core/MultiThreading/Semaphore.h"
+#include "../Core/OrthancException.h"
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace Orthanc
+{
+  static unsigned int GetDecodingSlotsCount()
+  {
+    unsigned int count = boost::thread::hardware_concurrency();
+    return (count == 0 ? 1 : count);
+  }
+
+
+  // Process-wide pool of slots that is shared by all the volumes that
+  // are concurrently read, so that the number of frames that are
+  // decoded in parallel does not grow with the number of HTTP requests
+  static Semaphore  decodingSlots_(GetDecodingSlotsCount());
+
+
+  namespace
+  {
+    class DecodingSlots : public boost::noncopyable
+    {
+    private:
+      unsigned int  count_;
+
+    public:
+      DecodingSlots() : count_(0)
+      {
+      }
+
+      ~DecodingSlots()
+      {
+        for (unsigned int i = 0; i < count_; i++)
+        {
+          decodingSlots_.Release();
+        }
+      }
+
+      bool Acquire(unsigned int timeout)
+      {
+        if (decodingSlots_.TryAcquire(timeout))
+        {
+          count_++;
+          return true;
+        }
+        else
+        {
+          return false;
+        }
+      }
+
+      unsigned int GetCount() const
+      {
+        return count_;
+      }
+    };
+  }
+
+
+  class VolumeReader::Frames : public boost::noncopyable
+  {
+  private:
+    std::vector<ImageAccessor*>  images_;
+
+  public:
+    ~Frames()
+    {
+      for (size_t i = 0; i < images_.size(); i++)
+      {
+        if (images_[i] != NULL)
+        {
+          delete images_[i];
+        }
+      }
+    }
+
+    std::vector<ImageAccessor*>& GetImages()
+    {
+      return images_;
+    }
+
+    size_t GetSize() const
+    {
+      return images_.size();
+    }
+
+    ImageAccessor* Release(size_t index)
+    {
+      assert(index < images_.size());
+      ImageAccessor* image = images_[index];
+      images_[index] = NULL;
+      return image;
+    }
+  };
+
+
+  void VolumeReader::DecodeInstance(Frames& target,
+                                    const std::string& instanceId,
+                                    unsigned int threadsCount)
+  {
+    std::string dicom;
+    context_.ReadDicom(dicom, instanceId);
+
+    // Parse the file locally instead of going through the cache of
+    // the server context, as in "BulkContentReader"
+    ParsedDicomFile parsed(dicom);
+    const unsigned int count = parsed.GetFramesCount();
+
+#if ORTHANC_ENABLE_PLUGINS == 1
+    if (context_.HasPlugins() &&
+        context_.GetPlugins().HasCustomImageDecoder())
+    {
+      for (unsigned int frame = 0; frame < count; frame++)
+      {
+        std::auto_ptr<ImageAccessor> image(context_.GetPlugins().DecodeUnsafe(dicom.c_str(), dicom.size(), frame));
+        if (image.get() == NULL)
+        {
+          image.reset(DicomImageDecoder::Decode(parsed, frame));
+        }
+
+        target.GetImages().push_back(image.release());
+      }
+
+      return;
+    }
+#endif
+
+    DicomImageDecoder::DecodeFrames(target.GetImages(), parsed, 0, count, threadsCount);
+  }
+
+
+  void VolumeReader::Worker(VolumeReader* that)
+  {
+    for (;;)
+    {
+      size_t index;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->cancelled_ &&
+               that->nextToDecode_ < that->instances_.size() &&
+               that->nextToDecode_ >= that->nextToConsume_ + that->maxPending_)
+        {
+          that->consumed_.wait(lock);
+        }
+
+        if (that->cancelled_ ||
+            that->nextToDecode_ >= that->instances_.size())
+        {
+          return;
+        }
+
+        index = that->nextToDecode_++;
+      }
+
+      std::auto_ptr<Frames> frames(new Frames);
+      bool success = true;
+
+      try
+      {
+        DecodingSlots slots;
+
+        // Wait for a slot in the shared pool, unless the reading of
+        // the volume is cancelled in the meantime
+        while (!slots.Acquire(100 /* milliseconds */))
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          if (that->cancelled_)
+          {
+            return;
+          }
+        }
+
+        if (that->instances_.size() == 1)
+        {
+          // The volume is made of one single multi-frame instance: Its
+          // frames are decoded in parallel, using the slots that are
+          // available at once
+          while (slots.GetCount() < that->threadsCount_ &&
+                 slots.Acquire(0))
+          {
+          }
+        }
+
+        that->DecodeInstance(*frames, that->instances_[index], slots.GetCount());
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot decode instance " << that->instances_[index]
+                   << " of a volume: " << e.What();
+        success = false;
+      }
+      catch (std::bad_alloc&)
+      {
+        LOG(ERROR) << "Not enough memory to decode a volume";
+        success = false;
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Native exception while decoding instance "
+                   << that->instances_[index] << " of a volume";
+        success = false;
+      }
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      if (success)
+      {
+        that->ready_[index] = frames.release();
+      }
+      else
+      {
+        that->cancelled_ = true;
+        that->success_ = false;
+        that->consumed_.notify_all();
+      }
+
+      that->decoded_.notify_all();
+    }
+  }
+
+
+  VolumeReader::VolumeReader(ServerContext& context,
+                             const std::vector<std::string>& instances,
+                             unsigned int threadsCount,
+                             size_t maxPending) :
+    context_(context),
+    instances_(instances),
+    threadsCount_(threadsCount),
+    maxPending_(maxPending),
+    nextToDecode_(0),
+    nextToConsume_(0),
+    cancelled_(false),
+    success_(true),
+    currentFrame_(0)
+  {
+    if (threadsCount == 0 ||
+        maxPending == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    workers_.resize(threadsCount);
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      workers_[i] = new boost::thread(Worker, this);
+    }
+  }
+
+
+  VolumeReader::~VolumeReader()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      cancelled_ = true;
+      consumed_.notify_all();
+    }
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      if (workers_[i]->joinable())
+      {
+        workers_[i]->join();
+      }
+
+      delete workers_[i];
+    }
+
+    for (std::map<size_t, Frames*>::iterator it = ready_.begin(); it != ready_.end(); ++it)
+    {
+      delete it->second;
+    }
+  }
+
+
+  ImageAccessor* VolumeReader::Next()
+  {
+    for (;;)
+    {
+      if (current_.get() != NULL &&
+          currentFrame_ < current_->GetSize())
+      {
+        return current_->Release(currentFrame_++);
+      }
+
+      current_.reset(NULL);
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (success_ &&
+             nextToConsume_ < instances_.size() &&
+             ready_.find(nextToConsume_) == ready_.end())
+      {
+        decoded_.wait(lock);
+      }
+
+      if (!success_ ||
+          nextToConsume_ >= instances_.size())
+      {
+        return NULL;
+      }
+
+      std::map<size_t, Frames*>::iterator found = ready_.find(nextToConsume_);
+      current_.reset(found->second);
+      currentFrame_ = 0;
+      ready_.erase(found);
+
+      nextToConsume_++;
+      consumed_.notify_all();
+    }
+  }
+
+
+  bool VolumeReader::IsSuccess()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return success_;
+  }
+
+
+  void VolumeReader::FormatNumpyHeader(std::string& target,
+                                       PixelFormat format,
+                                       unsigned int width,
+                                       unsigned int height,
+                                       unsigned int depth)
+  {
+    // https://docs.scipy.org/doc/numpy/neps/npy-format.html
+    std::string type;
+    unsigned int channels = 1;
+
+    switch (format)
+    {
+      case PixelFormat_Grayscale8:
+        type = "|u1";
+        break;
+
+      case PixelFormat_Grayscale16:
+        type = "<u2";
+        break;
+
+      case PixelFormat_SignedGrayscale16:
+        type = "<i2";
+        break;
+
+      case PixelFormat_Float32:
+        type = "<f4";
+        break;
+
+      case PixelFormat_RGB24:
+        type = "|u1";
+        channels = 3;
+        break;
+
+      case PixelFormat_RGBA32:
+        type = "|u1";
+        channels = 4;
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    std::string shape = (boost::lexical_cast<std::string>(depth) + ", " +
+                         boost::lexical_cast<std::string>(height) + ", " +
+                         boost::lexical_cast<std::string>(width));
+
+    if (channels != 1)
+    {
+      shape += ", " + boost::lexical_cast<std::string>(channels);
+    }
+
+    std::string dictionary = ("{'descr': '" + type + "', 'fortran_order': False, "
+                              "'shape': (" + shape + "), }");
+
+    // The magic string, the version and the length of the header take
+    // 10 bytes. The total size is padded with spaces to a multiple of
+    // 64 bytes, and the header is terminated by a newline.
+    size_t length = 10 + dictionary.size() + 1;
+    length = ((length + 63) / 64) * 64;
+
+    const size_t headerLength = length - 10;
+    if (headerLength > 65535)
+    {
+      throw OrthancException(ErrorCode_InternalError);
+    }
+
+    target = "\x93NUMPY";
+    target.push_back(1);  // Major version
+    target.push_back(0);  // Minor version
+    target.push_back(static_cast<char>(headerLength & 0xff));
+    target.push_back(static_cast<char>((headerLength >> 8) & 0xff));
+    target += dictionary;
+    target.append(length - target.size() - 1, ' ');
+    target.push_back('\n');
+
+    assert(target.size() == length);
+  }
+}
@@ -0,0 +1,105 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017 Osimis, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ServerContext.h"
+
+#include <map>
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Decodes all the frames of an ordered list of instances (typically
+   * the slices of a 3D volume) in a pool of threads, and delivers the
+   * decoded frames in order to the consumer that writes them to the
+   * network. At most "maxPending" instances are decoded ahead of the
+   * consumer. A thread only decodes once it owns a slot of a pool
+   * that is shared by all the readers, whose size is the number of
+   * CPU cores.
+   **/
+  class VolumeReader : public boost::noncopyable
+  {
+  private:
+    class Frames;
+
+    ServerContext&                 context_;
+    std::vector<std::string>       instances_;
+    unsigned int                   threadsCount_;
+    size_t                         maxPending_;
+
+    boost::mutex                   mutex_;
+    boost::condition_variable      decoded_;
+    boost::condition_variable      consumed_;
+    size_t                         nextToDecode_;
+    size_t                         nextToConsume_;
+    std::map<size_t, Frames*>      ready_;
+    bool                           cancelled_;
+    bool                           success_;
+    std::vector<boost::thread*>    workers_;
+
+    std::auto_ptr<Frames>          current_;
+    size_t                         currentFrame_;
+
+    void DecodeInstance(Frames& target,
+                        const std::string& instanceId,
+                        unsigned int threadsCount);
+
+    static void Worker(VolumeReader* that);
+
+  public:
+    VolumeReader(ServerContext& context,
+                 const std::vector<std::string>& instances,
+                 unsigned int threadsCount,
+                 size_t maxPending);
+
+    ~VolumeReader();
+
+    // Returns NULL once all the frames have been read. The caller
+    // takes the ownership of the returned image.
+    ImageAccessor* Next();
+
+    // Only meaningful once "Next()" has returned NULL
+    bool IsSuccess();
+
+    // Header of a NumPy ".npy" file containing a volume of "depth"
+    // frames, with one dimension per channel for color images
+    static void FormatNumpyHeader(std::string& target,
+                                  PixelFormat format,
+                                  unsigned int width,
+                                  unsigned int height,
+                                  unsigned int depth);
+  };
+}
@@ -763,12 +763,16 @@ static bool StartHttpServer(ServerContext& context,
   httpServer.SetPortNumber(Configuration::GetGlobalUnsignedIntegerParameter("HttpPort", 8042));
   httpServer.SetRemoteAccessAllowed(Configuration::GetGlobalBoolParameter("RemoteAccessAllowed", false));
   httpServer.SetKeepAliveEnabled(Configuration::GetGlobalBoolParameter("KeepAlive", false));
+  httpServer.SetKeepAliveTimeout(Configuration::GetGlobalUnsignedIntegerParameter("KeepAliveTimeout", 1));
   httpServer.SetHttpCompressionEnabled(Configuration::GetGlobalBoolParameter("HttpCompressionEnabled", true));
+  httpServer.SetThreadsCount(Configuration::GetGlobalUnsignedIntegerParameter("HttpThreadsCount", 50));
+  httpServer.SetRequestTimeout(Configuration::GetGlobalUnsignedIntegerParameter("HttpRequestTimeout", 30));
   httpServer.SetIncomingHttpRequestFilter(httpFilter);
   httpServer.SetHttpExceptionFormatter(exceptionFormatter);
 
   httpServer.SetAuthenticationEnabled(Configuration::GetGlobalBoolParameter("AuthenticationEnabled", false));
   Configuration::SetupRegisteredUsers(httpServer);
+  Configuration::SetupHttpConcurrencyLimits(context.GetHttpHandler());
 
   if (Configuration::GetGlobalBoolParameter("SslEnabled", false))
   {
@@ -972,7 +976,8 @@ static void UpgradeDatabase(IDatabaseWrapper& database,
 
 static bool ConfigureServerContext(IDatabaseWrapper& database,
                                    IStorageArea& storageArea,
-                                   OrthancPlugins *plugins)
+                                   OrthancPlugins *plugins,
+                                   bool isBuiltinDatabase)
 {
   // These configuration options must be set before creating the
   // ServerContext, otherwise the possible Lua scripts will not be
@@ -986,6 +991,16 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
   DicomUserConnection::SetDefaultTimeout(Configuration::GetGlobalUnsignedIntegerParameter("DicomScuTimeout", 10));
 
   ServerContext context(database, storageArea);
+
+  if (isBuiltinDatabase)
+  {
+    DatabaseReadersPool* readers = Configuration::CreateDatabaseReadersPool();
+    if (readers != NULL)
+    {
+      context.GetIndex().SetReadersPool(readers);
+    }
+  }
+
   context.SetCompressionEnabled(Configuration::GetGlobalBoolParameter("StorageCompression", false));
   context.SetStoreMD5ForAttachments(Configuration::GetGlobalBoolParameter("StoreMD5ForAttachments", true));
 
@@ -1008,6 +1023,10 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
     context.GetIndex().SetMaximumStorageSize(0);
   }
 
+  context.GetIndex().SetMaximumHistorySize(Configuration::GetGlobalUnsignedIntegerParameter("MaximumHistorySize", 0));
+  context.GetIndex().SetMaximumHistoryAge(Configuration::GetGlobalUnsignedIntegerParameter("MaximumHistoryAge", 0));
+  context.GetIndex().SetMaximumChangesWaiters(Configuration::GetGlobalUnsignedIntegerParameter("ChangesLongPollingLimit", 4));
+
   LoadLuaScripts(context);
 
 #if ORTHANC_ENABLE_PLUGINS == 1
@@ -1052,7 +1071,8 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
 static bool ConfigureDatabase(IDatabaseWrapper& database,
                               IStorageArea& storageArea,
                               OrthancPlugins *plugins,
-                              bool upgradeDatabase)
+                              bool upgradeDatabase,
+                              bool isBuiltinDatabase)
 {
   database.Open();
 
@@ -1071,7 +1091,7 @@ static bool ConfigureDatabase(IDatabaseWrapper& database,
     throw OrthancException(ErrorCode_IncompatibleDatabaseVersion);
   }
 
-  bool success = ConfigureServerContext(database, storageArea, plugins);
+  bool success = ConfigureServerContext(database, storageArea, plugins, isBuiltinDatabase);
 
   database.Close();
 
@@ -1116,14 +1136,15 @@ static bool ConfigurePlugins(int argc,
   assert(database != NULL);
   assert(storage.get() != NULL);
 
-  return ConfigureDatabase(*database, *storage, &plugins, upgradeDatabase);
+  return ConfigureDatabase(*database, *storage, &plugins, upgradeDatabase,
+                           databasePtr.get() != NULL /* built-in SQLite index */);
 
 #elif ORTHANC_ENABLE_PLUGINS == 0
   // The plugins are disabled
   databasePtr.reset(Configuration::CreateDatabaseWrapper());
   storage.reset(Configuration::CreateStorageArea());
 
-  return ConfigureDatabase(*databasePtr, *storage, NULL, upgradeDatabase);
+  return ConfigureDatabase(*databasePtr, *storage, NULL, upgradeDatabase, true);
 
 #else
 #  error The macro ORTHANC_ENABLE_PLUGINS must be set to 0 or 1
@@ -41,6 +41,9 @@
 
 #include "../../Core/OrthancException.h"
 #include "../../Core/Logging.h"
+#include "../../OrthancServer/ResourcesContent.h"
+#include "../../OrthancServer/Search/LookupIdentifierQuery.h"
+#include "../../OrthancServer/ServerToolbox.h"
 #include "PluginsEnumerations.h"
 
 #include <cassert>
@@ -76,6 +79,7 @@ namespace Orthanc
     answerDicomMap_ = NULL;
     answerChanges_ = NULL;
     answerExportedResources_ = NULL;
+    answerMetadata_ = NULL;
     answerDone_ = NULL;
   }
 
@@ -175,6 +179,7 @@ namespace Orthanc
     answerDicomMap_(NULL),
     answerChanges_(NULL),
     answerExportedResources_(NULL),
+    answerMetadata_(NULL),
     answerDone_(NULL)
   {
     memset(&extensions_, 0, sizeof(extensions_));
@@ -256,6 +261,23 @@ namespace Orthanc
   void OrthancPluginDatabase::GetAllMetadata(std::map<MetadataType, std::string>& target,
                                              int64_t id)
   {
+    if (extensions_.getAllMetadata != NULL)
+    {
+      ResetAnswers();
+      answerMetadata_ = &target;
+      target.clear();
+
+      CheckSuccess(extensions_.getAllMetadata(GetContext(), payload_, id));
+
+      if (type_ != _OrthancPluginDatabaseAnswerType_None &&
+          type_ != _OrthancPluginDatabaseAnswerType_Metadata)
+      {
+        throw OrthancException(ErrorCode_DatabasePlugin);
+      }
+
+      return;
+    }
+
     std::list<MetadataType> metadata;
     ListAvailableMetadata(metadata, id);
 
@@ -885,6 +907,150 @@ namespace Orthanc
   }
 
 
+  bool OrthancPluginDatabase::CreateInstance(CreateInstanceResult& result,
+                                             int64_t& instanceId,
+                                             const std::string& patient,
+                                             const std::string& study,
+                                             const std::string& series,
+                                             const std::string& instance)
+  {
+    if (extensions_.createInstance == NULL)
+    {
+      return ServerToolbox::CreateInstance(result, instanceId, *this, patient, study, series, instance);
+    }
+
+    OrthancPluginCreateInstanceResult output;
+    memset(&output, 0, sizeof(output));
+
+    CheckSuccess(extensions_.createInstance(&output, payload_, patient.c_str(),
+                                            study.c_str(), series.c_str(), instance.c_str()));
+
+    instanceId = output.instanceId;
+
+    if (output.isNewInstance)
+    {
+      result.isNewPatient_ = output.isNewPatient;
+      result.isNewStudy_ = output.isNewStudy;
+      result.isNewSeries_ = output.isNewSeries;
+      result.patientId_ = output.patientId;
+      result.studyId_ = output.studyId;
+      result.seriesId_ = output.seriesId;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  static void ConvertTags(std::vector<OrthancPluginResourcesContentTags>& target,
+                          const ResourcesContent::ListTags& source)
+  {
+    target.resize(source.size());
+
+    size_t i = 0;
+    for (ResourcesContent::ListTags::const_iterator
+           it = source.begin(); it != source.end(); ++it, i++)
+    {
+      target[i].resource = it->GetResourceId();
+      target[i].group = it->GetTag().GetGroup();
+      target[i].element = it->GetTag().GetElement();
+      target[i].value = it->GetValue().c_str();
+    }
+  }
+
+
+  void OrthancPluginDatabase::SetResourcesContent(const ResourcesContent& content)
+  {
+    if (extensions_.setResourcesContent == NULL)
+    {
+      content.Store(*this);
+      return;
+    }
+
+    std::vector<OrthancPluginResourcesContentTags> identifierTags, mainDicomTags;
+    ConvertTags(identifierTags, content.GetIdentifierTags());
+    ConvertTags(mainDicomTags, content.GetMainDicomTags());
+
+    std::vector<OrthancPluginResourcesContentMetadata> metadata;
+    metadata.reserve(content.GetMetadata().size());
+
+    for (ResourcesContent::ListMetadata::const_iterator
+           it = content.GetMetadata().begin(); it != content.GetMetadata().end(); ++it)
+    {
+      OrthancPluginResourcesContentMetadata tmp;
+      tmp.resource = it->GetResourceId();
+      tmp.metadata = static_cast<int32_t>(it->GetType());
+      tmp.value = it->GetValue().c_str();
+      metadata.push_back(tmp);
+    }
+
+    std::vector<OrthancPluginResourcesContentAttachment> attachments;
+    attachments.reserve(content.GetAttachments().size());
+
+    for (ResourcesContent::ListAttachments::const_iterator
+           it = content.GetAttachments().begin(); it != content.GetAttachments().end(); ++it)
+    {
+      const FileInfo& info = it->GetAttachment();
+
+      OrthancPluginResourcesContentAttachment tmp;
+      tmp.resource = it->GetResourceId();
+      tmp.attachment.uuid = info.GetUuid().c_str();
+      tmp.attachment.contentType = static_cast<int32_t>(info.GetContentType());
+      tmp.attachment.uncompressedSize = info.GetUncompressedSize();
+      tmp.attachment.uncompressedHash = info.GetUncompressedMD5().c_str();
+      tmp.attachment.compressionType = static_cast<int32_t>(info.GetCompressionType());
+      tmp.attachment.compressedSize = info.GetCompressedSize();
+      tmp.attachment.compressedHash = info.GetCompressedMD5().c_str();
+      attachments.push_back(tmp);
+    }
+
+    CheckSuccess(extensions_.setResourcesContent(
+                   payload_,
+                   identifierTags.size(), identifierTags.empty() ? NULL : &identifierTags[0],
+                   mainDicomTags.size(), mainDicomTags.empty() ? NULL : &mainDicomTags[0],
+                   metadata.size(), metadata.empty() ? NULL : &metadata[0],
+                   attachments.size(), attachments.empty() ? NULL : &attachments[0]));
+  }
+
+
+  void OrthancPluginDatabase::LookupIdentifiers(std::list<int64_t>& result,
+                                                const LookupIdentifierQuery& query)
+  {
+    if (extensions_.lookupIdentifiers == NULL)
+    {
+      query.ApplyWithPrimitives(result, *this);
+      return;
+    }
+
+    std::vector<OrthancPluginIdentifierConstraintItem> constraints;
+
+    for (size_t i = 0; i < query.GetSize(); i++)
+    {
+      const LookupIdentifierQuery::Disjunction& disjunction = query.GetDisjunction(i);
+
+      for (size_t j = 0; j < disjunction.GetSize(); j++)
+      {
+        const LookupIdentifierQuery::Constraint& constraint = disjunction.GetConstraint(j);
+
+        OrthancPluginIdentifierConstraintItem item;
+        item.disjunction = static_cast<uint32_t>(i);
+        item.group = constraint.GetTag().GetGroup();
+        item.element = constraint.GetTag().GetElement();
+        item.constraint = Plugins::Convert(constraint.GetType());
+        item.value = constraint.GetValue().c_str();
+        constraints.push_back(item);
+      }
+    }
+
+    ResetAnswers();
+    CheckSuccess(extensions_.lookupIdentifiers(GetContext(), payload_, Plugins::Convert(query.GetLevel()),
+                                               constraints.size(), constraints.empty() ? NULL : &constraints[0]));
+    ForwardAnswers(result);
+  }
+
+
   void OrthancPluginDatabase::AnswerReceived(const _OrthancPluginDatabaseAnswer& answer)
   {
     if (answer.type == _OrthancPluginDatabaseAnswerType_None)
@@ -942,6 +1108,11 @@ namespace Orthanc
           answerExportedResources_->clear();
           break;
 
+        case _OrthancPluginDatabaseAnswerType_Metadata:
+          assert(answerMetadata_ != NULL);
+          answerMetadata_->clear();
+          break;
+
         default:
           LOG(ERROR) << "Unhandled type of answer for custom index plugin: " << answer.type;
           throw OrthancException(ErrorCode_DatabasePlugin);
@@ -1069,6 +1240,18 @@ namespace Orthanc
         break;
       }
 
+      case _OrthancPluginDatabaseAnswerType_Metadata:
+      {
+        if (answer.valueString == NULL)
+        {
+          throw OrthancException(ErrorCode_DatabasePlugin);
+        }
+
+        assert(answerMetadata_ != NULL);
+        (*answerMetadata_) [static_cast<MetadataType>(answer.valueInt32)] = answer.valueString;
+        break;
+      }
+
       default:
         LOG(ERROR) << "Unhandled type of answer for custom index plugin: " << answer.type;
         throw OrthancException(ErrorCode_DatabasePlugin);
@@ -66,6 +66,7 @@ namespace Orthanc
     DicomMap*                      answerDicomMap_;
     std::list<ServerIndexChange>*  answerChanges_;
     std::list<ExportedResource>*   answerExportedResources_;
+    std::map<MetadataType, std::string>*  answerMetadata_;
     bool*                          answerDone_;
 
     OrthancPluginDatabaseContext* GetContext()
@@ -138,6 +139,26 @@ namespace Orthanc
       return false;
     }
 
+    virtual bool HasHistoryPruning() const
+    {
+      // The database SDK has no primitive to remove a range of changes
+      return false;
+    }
+
+    virtual unsigned int PruneChanges(int64_t maxSeq,
+                                      const std::string& olderThan,
+                                      unsigned int maxCount)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
+    virtual unsigned int PruneExportedResources(int64_t maxSeq,
+                                                const std::string& olderThan,
+                                                unsigned int maxCount)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
+
     virtual void GetAllMetadata(std::map<MetadataType, std::string>& target,
                                 int64_t id);
 
@@ -261,6 +282,18 @@ namespace Orthanc
     virtual void Upgrade(unsigned int targetVersion,
                          IStorageArea& storageArea);
 
+    virtual bool CreateInstance(CreateInstanceResult& result,
+                                int64_t& instanceId,
+                                const std::string& patient,
+                                const std::string& study,
+                                const std::string& series,
+                                const std::string& instance);
+
+    virtual void SetResourcesContent(const ResourcesContent& content);
+
+    virtual void LookupIdentifiers(std::list<int64_t>& result,
+                                   const LookupIdentifierQuery& query);
+
     void AnswerReceived(const _OrthancPluginDatabaseAnswer& answer);
   };
 }
@@ -308,6 +308,33 @@ namespace Orthanc
     };
 
 
+    class ChunkedRestCallback : public boost::noncopyable
+    {
+    private:
+      _OrthancPluginChunkedRestCallback  parameters_;
+      boost::regex                       regex_;
+
+    public:
+      ChunkedRestCallback(const _OrthancPluginChunkedRestCallback& parameters) :
+        parameters_(parameters),
+        regex_(parameters.pathRegularExpression)
+      {
+        // The regular expression is not owned by Orthanc
+        parameters_.pathRegularExpression = NULL;
+      }
+
+      const boost::regex& GetRegularExpression() const
+      {
+        return regex_;
+      }
+
+      const _OrthancPluginChunkedRestCallback& GetParameters() const
+      {
+        return parameters_;
+      }
+    };
+
+
     class ServerContextLock
     {
     private:
@@ -342,6 +369,7 @@ namespace Orthanc
 
     typedef std::pair<std::string, _OrthancPluginProperty>  Property;
     typedef std::list<RestCallback*>  RestCallbacks;
+    typedef std::list<ChunkedRestCallback*>  ChunkedRestCallbacks;
     typedef std::list<OrthancPluginOnStoredInstanceCallback>  OnStoredCallbacks;
     typedef std::list<OrthancPluginOnChangeCallback>  OnChangeCallbacks;
     typedef std::list<OrthancPluginIncomingHttpRequestFilter>  IncomingHttpRequestFilters;
@@ -352,6 +380,7 @@ namespace Orthanc
     PluginsManager manager_;
 
     RestCallbacks restCallbacks_;
+    ChunkedRestCallbacks chunkedRestCallbacks_;
     OnStoredCallbacks  onStoredCallbacks_;
     OnChangeCallbacks  onChangeCallbacks_;
     OrthancPluginFindCallback  findCallback_;
@@ -791,6 +820,12 @@ namespace Orthanc
     {
       delete *it;
     }
+
+    for (PImpl::ChunkedRestCallbacks::iterator it = pimpl_->chunkedRestCallbacks_.begin(); 
+         it != pimpl_->chunkedRestCallbacks_.end(); ++it)
+    {
+      delete *it;
+    }
   }
 
 
@@ -827,6 +862,256 @@ namespace Orthanc
   }
 
 
+  namespace
+  {
+    // Anonymous namespace to avoid clashes between compilation modules
+    class HttpRequestConverter : public boost::noncopyable
+    {
+    private:
+      std::vector<std::string>  groups_;
+      std::vector<const char*>  cgroups_;
+      std::vector<const char*>  getKeys_;
+      std::vector<const char*>  getValues_;
+      std::vector<const char*>  headersKeys_;
+      std::vector<const char*>  headersValues_;
+      OrthancPluginHttpRequest  request_;
+
+    public:
+      HttpRequestConverter(const boost::cmatch& match,
+                           HttpMethod method,
+                           const IHttpHandler::Arguments& headers)
+      {
+        memset(&request_, 0, sizeof(OrthancPluginHttpRequest));
+
+        // Extract the value of the free parameters of the regular expression
+        if (match.size() > 1)
+        {
+          groups_.resize(match.size() - 1);
+          cgroups_.resize(match.size() - 1);
+          for (size_t i = 1; i < match.size(); i++)
+          {
+            groups_[i - 1] = match[i];
+            cgroups_[i - 1] = groups_[i - 1].c_str();
+          }
+        }
+
+        switch (method)
+        {
+          case HttpMethod_Get:
+            request_.method = OrthancPluginHttpMethod_Get;
+            break;
+
+          case HttpMethod_Post:
+            request_.method = OrthancPluginHttpMethod_Post;
+            break;
+
+          case HttpMethod_Delete:
+            request_.method = OrthancPluginHttpMethod_Delete;
+            break;
+
+          case HttpMethod_Put:
+            request_.method = OrthancPluginHttpMethod_Put;
+            break;
+
+          default:
+            throw OrthancException(ErrorCode_InternalError);
+        }
+
+        ArgumentsToPlugin(headersKeys_, headersValues_, headers);
+
+        request_.groups = (cgroups_.size() ? &cgroups_[0] : NULL);
+        request_.groupsCount = cgroups_.size();
+        request_.headersCount = headers.size();
+
+        if (headers.size() > 0)
+        {
+          request_.headersKeys = &headersKeys_[0];
+          request_.headersValues = &headersValues_[0];
+        }
+      }
+
+      void SetGetArguments(const IHttpHandler::GetArguments& arguments)
+      {
+        ArgumentsToPlugin(getKeys_, getValues_, arguments);
+
+        request_.getCount = arguments.size();
+
+        if (arguments.size() > 0)
+        {
+          request_.getKeys = &getKeys_[0];
+          request_.getValues = &getValues_[0];
+        }
+      }
+
+      void SetBody(const char* data,
+                   size_t size)
+      {
+        request_.body = data;
+        request_.bodySize = size;
+      }
+
+      const OrthancPluginHttpRequest& GetRequest() const
+      {
+        return request_;
+      }
+    };
+
+
+    class PluginChunkedRequestReader : public IHttpHandler::IChunkedRequestReader
+    {
+    private:
+      // As for "OrthancPluginRegisterRestCallback()", the chunked
+      // callbacks are serialized with the other REST callbacks
+      boost::recursive_mutex&                   restCallbackMutex_;
+      PluginsErrorDictionary&                   dictionary_;
+      _OrthancPluginChunkedRestCallback         parameters_;
+      OrthancPluginServerChunkedRequestReader*  reader_;
+
+      void CheckSuccess(OrthancPluginErrorCode error)
+      {
+        if (error != OrthancPluginErrorCode_Success)
+        {
+          dictionary_.LogError(error, false);
+          throw OrthancException(static_cast<ErrorCode>(error));
+        }
+      }
+
+    public:
+      PluginChunkedRequestReader(boost::recursive_mutex& restCallbackMutex,
+                                 PluginsErrorDictionary& dictionary,
+                                 const _OrthancPluginChunkedRestCallback& parameters,
+                                 OrthancPluginServerChunkedRequestReaderFactory factory,
+                                 const std::string& flatUri,
+                                 const OrthancPluginHttpRequest& request) :
+        restCallbackMutex_(restCallbackMutex),
+        dictionary_(dictionary),
+        parameters_(parameters),
+        reader_(NULL)
+      {
+        assert(factory != NULL);
+
+        OrthancPluginErrorCode error;
+
+        {
+          boost::recursive_mutex::scoped_lock lock(restCallbackMutex_);
+          error = factory(&reader_, flatUri.c_str(), &request);
+        }
+
+        CheckSuccess(error);
+
+        if (reader_ == NULL)
+        {
+          throw OrthancException(ErrorCode_Plugin);
+        }
+      }
+
+      virtual ~PluginChunkedRequestReader()
+      {
+        assert(reader_ != NULL);
+
+        boost::recursive_mutex::scoped_lock lock(restCallbackMutex_);
+        parameters_.finalize(reader_);
+      }
+
+      virtual void AddBodyChunk(const void* data,
+                                size_t size)
+      {
+        // The chunks given to the plugins are limited to 4GB
+        static const size_t MAX_CHUNK = 0xffffffffu;
+
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+
+        while (size > 0)
+        {
+          size_t s = (size < MAX_CHUNK ? size : MAX_CHUNK);
+
+          OrthancPluginErrorCode error;
+
+          {
+            boost::recursive_mutex::scoped_lock lock(restCallbackMutex_);
+            error = parameters_.addChunk(reader_, p, static_cast<uint32_t>(s));
+          }
+
+          CheckSuccess(error);
+          p += s;
+          size -= s;
+        }
+      }
+
+      virtual void Execute(HttpOutput& output)
+      {
+        OrthancPluginErrorCode error;
+
+        {
+          boost::recursive_mutex::scoped_lock lock(restCallbackMutex_);
+          error = parameters_.execute(reader_, reinterpret_cast<OrthancPluginRestOutput*>(&output));
+        }
+
+        if (error == OrthancPluginErrorCode_Success && 
+            output.IsWritingMultipart())
+        {
+          output.CloseMultipart();
+        }
+
+        CheckSuccess(error);
+      }
+    };
+  }
+
+
+  template <typename Callback>
+  static Callback* LookupRestCallback(boost::cmatch& match,
+                                      const std::list<Callback*>& callbacks,
+                                      const std::string& flatUri)
+  {
+    // If several callbacks match the URI, the last one is used
+    Callback* callback = NULL;
+
+    for (typename std::list<Callback*>::const_iterator it = callbacks.begin(); 
+         it != callbacks.end(); ++it)
+    {
+      // Check whether the regular expression associated to this
+      // callback matches the URI
+      boost::cmatch what;
+      if (boost::regex_match(flatUri.c_str(), what, (*it)->GetRegularExpression()))
+      {
+        callback = *it;
+        match = what;
+      }
+    }
+
+    return callback;
+  }
+
+
+  static std::string GetChunkedAllowedMethods(const _OrthancPluginChunkedRestCallback& parameters)
+  {
+    std::string s;
+
+    if (parameters.getHandler != NULL)
+    {
+      s += ",GET";
+    }
+
+    if (parameters.postHandler != NULL)
+    {
+      s += ",POST";
+    }
+
+    if (parameters.deleteHandler != NULL)
+    {
+      s += ",DELETE";
+    }
+
+    if (parameters.putHandler != NULL)
+    {
+      s += ",PUT";
+    }
+
+    return s.empty() ? s : s.substr(1);
+  }
+
+
   bool OrthancPlugins::Handle(HttpOutput& output,
                               RequestOrigin /*origin*/,
                               const char* /*remoteIp*/,
@@ -839,38 +1124,46 @@ namespace Orthanc
                               size_t bodySize)
   {
     std::string flatUri = Toolbox::FlattenUri(uri);
-    PImpl::RestCallback* callback = NULL;
-
-    std::vector<std::string> groups;
-    std::vector<const char*> cgroups;
+    boost::cmatch match;
 
     // Loop over the callbacks registered by the plugins
-    bool found = false;
-    for (PImpl::RestCallbacks::const_iterator it = pimpl_->restCallbacks_.begin(); 
-         it != pimpl_->restCallbacks_.end() && !found; ++it)
+    PImpl::RestCallback* callback = LookupRestCallback(match, pimpl_->restCallbacks_, flatUri);
+
+    if (callback != NULL)
     {
-      // Check whether the regular expression associated to this
-      // callback matches the URI
-      boost::cmatch what;
-      if (boost::regex_match(flatUri.c_str(), what, (*it)->GetRegularExpression()))
+      LOG(INFO) << "Delegating HTTP request to plugin for URI: " << flatUri;
+
+      HttpRequestConverter converter(match, method, headers);
+      converter.SetBody(bodyData, bodySize);
+
+      if (method == HttpMethod_Get)
       {
-        callback = *it;
+        converter.SetGetArguments(getArguments);
+      }
 
-        // Extract the value of the free parameters of the regular expression
-        if (what.size() > 1)
-        {
-          groups.resize(what.size() - 1);
-          cgroups.resize(what.size() - 1);
-          for (size_t i = 1; i < what.size(); i++)
-          {
-            groups[i - 1] = what[i];
-            cgroups[i - 1] = groups[i - 1].c_str();
-          }
-        }
+      OrthancPluginErrorCode error = callback->Invoke
+        (pimpl_->restCallbackMutex_, output, flatUri, converter.GetRequest());
+
+      if (error == OrthancPluginErrorCode_Success && 
+          output.IsWritingMultipart())
+      {
+        output.CloseMultipart();
+      }
+
+      if (error == OrthancPluginErrorCode_Success)
+      {
+        return true;
+      }
+      else
+      {
+        GetErrorDictionary().LogError(error, false);
+        throw OrthancException(static_cast<ErrorCode>(error));
       }
     }
 
-    if (callback == NULL)
+    PImpl::ChunkedRestCallback* chunked = LookupRestCallback(match, pimpl_->chunkedRestCallbacks_, flatUri);
+
+    if (chunked == NULL)
     {
       // Callback not found
       return false;
@@ -878,74 +1171,122 @@ namespace Orthanc
 
     LOG(INFO) << "Delegating HTTP request to plugin for URI: " << flatUri;
 
-    std::vector<const char*> getKeys, getValues, headersKeys, headersValues;
-
-    OrthancPluginHttpRequest request;
-    memset(&request, 0, sizeof(OrthancPluginHttpRequest));
+    const _OrthancPluginChunkedRestCallback& parameters = chunked->GetParameters();
+    HttpRequestConverter converter(match, method, headers);
 
-    ArgumentsToPlugin(headersKeys, headersValues, headers);
+    OrthancPluginRestCallback handler = NULL;
+    OrthancPluginServerChunkedRequestReaderFactory factory = NULL;
 
     switch (method)
     {
       case HttpMethod_Get:
-        request.method = OrthancPluginHttpMethod_Get;
-        ArgumentsToPlugin(getKeys, getValues, getArguments);
+        handler = parameters.getHandler;
+        converter.SetGetArguments(getArguments);
         break;
 
-      case HttpMethod_Post:
-        request.method = OrthancPluginHttpMethod_Post;
+      case HttpMethod_Delete:
+        handler = parameters.deleteHandler;
         break;
 
-      case HttpMethod_Delete:
-        request.method = OrthancPluginHttpMethod_Delete;
+      case HttpMethod_Post:
+        factory = parameters.postHandler;
         break;
 
       case HttpMethod_Put:
-        request.method = OrthancPluginHttpMethod_Put;
+        factory = parameters.putHandler;
         break;
 
       default:
         throw OrthancException(ErrorCode_InternalError);
     }
 
+    if (handler != NULL)
+    {
+      OrthancPluginErrorCode error;
 
-    request.groups = (cgroups.size() ? &cgroups[0] : NULL);
-    request.groupsCount = cgroups.size();
-    request.getCount = getArguments.size();
-    request.body = bodyData;
-    request.bodySize = bodySize;
-    request.headersCount = headers.size();
-    
-    if (getArguments.size() > 0)
+      {
+        boost::recursive_mutex::scoped_lock lock(pimpl_->restCallbackMutex_);
+        error = handler(reinterpret_cast<OrthancPluginRestOutput*>(&output), 
+                        flatUri.c_str(), &converter.GetRequest());
+      }
+
+      if (error == OrthancPluginErrorCode_Success && 
+          output.IsWritingMultipart())
+      {
+        output.CloseMultipart();
+      }
+
+      if (error != OrthancPluginErrorCode_Success)
+      {
+        GetErrorDictionary().LogError(error, false);
+        throw OrthancException(static_cast<ErrorCode>(error));
+      }
+    }
+    else if (factory != NULL)
     {
-      request.getKeys = &getKeys[0];
-      request.getValues = &getValues[0];
+      // The body is already available in memory (e.g. multipart
+      // upload, or call from a Lua script): Give it as a single chunk
+      PluginChunkedRequestReader reader(pimpl_->restCallbackMutex_, GetErrorDictionary(),
+                                        parameters, factory, flatUri, converter.GetRequest());
+      reader.AddBodyChunk(bodyData, bodySize);
+      reader.Execute(output);
     }
-    
-    if (headers.size() > 0)
+    else
     {
-      request.headersKeys = &headersKeys[0];
-      request.headersValues = &headersValues[0];
+      output.SendMethodNotAllowed(GetChunkedAllowedMethods(parameters));
     }
 
-    assert(callback != NULL);
-    OrthancPluginErrorCode error = callback->Invoke(pimpl_->restCallbackMutex_, output, flatUri, request);
+    return true;
+  }
+
+
+  bool OrthancPlugins::CreateChunkedRequestReader(std::auto_ptr<IChunkedRequestReader>& target,
+                                                  RequestOrigin /*origin*/,
+                                                  const char* /*remoteIp*/,
+                                                  const char* /*username*/,
+                                                  HttpMethod method,
+                                                  const UriComponents& uri,
+                                                  const Arguments& headers)
+  {
+    std::string flatUri = Toolbox::FlattenUri(uri);
+    boost::cmatch match;
 
-    if (error == OrthancPluginErrorCode_Success && 
-        output.IsWritingMultipart())
+    if (LookupRestCallback(match, pimpl_->restCallbacks_, flatUri) != NULL)
     {
-      output.CloseMultipart();
+      // Regular callback: The full body must be read before "Handle()"
+      return true;
     }
 
-    if (error == OrthancPluginErrorCode_Success)
+    PImpl::ChunkedRestCallback* chunked = LookupRestCallback(match, pimpl_->chunkedRestCallbacks_, flatUri);
+
+    if (chunked == NULL)
     {
-      return true;
+      return false;
     }
-    else
+
+    const _OrthancPluginChunkedRestCallback& parameters = chunked->GetParameters();
+
+    OrthancPluginServerChunkedRequestReaderFactory factory = NULL;
+
+    if (method == HttpMethod_Post)
+    {
+      factory = parameters.postHandler;
+    }
+    else if (method == HttpMethod_Put)
     {
-      GetErrorDictionary().LogError(error, false);
-      throw OrthancException(static_cast<ErrorCode>(error));
+      factory = parameters.putHandler;
     }
+
+    if (factory != NULL)
+    {
+      LOG(INFO) << "Delegating chunked HTTP request to plugin for URI: " << flatUri;
+
+      HttpRequestConverter converter(match, method, headers);
+      target.reset(new PluginChunkedRequestReader(pimpl_->restCallbackMutex_, GetErrorDictionary(),
+                                                  parameters, factory, flatUri, converter.GetRequest()));
+    }
+
+    return true;
   }
 
 
@@ -1020,6 +1361,25 @@ namespace Orthanc
 
 
 
+  void OrthancPlugins::RegisterChunkedRestCallback(const void* parameters)
+  {
+    const _OrthancPluginChunkedRestCallback& p = 
+      *reinterpret_cast<const _OrthancPluginChunkedRestCallback*>(parameters);
+
+    if ((p.postHandler != NULL || p.putHandler != NULL) &&
+        (p.addChunk == NULL || p.execute == NULL || p.finalize == NULL))
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    LOG(INFO) << "Plugin has registered a chunked REST callback on: " 
+              << p.pathRegularExpression;
+
+    pimpl_->chunkedRestCallbacks_.push_back(new PImpl::ChunkedRestCallback(p));
+  }
+
+
+
   void OrthancPlugins::RegisterOnStoredInstanceCallback(const void* parameters)
   {
     const _OrthancPluginOnStoredInstanceCallback& p = 
@@ -1652,6 +2012,31 @@ namespace Orthanc
   }
 
 
+  void OrthancPlugins::TranscodeDicomInstance(const void* parameters)
+  {
+    const _OrthancPluginTranscodeDicomInstance& p = 
+      *reinterpret_cast<const _OrthancPluginTranscodeDicomInstance*>(parameters);
+
+    if (p.transferSyntax == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    std::string result;
+
+    {
+      ParsedDicomFile dicom(p.source, p.size);
+      if (!dicom.Transcode(result, p.transferSyntax))
+      {
+        LOG(ERROR) << "No codec is available to transcode to transfer syntax: " << p.transferSyntax;
+        throw OrthancException(ErrorCode_NotImplemented);
+      }
+    }
+
+    CopyToMemoryBuffer(*p.target, result);
+  }
+
+
   static OrthancPluginImage* ReturnImage(std::auto_ptr<ImageAccessor>& image)
   {
     // Images returned to plugins are assumed to be writeable. If the
@@ -2217,6 +2602,10 @@ namespace Orthanc
         BufferCompression(parameters);
         return true;
 
+      case _OrthancPluginService_TranscodeDicomInstance:
+        TranscodeDicomInstance(parameters);
+        return true;
+
       case _OrthancPluginService_AnswerBuffer:
         AnswerBuffer(parameters);
         return true;
@@ -2704,6 +3093,10 @@ namespace Orthanc
         RegisterIncomingHttpRequestFilter2(parameters);
         return true;
 
+      case _OrthancPluginService_RegisterChunkedRestCallback:
+        RegisterChunkedRestCallback(parameters);
+        return true;
+
       case _OrthancPluginService_RegisterStorageArea:
       {
         LOG(INFO) << "Plugin has registered a custom storage area";
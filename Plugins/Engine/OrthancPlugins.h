@@ -92,6 +92,8 @@ namespace Orthanc
     void RegisterRestCallback(const void* parameters,
                               bool lock);
 
+    void RegisterChunkedRestCallback(const void* parameters);
+
     void RegisterOnStoredInstanceCallback(const void* parameters);
 
     void RegisterOnChangeCallback(const void* parameters);
@@ -147,6 +149,8 @@ namespace Orthanc
 
     void BufferCompression(const void* parameters);
 
+    void TranscodeDicomInstance(const void* parameters);
+
     void UncompressImage(const void* parameters);
 
     void CompressImage(const void* parameters);
@@ -213,6 +217,14 @@ namespace Orthanc
                         const char* bodyData,
                         size_t bodySize);
 
+    virtual bool CreateChunkedRequestReader(std::auto_ptr<IChunkedRequestReader>& target,
+                                            RequestOrigin origin,
+                                            const char* remoteIp,
+                                            const char* username,
+                                            HttpMethod method,
+                                            const UriComponents& uri,
+                                            const Arguments& headers);
+
     virtual bool InvokeService(SharedLibrary& plugin,
                                _OrthancPluginService service,
                                const void* parameters);
@@ -195,6 +195,9 @@ namespace Orthanc
         case FileContentType_DicomAsJson:
           return OrthancPluginContentType_DicomAsJson;
 
+        case FileContentType_Thumbnail:
+          return OrthancPluginContentType_Thumbnail;
+
         default:
           return OrthancPluginContentType_Unknown;
       }
@@ -211,6 +214,9 @@ namespace Orthanc
         case OrthancPluginContentType_DicomAsJson:
           return FileContentType_DicomAsJson;
 
+        case OrthancPluginContentType_Thumbnail:
+          return FileContentType_Thumbnail;
+
         default:
           return FileContentType_Unknown;
       }
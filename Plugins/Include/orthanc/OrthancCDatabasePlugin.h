@@ -75,6 +75,7 @@ extern "C"
     _OrthancPluginDatabaseAnswerType_Int64 = 15,
     _OrthancPluginDatabaseAnswerType_Resource = 16,
     _OrthancPluginDatabaseAnswerType_String = 17,
+    _OrthancPluginDatabaseAnswerType_Metadata = 18,
 
     _OrthancPluginDatabaseAnswerType_INTERNAL = 0x7fffffff
   } _OrthancPluginDatabaseAnswerType;
@@ -120,6 +121,51 @@ extern "C"
     const char*                sopInstanceUid;
   } OrthancPluginExportedResource;
 
+  typedef struct
+  {
+    uint8_t  isNewInstance;
+    int64_t  instanceId;
+
+    /* The following fields are only used if "isNewInstance == true",
+       in which case all the parent IDs must be set */
+    uint8_t  isNewPatient;
+    uint8_t  isNewStudy;
+    uint8_t  isNewSeries;
+    int64_t  patientId;
+    int64_t  studyId;
+    int64_t  seriesId;
+  } OrthancPluginCreateInstanceResult;
+
+  typedef struct
+  {
+    int64_t      resource;
+    uint16_t     group;
+    uint16_t     element;
+    const char*  value;
+  } OrthancPluginResourcesContentTags;
+
+  typedef struct
+  {
+    int64_t      resource;
+    int32_t      metadata;
+    const char*  value;
+  } OrthancPluginResourcesContentMetadata;
+
+  typedef struct
+  {
+    int64_t                  resource;
+    OrthancPluginAttachment  attachment;
+  } OrthancPluginResourcesContentAttachment;
+
+  typedef struct
+  {
+    uint32_t                           disjunction;  /* Index of the disjunction containing this constraint */
+    uint16_t                           group;
+    uint16_t                           element;
+    OrthancPluginIdentifierConstraint  constraint;
+    const char*                        value;
+  } OrthancPluginIdentifierConstraintItem;
+
 
   typedef struct
   {
@@ -202,6 +248,21 @@ extern "C"
     context->InvokeService(context, _OrthancPluginService_DatabaseAnswer, &params);
   }
 
+  ORTHANC_PLUGIN_INLINE void OrthancPluginDatabaseAnswerMetadata(
+    OrthancPluginContext*          context,
+    OrthancPluginDatabaseContext*  database,
+    int32_t                        metadata,
+    const char*                    value)
+  {
+    _OrthancPluginDatabaseAnswer params;
+    memset(&params, 0, sizeof(params));
+    params.database = database;
+    params.type = _OrthancPluginDatabaseAnswerType_Metadata;
+    params.valueInt32 = metadata;
+    params.valueString = value;
+    context->InvokeService(context, _OrthancPluginService_DatabaseAnswer, &params);
+  }
+
   ORTHANC_PLUGIN_INLINE void OrthancPluginDatabaseAnswerExportedResource(
     OrthancPluginContext*                 context,
     OrthancPluginDatabaseContext*         database,
@@ -682,6 +743,53 @@ extern "C"
       OrthancPluginResourceType resourceType,
       const OrthancPluginDicomTag* tag,
       OrthancPluginIdentifierConstraint constraint);
+
+    /* The following primitives are new in Orthanc 1.3.1. They are
+       optional: If they are set to NULL, Orthanc falls back to a
+       sequence of calls to the primitives above. */
+
+    /* Creates the instance and its missing parents, in one call */
+    OrthancPluginErrorCode  (*createInstance) (
+      /* outputs */
+      OrthancPluginCreateInstanceResult* output,
+      /* inputs */
+      void* payload,
+      const char* hashPatient,
+      const char* hashStudy,
+      const char* hashSeries,
+      const char* hashInstance);
+
+    /* Stores all the tags, metadata and attachments of a new instance */
+    OrthancPluginErrorCode  (*setResourcesContent) (
+      /* inputs */
+      void* payload,
+      uint32_t countIdentifierTags,
+      const OrthancPluginResourcesContentTags* identifierTags,
+      uint32_t countMainDicomTags,
+      const OrthancPluginResourcesContentTags* mainDicomTags,
+      uint32_t countMetadata,
+      const OrthancPluginResourcesContentMetadata* metadata,
+      uint32_t countAttachments,
+      const OrthancPluginResourcesContentAttachment* attachments);
+
+    /* Intersection of disjunctions of constraints, in one call.
+       Output: Use OrthancPluginDatabaseAnswerInt64() */
+    OrthancPluginErrorCode  (*lookupIdentifiers) (
+      /* outputs */
+      OrthancPluginDatabaseContext* context,
+      /* inputs */
+      void* payload,
+      OrthancPluginResourceType resourceType,
+      uint32_t countConstraints,
+      const OrthancPluginIdentifierConstraintItem* constraints);
+
+    /* Output: Use OrthancPluginDatabaseAnswerMetadata() */
+    OrthancPluginErrorCode  (*getAllMetadata) (
+      /* outputs */
+      OrthancPluginDatabaseContext* context,
+      /* inputs */
+      void* payload,
+      int64_t id);
    } OrthancPluginDatabaseExtensions;
 
 /*<! @endcond */
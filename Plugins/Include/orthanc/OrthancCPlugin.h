@@ -14,6 +14,7 @@
  *    - Store the context pointer so that it can use the plugin 
  *      services of Orthanc.
  *    - Register all its REST callbacks using ::OrthancPluginRegisterRestCallback().
+ *    - Possibly register REST callbacks that read the body of the requests as a stream using OrthancPluginRegisterChunkedRestCallback().
  *    - Possibly register its callback for received DICOM instances using ::OrthancPluginRegisterOnStoredInstanceCallback().
  *    - Possibly register its callback for changes to the DICOM store using ::OrthancPluginRegisterOnChangeCallback().
  *    - Possibly register a custom storage area using ::OrthancPluginRegisterStorageArea().
@@ -410,6 +411,7 @@ extern "C"
     _OrthancPluginService_CallHttpClient2 = 27,
     _OrthancPluginService_GenerateUuid = 28,
     _OrthancPluginService_RegisterPrivateDictionaryTag = 29,
+    _OrthancPluginService_TranscodeDicomInstance = 30,  /* New in Orthanc 1.3.1 */
 
     /* Registration of callbacks */
     _OrthancPluginService_RegisterRestCallback = 1000,
@@ -423,6 +425,7 @@ extern "C"
     _OrthancPluginService_RegisterFindCallback = 1008,
     _OrthancPluginService_RegisterMoveCallback = 1009,
     _OrthancPluginService_RegisterIncomingHttpRequestFilter2 = 1010,
+    _OrthancPluginService_RegisterChunkedRestCallback = 1011,  /* New in Orthanc 1.3.1 */
 
     /* Sending answers to REST calls */
     _OrthancPluginService_AnswerBuffer = 2000,
@@ -583,6 +586,7 @@ extern "C"
     OrthancPluginContentType_Unknown = 0,      /*!< Unknown content type */
     OrthancPluginContentType_Dicom = 1,        /*!< DICOM */
     OrthancPluginContentType_DicomAsJson = 2,  /*!< JSON summary of a DICOM file */
+    OrthancPluginContentType_Thumbnail = 3,    /*!< JPEG thumbnail of an instance or series */
 
     _OrthancPluginContentType_INTERNAL = 0x7fffffff
   } OrthancPluginContentType;
@@ -870,6 +874,15 @@ extern "C"
 
 
 
+  /**
+   * @brief Opaque structure that is created by a plugin to read the
+   * body of an incoming HTTP request, as it is received by Orthanc.
+   * @ingroup Callbacks
+   **/
+  typedef struct _OrthancPluginServerChunkedRequestReader_t OrthancPluginServerChunkedRequestReader;
+
+
+
   /**
    * @brief Signature of a callback function that answers to a REST request.
    * @ingroup Callbacks
@@ -881,6 +894,60 @@ extern "C"
 
 
 
+  /**
+   * @brief Signature of a callback function that creates a reader for
+   * the body of an incoming POST or PUT request.
+   *
+   * The "body" and "bodySize" fields of "request" are not set, as the
+   * body has not been received yet. The GET arguments are not set
+   * either. The content of "request" is only valid during the call.
+   *
+   * @param reader Memory location where to store the newly created reader.
+   * @param url The URI of the request.
+   * @param request The description of the request, without its body.
+   * @return 0 if success, other value if error.
+   * @ingroup Callbacks
+   **/
+  typedef OrthancPluginErrorCode (*OrthancPluginServerChunkedRequestReaderFactory) (
+    OrthancPluginServerChunkedRequestReader** reader,
+    const char* url,
+    const OrthancPluginHttpRequest* request);
+
+
+
+  /**
+   * @brief Signature of a callback function that receives one chunk
+   * of the body of an incoming request.
+   * @ingroup Callbacks
+   **/
+  typedef OrthancPluginErrorCode (*OrthancPluginServerChunkedRequestReaderAddChunk) (
+    OrthancPluginServerChunkedRequestReader* reader,
+    const void* data,
+    uint32_t size);
+
+
+
+  /**
+   * @brief Signature of a callback function that answers to a request
+   * whose body has been entirely received.
+   * @ingroup Callbacks
+   **/
+  typedef OrthancPluginErrorCode (*OrthancPluginServerChunkedRequestReaderExecute) (
+    OrthancPluginServerChunkedRequestReader* reader,
+    OrthancPluginRestOutput* output);
+
+
+
+  /**
+   * @brief Signature of a callback function that releases a reader.
+   * It is always invoked, even if an error has occurred.
+   * @ingroup Callbacks
+   **/
+  typedef void (*OrthancPluginServerChunkedRequestReaderFinalize) (
+    OrthancPluginServerChunkedRequestReader* reader);
+
+
+
   /**
    * @brief Signature of a callback function that is triggered when Orthanc receives a DICOM instance.
    * @ingroup Callbacks
@@ -2948,7 +3015,7 @@ extern "C"
    * 
    * @param context The Orthanc plugin context, as received by OrthancPluginInitialize().
    * @param output The HTTP connection to the client application.
-   * @param subType The sub-type of the multipart answer ("mixed" or "related").
+   * @param subType The sub-type of the multipart answer ("mixed", "related" or "x-mixed-replace").
    * @param contentType The MIME type of the items in the multipart answer.
    * @return 0 if success, or the error code if failure.
    * @see OrthancPluginSendMultipartItem(), OrthancPluginSendMultipartItem2()
@@ -5609,6 +5676,124 @@ extern "C"
     return context->InvokeService(context, _OrthancPluginService_RegisterIncomingHttpRequestFilter2, &params);
   }
 
+
+
+  typedef struct
+  {
+    const char*                                      pathRegularExpression;
+    OrthancPluginRestCallback                        getHandler;
+    OrthancPluginServerChunkedRequestReaderFactory   postHandler;
+    OrthancPluginRestCallback                        deleteHandler;
+    OrthancPluginServerChunkedRequestReaderFactory   putHandler;
+    OrthancPluginServerChunkedRequestReaderAddChunk  addChunk;
+    OrthancPluginServerChunkedRequestReaderExecute   execute;
+    OrthancPluginServerChunkedRequestReaderFinalize  finalize;
+  } _OrthancPluginChunkedRestCallback;
+
+  /**
+   * @brief Register a REST callback that reads the body of the
+   * requests as a stream.
+   *
+   * This function registers a REST callback against a regular
+   * expression for a URI. Contrarily to
+   * OrthancPluginRegisterRestCallback(), the body of the POST and PUT
+   * requests is not accumulated in memory by Orthanc: It is given to
+   * the plugin chunk by chunk, as it is received from the network
+   * (possibly using the chunked transfer encoding). This is useful to
+   * process large uploads with a bounded memory footprint.
+   *
+   * For each POST (resp. PUT) request, "postHandler" (resp.
+   * "putHandler") creates a reader, that receives the successive
+   * chunks of the body through "addChunk". Once the body is complete,
+   * "execute" is invoked to write the answer. The reader is finally
+   * released by "finalize".
+   *
+   * As with OrthancPluginRegisterRestCallback(), the callbacks are
+   * invoked in mutual exclusion with the other REST callbacks. This
+   * function must be called during the initialization of the plugin,
+   * i.e. inside the OrthancPluginInitialize() public function.
+   * 
+   * @param context The Orthanc plugin context, as received by OrthancPluginInitialize().
+   * @param pathRegularExpression Regular expression for the URI. May contain groups.
+   * @param getHandler The callback for GET requests (can be NULL).
+   * @param postHandler The factory of readers for POST requests (can be NULL).
+   * @param deleteHandler The callback for DELETE requests (can be NULL).
+   * @param putHandler The factory of readers for PUT requests (can be NULL).
+   * @param addChunk The callback receiving the chunks of the body.
+   * @param execute The callback answering the request once the body is complete.
+   * @param finalize The callback releasing the reader.
+   * @see OrthancPluginRegisterRestCallback()
+   * @ingroup Callbacks
+   **/
+  ORTHANC_PLUGIN_INLINE void OrthancPluginRegisterChunkedRestCallback(
+    OrthancPluginContext*                            context,
+    const char*                                      pathRegularExpression,
+    OrthancPluginRestCallback                        getHandler,
+    OrthancPluginServerChunkedRequestReaderFactory   postHandler,
+    OrthancPluginRestCallback                        deleteHandler,
+    OrthancPluginServerChunkedRequestReaderFactory   putHandler,
+    OrthancPluginServerChunkedRequestReaderAddChunk  addChunk,
+    OrthancPluginServerChunkedRequestReaderExecute   execute,
+    OrthancPluginServerChunkedRequestReaderFinalize  finalize)
+  {
+    _OrthancPluginChunkedRestCallback params;
+    params.pathRegularExpression = pathRegularExpression;
+    params.getHandler = getHandler;
+    params.postHandler = postHandler;
+    params.deleteHandler = deleteHandler;
+    params.putHandler = putHandler;
+    params.addChunk = addChunk;
+    params.execute = execute;
+    params.finalize = finalize;
+
+    context->InvokeService(context, _OrthancPluginService_RegisterChunkedRestCallback, &params);
+  }
+
+
+
+  typedef struct
+  {
+    OrthancPluginMemoryBuffer*  target;
+    const void*                 source;
+    uint32_t                    size;
+    const char*                 transferSyntax;
+  } _OrthancPluginTranscodeDicomInstance;
+
+  /**
+   * @brief Transcode a DICOM instance.
+   *
+   * This function converts a DICOM instance to another transfer
+   * syntax, using the DCMTK codecs of the Orthanc core. Only the
+   * lossless transfer syntaxes are supported (Little/Big Endian
+   * uncompressed, RLE Lossless, JPEG Lossless and JPEG-LS Lossless),
+   * so that the SOP Instance UID is kept unchanged. The JPEG and
+   * JPEG-LS encoders are not available if Orthanc is statically
+   * linked against DCMTK.
+   *
+   * @param context The Orthanc plugin context, as received by OrthancPluginInitialize().
+   * @param target The target memory buffer. It must be freed with OrthancPluginFreeMemoryBuffer().
+   * @param source The DICOM instance to transcode.
+   * @param size The size in bytes of the DICOM instance.
+   * @param transferSyntax The UID of the target transfer syntax.
+   * @return 0 if success, or the error code if failure.
+   * @ingroup Toolbox
+   **/
+  ORTHANC_PLUGIN_INLINE OrthancPluginErrorCode OrthancPluginTranscodeDicomInstance(
+    OrthancPluginContext*       context,
+    OrthancPluginMemoryBuffer*  target,
+    const void*                 source,
+    uint32_t                    size,
+    const char*                 transferSyntax)
+  {
+    _OrthancPluginTranscodeDicomInstance params;
+    params.target = target;
+    params.source = source;
+    params.size = size;
+    params.transferSyntax = transferSyntax;
+
+    return context->InvokeService(context, _OrthancPluginService_TranscodeDicomInstance, &params);
+  }
+
 #ifdef  __cplusplus
 }
 #endif
@@ -38,6 +38,8 @@
 
 #include <stdexcept>
 #include <list>
+#include <map>
+#include <set>
 #include <string>
 
 namespace OrthancPlugins
@@ -467,6 +469,166 @@ namespace OrthancPlugins
                                  OrthancPluginStorageArea* storageArea) = 0;
 
     virtual void ClearMainDicomTags(int64_t internalId) = 0;
+
+
+    /**
+     * The high-level primitives below are new in Orthanc 1.3.1. They
+     * group several of the primitives above into one single call. The
+     * default implementations only chain the primitives above:
+     * Database engines should override them if they can do better
+     * (e.g. by using one single SQL query).
+     **/
+
+    // Returns "false" iff. the instance already exists (in which
+    // case, only "result.instanceId" is set). Otherwise, the internal
+    // IDs of the parent series, study and patient must all be set.
+    virtual bool CreateInstance(OrthancPluginCreateInstanceResult& result /*out*/,
+                                const char* hashPatient,
+                                const char* hashStudy,
+                                const char* hashSeries,
+                                const char* hashInstance)
+    {
+      OrthancPluginResourceType type;
+      if (LookupResource(result.instanceId, type, hashInstance))
+      {
+        result.isNewInstance = false;
+        return false;
+      }
+
+      result.isNewInstance = true;
+      result.isNewPatient = !LookupResource(result.patientId, type, hashPatient);
+      result.isNewStudy = !LookupResource(result.studyId, type, hashStudy);
+      result.isNewSeries = !LookupResource(result.seriesId, type, hashSeries);
+
+      result.instanceId = CreateResource(hashInstance, OrthancPluginResourceType_Instance);
+
+      if (result.isNewSeries)
+      {
+        result.seriesId = CreateResource(hashSeries, OrthancPluginResourceType_Series);
+      }
+
+      if (result.isNewStudy)
+      {
+        result.studyId = CreateResource(hashStudy, OrthancPluginResourceType_Study);
+      }
+
+      if (result.isNewPatient)
+      {
+        result.patientId = CreateResource(hashPatient, OrthancPluginResourceType_Patient);
+      }
+
+      AttachChild(result.seriesId, result.instanceId);
+
+      if (result.isNewSeries)
+      {
+        AttachChild(result.studyId, result.seriesId);
+      }
+
+      if (result.isNewStudy)
+      {
+        AttachChild(result.patientId, result.studyId);
+      }
+
+      return true;
+    }
+
+    virtual void SetResourcesContent(uint32_t countIdentifierTags,
+                                     const OrthancPluginResourcesContentTags* identifierTags,
+                                     uint32_t countMainDicomTags,
+                                     const OrthancPluginResourcesContentTags* mainDicomTags,
+                                     uint32_t countMetadata,
+                                     const OrthancPluginResourcesContentMetadata* metadata,
+                                     uint32_t countAttachments,
+                                     const OrthancPluginResourcesContentAttachment* attachments)
+    {
+      for (uint32_t i = 0; i < countIdentifierTags; i++)
+      {
+        SetIdentifierTag(identifierTags[i].resource, identifierTags[i].group,
+                         identifierTags[i].element, identifierTags[i].value);
+      }
+
+      for (uint32_t i = 0; i < countMainDicomTags; i++)
+      {
+        SetMainDicomTag(mainDicomTags[i].resource, mainDicomTags[i].group,
+                        mainDicomTags[i].element, mainDicomTags[i].value);
+      }
+
+      for (uint32_t i = 0; i < countMetadata; i++)
+      {
+        SetMetadata(metadata[i].resource, metadata[i].metadata, metadata[i].value);
+      }
+
+      for (uint32_t i = 0; i < countAttachments; i++)
+      {
+        AddAttachment(attachments[i].resource, attachments[i].attachment);
+      }
+    }
+
+    // The constraints sharing the same "disjunction" index are
+    // combined with OR, and the disjunctions are combined with AND
+    virtual void LookupIdentifiers(std::list<int64_t>& target /*out*/,
+                                   OrthancPluginResourceType resourceType,
+                                   uint32_t countConstraints,
+                                   const OrthancPluginIdentifierConstraintItem* constraints)
+    {
+      typedef std::map<uint32_t, std::set<int64_t> >  Disjunctions;
+      Disjunctions disjunctions;
+
+      for (uint32_t i = 0; i < countConstraints; i++)
+      {
+        std::list<int64_t> tmp;
+        LookupIdentifier(tmp, resourceType, constraints[i].group, constraints[i].element,
+                         constraints[i].constraint, constraints[i].value);
+
+        std::set<int64_t>& disjunction = disjunctions[constraints[i].disjunction];
+        disjunction.insert(tmp.begin(), tmp.end());
+      }
+
+      target.clear();
+
+      if (disjunctions.empty())
+      {
+        return;
+      }
+
+      std::set<int64_t> result = disjunctions.begin()->second;
+
+      for (Disjunctions::const_iterator it = disjunctions.begin(); it != disjunctions.end(); ++it)
+      {
+        std::set<int64_t> intersection;
+
+        for (std::set<int64_t>::const_iterator item = result.begin(); item != result.end(); ++item)
+        {
+          if (it->second.find(*item) != it->second.end())
+          {
+            intersection.insert(*item);
+          }
+        }
+
+        result.swap(intersection);
+      }
+
+      target.insert(target.end(), result.begin(), result.end());
+    }
+
+    virtual void GetAllMetadata(std::map<int32_t, std::string>& target /*out*/,
+                                int64_t id)
+    {
+      std::list<int32_t> metadata;
+      ListAvailableMetadata(metadata, id);
+
+      target.clear();
+
+      for (std::list<int32_t>::const_iterator
+             it = metadata.begin(); it != metadata.end(); ++it)
+      {
+        std::string value;
+        if (LookupMetadata(value, id, *it))
+        {
+          target[*it] = value;
+        }
+      }
+    }
   };
 
 
@@ -1812,6 +1974,136 @@ namespace OrthancPlugins
       }
     }
 
+
+
+    static OrthancPluginErrorCode CreateInstance(OrthancPluginCreateInstanceResult* output,
+                                                 void* payload,
+                                                 const char* hashPatient,
+                                                 const char* hashStudy,
+                                                 const char* hashSeries,
+                                                 const char* hashInstance)
+    {
+      IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
+
+      try
+      {
+        backend->CreateInstance(*output, hashPatient, hashStudy, hashSeries, hashInstance);
+        return OrthancPluginErrorCode_Success;
+      }
+      catch (std::runtime_error& e)
+      {
+        LogError(backend, e);
+        return OrthancPluginErrorCode_DatabasePlugin;
+      }
+      catch (DatabaseException& e)
+      {
+        return e.GetErrorCode();
+      }
+    }
+
+
+    static OrthancPluginErrorCode SetResourcesContent(void* payload,
+                                                      uint32_t countIdentifierTags,
+                                                      const OrthancPluginResourcesContentTags* identifierTags,
+                                                      uint32_t countMainDicomTags,
+                                                      const OrthancPluginResourcesContentTags* mainDicomTags,
+                                                      uint32_t countMetadata,
+                                                      const OrthancPluginResourcesContentMetadata* metadata,
+                                                      uint32_t countAttachments,
+                                                      const OrthancPluginResourcesContentAttachment* attachments)
+    {
+      IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
+
+      try
+      {
+        backend->SetResourcesContent(countIdentifierTags, identifierTags,
+                                     countMainDicomTags, mainDicomTags,
+                                     countMetadata, metadata,
+                                     countAttachments, attachments);
+        return OrthancPluginErrorCode_Success;
+      }
+      catch (std::runtime_error& e)
+      {
+        LogError(backend, e);
+        return OrthancPluginErrorCode_DatabasePlugin;
+      }
+      catch (DatabaseException& e)
+      {
+        return e.GetErrorCode();
+      }
+    }
+
+
+    static OrthancPluginErrorCode LookupIdentifiers(OrthancPluginDatabaseContext* context,
+                                                    void* payload,
+                                                    OrthancPluginResourceType resourceType,
+                                                    uint32_t countConstraints,
+                                                    const OrthancPluginIdentifierConstraintItem* constraints)
+    {
+      IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
+
+      try
+      {
+        std::list<int64_t> target;
+        backend->LookupIdentifiers(target, resourceType, countConstraints, constraints);
+
+        for (std::list<int64_t>::const_iterator
+               it = target.begin(); it != target.end(); ++it)
+        {
+          OrthancPluginDatabaseAnswerInt64(backend->GetOutput().context_,
+                                           backend->GetOutput().database_, *it);
+        }
+
+        return OrthancPluginErrorCode_Success;
+      }
+      catch (std::runtime_error& e)
+      {
+        LogError(backend, e);
+        return OrthancPluginErrorCode_DatabasePlugin;
+      }
+      catch (DatabaseException& e)
+      {
+        return e.GetErrorCode();
+      }
+    }
+
+
+    static OrthancPluginErrorCode GetAllMetadata(OrthancPluginDatabaseContext* context,
+                                                 void* payload,
+                                                 int64_t id)
+    {
+      IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
+
+      try
+      {
+        std::map<int32_t, std::string> target;
+        backend->GetAllMetadata(target, id);
+
+        for (std::map<int32_t, std::string>::const_iterator
+               it = target.begin(); it != target.end(); ++it)
+        {
+          OrthancPluginDatabaseAnswerMetadata(backend->GetOutput().context_,
+                                              backend->GetOutput().database_,
+                                              it->first, it->second.c_str());
+        }
+
+        return OrthancPluginErrorCode_Success;
+      }
+      catch (std::runtime_error& e)
+      {
+        LogError(backend, e);
+        return OrthancPluginErrorCode_DatabasePlugin;
+      }
+      catch (DatabaseException& e)
+      {
+        return e.GetErrorCode();
+      }
+    }
+
     
   public:
     /**
@@ -1883,6 +2175,10 @@ namespace OrthancPlugins
       extensions.clearMainDicomTags = ClearMainDicomTags;
       extensions.getAllInternalIds = GetAllInternalIds;   // New in Orthanc 0.9.5 (db v6)
       extensions.lookupIdentifier3 = LookupIdentifier3;   // New in Orthanc 0.9.5 (db v6)
+      extensions.createInstance = CreateInstance;            // New in Orthanc 1.3.1
+      extensions.setResourcesContent = SetResourcesContent;  // New in Orthanc 1.3.1
+      extensions.lookupIdentifiers = LookupIdentifiers;      // New in Orthanc 1.3.1
+      extensions.getAllMetadata = GetAllMetadata;            // New in Orthanc 1.3.1
 
       OrthancPluginDatabaseContext* database = OrthancPluginRegisterDatabaseBackendV2(context, &params, &extensions, &backend);
       if (!context)
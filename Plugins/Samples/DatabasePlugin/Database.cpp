@@ -37,6 +37,8 @@
 
 #include <EmbeddedResources.h>
 #include <boost/lexical_cast.hpp>
+#include <map>
+#include <vector>
 
 
 namespace Internals
@@ -400,6 +402,114 @@ void Database::ListAvailableMetadata(std::list<int32_t>& target /*out*/,
 }
 
 
+void Database::GetAllMetadata(std::map<int32_t, std::string>& target /*out*/,
+                              int64_t id)
+{
+  // Retrieve all the metadata with one single SQL query, instead of
+  // the default "ListAvailableMetadata() + N * LookupMetadata()"
+  target.clear();
+
+  Orthanc::SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT type, value FROM Metadata WHERE id=?");
+  s.BindInt64(0, id);
+
+  while (s.Step())
+  {
+    target[s.ColumnInt(0)] = s.ColumnString(1);
+  }
+}
+
+
+void Database::LookupIdentifiers(std::list<int64_t>& target /*out*/,
+                                 OrthancPluginResourceType resourceType,
+                                 uint32_t countConstraints,
+                                 const OrthancPluginIdentifierConstraintItem* constraints)
+{
+  // Evaluate the whole query with one single SQL statement: The
+  // constraints of one disjunction are combined with "UNION", and the
+  // disjunctions are combined with "INTERSECT"
+  target.clear();
+
+  if (countConstraints == 0)
+  {
+    return;
+  }
+
+  typedef std::map<uint32_t, std::list<uint32_t> >  Disjunctions;
+  Disjunctions disjunctions;
+
+  for (uint32_t i = 0; i < countConstraints; i++)
+  {
+    disjunctions[constraints[i].disjunction].push_back(i);
+  }
+
+  std::string sql;
+  std::vector<uint32_t> bound;   // Index of the constraint bound to each group of parameters
+
+  for (Disjunctions::const_iterator it = disjunctions.begin(); it != disjunctions.end(); ++it)
+  {
+    if (!sql.empty())
+    {
+      sql += " INTERSECT ";
+    }
+
+    std::string disjunction;
+
+    for (std::list<uint32_t>::const_iterator
+           constraint = it->second.begin(); constraint != it->second.end(); ++constraint)
+    {
+      if (!disjunction.empty())
+      {
+        disjunction += " UNION ";
+      }
+
+      disjunction += ("SELECT d.id FROM DicomIdentifiers AS d, Resources AS r WHERE "
+                      "d.id = r.internalId AND r.resourceType=? AND "
+                      "d.tagGroup=? AND d.tagElement=? AND ");
+
+      switch (constraints[*constraint].constraint)
+      {
+        case OrthancPluginIdentifierConstraint_GreaterOrEqual:
+          disjunction += "d.value>=?";
+          break;
+
+        case OrthancPluginIdentifierConstraint_SmallerOrEqual:
+          disjunction += "d.value<=?";
+          break;
+
+        case OrthancPluginIdentifierConstraint_Wildcard:
+          disjunction += "d.value GLOB ?";
+          break;
+
+        case OrthancPluginIdentifierConstraint_Equal:
+        default:
+          disjunction += "d.value=?";
+          break;
+      }
+
+      bound.push_back(*constraint);
+    }
+
+    sql += "SELECT * FROM (" + disjunction + ")";
+  }
+
+  Orthanc::SQLite::Statement s(db_, sql);
+
+  for (size_t i = 0; i < bound.size(); i++)
+  {
+    const OrthancPluginIdentifierConstraintItem& constraint = constraints[bound[i]];
+    s.BindInt(4 * i, Orthanc::Plugins::Convert(resourceType));
+    s.BindInt(4 * i + 1, constraint.group);
+    s.BindInt(4 * i + 2, constraint.element);
+    s.BindString(4 * i + 3, constraint.value);
+  }
+
+  while (s.Step())
+  {
+    target.push_back(s.ColumnInt64(0));
+  }
+}
+
+
 void Database::ListAvailableAttachments(std::list<int32_t>& target /*out*/,
                                         int64_t id)
 {
@@ -282,4 +282,19 @@ public:
   {
     base_.ClearMainDicomTags(internalId);
   }
+
+  /**
+   * Among the high-level primitives, "CreateInstance()" and
+   * "SetResourcesContent()" are deliberately not overridden: SQLite
+   * runs in-process, so chaining the low-level primitives (which is
+   * the default implementation) costs no round-trip. The lookups are
+   * overridden, as they save SQL queries.
+   **/
+  virtual void GetAllMetadata(std::map<int32_t, std::string>& target /*out*/,
+                              int64_t id);
+
+  virtual void LookupIdentifiers(std::list<int64_t>& target /*out*/,
+                                 OrthancPluginResourceType resourceType,
+                                 uint32_t countConstraints,
+                                 const OrthancPluginIdentifierConstraintItem* constraints);
 };
@@ -5,6 +5,24 @@ if (STATIC_BUILD OR NOT USE_SYSTEM_CIVETWEB)
 
   DownloadPackage(${CIVETWEB_MD5} ${CIVETWEB_URL} "${CIVETWEB_SOURCES_DIR}")
 
+  # Add "mg_disable_keep_alive()", so that Orthanc can close a
+  # keep-alive connection whose answer is truncated
+  file(READ ${CIVETWEB_SOURCES_DIR}/src/civetweb.c CIVETWEB_C)
+  if (NOT CIVETWEB_C MATCHES "mg_disable_keep_alive")
+    file(APPEND ${CIVETWEB_SOURCES_DIR}/src/civetweb.c
+      "\nvoid mg_disable_keep_alive(struct mg_connection *conn) {\n"
+      "  if (conn != NULL) {\n"
+      "    conn->must_close = 1;\n"
+      "  }\n"
+      "}\n")
+    file(APPEND ${CIVETWEB_SOURCES_DIR}/include/civetweb.h
+      "\n#ifdef __cplusplus\nextern \"C\" {\n#endif\n"
+      "void mg_disable_keep_alive(struct mg_connection *conn);\n"
+      "#ifdef __cplusplus\n}\n#endif\n")
+  endif()
+
+  add_definitions(-DCIVETWEB_HAS_DISABLE_KEEP_ALIVE=1)
+
   include_directories(
     ${CIVETWEB_SOURCES_DIR}/include
     )
@@ -53,5 +71,12 @@ else()
     message(FATAL_ERROR "Please install the libcivetweb-devel package")
   endif()
 
+  CHECK_LIBRARY_EXISTS(civetweb mg_disable_keep_alive "" HAVE_CIVETWEB_DISABLE_KEEP_ALIVE)
+  if (HAVE_CIVETWEB_DISABLE_KEEP_ALIVE)
+    add_definitions(-DCIVETWEB_HAS_DISABLE_KEEP_ALIVE=1)
+  else()
+    add_definitions(-DCIVETWEB_HAS_DISABLE_KEEP_ALIVE=0)
+  endif()
+
   link_libraries(civetweb)
 endif()
@@ -280,6 +280,9 @@ if (STATIC_BUILD OR NOT USE_SYSTEM_DCMTK)
     set(DCMTK_USE_EMBEDDED_DICTIONARIES 0)
   endif()
 
+  # The JPEG and JPEG-LS encoders are not compiled (see above)
+  set(DCMTK_HAS_ENCODERS 0)
+
 else()
   # The following line allows to manually add libraries at the
   # command-line, which is necessary for Ubuntu/Debian packages
@@ -318,9 +321,11 @@ else()
     ${DCMTK_VERSION_NUMBER1})
 
   set(DCMTK_USE_EMBEDDED_DICTIONARIES 0)
+  set(DCMTK_HAS_ENCODERS 1)
 endif()
 
 
+add_definitions(-DDCMTK_HAS_ENCODERS=${DCMTK_HAS_ENCODERS})
 add_definitions(-DDCMTK_VERSION_NUMBER=${DCMTK_VERSION_NUMBER})
 message("DCMTK version: ${DCMTK_VERSION_NUMBER}")
 
@@ -40,6 +40,24 @@ if (STATIC_BUILD OR NOT USE_SYSTEM_MONGOOSE)
     message(FATAL_ERROR "Error while patching a file")
   endif()
 
+  # Add "mg_disable_keep_alive()", so that Orthanc can close a
+  # keep-alive connection whose answer is truncated
+  file(READ ${MONGOOSE_SOURCES_DIR}/mongoose.c MONGOOSE_C)
+  if (NOT MONGOOSE_C MATCHES "mg_disable_keep_alive")
+    file(APPEND ${MONGOOSE_SOURCES_DIR}/mongoose.c
+      "\nvoid mg_disable_keep_alive(struct mg_connection *conn) {\n"
+      "  if (conn != NULL) {\n"
+      "    conn->must_close = 1;\n"
+      "  }\n"
+      "}\n")
+    file(APPEND ${MONGOOSE_SOURCES_DIR}/mongoose.h
+      "\n#ifdef __cplusplus\nextern \"C\" {\n#endif\n"
+      "void mg_disable_keep_alive(struct mg_connection *conn);\n"
+      "#ifdef __cplusplus\n}\n#endif\n")
+  endif()
+
+  add_definitions(-DMONGOOSE_HAS_DISABLE_KEEP_ALIVE=1)
+
   include_directories(
     ${MONGOOSE_SOURCES_DIR}
     )
@@ -91,5 +109,12 @@ else()
     add_definitions(-DMONGOOSE_USE_CALLBACKS=0)
   endif()
 
+  CHECK_LIBRARY_EXISTS(mongoose mg_disable_keep_alive "" HAVE_MONGOOSE_DISABLE_KEEP_ALIVE)
+  if (HAVE_MONGOOSE_DISABLE_KEEP_ALIVE)
+    add_definitions(-DMONGOOSE_HAS_DISABLE_KEEP_ALIVE=1)
+  else()
+    add_definitions(-DMONGOOSE_HAS_DISABLE_KEEP_ALIVE=0)
+  endif()
+
   link_libraries(mongoose)
 endif()
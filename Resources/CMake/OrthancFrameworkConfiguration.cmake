@@ -53,6 +53,7 @@ set(ORTHANC_CORE_SOURCES_INTERNAL
   ${ORTHANC_ROOT}/Core/Images/ImageAccessor.cpp
   ${ORTHANC_ROOT}/Core/Images/ImageBuffer.cpp
   ${ORTHANC_ROOT}/Core/Images/ImageProcessing.cpp
+  ${ORTHANC_ROOT}/Core/Images/ImageRenderer.cpp
   ${ORTHANC_ROOT}/Core/Logging.cpp
   ${ORTHANC_ROOT}/Core/Toolbox.cpp
   ${ORTHANC_ROOT}/Core/WebServiceParameters.cpp
@@ -178,8 +179,10 @@ if (ENABLE_WEB_SERVER)
     ${ORTHANC_ROOT}/Core/RestApi/RestApiCall.cpp
     ${ORTHANC_ROOT}/Core/RestApi/RestApiGetCall.cpp
     ${ORTHANC_ROOT}/Core/RestApi/RestApiHierarchy.cpp
+    ${ORTHANC_ROOT}/Core/RestApi/RestApiJsonWriter.cpp
     ${ORTHANC_ROOT}/Core/RestApi/RestApiOutput.cpp
     ${ORTHANC_ROOT}/Core/RestApi/RestApiPath.cpp
+    ${ORTHANC_ROOT}/Core/RestApi/RestApiRouter.cpp
     )
   
 else()
@@ -330,6 +333,7 @@ if (ENABLE_DCMTK)
   set(ORTHANC_DICOM_SOURCES_INTERNAL
     ${ORTHANC_ROOT}/Core/DicomParsing/DicomDirWriter.cpp
     ${ORTHANC_ROOT}/Core/DicomParsing/DicomModification.cpp
+    ${ORTHANC_ROOT}/Core/DicomParsing/DicomWebFormatter.cpp
     ${ORTHANC_ROOT}/Core/DicomParsing/FromDcmtkBridge.cpp
     ${ORTHANC_ROOT}/Core/DicomParsing/ParsedDicomFile.cpp
     ${ORTHANC_ROOT}/Core/DicomParsing/ToDcmtkBridge.cpp
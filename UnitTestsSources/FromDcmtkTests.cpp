@@ -37,6 +37,7 @@
 #include "../Core/DicomParsing/FromDcmtkBridge.h"
 #include "../Core/DicomParsing/ToDcmtkBridge.h"
 #include "../Core/DicomParsing/DicomModification.h"
+#include "../Core/DicomParsing/DicomWebFormatter.h"
 #include "../OrthancServer/ServerToolbox.h"
 #include "../Core/OrthancException.h"
 #include "../Core/Images/ImageBuffer.h"
@@ -52,6 +53,9 @@
 
 #include <dcmtk/dcmdata/dcelem.h>
 #include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcpixel.h>
+#include <dcmtk/dcmdata/dcpixseq.h>
+#include <dcmtk/dcmdata/dcpxitem.h>
 
 using namespace Orthanc;
 
@@ -1250,3 +1254,369 @@ TEST(Toolbox, CaseWithAccents)
 {
   ASSERT_EQ(toUpperResult, Toolbox::ToUpperCaseWithAccents(toUpperSource));
 }
+
+
+TEST(DicomWebFormatter, Basic)
+{
+  for (int i = ValueRepresentation_ApplicationEntity; i < ValueRepresentation_NotSupported; i++)
+  {
+    ValueRepresentation vr = static_cast<ValueRepresentation>(i);
+    ASSERT_EQ(vr, StringToValueRepresentation(EnumerationToString(vr), true));
+  }
+
+  ASSERT_EQ("00100010", DicomWebFormatter::FormatTag(DICOM_TAG_PATIENT_NAME));
+  ASSERT_EQ("7FE00010", DicomWebFormatter::FormatTag(DICOM_TAG_PIXEL_DATA));
+
+  DicomTag tag(0, 0);
+  ASSERT_TRUE(DicomWebFormatter::ParseTag(tag, "PatientID"));
+  ASSERT_EQ(DICOM_TAG_PATIENT_ID, tag);
+  ASSERT_TRUE(DicomWebFormatter::ParseTag(tag, "0020000d"));
+  ASSERT_EQ(DICOM_TAG_STUDY_INSTANCE_UID, tag);
+  ASSERT_FALSE(DicomWebFormatter::ParseTag(tag, "Nope"));
+
+  DicomMap m;
+  m.SetValue(DICOM_TAG_PATIENT_NAME, "Hello^World\\Other", false);
+  m.SetValue(DICOM_TAG_ROWS, "512", false);
+  m.SetValue(DICOM_TAG_SLICE_THICKNESS, " 2.5 ", false);
+  m.SetValue(DICOM_TAG_STUDY_DESCRIPTION, "", false);
+  m.SetValue(DICOM_TAG_SERIES_DESCRIPTION, DicomValue());
+
+  Json::Value a;
+  DicomWebFormatter::Apply(a, m);
+  ASSERT_EQ(5u, a.size());
+  ASSERT_EQ("PN", a["00100010"]["vr"].asString());
+  ASSERT_EQ(2u, a["00100010"]["Value"].size());
+  ASSERT_EQ("Hello^World", a["00100010"]["Value"][0]["Alphabetic"].asString());
+  ASSERT_EQ("Other", a["00100010"]["Value"][1]["Alphabetic"].asString());
+  ASSERT_EQ("US", a["00280010"]["vr"].asString());
+  ASSERT_EQ(512, a["00280010"]["Value"][0].asInt());
+  ASSERT_EQ("DS", a["00180050"]["vr"].asString());
+  ASSERT_DOUBLE_EQ(2.5, a["00180050"]["Value"][0].asDouble());
+  ASSERT_EQ(1u, a["00081030"].size());
+  ASSERT_EQ(1u, a["0008103E"].size());
+
+  Json::Value full = Json::objectValue;
+  full["0008,0016"]["Name"] = "SOPClassUID";
+  full["0008,0016"]["Type"] = "String";
+  full["0008,0016"]["Value"] = "1.2.840.10008.5.1.4.1.1.2";
+  full["0008,1140"]["Name"] = "ReferencedImageSequence";
+  full["0008,1140"]["Type"] = "Sequence";
+  full["0008,1140"]["Value"] = Json::arrayValue;
+  full["0008,1140"]["Value"].append(Json::objectValue);
+  full["0008,1140"]["Value"][0]["0008,1155"]["Name"] = "ReferencedSOPInstanceUID";
+  full["0008,1140"]["Value"][0]["0008,1155"]["Type"] = "String";
+  full["0008,1140"]["Value"][0]["0008,1155"]["Value"] = "1.2.3";
+  full["0028,1201"]["Name"] = "RedPaletteColorLookupTableData";
+  full["0028,1201"]["Type"] = "Binary";
+  full["0028,1201"]["Value"] = "data:application/octet-stream;base64,AAEC";
+  full["7fe0,0010"]["Name"] = "PixelData";
+  full["7fe0,0010"]["Type"] = "TooLong";
+  full["7fe0,0010"]["Value"] = Json::nullValue;
+
+  Json::Value b;
+  DicomWebFormatter::ApplyFullJson(b, full);
+  ASSERT_EQ(4u, b.size());
+  ASSERT_EQ("UI", b["00080016"]["vr"].asString());
+  ASSERT_EQ("1.2.840.10008.5.1.4.1.1.2", b["00080016"]["Value"][0].asString());
+  ASSERT_EQ("SQ", b["00081140"]["vr"].asString());
+  ASSERT_EQ(1u, b["00081140"]["Value"].size());
+  ASSERT_EQ("1.2.3", b["00081140"]["Value"][0]["00081155"]["Value"][0].asString());
+  ASSERT_EQ("OW", b["00281201"]["vr"].asString());
+  ASSERT_EQ("AAEC", b["00281201"]["InlineBinary"].asString());
+  ASSERT_EQ(1u, b["7FE00010"].size());  // Only the "vr" field
+
+  ASSERT_THROW(DicomWebFormatter::ApplyFullJson(b, Json::arrayValue), OrthancException);
+}
+
+
+TEST(ParsedDicomFile, LazyPixelData)
+{
+  Orthanc::Image image(Orthanc::PixelFormat_Grayscale16, 17, 9, false);
+  for (unsigned int y = 0; y < image.GetHeight(); y++)
+  {
+    uint16_t *p = reinterpret_cast<uint16_t*>(image.GetRow(y));
+    for (unsigned int x = 0; x < image.GetWidth(); x++, p++)
+    {
+      *p = static_cast<uint16_t>(x * 100 + y);
+    }
+  }
+
+  std::string dicom;
+
+  {
+    ParsedDicomFile f(true);
+    f.ReplacePlainString(DICOM_TAG_PATIENT_NAME, "Lazy");
+    f.EmbedImage(image);
+    f.SaveToMemoryBuffer(dicom);
+  }
+
+  size_t offset;
+  ASSERT_TRUE(FromDcmtkBridge::LookupPixelDataOffset(offset, dicom.c_str(), dicom.size()));
+  ASSERT_LT(offset, dicom.size());
+  ASSERT_EQ(0xe0, static_cast<uint8_t>(dicom[offset]));
+  ASSERT_EQ(0x7f, static_cast<uint8_t>(dicom[offset + 1]));
+  ASSERT_EQ(0x10, static_cast<uint8_t>(dicom[offset + 2]));
+  ASSERT_EQ(0x00, static_cast<uint8_t>(dicom[offset + 3]));
+
+  // The pixel data must be the last element of the file
+  ASSERT_FALSE(FromDcmtkBridge::LookupPixelDataOffset(offset, dicom.c_str(), offset));
+  ASSERT_FALSE(FromDcmtkBridge::LookupPixelDataOffset(offset, dicom.c_str(), dicom.size() - 1));
+  ASSERT_FALSE(FromDcmtkBridge::LookupPixelDataOffset(offset, dicom.c_str(), 100));
+
+  ParsedDicomFile full(dicom);
+
+  {
+    ParsedDicomFile lazy(dicom, true);
+    ASSERT_TRUE(lazy.HasTag(DICOM_TAG_PIXEL_DATA));
+    ASSERT_EQ(1u, lazy.GetFramesCount());
+
+    Json::Value a, b;
+    full.DatasetToJson(a);
+    lazy.DatasetToJson(b);
+    ASSERT_EQ(a.toStyledString(), b.toStyledString());
+
+    DicomMap m1, m2;
+    full.ExtractDicomSummary(m1);
+    lazy.ExtractDicomSummary(m2);
+    ASSERT_TRUE(m1.HasTag(DICOM_TAG_PIXEL_DATA));
+    ASSERT_TRUE(m2.HasTag(DICOM_TAG_PIXEL_DATA));
+    ASSERT_EQ(m1.GetSize(), m2.GetSize());
+
+    std::string s1, s2, mime;
+    full.GetRawFrame(s1, mime, 0);
+    lazy.GetRawFrame(s2, mime, 0);
+    ASSERT_EQ(17u * 9u * 2u, s2.size());
+    ASSERT_EQ(s1, s2);
+
+    std::string saved;
+    lazy.SaveToMemoryBuffer(saved);
+    ASSERT_EQ(dicom, saved);
+
+    // Accessing the DCMTK object parses the pixel data
+    std::auto_ptr<Orthanc::ImageAccessor> decoded(Orthanc::DicomImageDecoder::Decode(lazy, 0));
+    ASSERT_EQ(17u, decoded->GetWidth());
+    ASSERT_EQ(9u, decoded->GetHeight());
+    ASSERT_EQ(Orthanc::PixelFormat_Grayscale16, decoded->GetFormat());
+
+    for (unsigned int y = 0; y < image.GetHeight(); y++)
+    {
+      ASSERT_EQ(0, memcmp(image.GetConstRow(y), decoded->GetConstRow(y), 17 * 2));
+    }
+
+    lazy.SaveToMemoryBuffer(saved);
+    ASSERT_EQ(dicom, saved);
+  }
+
+  {
+    ParsedDicomFile lazy(dicom, true);
+    lazy.Remove(DICOM_TAG_PIXEL_DATA);
+    ASSERT_FALSE(lazy.HasTag(DICOM_TAG_PIXEL_DATA));
+
+    std::string saved;
+    lazy.SaveToMemoryBuffer(saved);
+    ASSERT_EQ(offset, saved.size());
+    ASSERT_EQ(0, memcmp(dicom.c_str(), saved.c_str(), offset));
+  }
+}
+
+
+static void EncodeRleFrame(std::string& target,
+                           const std::string& pixels)
+{
+  // RLE header with one single segment (8bpp grayscale), followed
+  // by a sequence of literal runs of at most 128 bytes
+  target.assign(64, '\0');
+  target[0] = 1;   // Number of segments
+  target[4] = 64;  // Offset of the first segment
+
+  for (size_t pos = 0; pos < pixels.size(); pos += 128)
+  {
+    size_t n = std::min(static_cast<size_t>(128), pixels.size() - pos);
+    target.push_back(static_cast<char>(n - 1));
+    target.append(pixels, pos, n);
+  }
+
+  if (target.size() % 2 == 1)
+  {
+    target.push_back('\0');
+  }
+}
+
+
+static DcmPixelItem* CreateFragment(const std::string& content)
+{
+  std::auto_ptr<DcmPixelItem> item(new DcmPixelItem(DcmTag(DCM_Item, EVR_OB)));
+  if (!content.empty() &&
+      !item->putUint8Array(reinterpret_cast<const Uint8*>(content.c_str()), content.size()).good())
+  {
+    throw OrthancException(ErrorCode_InternalError);
+  }
+
+  return item.release();
+}
+
+
+TEST(DicomImageDecoder, DecodeFrames)
+{
+  static const unsigned int WIDTH = 13;
+  static const unsigned int HEIGHT = 7;
+  static const unsigned int FRAMES = 20;
+
+  std::vector<std::string> expected(FRAMES);
+
+  std::string dicom;
+
+  {
+    ParsedDicomFile f(true);
+    f.ReplacePlainString(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.7.2");
+    f.ReplacePlainString(DICOM_TAG_ROWS, "7");
+    f.ReplacePlainString(DICOM_TAG_COLUMNS, "13");
+    f.ReplacePlainString(DICOM_TAG_NUMBER_OF_FRAMES, "20");
+    f.ReplacePlainString(DICOM_TAG_SAMPLES_PER_PIXEL, "1");
+    f.ReplacePlainString(DICOM_TAG_BITS_ALLOCATED, "8");
+    f.ReplacePlainString(DICOM_TAG_BITS_STORED, "8");
+    f.ReplacePlainString(DICOM_TAG_HIGH_BIT, "7");
+    f.ReplacePlainString(DICOM_TAG_PIXEL_REPRESENTATION, "0");
+    f.ReplacePlainString(DICOM_TAG_PHOTOMETRIC_INTERPRETATION, "MONOCHROME2");
+
+    // Encapsulated RLE pixel data, with a basic offset table
+    std::vector<std::string> fragments(FRAMES);
+    std::string offsetTable;
+    uint32_t offset = 0;
+
+    for (unsigned int i = 0; i < FRAMES; i++)
+    {
+      expected[i].resize(WIDTH * HEIGHT);
+      for (unsigned int j = 0; j < WIDTH * HEIGHT; j++)
+      {
+        expected[i][j] = static_cast<char>((j * 3 + i * 11) % 256);
+      }
+
+      EncodeRleFrame(fragments[i], expected[i]);
+
+      for (unsigned int k = 0; k < 4; k++)
+      {
+        offsetTable.push_back(static_cast<char>((offset >> (8 * k)) & 0xff));
+      }
+
+      offset += fragments[i].size() + 8;
+    }
+
+    std::auto_ptr<DcmPixelSequence> sequence(new DcmPixelSequence(DcmTag(DCM_PixelData, EVR_OB)));
+    ASSERT_TRUE(sequence->insert(CreateFragment(offsetTable)).good());
+    for (unsigned int i = 0; i < FRAMES; i++)
+    {
+      ASSERT_TRUE(sequence->insert(CreateFragment(fragments[i])).good());
+    }
+
+    std::auto_ptr<DcmPixelData> pixelData(new DcmPixelData(DCM_PixelData));
+    pixelData->putOriginalRepresentation(EXS_RLELossless, NULL, sequence.release());
+
+    DcmDataset& dataset = *f.GetDcmtkObject().getDataset();
+    ASSERT_TRUE(dataset.insert(pixelData.release()).good());
+    dataset.updateOriginalXfer();
+
+    f.SaveToMemoryBuffer(dicom);
+  }
+
+  ParsedDicomFile f(dicom);
+  ASSERT_EQ(FRAMES, f.GetFramesCount());
+
+  for (unsigned int i = 0; i < FRAMES; i++)
+  {
+    ASSERT_EQ(i + 1, f.GetFrameStartFragment(i));  // Fragment 0 is the offset table
+  }
+
+  for (unsigned int threads = 1; threads <= 4; threads++)
+  {
+    std::vector<ImageAccessor*> frames;
+    DicomImageDecoder::DecodeFrames(frames, f, 3, 15, threads);
+    ASSERT_EQ(15u, frames.size());
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+      ASSERT_EQ(PixelFormat_Grayscale8, frames[i]->GetFormat());
+      ASSERT_EQ(WIDTH, frames[i]->GetWidth());
+      ASSERT_EQ(HEIGHT, frames[i]->GetHeight());
+
+      for (unsigned int y = 0; y < HEIGHT; y++)
+      {
+        ASSERT_EQ(0, memcmp(frames[i]->GetConstRow(y), expected[3 + i].c_str() + y * WIDTH, WIDTH));
+      }
+
+      std::auto_ptr<ImageAccessor> single(DicomImageDecoder::Decode(f, 3 + i));
+      ASSERT_EQ(0, memcmp(single->GetConstRow(HEIGHT - 1), frames[i]->GetConstRow(HEIGHT - 1), WIDTH));
+
+      delete frames[i];
+    }
+  }
+
+  std::vector<ImageAccessor*> frames;
+  ASSERT_THROW(DicomImageDecoder::DecodeFrames(frames, f, 10, 11, 2), OrthancException);
+  ASSERT_TRUE(frames.empty());
+}
+
+
+TEST(ParsedDicomFile, Transcode)
+{
+  Orthanc::Image image(Orthanc::PixelFormat_Grayscale16, 17, 9, false);
+  for (unsigned int y = 0; y < image.GetHeight(); y++)
+  {
+    uint16_t *p = reinterpret_cast<uint16_t*>(image.GetRow(y));
+    for (unsigned int x = 0; x < image.GetWidth(); x++, p++)
+    {
+      *p = static_cast<uint16_t>(x * 1000 + y);
+    }
+  }
+
+  std::string dicom, sopInstanceUid;
+
+  {
+    ParsedDicomFile f(true);
+    f.EmbedImage(image);
+    f.SaveToMemoryBuffer(dicom);
+    ASSERT_TRUE(f.GetTagValue(sopInstanceUid, DICOM_TAG_SOP_INSTANCE_UID));
+  }
+
+  std::string rle;
+
+  {
+    ParsedDicomFile f(dicom, true);
+    ASSERT_TRUE(f.Transcode(rle, "1.2.840.10008.1.2.5"));
+    ASSERT_THROW(f.Transcode(rle, "1.2.840.10008.1.2.4.50"), OrthancException);  // Lossy
+  }
+
+  std::string uncompressed;
+
+  {
+    ParsedDicomFile f(rle);
+    ASSERT_EQ(EXS_RLELossless, f.GetDcmtkObject().getDataset()->getOriginalXfer());
+
+    std::string s;
+    ASSERT_TRUE(f.GetTagValue(s, DICOM_TAG_SOP_INSTANCE_UID));
+    ASSERT_EQ(sopInstanceUid, s);
+
+    std::auto_ptr<Orthanc::ImageAccessor> decoded(Orthanc::DicomImageDecoder::Decode(f, 0));
+    ASSERT_EQ(Orthanc::PixelFormat_Grayscale16, decoded->GetFormat());
+    for (unsigned int y = 0; y < image.GetHeight(); y++)
+    {
+      ASSERT_EQ(0, memcmp(image.GetConstRow(y), decoded->GetConstRow(y), 17 * 2));
+    }
+
+    ASSERT_TRUE(f.Transcode(uncompressed, "1.2.840.10008.1.2"));
+  }
+
+  {
+    ParsedDicomFile f(uncompressed);
+    ASSERT_EQ(EXS_LittleEndianImplicit, f.GetDcmtkObject().getDataset()->getOriginalXfer());
+
+    std::string raw, mime;
+    f.GetRawFrame(raw, mime, 0);
+    ASSERT_EQ(17u * 9u * 2u, raw.size());
+
+    for (unsigned int y = 0; y < image.GetHeight(); y++)
+    {
+      ASSERT_EQ(0, memcmp(image.GetConstRow(y), raw.c_str() + y * 17 * 2, 17 * 2));
+    }
+  }
+}
@@ -35,8 +35,14 @@
 #include "gtest/gtest.h"
 
 #include "../Core/DicomFormat/DicomImageInformation.h"
+#include "../Core/Images/Image.h"
 #include "../Core/Images/ImageBuffer.h"
 #include "../Core/Images/ImageProcessing.h"
+#include "../Core/Images/ImageRenderer.h"
+#include "../Core/Logging.h"
+#include "../Core/OrthancException.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 using namespace Orthanc;
 
@@ -79,3 +85,477 @@ TEST(DicomImageInformation, ExtractPixelFormat2)
   ASSERT_TRUE(info.ExtractPixelFormat(format, false));
   ASSERT_EQ(PixelFormat_SignedGrayscale16, format);
 }
+
+
+namespace
+{
+  class SimdTester : public boost::noncopyable
+  {
+  private:
+    uint32_t seed_;
+    bool     previous_;
+
+  public:
+    SimdTester() :
+      seed_(42),
+      previous_(ImageProcessing::IsSimdEnabled())
+    {
+    }
+
+    ~SimdTester()
+    {
+      ImageProcessing::SetSimdEnabled(previous_);
+    }
+
+    // Fills the image with pseudo-random bytes, which covers the
+    // extreme values of each pixel format
+    void Fill(ImageAccessor& image)
+    {
+      for (unsigned int y = 0; y < image.GetHeight(); y++)
+      {
+        uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(y));
+        for (unsigned int x = 0; x < image.GetWidth() * GetBytesPerPixel(image.GetFormat()); x++)
+        {
+          seed_ = seed_ * 1103515245u + 12345u;
+          p[x] = static_cast<uint8_t>(seed_ >> 16);
+        }
+      }
+
+      if (image.GetFormat() == PixelFormat_Float32)
+      {
+        // Avoid NaN and infinite values
+        for (unsigned int y = 0; y < image.GetHeight(); y++)
+        {
+          float* p = reinterpret_cast<float*>(image.GetRow(y));
+          for (unsigned int x = 0; x < image.GetWidth(); x++)
+          {
+            p[x] = static_cast<float>(y * 1000 + x) / 7.0f;
+          }
+        }
+      }
+    }
+
+    static bool IsSame(const ImageAccessor& a,
+                       const ImageAccessor& b)
+    {
+      if (a.GetFormat() != b.GetFormat() ||
+          a.GetWidth() != b.GetWidth() ||
+          a.GetHeight() != b.GetHeight())
+      {
+        return false;
+      }
+
+      size_t size = a.GetWidth() * GetBytesPerPixel(a.GetFormat());
+      for (unsigned int y = 0; y < a.GetHeight(); y++)
+      {
+        if (memcmp(a.GetConstRow(y), b.GetConstRow(y), size) != 0)
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  };
+}
+
+
+static const PixelFormat TESTED_FORMATS[] = {
+  PixelFormat_Grayscale8,
+  PixelFormat_Grayscale16,
+  PixelFormat_SignedGrayscale16,
+  PixelFormat_Float32,
+  PixelFormat_RGB24,
+  PixelFormat_RGBA32,
+  PixelFormat_BGRA32
+};
+
+static const size_t TESTED_FORMATS_COUNT = sizeof(TESTED_FORMATS) / sizeof(PixelFormat);
+
+
+TEST(ImageProcessing, SimdBitExact)
+{
+  if (!ImageProcessing::IsSimdAvailable())
+  {
+    return;
+  }
+
+  static const unsigned int WIDTHS[] = { 1, 7, 8, 9, 15, 16, 17, 31, 33, 100 };
+
+  SimdTester tester;
+
+  for (size_t w = 0; w < sizeof(WIDTHS) / sizeof(unsigned int); w++)
+  {
+    // Convert
+    for (size_t i = 0; i < TESTED_FORMATS_COUNT; i++)
+    {
+      Image source(TESTED_FORMATS[i], WIDTHS[w], 3, false);
+      tester.Fill(source);
+
+      for (size_t j = 0; j < TESTED_FORMATS_COUNT; j++)
+      {
+        Image a(TESTED_FORMATS[j], WIDTHS[w], 3, false);
+        Image b(TESTED_FORMATS[j], WIDTHS[w], 3, false);
+
+        ImageProcessing::SetSimdEnabled(false);
+
+        try
+        {
+          ImageProcessing::Convert(a, source);
+        }
+        catch (OrthancException&)
+        {
+          continue;  // Unsupported conversion
+        }
+
+        ImageProcessing::SetSimdEnabled(true);
+        ImageProcessing::Convert(b, source);
+        ASSERT_TRUE(SimdTester::IsSame(a, b));
+      }
+    }
+
+    // Operations on grayscale images
+    for (size_t i = 0; i < 3; i++)
+    {
+      Image source(TESTED_FORMATS[i], WIDTHS[w], 3, false);
+      tester.Fill(source);
+
+      int64_t min1, max1, min2, max2;
+      ImageProcessing::SetSimdEnabled(false);
+      ImageProcessing::GetMinMaxValue(min1, max1, source);
+      ImageProcessing::SetSimdEnabled(true);
+      ImageProcessing::GetMinMaxValue(min2, max2, source);
+      ASSERT_EQ(min1, min2);
+      ASSERT_EQ(max1, max2);
+
+      {
+        std::vector<int32_t> a(WIDTHS[w], 0), b(WIDTHS[w], 0);
+        for (unsigned int y = 0; y < source.GetHeight(); y++)
+        {
+          ImageProcessing::SetSimdEnabled(false);
+          ImageProcessing::AccumulateRow(&a[0], source, y);
+          ImageProcessing::SetSimdEnabled(true);
+          ImageProcessing::AccumulateRow(&b[0], source, y);
+        }
+        ASSERT_TRUE(a == b);
+      }
+
+      static const int64_t CONSTANTS[] = { -70000, -40000, -300, -1, 1, 300, 40000, 70000 };
+      for (size_t k = 0; k < sizeof(CONSTANTS) / sizeof(int64_t); k++)
+      {
+        std::auto_ptr<Image> a(Image::Clone(source));
+        std::auto_ptr<Image> b(Image::Clone(source));
+        ImageProcessing::SetSimdEnabled(false);
+        ImageProcessing::AddConstant(*a, CONSTANTS[k]);
+        ImageProcessing::SetSimdEnabled(true);
+        ImageProcessing::AddConstant(*b, CONSTANTS[k]);
+        ASSERT_TRUE(SimdTester::IsSame(*a, *b));
+      }
+
+      static const float FACTORS[] = { 0.5f, 1.5f, -2.0f, 3.3f, 0.0039f };
+      for (size_t k = 0; k < sizeof(FACTORS) / sizeof(float); k++)
+      {
+        std::auto_ptr<Image> a(Image::Clone(source));
+        std::auto_ptr<Image> b(Image::Clone(source));
+        ImageProcessing::SetSimdEnabled(false);
+        ImageProcessing::MultiplyConstant(*a, FACTORS[k]);
+        ImageProcessing::SetSimdEnabled(true);
+        ImageProcessing::MultiplyConstant(*b, FACTORS[k]);
+        ASSERT_TRUE(SimdTester::IsSame(*a, *b));
+      }
+
+      static const float SHIFT_SCALE[][2] = {
+        { -100.0f, 2.5f }, { 0.0f, 0.5f }, { 0.5f, 0.5f }, { 1000.0f, -3.0f }, { 32768.0f, 0.0039f }
+      };
+
+      for (size_t k = 0; k < sizeof(SHIFT_SCALE) / sizeof(SHIFT_SCALE[0]); k++)
+      {
+        std::auto_ptr<Image> a(Image::Clone(source));
+        std::auto_ptr<Image> b(Image::Clone(source));
+        ImageProcessing::SetSimdEnabled(false);
+        ImageProcessing::ShiftScale(*a, SHIFT_SCALE[k][0], SHIFT_SCALE[k][1]);
+        ImageProcessing::SetSimdEnabled(true);
+        ImageProcessing::ShiftScale(*b, SHIFT_SCALE[k][0], SHIFT_SCALE[k][1]);
+        ASSERT_TRUE(SimdTester::IsSame(*a, *b));
+      }
+    }
+
+    {
+      Image source(PixelFormat_Grayscale8, WIDTHS[w], 3, false);
+      tester.Fill(source);
+
+      std::auto_ptr<Image> a(Image::Clone(source));
+      std::auto_ptr<Image> b(Image::Clone(source));
+      ImageProcessing::SetSimdEnabled(false);
+      ImageProcessing::Invert(*a);
+      ImageProcessing::SetSimdEnabled(true);
+      ImageProcessing::Invert(*b);
+      ASSERT_TRUE(SimdTester::IsSame(*a, *b));
+    }
+  }
+}
+
+
+TEST(ImageProcessing, DISABLED_SimdBenchmark)
+{
+  // Micro-benchmark of the scalar and vectorized routines on a
+  // 2048x2048 frame, for each pair of pixel formats. Run it with
+  // "--gtest_also_run_disabled_tests".
+  const unsigned int SIZE = 2048;
+  const unsigned int ITERATIONS = 10;
+
+  SimdTester tester;
+
+  for (size_t i = 0; i < TESTED_FORMATS_COUNT; i++)
+  {
+    Image source(TESTED_FORMATS[i], SIZE, SIZE, false);
+    tester.Fill(source);
+
+    for (size_t j = 0; j < TESTED_FORMATS_COUNT; j++)
+    {
+      Image target(TESTED_FORMATS[j], SIZE, SIZE, false);
+      unsigned int elapsed[2];
+
+      try
+      {
+        for (int simd = 0; simd < 2; simd++)
+        {
+          ImageProcessing::SetSimdEnabled(simd == 1);
+
+          boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+          for (unsigned int k = 0; k < ITERATIONS; k++)
+          {
+            ImageProcessing::Convert(target, source);
+          }
+
+          elapsed[simd] = static_cast<unsigned int>(
+            (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds());
+        }
+      }
+      catch (OrthancException&)
+      {
+        continue;  // Unsupported conversion
+      }
+
+      LOG(WARNING) << "Convert " << EnumerationToString(TESTED_FORMATS[i]) << " to "
+                   << EnumerationToString(TESTED_FORMATS[j]) << ": "
+                   << elapsed[0] << "ms scalar, " << elapsed[1] << "ms SIMD";
+    }
+
+    if (i < 3)
+    {
+      unsigned int elapsed[2];
+
+      for (int simd = 0; simd < 2; simd++)
+      {
+        ImageProcessing::SetSimdEnabled(simd == 1);
+
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        for (unsigned int k = 0; k < ITERATIONS; k++)
+        {
+          int64_t a, b;
+          ImageProcessing::GetMinMaxValue(a, b, source);
+          ImageProcessing::AddConstant(source, 1);
+          ImageProcessing::ShiftScale(source, -10.0f, 0.9f);
+          ImageProcessing::MultiplyConstant(source, 1.1f);
+        }
+
+        elapsed[simd] = static_cast<unsigned int>(
+          (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds());
+      }
+
+      LOG(WARNING) << "Windowing " << EnumerationToString(TESTED_FORMATS[i]) << ": "
+                   << elapsed[0] << "ms scalar, " << elapsed[1] << "ms SIMD";
+    }
+  }
+}
+
+
+TEST(ImageRenderer, Basic)
+{
+  {
+    Image image(PixelFormat_Grayscale16, 100, 50, false);
+
+    ImageRenderer renderer;
+
+    unsigned int w, h;
+    renderer.GetTargetSize(w, h, image);
+    ASSERT_EQ(100u, w);
+    ASSERT_EQ(50u, h);
+
+    renderer.SetMaximumSize(200, 200);  // Never upscale
+    renderer.GetTargetSize(w, h, image);
+    ASSERT_EQ(100u, w);
+    ASSERT_EQ(50u, h);
+
+    renderer.SetMaximumSize(20, 0);
+    renderer.GetTargetSize(w, h, image);
+    ASSERT_EQ(20u, w);
+    ASSERT_EQ(10u, h);
+
+    renderer.SetMaximumSize(20, 5);
+    renderer.GetTargetSize(w, h, image);
+    ASSERT_EQ(10u, w);
+    ASSERT_EQ(5u, h);
+
+    ASSERT_THROW(renderer.SetWindowing(100, 0), OrthancException);
+  }
+
+  {
+    // 4x2 image, downscaled to 2x1: Each target pixel averages 2x2
+    // source pixels
+    Image image(PixelFormat_Grayscale16, 4, 2, false);
+    uint16_t* p = reinterpret_cast<uint16_t*>(image.GetRow(0));
+    p[0] = 100;  p[1] = 300;  p[2] = 1000;  p[3] = 1000;
+    p = reinterpret_cast<uint16_t*>(image.GetRow(1));
+    p[0] = 100;  p[1] = 300;  p[2] = 3000;  p[3] = 3000;
+
+    ImageRenderer renderer;
+    renderer.SetMaximumSize(2, 0);
+
+    {
+      // No windowing: Truncation of the averages (200 and 2000)
+      std::auto_ptr<ImageAccessor> r(renderer.Render(image));
+      ASSERT_EQ(PixelFormat_Grayscale8, r->GetFormat());
+      ASSERT_EQ(2u, r->GetWidth());
+      ASSERT_EQ(1u, r->GetHeight());
+      ASSERT_EQ(200, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [0]);
+      ASSERT_EQ(255, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [1]);
+    }
+
+    {
+      // Stretch the dynamics: The min/max are taken from the source
+      renderer.SetStretchDynamics(true);
+      std::auto_ptr<ImageAccessor> r(renderer.Render(image));
+      ASSERT_EQ(9, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [0]);   // (200-100)*255/2900
+      ASSERT_EQ(167, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [1]);  // (2000-100)*255/2900
+    }
+
+    {
+      // Windowing on the rescaled values, then inversion
+      renderer.SetRescale(2, -1000);  // Rescaled averages: -600 and 3000
+      renderer.SetWindowing(-600, 510);
+      std::auto_ptr<ImageAccessor> r(renderer.Render(image));
+      ASSERT_EQ(128, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [0]);
+      ASSERT_EQ(255, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [1]);
+
+      renderer.SetInvert(true);
+      r.reset(renderer.Render(image));
+      ASSERT_EQ(127, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [0]);
+      ASSERT_EQ(0, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [1]);
+    }
+
+    {
+      // Rescale without windowing: Truncation of the rescaled averages
+      ImageRenderer rescaled;
+      rescaled.SetMaximumSize(2, 0);
+      rescaled.SetRescale(0.1f, 50);  // Rescaled averages: 70 and 250
+      std::auto_ptr<ImageAccessor> r(rescaled.Render(image));
+      ASSERT_EQ(70, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [0]);
+      ASSERT_EQ(250, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [1]);
+
+      // Negative slope: The stretched dynamics is reversed
+      rescaled.SetRescale(-1, 0);
+      rescaled.SetStretchDynamics(true);
+      r.reset(rescaled.Render(image));
+      ASSERT_EQ(246, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [0]);  // (-200+3000)*255/2900
+      ASSERT_EQ(88, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [1]);   // (-2000+3000)*255/2900
+    }
+  }
+
+  {
+    // Color images are only downscaled
+    Image image(PixelFormat_RGB24, 2, 2, false);
+    uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(0));
+    p[0] = 10;  p[1] = 20;  p[2] = 30;  p[3] = 30;  p[4] = 40;  p[5] = 50;
+    p = reinterpret_cast<uint8_t*>(image.GetRow(1));
+    p[0] = 10;  p[1] = 20;  p[2] = 30;  p[3] = 30;  p[4] = 40;  p[5] = 51;
+
+    ImageRenderer renderer;
+    renderer.SetMaximumSize(1, 1);
+    renderer.SetWindowing(0, 10);
+    renderer.SetInvert(true);
+
+    std::auto_ptr<ImageAccessor> r(renderer.Render(image));
+    ASSERT_EQ(PixelFormat_RGB24, r->GetFormat());
+    ASSERT_EQ(1u, r->GetWidth());
+    ASSERT_EQ(1u, r->GetHeight());
+    ASSERT_EQ(20, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [0]);
+    ASSERT_EQ(30, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [1]);
+    ASSERT_EQ(40, reinterpret_cast<const uint8_t*>(r->GetConstRow(0)) [2]);  // 40.25
+  }
+}
+
+
+TEST(ImageRenderer, LookupTable)
+{
+  // A 12-bit image that is large enough for the lookup table to be
+  // used (4096 pixels), with one value that exceeds the bits stored
+  Image image(PixelFormat_Grayscale16, 64, 64, false);
+  for (unsigned int y = 0; y < 64; y++)
+  {
+    uint16_t* p = reinterpret_cast<uint16_t*>(image.GetRow(y));
+    for (unsigned int x = 0; x < 64; x++)
+    {
+      p[x] = static_cast<uint16_t>(y * 64 + x);
+    }
+  }
+
+  reinterpret_cast<uint16_t*>(image.GetRow(0)) [1] = 5000;
+
+  ImageRenderer renderer;
+  renderer.SetBitsStored(12);
+  renderer.SetRescale(2, -1000);
+  renderer.SetWindowing(0, 510);
+  renderer.SetInvert(true);
+  ASSERT_THROW(renderer.SetBitsStored(17), OrthancException);
+
+  size_t count = ImageRenderer::GetLookupTablesCount();
+
+  std::auto_ptr<ImageAccessor> r(renderer.Render(image));
+  ASSERT_EQ(PixelFormat_Grayscale8, r->GetFormat());
+  ASSERT_EQ(count + 1, ImageRenderer::GetLookupTablesCount());
+
+  const uint8_t* q = reinterpret_cast<const uint8_t*>(r->GetConstRow(0));
+  ASSERT_EQ(255, q[0]);   // 2 * 0 - 1000 = -1000, below the window
+  ASSERT_EQ(0, q[1]);     // 5000 is not covered by the table
+
+  // 2 * 500 - 1000 = 0 is the center of the window
+  const unsigned int y = 500 / 64;
+  const unsigned int x = 500 % 64;
+  ASSERT_EQ(127, reinterpret_cast<const uint8_t*>(r->GetConstRow(y)) [x]);
+
+  // The same parameters reuse the same table
+  r.reset(renderer.Render(image));
+  ASSERT_EQ(count + 1, ImageRenderer::GetLookupTablesCount());
+
+  {
+    // 8bpp images use a table of 256 values
+    Image small(PixelFormat_Grayscale8, 16, 16, false);
+    for (unsigned int y = 0; y < 16; y++)
+    {
+      uint8_t* p = reinterpret_cast<uint8_t*>(small.GetRow(y));
+      for (unsigned int x = 0; x < 16; x++)
+      {
+        p[x] = static_cast<uint8_t>(y * 16 + x);
+      }
+    }
+
+    ImageRenderer a;
+    a.SetWindowing(100, 50);
+    std::auto_ptr<ImageAccessor> ra(a.Render(small));
+
+    for (unsigned int y = 0; y < 16; y++)
+    {
+      for (unsigned int x = 0; x < 16; x++)
+      {
+        int v = y * 16 + x;
+        int expected = (v <= 75 ? 0 : (v >= 125 ? 255 : -1));
+        if (expected != -1)
+        {
+          ASSERT_EQ(expected, reinterpret_cast<const uint8_t*>(ra->GetConstRow(y)) [x]);
+        }
+      }
+    }
+  }
+}
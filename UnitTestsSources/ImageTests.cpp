@@ -37,15 +37,18 @@
 #include "../Core/Images/Font.h"
 #include "../Core/Images/Image.h"
 #include "../Core/Images/ImageProcessing.h"
+#include "../Core/Images/ImageRenderer.h"
 #include "../Core/Images/JpegReader.h"
 #include "../Core/Images/JpegWriter.h"
 #include "../Core/Images/PngReader.h"
 #include "../Core/Images/PngWriter.h"
+#include "../Core/Logging.h"
 #include "../Core/Toolbox.h"
 #include "../Core/TemporaryFile.h"
 #include "../OrthancServer/OrthancInitialization.h"  // For the FontRegistry
 
 #include <stdint.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 
 TEST(PngWriter, ColorPattern)
@@ -257,6 +260,207 @@ TEST(JpegWriter, Basic)
 }
 
 
+TEST(PngWriter, Profiles)
+{
+  ASSERT_EQ(Orthanc::ImageEncoderProfile_Fast, Orthanc::StringToImageEncoderProfile("fast"));
+  ASSERT_EQ(Orthanc::ImageEncoderProfile_Balanced, Orthanc::StringToImageEncoderProfile("Balanced"));
+  ASSERT_EQ(Orthanc::ImageEncoderProfile_Small, Orthanc::StringToImageEncoderProfile("SMALL"));
+  ASSERT_THROW(Orthanc::StringToImageEncoderProfile("nope"), Orthanc::OrthancException);
+  ASSERT_STREQ("Balanced", Orthanc::EnumerationToString(Orthanc::ImageEncoderProfile_Balanced));
+
+  Orthanc::Image img(Orthanc::PixelFormat_Grayscale16, 64, 48, false);
+  for (unsigned int y = 0; y < img.GetHeight(); y++)
+  {
+    uint16_t* p = reinterpret_cast<uint16_t*>(img.GetRow(y));
+    for (unsigned int x = 0; x < img.GetWidth(); x++, p++)
+    {
+      *p = static_cast<uint16_t>((x * 97 + y * 1013) % 4096);
+    }
+  }
+
+  Orthanc::PngWriter w;
+  ASSERT_EQ(6u, w.GetCompressionLevel());
+  ASSERT_TRUE(w.IsAdaptiveFiltering());
+  ASSERT_THROW(w.SetCompressionLevel(10), Orthanc::OrthancException);
+
+  w.SetProfile(Orthanc::ImageEncoderProfile_Fast);
+  ASSERT_EQ(1u, w.GetCompressionLevel());
+  ASSERT_FALSE(w.IsAdaptiveFiltering());
+
+  // The PNG encoding is lossless, whatever the profile
+  for (int i = 0; i < 3; i++)
+  {
+    Orthanc::PngWriter writer;
+    writer.SetProfile(static_cast<Orthanc::ImageEncoderProfile>(i));
+
+    std::string s;
+    writer.WriteToMemory(s, img);
+
+    Orthanc::PngReader reader;
+    reader.ReadFromMemory(s);
+    ASSERT_EQ(Orthanc::PixelFormat_Grayscale16, reader.GetFormat());
+    ASSERT_EQ(64u, reader.GetWidth());
+    ASSERT_EQ(48u, reader.GetHeight());
+
+    for (unsigned int y = 0; y < img.GetHeight(); y++)
+    {
+      ASSERT_EQ(0, memcmp(img.GetConstRow(y), reader.GetConstRow(y), 2 * img.GetWidth()));
+    }
+  }
+}
+
+
+TEST(JpegWriter, Profiles)
+{
+  Orthanc::Image img(Orthanc::PixelFormat_RGB24, 32, 32, false);
+  for (unsigned int y = 0; y < img.GetHeight(); y++)
+  {
+    uint8_t* p = reinterpret_cast<uint8_t*>(img.GetRow(y));
+    for (unsigned int x = 0; x < img.GetWidth(); x++, p += 3)
+    {
+      p[0] = static_cast<uint8_t>(x * 8);
+      p[1] = static_cast<uint8_t>(y * 8);
+      p[2] = 128;
+    }
+  }
+
+  Orthanc::JpegWriter w;
+  ASSERT_FALSE(w.IsFastDct());
+  ASSERT_TRUE(w.IsChromaSubsampling());
+  ASSERT_FALSE(w.IsProgressive());
+
+  w.SetProfile(Orthanc::ImageEncoderProfile_Small);
+  ASSERT_TRUE(w.IsProgressive());
+  ASSERT_TRUE(w.IsOptimizeCoding());
+  ASSERT_EQ(90, w.GetQuality());
+
+  for (int i = 0; i < 3; i++)
+  {
+    for (int subsampling = 0; subsampling < 2; subsampling++)
+    {
+      Orthanc::JpegWriter writer;
+      writer.SetProfile(static_cast<Orthanc::ImageEncoderProfile>(i));
+      writer.SetChromaSubsampling(subsampling == 1);
+
+      std::string s;
+      writer.WriteToMemory(s, img);
+
+      Orthanc::JpegReader reader;
+      reader.ReadFromMemory(s);
+      ASSERT_EQ(Orthanc::PixelFormat_RGB24, reader.GetFormat());
+      ASSERT_EQ(32u, reader.GetWidth());
+      ASSERT_EQ(32u, reader.GetHeight());
+
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(reader.GetConstRow(16));
+      ASSERT_NEAR(128, p[16 * 3], 8);
+      ASSERT_NEAR(128, p[16 * 3 + 1], 8);
+      ASSERT_NEAR(128, p[16 * 3 + 2], 8);
+    }
+  }
+}
+
+
+TEST(ImageWriters, DISABLED_ProfilesBenchmark)
+{
+  // Compares the latency and the size of the PNG and JPEG encoders
+  // for each profile, on synthetic images whose size and dynamics
+  // are typical of CT, MR, digital radiography (DX) and ultrasound
+  // (US). Run it with "--gtest_also_run_disabled_tests".
+  struct Modality
+  {
+    const char*           name_;
+    Orthanc::PixelFormat  format_;
+    unsigned int          width_;
+    unsigned int          height_;
+    unsigned int          dynamics_;
+  };
+
+  static const Modality MODALITIES[] = {
+    { "CT", Orthanc::PixelFormat_Grayscale16, 512, 512, 4096 },
+    { "MR", Orthanc::PixelFormat_Grayscale16, 256, 256, 1024 },
+    { "DX", Orthanc::PixelFormat_Grayscale16, 2048, 2500, 16384 },
+    { "US", Orthanc::PixelFormat_RGB24, 640, 480, 256 }
+  };
+
+  const unsigned int ITERATIONS = 5;
+
+  for (size_t m = 0; m < sizeof(MODALITIES) / sizeof(Modality); m++)
+  {
+    const Modality& modality = MODALITIES[m];
+
+    // Smooth anatomy-like gradients, with some noise
+    Orthanc::Image source(modality.format_, modality.width_, modality.height_, false);
+    uint32_t seed = 42;
+    for (unsigned int y = 0; y < source.GetHeight(); y++)
+    {
+      uint8_t* row = reinterpret_cast<uint8_t*>(source.GetRow(y));
+      for (unsigned int x = 0; x < source.GetWidth(); x++)
+      {
+        seed = seed * 1103515245 + 12345;
+        unsigned int noise = (seed >> 16) % 16;
+        unsigned int v = ((x + y) * modality.dynamics_ / (source.GetWidth() + source.GetHeight()) + noise) % modality.dynamics_;
+
+        if (modality.format_ == Orthanc::PixelFormat_RGB24)
+        {
+          row[3 * x] = static_cast<uint8_t>(v);
+          row[3 * x + 1] = static_cast<uint8_t>(v / 2);
+          row[3 * x + 2] = static_cast<uint8_t>(255 - v);
+        }
+        else
+        {
+          reinterpret_cast<uint16_t*>(row) [x] = static_cast<uint16_t>(v);
+        }
+      }
+    }
+
+    // The JPEG encoder expects 8bpp images, such as the previews
+    Orthanc::ImageRenderer renderer;
+    renderer.SetStretchDynamics(true);
+    std::auto_ptr<Orthanc::ImageAccessor> preview(renderer.Render(source));
+
+    for (int i = 0; i < 3; i++)
+    {
+      Orthanc::ImageEncoderProfile profile = static_cast<Orthanc::ImageEncoderProfile>(i);
+
+      Orthanc::PngWriter png;
+      png.SetProfile(profile);
+
+      Orthanc::JpegWriter jpeg;
+      jpeg.SetProfile(profile);
+
+      std::string s;
+      size_t sizes[2];
+      unsigned int elapsed[2];
+
+      for (int k = 0; k < 2; k++)
+      {
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        for (unsigned int j = 0; j < ITERATIONS; j++)
+        {
+          if (k == 0)
+          {
+            png.WriteToMemory(s, source);
+          }
+          else
+          {
+            jpeg.WriteToMemory(s, *preview);
+          }
+        }
+
+        elapsed[k] = static_cast<unsigned int>(
+          (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds() / ITERATIONS);
+        sizes[k] = s.size();
+      }
+
+      LOG(WARNING) << modality.name_ << " " << source.GetWidth() << "x" << source.GetHeight()
+                   << ", profile " << Orthanc::EnumerationToString(profile)
+                   << ": PNG " << elapsed[0] << "ms, " << sizes[0] / 1024 << "KB; "
+                   << "JPEG " << elapsed[1] << "ms, " << sizes[1] / 1024 << "KB";
+    }
+  }
+}
+
+
 TEST(Font, Basic)
 {
   Orthanc::Image s(Orthanc::PixelFormat_RGB24, 640, 480, false);
@@ -34,6 +34,7 @@
 #include "PrecompiledHeadersUnitTests.h"
 #include "gtest/gtest.h"
 
+#include "../OrthancServer/CineStreamer.h"
 #include "../OrthancServer/Scheduler/ServerScheduler.h"
 #include "../Core/OrthancException.h"
 #include "../Core/SystemToolbox.h"
@@ -41,6 +42,7 @@
 #include "../Core/MultiThreading/Locker.h"
 #include "../Core/MultiThreading/Mutex.h"
 #include "../Core/MultiThreading/ReaderWriterLock.h"
+#include "../Core/MultiThreading/Semaphore.h"
 
 using namespace Orthanc;
 
@@ -128,6 +130,31 @@ TEST(MultiThreading, ReaderWriterLock)
 }
 
 
+TEST(MultiThreading, Semaphore)
+{
+  Semaphore semaphore(2);
+
+  semaphore.Acquire();
+  ASSERT_TRUE(semaphore.TryAcquire(0));
+  ASSERT_FALSE(semaphore.TryAcquire(10));
+
+  semaphore.Release();
+  ASSERT_TRUE(semaphore.TryAcquire(10));
+  ASSERT_FALSE(semaphore.TryAcquire(0));
+
+  semaphore.Release();
+
+  {
+    Semaphore::Locker locker(semaphore);
+    ASSERT_FALSE(semaphore.TryAcquire(0));
+  }
+
+  ASSERT_TRUE(semaphore.TryAcquire(0));
+  semaphore.Release();
+  semaphore.Release();
+}
+
+
 
 #include "../Core/DicomNetworking/ReusableDicomUserConnection.h"
 
@@ -259,3 +286,99 @@ TEST(MultiThreading, ServerScheduler)
     t.join();
   }
 }
+
+
+
+namespace
+{
+  class CountingFrameEncoder : public CineStreamer::IFrameEncoder
+  {
+  private:
+    boost::mutex  mutex_;
+    unsigned int  count_;
+    unsigned int  failure_;
+
+  public:
+    explicit CountingFrameEncoder(unsigned int failure) :
+      count_(0),
+      failure_(failure)
+    {
+    }
+
+    virtual void Encode(std::string& target,
+                        unsigned int frame)
+    {
+      if (frame == failure_)
+      {
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+
+      target = "frame" + boost::lexical_cast<std::string>(frame);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      count_++;
+    }
+
+    unsigned int GetCount()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return count_;
+    }
+  };
+}
+
+
+TEST(MultiThreading, CineStreamer)
+{
+  {
+    CountingFrameEncoder encoder(1000);
+    ASSERT_THROW(CineStreamer(encoder, 10, 0), OrthancException);
+  }
+
+  {
+    CountingFrameEncoder encoder(1000);
+    CineStreamer streamer(encoder, 10, 2);
+
+    // The worker does not run further than 2 frames ahead
+    SystemToolbox::USleep(100000);
+    ASSERT_GE(2u, encoder.GetCount());
+
+    std::string s;
+    for (unsigned int i = 0; i < 10; i++)
+    {
+      ASSERT_TRUE(streamer.Next(s));
+      ASSERT_EQ("frame" + boost::lexical_cast<std::string>(i), s);
+    }
+
+    ASSERT_FALSE(streamer.Next(s));
+    ASSERT_FALSE(streamer.Next(s));
+    ASSERT_TRUE(streamer.IsSuccess());
+    ASSERT_EQ(10u, encoder.GetCount());
+  }
+
+  {
+    // The consumer stops early: The destructor cancels the worker
+    CountingFrameEncoder encoder(1000);
+    CineStreamer streamer(encoder, 100, 3);
+
+    std::string s;
+    ASSERT_TRUE(streamer.Next(s));
+    ASSERT_EQ("frame0", s);
+  }
+
+  {
+    // The encoding of the 4th frame fails: The frames that were
+    // encoded before are delivered, then the stream is interrupted
+    CountingFrameEncoder encoder(3);
+    CineStreamer streamer(encoder, 10, 4);
+
+    std::string s;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+      ASSERT_TRUE(streamer.Next(s));
+    }
+
+    ASSERT_FALSE(streamer.Next(s));
+    ASSERT_FALSE(streamer.IsSuccess());
+  }
+}
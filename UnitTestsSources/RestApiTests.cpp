@@ -37,6 +37,7 @@
 #include <ctype.h>
 #include <boost/lexical_cast.hpp>
 #include <algorithm>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "../Core/ChunkedBuffer.h"
 #include "../Core/HttpClient.h"
@@ -46,6 +47,7 @@
 #include "../Core/OrthancException.h"
 #include "../Core/Compression/ZlibCompressor.h"
 #include "../Core/RestApi/RestApiHierarchy.h"
+#include "../Core/RestApi/RestApiRouter.h"
 #include "../Core/HttpServer/HttpContentNegociation.h"
 
 using namespace Orthanc;
@@ -185,6 +187,44 @@ TEST(RestApi, ParseCookies)
   ASSERT_EQ("v", cookies["n"]);
 }
 
+
+TEST(RestApi, ParseMultipartBody)
+{
+  std::string boundary;
+  ASSERT_FALSE(HttpToolbox::LookupMultipartBoundary(boundary, "application/dicom"));
+  ASSERT_FALSE(HttpToolbox::LookupMultipartBoundary(boundary, "multipart/related; type=application/dicom"));
+  ASSERT_TRUE(HttpToolbox::LookupMultipartBoundary(boundary, "multipart/related; type=application/dicom; boundary=XYZ"));
+  ASSERT_EQ("XYZ", boundary);
+  ASSERT_TRUE(HttpToolbox::LookupMultipartBoundary(boundary, "Multipart/Related;Boundary=\"a b\";type=\"application/dicom\""));
+  ASSERT_EQ("a b", boundary);
+
+  const std::string body = 
+    "preamble\r\n"
+    "--XYZ\r\n"
+    "Content-Type: application/dicom\r\n"
+    "Content-Location: a\r\n"
+    "\r\n"
+    "hello\r\n--XY\r\n"
+    "--XYZ\r\n"
+    "\r\n"
+    "\r\n"
+    "--XYZ--\r\n"
+    "epilogue";
+
+  std::vector<HttpToolbox::MultipartPart> parts;
+  HttpToolbox::ParseMultipartBody(parts, body.c_str(), body.size(), "XYZ");
+  ASSERT_EQ(2u, parts.size());
+  ASSERT_EQ(2u, parts[0].headers.size());
+  ASSERT_EQ("application/dicom", parts[0].headers["content-type"]);
+  ASSERT_EQ("a", parts[0].headers["content-location"]);
+  ASSERT_EQ("hello\r\n--XY", std::string(parts[0].content, parts[0].size));
+  ASSERT_EQ(0u, parts[1].headers.size());
+  ASSERT_EQ(0u, parts[1].size);
+
+  ASSERT_THROW(HttpToolbox::ParseMultipartBody(parts, body.c_str(), body.size(), "nope"), OrthancException);
+  ASSERT_THROW(HttpToolbox::ParseMultipartBody(parts, body.c_str(), body.size() - 20, "XYZ"), OrthancException);
+}
+
 TEST(RestApi, RestApiPath)
 {
   IHttpHandler::Arguments args;
@@ -349,6 +389,206 @@ TEST(RestApi, RestApiHierarchy)
 
 
 
+static void DeleteValue(RestApiDeleteCall& call)
+{
+}
+
+
+static bool LookupRoute(std::string& trailing,
+                        std::string& wildcards,
+                        const RestApiRouter& router, 
+                        const std::string& uri,
+                        HttpMethod method = HttpMethod_Get)
+{
+  UriComponents p;
+  Toolbox::SplitUriComponents(p, uri);
+
+  const RestApiHierarchy::Resource* resource = NULL;
+  RestApiRouteMatch match(p);
+  if (!router.Lookup(resource, match, method))
+  {
+    return false;
+  }
+
+  UriComponents t;
+  match.GetTrailing(t);
+  trailing = Toolbox::FlattenUri(t);
+
+  wildcards.clear();
+  for (size_t i = 0; i < match.GetWildcardsCount(); i++)
+  {
+    wildcards += match.GetWildcardName(i) + "=" + match.GetWildcardValue(i) + ";";
+  }
+
+  return resource != NULL;
+}
+
+
+TEST(RestApi, RestApiRouter)
+{
+  RestApiHierarchy root;
+  root.Register("/hello/world/test", SetValue<1>);
+  root.Register("/hello/world/test2", SetValue<2>);
+  root.Register("/hello/{world}/test3/test4", SetValue<3>);
+  root.Register("/hello/{world}/{a}/test5", SetValue<4>);
+  root.Register("/hello2/*", SetValue<5>);
+  root.Register("/hello/world/test2", DeleteValue);
+
+  RestApiRouter router;
+  ASSERT_FALSE(router.IsCompiled());
+
+  std::string t, w;
+  ASSERT_FALSE(LookupRoute(t, w, router, "/hello/world/test"));
+
+  router.Compile(root);
+  ASSERT_TRUE(router.IsCompiled());
+  ASSERT_EQ(11u, router.GetNodesCount());
+
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello/world/test"));
+  ASSERT_EQ("/", t);
+  ASSERT_EQ("", w);
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello/world/test2"));
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello/world/test2", HttpMethod_Delete));
+  ASSERT_FALSE(LookupRoute(t, w, router, "/hello/world/test", HttpMethod_Delete));
+  ASSERT_FALSE(LookupRoute(t, w, router, "/hello/world/test2", HttpMethod_Post));
+
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello/b/test3/test4"));
+  ASSERT_EQ("world=b;", w);
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello/world/test3/test4"));
+  ASSERT_EQ("world=world;", w);
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello/b/c/test5"));
+  ASSERT_EQ("world=b;a=c;", w);
+  ASSERT_FALSE(LookupRoute(t, w, router, "/hello/b/test3/test"));
+  ASSERT_FALSE(LookupRoute(t, w, router, "/hello/b/test3"));
+  ASSERT_FALSE(LookupRoute(t, w, router, "/nope"));
+
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello2/a/b"));
+  ASSERT_EQ("/a/b", t);
+  ASSERT_TRUE(LookupRoute(t, w, router, "/hello2"));
+  ASSERT_EQ("/", t);
+
+  {
+    UriComponents p;
+    Toolbox::SplitUriComponents(p, "/hello/b/c/test5");
+    RestApiRouteMatch match(p);
+    const RestApiHierarchy::Resource* resource = NULL;
+    ASSERT_TRUE(router.Lookup(resource, match, HttpMethod_Get));
+    ASSERT_EQ("b", match.GetUriComponent("world", "nope"));
+    ASSERT_EQ("c", match.GetUriComponent("a", "nope"));
+    ASSERT_EQ("nope", match.GetUriComponent("b", "nope"));
+    ASSERT_FALSE(match.HasTrailing());
+  }
+
+  std::set<HttpMethod> methods;
+  UriComponents p;
+  Toolbox::SplitUriComponents(p, "/hello/world/test2");
+  router.GetAcceptedMethods(methods, p);
+  ASSERT_EQ(2u, methods.size());
+  ASSERT_TRUE(methods.find(HttpMethod_Get) != methods.end());
+  ASSERT_TRUE(methods.find(HttpMethod_Delete) != methods.end());
+
+  methods.clear();
+  Toolbox::SplitUriComponents(p, "/hello/world/test3");
+  router.GetAcceptedMethods(methods, p);
+  ASSERT_TRUE(methods.empty());
+}
+
+
+namespace
+{
+  class NullVisitor : public RestApiHierarchy::IVisitor
+  {
+  public:
+    virtual bool Visit(const RestApiHierarchy::Resource& resource,
+                       const UriComponents& uri,
+                       const IHttpHandler::Arguments& components,
+                       const UriComponents& trailing)
+    {
+      return resource.HasHandler(HttpMethod_Get);
+    }
+  };
+}
+
+
+TEST(RestApi, DISABLED_RestApiRouterBenchmark)
+{
+  // Micro-benchmark comparing the routing of "RestApiHierarchy" and
+  // "RestApiRouter". Run it with "--gtest_also_run_disabled_tests".
+  static const char* ROUTES[] = {
+    "/instances", "/instances/{id}", "/instances/{id}/file",
+    "/instances/{id}/tags", "/instances/{id}/simplified-tags",
+    "/instances/{id}/frames/{frame}/preview", "/instances/{id}/frames/{frame}/raw",
+    "/series", "/series/{id}", "/series/{id}/instances", "/series/{id}/ordered-slices",
+    "/studies", "/studies/{id}", "/studies/{id}/series",
+    "/patients", "/patients/{id}", "/patients/{id}/studies",
+    "/{resourceType}/{id}/metadata", "/{resourceType}/{id}/metadata/{name}",
+    "/{resourceType}/{id}/attachments/{name}/data",
+    "/system", "/statistics", "/changes", "/exports", "/tools/find", "/app/*"
+  };
+
+  static const char* URIS[] = {
+    "/instances/19816330-cb02e1cf-df3a8fe8-bf510623-ccefe9f5/tags",
+    "/series/6da51c7d-8ed2b0b5-94e1a1b3-20b2a0e4-86b09ac1",
+    "/patients/6816cb19-844d5aee-85245eba-28e841e6-2414fae2/metadata/LastUpdate",
+    "/instances/19816330-cb02e1cf-df3a8fe8-bf510623-ccefe9f5/frames/0/raw",
+    "/system",
+    "/app/explorer.html"
+  };
+
+  const size_t ROUTES_COUNT = sizeof(ROUTES) / sizeof(const char*);
+  const size_t URIS_COUNT = sizeof(URIS) / sizeof(const char*);
+  const size_t ITERATIONS = 200000;
+
+  RestApiHierarchy root;
+  for (size_t i = 0; i < ROUTES_COUNT; i++)
+  {
+    root.Register(ROUTES[i], SetValue<1>);
+  }
+
+  RestApiRouter router;
+  router.Compile(root);
+
+  std::vector<UriComponents> uris(URIS_COUNT);
+  for (size_t i = 0; i < URIS_COUNT; i++)
+  {
+    Toolbox::SplitUriComponents(uris[i], URIS[i]);
+  }
+
+  size_t count = 0;
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  for (size_t i = 0; i < ITERATIONS; i++)
+  {
+    NullVisitor visitor;
+    if (root.LookupResource(uris[i % URIS_COUNT], visitor))
+    {
+      count++;
+    }
+  }
+
+  boost::posix_time::ptime middle = boost::posix_time::microsec_clock::universal_time();
+
+  for (size_t i = 0; i < ITERATIONS; i++)
+  {
+    const RestApiHierarchy::Resource* resource = NULL;
+    RestApiRouteMatch match(uris[i % URIS_COUNT]);
+    if (router.Lookup(resource, match, HttpMethod_Get))
+    {
+      count++;
+    }
+  }
+
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+  ASSERT_EQ(2 * ITERATIONS, count);
+
+  LOG(WARNING) << "Routing of " << ITERATIONS << " URIs: "
+               << (middle - start).total_milliseconds() << "ms with RestApiHierarchy, "
+               << (end - middle).total_milliseconds() << "ms with RestApiRouter";
+}
+
+
+
 
 
 namespace
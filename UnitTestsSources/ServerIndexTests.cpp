@@ -36,9 +36,20 @@
 
 #include "../Core/FileStorage/FilesystemStorage.h"
 #include "../Core/Logging.h"
+#include "../Core/FileStorage/StorageAccessor.h"
+#include "../Core/Images/Image.h"
+#include "../Core/Images/ImageProcessing.h"
+#include "../Core/Images/JpegReader.h"
+#include "../OrthancServer/BulkContentReader.h"
+#include "../OrthancServer/DatabaseReadersPool.h"
 #include "../OrthancServer/DatabaseWrapper.h"
+#include "../OrthancServer/DecodedFramesCache.h"
+#include "../OrthancServer/ResourcesContent.h"
+#include "../OrthancServer/ResponseCache.h"
 #include "../OrthancServer/ServerContext.h"
 #include "../OrthancServer/ServerIndex.h"
+#include "../OrthancServer/ThumbnailGenerator.h"
+#include "../OrthancServer/VolumeReader.h"
 #include "../OrthancServer/Search/LookupIdentifierQuery.h"
 
 #include <ctype.h>
@@ -667,6 +678,50 @@ TEST_P(DatabaseWrapperTest, PatientProtection)
 
 
 
+TEST_P(DatabaseWrapperTest, PruneHistory)
+{
+  ASSERT_TRUE(index_->HasHistoryPruning());
+
+  int64_t patient = index_->CreateResource("patient", ResourceType_Patient);
+
+  for (int i = 0; i < 10; i++)
+  {
+    std::string date = "20100101T00000" + boost::lexical_cast<std::string>(i);
+    index_->LogChange(patient, ServerIndexChange(-1, ChangeType_NewPatient, ResourceType_Patient, "patient", date));
+    index_->LogExportedResource(ExportedResource(-1, ResourceType_Patient, "patient", "modality", date,
+                                                 "patient", "", "", ""));
+  }
+
+  CheckTableRecordCount(10, "Changes");
+  CheckTableRecordCount(10, "ExportedResources");
+
+  // Prune by sequence number
+  ASSERT_EQ(0u, index_->PruneChanges(-1, "", 100));
+  ASSERT_EQ(3u, index_->PruneChanges(3, "", 100));
+  CheckTableRecordCount(7, "Changes");
+
+  // Prune by date: Removes seq 4 and 5 (dates ending with 3 and 4)
+  ASSERT_EQ(2u, index_->PruneChanges(-1, "20100101T000005", 100));
+  CheckTableRecordCount(5, "Changes");
+
+  // The batch size is enforced
+  ASSERT_EQ(2u, index_->PruneChanges(100, "", 2));
+  CheckTableRecordCount(3, "Changes");
+
+  std::list<ServerIndexChange> changes;
+  bool done;
+  index_->GetChanges(changes, done, 0, 100);
+  ASSERT_TRUE(done);
+  ASSERT_EQ(3u, changes.size());
+  ASSERT_EQ(8, changes.front().GetSeq());
+
+  // The log of exported resources is left untouched
+  CheckTableRecordCount(10, "ExportedResources");
+  ASSERT_EQ(10u, index_->PruneExportedResources(100, "", 100));
+  CheckTableRecordCount(0, "ExportedResources");
+}
+
+
 TEST(ServerIndex, Sequence)
 {
   const std::string path = "UnitTestsStorage";
@@ -765,6 +820,71 @@ TEST_P(DatabaseWrapperTest, LookupIdentifier)
 
 
 
+TEST_P(DatabaseWrapperTest, CreateInstance)
+{
+  IDatabaseWrapper::CreateInstanceResult r;
+  int64_t instance;
+  ASSERT_TRUE(index_->CreateInstance(r, instance, "patient", "study", "series", "instance1"));
+  ASSERT_TRUE(r.isNewPatient_);
+  ASSERT_TRUE(r.isNewStudy_);
+  ASSERT_TRUE(r.isNewSeries_);
+  ASSERT_EQ(ResourceType_Instance, index_->GetResourceType(instance));
+  ASSERT_EQ(ResourceType_Series, index_->GetResourceType(r.seriesId_));
+  ASSERT_EQ(ResourceType_Study, index_->GetResourceType(r.studyId_));
+  ASSERT_EQ(ResourceType_Patient, index_->GetResourceType(r.patientId_));
+
+  int64_t parent;
+  ASSERT_TRUE(index_->LookupParent(parent, instance));
+  ASSERT_EQ(r.seriesId_, parent);
+  ASSERT_TRUE(index_->LookupParent(parent, r.seriesId_));
+  ASSERT_EQ(r.studyId_, parent);
+  ASSERT_TRUE(index_->LookupParent(parent, r.studyId_));
+  ASSERT_EQ(r.patientId_, parent);
+
+  int64_t series = r.seriesId_;
+  int64_t instance2;
+  ASSERT_TRUE(index_->CreateInstance(r, instance2, "patient", "study", "series", "instance2"));
+  ASSERT_FALSE(r.isNewPatient_);
+  ASSERT_FALSE(r.isNewStudy_);
+  ASSERT_FALSE(r.isNewSeries_);
+  ASSERT_NE(instance, instance2);
+  ASSERT_TRUE(index_->LookupParent(parent, instance2));
+  ASSERT_EQ(series, parent);
+
+  int64_t existing;
+  ASSERT_FALSE(index_->CreateInstance(r, existing, "patient", "study", "series", "instance1"));
+  ASSERT_EQ(instance, existing);
+  ASSERT_EQ(1u, index_->GetResourceCount(ResourceType_Patient));
+  ASSERT_EQ(2u, index_->GetResourceCount(ResourceType_Instance));
+
+  ResourcesContent content;
+  content.AddMainDicomTag(instance, DICOM_TAG_SOP_INSTANCE_UID, "1.2.3");
+  content.AddIdentifierTag(instance, DICOM_TAG_SOP_INSTANCE_UID, "1.2.3");
+  content.AddMetadata(instance, MetadataType_Instance_IndexInSeries, "42");
+  content.AddAttachment(instance, FileInfo("my-uuid", FileContentType_Dicom, 10, "md5"));
+  index_->SetResourcesContent(content);
+
+  DicomMap tags;
+  index_->GetMainDicomTags(tags, instance);
+  ASSERT_EQ("1.2.3", tags.GetValue(DICOM_TAG_SOP_INSTANCE_UID).GetContent());
+
+  std::map<MetadataType, std::string> metadata;
+  index_->GetAllMetadata(metadata, instance);
+  ASSERT_EQ(1u, metadata.size());
+  ASSERT_EQ("42", metadata[MetadataType_Instance_IndexInSeries]);
+
+  FileInfo attachment;
+  ASSERT_TRUE(index_->LookupAttachment(attachment, instance, FileContentType_Dicom));
+  ASSERT_EQ("my-uuid", attachment.GetUuid());
+
+  std::list<std::string> s;
+  DoLookup(s, ResourceType_Instance, DICOM_TAG_SOP_INSTANCE_UID, "1.2.3");
+  ASSERT_EQ(1u, s.size());
+  ASSERT_EQ("instance1", s.front());
+}
+
+
+
 TEST(ServerIndex, AttachmentRecycling)
 {
   const std::string path = "UnitTestsStorage";
@@ -839,8 +959,823 @@ TEST(ServerIndex, AttachmentRecycling)
 }
 
 
+
+TEST(ServerIndex, ThumbnailsOutOfQuota)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+  ServerIndex& index = context.GetIndex();
+
+  index.SetMaximumStorageSize(10);
+
+  std::string instances[2], series;
+
+  for (int i = 0; i < 2; i++)
+  {
+    std::string id = boost::lexical_cast<std::string>(i);
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient-" + id, false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study-" + id, false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series-" + id, false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + id, false);
+    instance.SetValue(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.1", false);  // CR image
+
+    std::map<MetadataType, std::string> instanceMetadata;
+    ServerIndex::Attachments attachments;
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    ASSERT_EQ(StoreStatus_Success, index.Store(instanceMetadata, toStore, attachments));
+
+    DicomInstanceHasher hasher(instance);
+    instances[i] = hasher.HashInstance();
+
+    if (i == 0)
+    {
+      series = hasher.HashSeries();
+    }
+  }
+
+  ASSERT_EQ(StoreStatus_Success, index.AddAttachment
+            (FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Dicom, 8, "md5"), instances[0]));
+
+  // The thumbnails are much larger than the maximum storage size
+  ASSERT_TRUE(index.SetThumbnail(FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Thumbnail, 100, "md5"), instances[0], true));
+  ASSERT_TRUE(index.SetThumbnail(FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Thumbnail, 100, "md5"), series, false));
+  ASSERT_FALSE(index.SetThumbnail(FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Thumbnail, 100, "md5"), series, false));
+  ASSERT_TRUE(index.SetThumbnail(FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Thumbnail, 50, "md5"), series, true));
+  ASSERT_FALSE(index.SetThumbnail(FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Thumbnail, 50, "md5"), "nope", true));
+  ASSERT_THROW(index.SetThumbnail(FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Dicom, 50, "md5"), series, true), OrthancException);
+
+  Json::Value tmp;
+  index.ComputeStatistics(tmp);
+  ASSERT_EQ(2, tmp["CountPatients"].asInt());
+  ASSERT_EQ(158, boost::lexical_cast<int>(tmp["TotalDiskSize"].asString()));
+
+  // 8 + 2 bytes out of the thumbnails: No recycling
+  ASSERT_EQ(StoreStatus_Success, index.AddAttachment
+            (FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Dicom, 2, "md5"), instances[1]));
+
+  index.ComputeStatistics(tmp);
+  ASSERT_EQ(2, tmp["CountPatients"].asInt());
+  ASSERT_EQ(160, boost::lexical_cast<int>(tmp["TotalDiskSize"].asString()));
+
+  // One more byte: The first patient is recycled, with its thumbnails
+  ASSERT_EQ(StoreStatus_Success, index.AddAttachment
+            (FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Dicom, 3, "md5"), instances[1]));
+
+  index.ComputeStatistics(tmp);
+  ASSERT_EQ(1, tmp["CountPatients"].asInt());
+  ASSERT_EQ(3, boost::lexical_cast<int>(tmp["TotalDiskSize"].asString()));
+
+  context.Stop();
+  db.Close();
+}
+
+
+
+static bool WaitPendingDeletions(ServerIndex& index)
+{
+  for (unsigned int i = 0; i < 1000; i++)
+  {
+    Json::Value pending;
+    index.GetPendingDeletions(pending);
+
+    if (pending.empty())
+    {
+      return true;
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  return false;
+}
+
+
+TEST(ServerIndex, IncrementalDeletion)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+  ServerIndex& index = context.GetIndex();
+
+  // More instances than the size of one deletion batch
+  const unsigned int count = 250;
+
+  ServerIndex::Attachments attachments;
+  std::string patient, series, instanceOfSeries;
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    std::string id = boost::lexical_cast<std::string>(i);
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series-" + boost::lexical_cast<std::string>(i % 3), false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + id, false);
+
+    std::map<MetadataType, std::string> instanceMetadata;
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    ASSERT_EQ(StoreStatus_Success, index.Store(instanceMetadata, toStore, attachments));
+
+    DicomInstanceHasher hasher(instance);
+    patient = hasher.HashPatient();
+    series = hasher.HashSeries();
+    instanceOfSeries = hasher.HashInstance();
+
+    FileInfo info(SystemToolbox::GenerateUuid(), FileContentType_Dicom, 1, "md5");
+    index.AddAttachment(info, hasher.HashInstance());
+  }
+
+  Json::Value tmp;
+  index.ComputeStatistics(tmp);
+  ASSERT_EQ(1, tmp["CountPatients"].asInt());
+  ASSERT_EQ(3, tmp["CountSeries"].asInt());
+  ASSERT_EQ(static_cast<int>(count), tmp["CountInstances"].asInt());
+
+  // Deleting a series leaves the study as the remaining ancestor
+  Json::Value remaining;
+  ASSERT_FALSE(index.DeleteResource(remaining, series, ResourceType_Patient));
+  ASSERT_TRUE(index.DeleteResource(remaining, series, ResourceType_Series));
+  ASSERT_EQ("Study", remaining["RemainingAncestor"]["Type"].asString());
+
+  // The series is hidden at once, even if not reclaimed yet. Its
+  // instances are hidden through their parent.
+  ASSERT_FALSE(index.DeleteResource(remaining, series, ResourceType_Series));
+  ASSERT_FALSE(index.LookupResource(tmp, series, ResourceType_Series));
+  ASSERT_FALSE(index.LookupResource(tmp, instanceOfSeries, ResourceType_Instance));
+
+  std::list<std::string> ids;
+  index.GetAllUuids(ids, ResourceType_Series);
+  ASSERT_EQ(2u, ids.size());
+  ASSERT_TRUE(std::find(ids.begin(), ids.end(), series) == ids.end());
+
+  ASSERT_TRUE(WaitPendingDeletions(index));
+
+  index.ComputeStatistics(tmp);
+  ASSERT_EQ(2, tmp["CountSeries"].asInt());
+  ASSERT_EQ(0, tmp["CountPendingDeletions"].asInt());
+
+  // Deleting the patient removes everything, over several batches
+  index.GetAllUuids(ids, ResourceType_Instance);
+  ASSERT_EQ(count - count / 3 - 1, ids.size());
+  const std::string instance = ids.front();
+
+  ASSERT_TRUE(index.DeleteResource(remaining, patient, ResourceType_Patient));
+  ASSERT_TRUE(remaining["RemainingAncestor"].isNull());
+
+  index.GetAllUuids(ids, ResourceType_Instance);
+  ASSERT_TRUE(ids.empty());
+  ASSERT_FALSE(index.LookupResource(tmp, instance, ResourceType_Instance));
+  ASSERT_THROW(index.GetChildInstances(ids, patient), OrthancException);
+
+  ASSERT_TRUE(WaitPendingDeletions(index));
+
+  index.ComputeStatistics(tmp);
+  ASSERT_EQ(0, tmp["CountPatients"].asInt());
+  ASSERT_EQ(0, tmp["CountStudies"].asInt());
+  ASSERT_EQ(0, tmp["CountSeries"].asInt());
+  ASSERT_EQ(0, tmp["CountInstances"].asInt());
+  ASSERT_EQ(0, boost::lexical_cast<int>(tmp["TotalDiskSize"].asString()));
+
+  // Stopping the context flushes the files that remain to be removed
+  context.Stop();
+
+  index.ComputeStatistics(tmp);
+  ASSERT_EQ(0, tmp["CountPendingFilesToRemove"].asInt());
+
+  db.Close();
+}
+
+
+TEST(ServerIndex, StoreIntoPendingDeletion)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+  ServerIndex& index = context.GetIndex();
+
+  ServerIndex::Attachments attachments;
+  std::string series;
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + boost::lexical_cast<std::string>(i), false);
+
+    std::map<MetadataType, std::string> instanceMetadata;
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    ASSERT_EQ(StoreStatus_Success, index.Store(instanceMetadata, toStore, attachments));
+
+    series = DicomInstanceHasher(instance).HashSeries();
+  }
+
+  // The whole patient is left empty, hence hidden
+  Json::Value remaining;
+  ASSERT_TRUE(index.DeleteResource(remaining, series, ResourceType_Series));
+  ASSERT_TRUE(remaining["RemainingAncestor"].isNull());
+
+  // Storing again an instance of the deleted series completes the
+  // deletion, whatever the progress of the background reclaiming
+  DicomMap instance;
+  instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+  instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+  instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+  instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-0", false);
+
+  std::map<MetadataType, std::string> instanceMetadata;
+  DicomInstanceToStore toStore;
+  toStore.SetSummary(instance);
+  ASSERT_EQ(StoreStatus_Success, index.Store(instanceMetadata, toStore, attachments));
+
+  Json::Value tmp;
+  index.GetPendingDeletions(tmp);
+  ASSERT_EQ(0u, tmp.size());
+
+  std::list<std::string> children;
+  index.GetChildInstances(children, series);
+  ASSERT_EQ(1u, children.size());
+  ASSERT_EQ(DicomInstanceHasher(instance).HashInstance(), children.front());
+
+  context.Stop();
+  db.Close();
+}
+
+
+static void StoreInstanceDelayed(ServerIndex* index)
+{
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+  DicomMap instance;
+  instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+  instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+  instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+  instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance", false);
+
+  std::map<MetadataType, std::string> instanceMetadata;
+  DicomInstanceToStore toStore;
+  toStore.SetSummary(instance);
+
+  ServerIndex::Attachments attachments;
+  index->Store(instanceMetadata, toStore, attachments);
+}
+
+
+TEST(ServerIndex, LongPollingChanges)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+  ServerIndex& index = context.GetIndex();
+
+  Json::Value changes;
+  index.GetChanges(changes, 0, 100, 10 /* ms */);
+  ASSERT_EQ(0u, changes["Changes"].size());
+  ASSERT_TRUE(changes["Done"].asBool());
+  ASSERT_EQ(0, changes["Last"].asInt());
+
+  boost::thread storeThread(StoreInstanceDelayed, &index);
+
+  // Wakes up as soon as the instance is stored
+  index.GetChanges(changes, 0, 100, 10000 /* ms */);
+  storeThread.join();
+
+  ASSERT_EQ(4u, changes["Changes"].size());
+  ASSERT_EQ("NewInstance", changes["Changes"][0]["ChangeType"].asString());
+
+  // No further change after the last one
+  int64_t last = changes["Last"].asInt();
+  index.GetChanges(changes, last, 100, 10 /* ms */);
+  ASSERT_EQ(0u, changes["Changes"].size());
+  ASSERT_EQ(last, changes["Last"].asInt());
+
+  // Long-polling disabled: Answers at once, whatever the timeout
+  index.SetMaximumChangesWaiters(0);
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+  index.GetChanges(changes, last, 100, 60000 /* ms */);
+  ASSERT_EQ(0u, changes["Changes"].size());
+  ASSERT_LT((boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds(), 10000);
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, PruneHistory)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+  ServerIndex& index = context.GetIndex();
+
+  for (int i = 0; i < 10; i++)
+  {
+    std::string id = boost::lexical_cast<std::string>(i);
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + id, false);
+
+    std::map<MetadataType, std::string> instanceMetadata;
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+
+    ServerIndex::Attachments attachments;
+    ASSERT_EQ(StoreStatus_Success, index.Store(instanceMetadata, toStore, attachments));
+  }
+
+  // 10 "NewInstance", plus "NewSeries", "NewStudy" and "NewPatient"
+  Json::Value changes;
+  index.GetChanges(changes, 0, 100);
+  ASSERT_EQ(13u, changes["Changes"].size());
+
+  // No retention policy by default
+  index.PruneHistory();
+  index.GetChanges(changes, 0, 100);
+  ASSERT_EQ(13u, changes["Changes"].size());
+
+  index.SetMaximumHistorySize(5);
+  index.PruneHistory();
+  index.GetChanges(changes, 0, 100);
+  ASSERT_EQ(5u, changes["Changes"].size());
+  ASSERT_EQ(9, changes["Changes"][0]["Seq"].asInt());
+  ASSERT_EQ(13, changes["Last"].asInt());
+
+  // All the changes are more recent than one day
+  index.SetMaximumHistorySize(0);
+  index.SetMaximumHistoryAge(1);
+  index.PruneHistory();
+  index.GetChanges(changes, 0, 100);
+  ASSERT_EQ(5u, changes["Changes"].size());
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, ReadersPool)
+{
+  const std::string path = "UnitTestsStorage";
+  const std::string index = path + "/readers";
+
+  FilesystemStorage storage(path);
+  SystemToolbox::RemoveFile(index);
+  SystemToolbox::RemoveFile(index + "-wal");
+  SystemToolbox::RemoveFile(index + "-shm");
+
+  DatabaseWrapper db(index);
+  db.SetExclusiveLocking(false);
+  db.Open();
+
+  std::auto_ptr<DatabaseReadersPool> pool(new DatabaseReadersPool);
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    std::auto_ptr<DatabaseWrapper> reader(new DatabaseWrapper(index));
+    reader->SetReadOnly(true);
+    reader->Open();
+    pool->Add(reader.release());
+  }
+
+  ASSERT_EQ(2u, pool->GetSize());
+
+  {
+    // The pooled connections reject writes
+    DatabaseReadersPool::Accessor accessor(*pool);
+    ASSERT_THROW(accessor.GetDatabase().SetGlobalProperty(GlobalProperty_FlushSleep, "1"), OrthancException);
+  }
+
+  ServerContext context(db, storage);
+  context.GetIndex().SetReadersPool(pool.release());
+
+  // The pool can only be set once
+  ASSERT_THROW(context.GetIndex().SetReadersPool(new DatabaseReadersPool), OrthancException);
+
+  DicomMap instance;
+  instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+  instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+  instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+  instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance", false);
+
+  std::map<MetadataType, std::string> instanceMetadata;
+  DicomInstanceToStore toStore;
+  toStore.SetSummary(instance);
+
+  // "LookupResource()" requires the DICOM file of the instances
+  ServerIndex::Attachments attachments;
+  attachments.push_back(FileInfo(SystemToolbox::GenerateUuid(), FileContentType_Dicom, 1, "md5"));
+  ASSERT_EQ(StoreStatus_Success, context.GetIndex().Store(instanceMetadata, toStore, attachments));
+
+  // The read-only requests see the committed instance
+  std::list<std::string> uuids;
+  context.GetIndex().GetAllUuids(uuids, ResourceType_Instance);
+  ASSERT_EQ(1u, uuids.size());
+
+  std::list<std::string> found;
+  context.GetIndex().LookupIdentifierExact(found, ResourceType_Instance, DICOM_TAG_SOP_INSTANCE_UID, "instance");
+  ASSERT_EQ(1u, found.size());
+  ASSERT_EQ(uuids.front(), found.front());
+
+  Json::Value json;
+  ASSERT_TRUE(context.GetIndex().LookupResource(json, uuids.front(), ResourceType_Instance));
+  ASSERT_EQ("instance", json["MainDicomTags"]["SOPInstanceUID"].asString());
+
+  std::string parent;
+  ASSERT_TRUE(context.GetIndex().LookupParent(parent, uuids.front(), ResourceType_Patient));
+
+  Json::Value patient;
+  ASSERT_TRUE(context.GetIndex().LookupResource(patient, parent, ResourceType_Patient));
+  ASSERT_FALSE(patient["IsStable"].asBool());
+
+  context.Stop();
+  db.Close();
+}
+
+
 TEST(LookupIdentifierQuery, NormalizeIdentifier)
 {
   ASSERT_EQ("H^L.LO", ServerToolbox::NormalizeIdentifier("   Hé^l.LO  %_  "));
   ASSERT_EQ("1.2.840.113619.2.176.2025", ServerToolbox::NormalizeIdentifier("   1.2.840.113619.2.176.2025  "));
 }
+
+
+TEST(ServerIndex, BulkContentReader)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+  ServerIndex& index = context.GetIndex();
+  StorageAccessor accessor(storage);
+
+  std::list<std::string> instances;
+
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    std::string id = boost::lexical_cast<std::string>(i);
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + id, false);
+
+    std::map<MetadataType, std::string> instanceMetadata;
+    DicomInstanceToStore toStore;
+    toStore.SetSummary(instance);
+    ServerIndex::Attachments attachments;
+    ASSERT_EQ(StoreStatus_Success, index.Store(instanceMetadata, toStore, attachments));
+
+    DicomInstanceHasher hasher(instance);
+    instances.push_back(hasher.HashInstance());
+
+    // The content is not parsed when reading files
+    FileInfo info = accessor.Write("content-" + id, FileContentType_Dicom, CompressionType_None, true);
+    ASSERT_EQ(StoreStatus_Success, index.AddAttachment(info, hasher.HashInstance()));
+  }
+
+  {
+    // Only one item is read ahead of the consumer
+    BulkContentReader reader(context, instances, false, 1);
+
+    unsigned int i = 0;
+    for (std::list<std::string>::const_iterator 
+           it = instances.begin(); it != instances.end(); ++it, i++)
+    {
+      std::auto_ptr<BulkContentReader::Item> item(reader.Next());
+      ASSERT_TRUE(item.get() != NULL);
+      ASSERT_FALSE(item->IsFrame());
+      ASSERT_EQ(*it, item->GetInstanceId());
+      ASSERT_EQ("/instances/" + *it + "/file", item->GetLocation());
+      ASSERT_EQ("application/dicom", item->GetContentType());
+      ASSERT_EQ("content-" + boost::lexical_cast<std::string>(i), item->GetContent());
+    }
+
+    ASSERT_TRUE(reader.Next() == NULL);
+    ASSERT_TRUE(reader.Next() == NULL);
+    ASSERT_TRUE(reader.IsSuccess());
+  }
+
+  {
+    // The consumer stops early: The destructor cancels the reader
+    BulkContentReader reader(context, instances, false, 2);
+    std::auto_ptr<BulkContentReader::Item> item(reader.Next());
+    ASSERT_TRUE(item.get() != NULL);
+  }
+
+  {
+    // Unknown instance: The reading is interrupted
+    std::list<std::string> tmp = instances;
+    tmp.push_front("nope");
+
+    BulkContentReader reader(context, tmp, false, 4);
+    ASSERT_TRUE(reader.Next() == NULL);
+    ASSERT_FALSE(reader.IsSuccess());
+  }
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, ResponseCache)
+{
+  ResponseCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  std::string content, contentType;
+  uint64_t generation = cache.StartComputation();
+  cache.Store(generation, "series", "/ordered-slices", "hello", "text/plain");
+  cache.EndComputation();
+  ASSERT_FALSE(cache.Lookup(content, contentType, "series", "/ordered-slices"));
+
+  cache.SetMaximumSize(1000);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  generation = cache.StartComputation();
+  cache.Store(generation, "series", "/ordered-slices", "hello", "text/plain");
+  cache.Store(generation, "series", "/shared-tags", "world", "application/json");
+  cache.Store(generation, "study", "/shared-tags", "study", "application/json");
+  cache.EndComputation();
+
+  ASSERT_TRUE(cache.Lookup(content, contentType, "series", "/ordered-slices"));
+  ASSERT_EQ("hello", content);
+  ASSERT_EQ("text/plain", contentType);
+  ASSERT_TRUE(cache.Lookup(content, contentType, "series", "/shared-tags"));
+  ASSERT_EQ("world", content);
+  ASSERT_FALSE(cache.Lookup(content, contentType, "series", "/nope"));
+
+  // A new instance in the series only invalidates the series
+  cache.SignalChange(ServerIndexChange(ChangeType_NewChildInstance, ResourceType_Series, "series"));
+  ASSERT_FALSE(cache.Lookup(content, contentType, "series", "/ordered-slices"));
+  ASSERT_FALSE(cache.Lookup(content, contentType, "series", "/shared-tags"));
+  ASSERT_TRUE(cache.Lookup(content, contentType, "study", "/shared-tags"));
+
+  cache.SignalChange(ServerIndexChange(ChangeType_StableStudy, ResourceType_Study, "study"));
+  ASSERT_TRUE(cache.Lookup(content, contentType, "study", "/shared-tags"));
+
+  // A change that happens during the computation discards the answer
+  generation = cache.StartComputation();
+  cache.Invalidate("series");
+  cache.Store(generation, "series", "/ordered-slices", "hello", "text/plain");
+  cache.Store(generation, "other", "/ordered-slices", "other", "text/plain");
+  cache.EndComputation();
+  ASSERT_FALSE(cache.Lookup(content, contentType, "series", "/ordered-slices"));
+  ASSERT_TRUE(cache.Lookup(content, contentType, "other", "/ordered-slices"));
+
+  // Deleting any resource clears the cache
+  cache.SignalChange(ServerIndexChange(ChangeType_Deleted, ResourceType_Instance, "instance"));
+  ASSERT_FALSE(cache.Lookup(content, contentType, "study", "/shared-tags"));
+  ASSERT_FALSE(cache.Lookup(content, contentType, "other", "/ordered-slices"));
+
+  // The least recently used answers are removed to respect the size
+  cache.SetMaximumSize(100);
+  generation = cache.StartComputation();
+  cache.Store(generation, "a", "/key", std::string(30, 'a'), "text/plain");
+  cache.Store(generation, "b", "/key", std::string(30, 'b'), "text/plain");
+  ASSERT_TRUE(cache.Lookup(content, contentType, "a", "/key"));
+  cache.Store(generation, "c", "/key", std::string(30, 'c'), "text/plain");
+  cache.Store(generation, "d", "/key", std::string(200, 'd'), "text/plain");
+  cache.EndComputation();
+
+  ASSERT_TRUE(cache.Lookup(content, contentType, "a", "/key"));
+  ASSERT_FALSE(cache.Lookup(content, contentType, "b", "/key"));
+  ASSERT_TRUE(cache.Lookup(content, contentType, "c", "/key"));
+  ASSERT_FALSE(cache.Lookup(content, contentType, "d", "/key"));
+
+  Json::Value statistics;
+  cache.GetStatistics(statistics);
+  ASSERT_EQ(2u, statistics["CountAnswers"].asUInt());
+}
+
+
+TEST(ServerIndex, ThumbnailGenerator)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+
+  std::string id;
+
+  {
+    ParsedDicomFile dicom(true);
+
+    Image image(PixelFormat_Grayscale16, 64, 32, false);
+    ImageProcessing::Set(image, 1000);
+    dicom.EmbedImage(image);
+
+    DicomInstanceToStore toStore;
+    toStore.SetParsedDicomFile(dicom);
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, toStore));
+  }
+
+  ASSERT_THROW(ThumbnailGenerator(context, 0, 1, 10), OrthancException);
+
+  {
+    ThumbnailGenerator generator(context, 16, 1, 10);
+    ASSERT_EQ(16u, generator.GetSize());
+
+    // The aspect ratio is preserved
+    std::string jpeg;
+    generator.Render(jpeg, id);
+
+    JpegReader reader;
+    reader.ReadFromMemory(jpeg);
+    ASSERT_EQ(PixelFormat_Grayscale8, reader.GetFormat());
+    ASSERT_EQ(16u, reader.GetWidth());
+    ASSERT_EQ(8u, reader.GetHeight());
+
+    ASSERT_THROW(generator.Render(jpeg, "nope"), OrthancException);
+  }
+
+  ASSERT_EQ(FileContentType_Thumbnail, StringToContentType("thumbnail"));
+  ASSERT_EQ("image/jpeg", GetFileContentMime(FileContentType_Thumbnail));
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, VolumeReader)
+{
+  const std::string path = "UnitTestsStorage";
+
+  FilesystemStorage storage(path);
+  DatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage);
+
+  std::vector<std::string> instances;
+
+  for (unsigned int i = 0; i < 5; i++)
+  {
+    ParsedDicomFile dicom(true);
+
+    Image image(PixelFormat_Grayscale16, 7, 3, false);
+    ImageProcessing::Set(image, 100 * i);
+    dicom.EmbedImage(image);
+
+    std::string id;
+    DicomInstanceToStore toStore;
+    toStore.SetParsedDicomFile(dicom);
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, toStore));
+    instances.push_back(id);
+  }
+
+  ASSERT_THROW(VolumeReader(context, instances, 0, 1), OrthancException);
+  ASSERT_THROW(VolumeReader(context, instances, 1, 0), OrthancException);
+
+  {
+    // The frames are delivered in order, whatever the number of threads
+    VolumeReader reader(context, instances, 3, 1);
+
+    for (unsigned int i = 0; i < instances.size(); i++)
+    {
+      std::auto_ptr<ImageAccessor> frame(reader.Next());
+      ASSERT_TRUE(frame.get() != NULL);
+      ASSERT_EQ(PixelFormat_Grayscale16, frame->GetFormat());
+      ASSERT_EQ(7u, frame->GetWidth());
+      ASSERT_EQ(3u, frame->GetHeight());
+      ASSERT_EQ(100 * i, reinterpret_cast<const uint16_t*>(frame->GetConstRow(2)) [6]);
+    }
+
+    ASSERT_TRUE(reader.Next() == NULL);
+    ASSERT_TRUE(reader.Next() == NULL);
+    ASSERT_TRUE(reader.IsSuccess());
+  }
+
+  {
+    // The consumer stops early: The destructor cancels the reader
+    VolumeReader reader(context, instances, 2, 2);
+    std::auto_ptr<ImageAccessor> frame(reader.Next());
+    ASSERT_TRUE(frame.get() != NULL);
+  }
+
+  {
+    // Unknown instance: The reading is interrupted
+    std::vector<std::string> tmp = instances;
+    tmp.insert(tmp.begin(), "nope");
+
+    VolumeReader reader(context, tmp, 2, 4);
+    ASSERT_TRUE(reader.Next() == NULL);
+    ASSERT_FALSE(reader.IsSuccess());
+  }
+
+  {
+    std::string header;
+    VolumeReader::FormatNumpyHeader(header, PixelFormat_SignedGrayscale16, 7, 3, 5);
+    ASSERT_EQ(0u, header.size() % 64);
+    ASSERT_EQ("\x93NUMPY", header.substr(0, 6));
+    ASSERT_EQ(1, header[6]);
+    ASSERT_EQ(0, header[7]);
+    ASSERT_EQ(header.size() - 10, static_cast<uint8_t>(header[8]) + 256u * static_cast<uint8_t>(header[9]));
+    ASSERT_EQ(10u, header.find("{'descr': '<i2', 'fortran_order': False, 'shape': (5, 3, 7), }"));
+    ASSERT_EQ('\n', header[header.size() - 1]);
+
+    VolumeReader::FormatNumpyHeader(header, PixelFormat_RGB24, 7, 3, 5);
+    ASSERT_NE(std::string::npos, header.find("'descr': '|u1'"));
+    ASSERT_NE(std::string::npos, header.find("'shape': (5, 3, 7, 3)"));
+
+    ASSERT_THROW(VolumeReader::FormatNumpyHeader(header, PixelFormat_BGRA32, 7, 3, 5), OrthancException);
+  }
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, DecodedFramesCache)
+{
+  DecodedFramesCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  DecodedFramesCache::FramePointer frame(new DecodedFramesCache::Frame(
+    new Image(PixelFormat_Grayscale16, 16, 16, false), 12, true, 2, -1000));
+  ASSERT_EQ(12u, frame->GetBitsStored());
+  ASSERT_TRUE(frame->IsMonochrome1());
+  ASSERT_FLOAT_EQ(2.0f, frame->GetRescaleSlope());
+  ASSERT_FLOAT_EQ(-1000.0f, frame->GetRescaleIntercept());
+  ASSERT_LE(512u, frame->GetMemorySize());
+
+  ASSERT_THROW(DecodedFramesCache::Frame(NULL, 0, false, 1, 0), OrthancException);
+
+  DecodedFramesCache::FramePointer found;
+  cache.Store(cache.GetGeneration(), "a", 0, frame);
+  ASSERT_FALSE(cache.Lookup(found, "a", 0));
+
+  // Room for 3 frames
+  cache.SetMaximumSize(3 * frame->GetMemorySize() + 10);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  uint64_t generation = cache.GetGeneration();
+  cache.Store(generation, "a", 0, frame);
+  cache.Store(generation, "a", 1, frame);
+  cache.Store(generation, "b", 0, frame);
+
+  ASSERT_TRUE(cache.Lookup(found, "a", 0));
+  ASSERT_EQ(frame.get(), found.get());
+  ASSERT_TRUE(cache.Lookup(found, "a", 1));
+  ASSERT_TRUE(cache.Lookup(found, "b", 0));
+  ASSERT_FALSE(cache.Lookup(found, "b", 1));
+
+  // The least recently used frame ("a", 0) is recycled
+  cache.Store(generation, "c", 0, frame);
+  ASSERT_FALSE(cache.Lookup(found, "a", 0));
+  ASSERT_TRUE(cache.Lookup(found, "a", 1));
+  ASSERT_TRUE(cache.Lookup(found, "c", 0));
+
+  // The deletion of an instance only invalidates its frames
+  cache.SignalChange(ServerIndexChange(ChangeType_Deleted, ResourceType_Instance, "a"));
+  ASSERT_FALSE(cache.Lookup(found, "a", 1));
+  ASSERT_TRUE(cache.Lookup(found, "b", 0));
+
+  // A frame that was decoded before an invalidation is discarded
+  cache.Store(generation, "a", 1, frame);
+  ASSERT_FALSE(cache.Lookup(found, "a", 1));
+
+  // The deletion of a series is signaled through its instances
+  cache.SignalChange(ServerIndexChange(ChangeType_NewInstance, ResourceType_Instance, "b"));
+  ASSERT_TRUE(cache.Lookup(found, "b", 0));
+  cache.SignalChange(ServerIndexChange(ChangeType_Deleted, ResourceType_Series, "series"));
+  ASSERT_TRUE(cache.Lookup(found, "b", 0));
+  ASSERT_TRUE(cache.Lookup(found, "c", 0));
+  cache.SignalChange(ServerIndexChange(ChangeType_Deleted, ResourceType_Instance, "b"));
+  cache.SignalChange(ServerIndexChange(ChangeType_Deleted, ResourceType_Instance, "c"));
+  ASSERT_FALSE(cache.Lookup(found, "b", 0));
+  ASSERT_FALSE(cache.Lookup(found, "c", 0));
+
+  // The frame is still owned by "frame"
+  ASSERT_EQ(16u, frame->GetImage().GetWidth());
+
+  Json::Value statistics;
+  cache.GetStatistics(statistics);
+  ASSERT_EQ(0u, statistics["CountFrames"].asUInt());
+  ASSERT_EQ("0", statistics["CurrentSize"].asString());
+}
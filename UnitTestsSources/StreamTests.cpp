@@ -40,10 +40,14 @@
 #include "../Core/OrthancException.h"
 #include "../Core/HttpServer/BufferHttpSender.h"
 #include "../Core/HttpServer/FilesystemHttpSender.h"
+#include "../Core/HttpServer/HttpOutput.h"
 #include "../Core/HttpServer/HttpStreamTranscoder.h"
+#include "../Core/RestApi/RestApiJsonWriter.h"
 #include "../Core/Compression/ZlibCompressor.h"
 #include "../Core/Compression/GzipCompressor.h"
 
+#include <boost/lexical_cast.hpp>
+
 
 using namespace Orthanc;
 
@@ -330,3 +334,643 @@ TEST(HttpStreamTranscoder, Basic)
     ASSERT_EQ(0u, u.size());
   }
 }
+
+
+TEST(HttpStreamTranscoder, ZlibToGzip)
+{
+  ZlibCompressor compressor;
+  GzipCompressor gzip;
+
+  std::string s = "Hello world " + SystemToolbox::GenerateUuid();
+  for (int i = 0; i < 10; i++)
+  {
+    s += s;   // Larger than the chunks used while inflating
+  }
+
+  std::string t;
+  IBufferCompressor::Compress(t, compressor, s);
+
+  Json::Value before = Json::objectValue;
+  HttpStreamTranscoder::GetStatistics(before);
+
+  for (int cs = 0; cs < 3; cs++)
+  {
+    BufferHttpSender sender;
+    sender.SetChunkSize(cs * 1000);
+    sender.GetBuffer() = t;
+
+    // Only "gzip" is accepted: The zlib stream is re-wrapped, not recompressed
+    HttpStreamTranscoder transcode(sender, CompressionType_ZlibWithSize);
+    ASSERT_EQ(HttpCompression_Gzip, transcode.SetupHttpCompression(true, false));
+    ASSERT_FALSE(transcode.SeekTo(0));
+
+    std::string u;
+    u.resize(static_cast<size_t>(transcode.GetContentLength()));
+
+    size_t pos = 0;
+    while (transcode.ReadNextChunk())
+    {
+      memcpy(&u[pos], transcode.GetChunkContent(), transcode.GetChunkSize());
+      pos += transcode.GetChunkSize();
+    }
+
+    ASSERT_EQ(u.size(), pos);
+    ASSERT_EQ(t.size() - sizeof(uint64_t) - 2 - 4 + 10 + 8, u.size());
+
+    std::string v;
+    IBufferCompressor::Uncompress(v, gzip, u);
+    ASSERT_EQ(s, v);
+  }
+
+  {
+    // "deflate" is preferred over "gzip", as it costs nothing
+    BufferHttpSender sender;
+    sender.SetChunkSize(3);
+    sender.GetBuffer() = t;
+    HttpStreamTranscoder transcode(sender, CompressionType_ZlibWithSize);
+    ASSERT_EQ(HttpCompression_Deflate, transcode.SetupHttpCompression(true, true));
+
+    std::string u;
+    while (transcode.ReadNextChunk())
+    {
+      u.append(transcode.GetChunkContent(), transcode.GetChunkSize());
+    }
+
+    ASSERT_EQ(t.substr(sizeof(uint64_t)), u);
+  }
+
+  Json::Value after = Json::objectValue;
+  HttpStreamTranscoder::GetStatistics(after);
+
+  ASSERT_EQ(boost::lexical_cast<uint64_t>(before["GzipRewrapCount"].asString()) + 3,
+            boost::lexical_cast<uint64_t>(after["GzipRewrapCount"].asString()));
+  ASSERT_EQ(boost::lexical_cast<uint64_t>(before["GzipRewrapUncompressedBytes"].asString()) + 3 * s.size(),
+            boost::lexical_cast<uint64_t>(after["GzipRewrapUncompressedBytes"].asString()));
+  ASSERT_EQ(boost::lexical_cast<uint64_t>(before["DeflatePassThroughCount"].asString()) + 1,
+            boost::lexical_cast<uint64_t>(after["DeflatePassThroughCount"].asString()));
+  ASSERT_EQ(boost::lexical_cast<uint64_t>(before["DeflatePassThroughUncompressedBytes"].asString()) + s.size(),
+            boost::lexical_cast<uint64_t>(after["DeflatePassThroughUncompressedBytes"].asString()));
+
+  // Savings: 3 gzip streams (18 bytes of header and trailer), and 1
+  // zlib stream (6 bytes of header and trailer)
+  const uint64_t payload = t.size() - sizeof(uint64_t) - 6;
+  ASSERT_EQ(boost::lexical_cast<int64_t>(before["SavedBytes"].asString()) +
+            static_cast<int64_t>(3 * (s.size() - payload - 18) + (s.size() - payload - 6)),
+            boost::lexical_cast<int64_t>(after["SavedBytes"].asString()));
+}
+
+
+namespace
+{
+  class RecordingHttpOutputStream : public IHttpOutputStream
+  {
+  private:
+    HttpStatus   status_;
+    std::string  header_;
+    std::string  body_;
+    bool         keepAlive_;
+
+  public:
+    RecordingHttpOutputStream() :
+      status_(HttpStatus_500_InternalServerError),
+      keepAlive_(true)
+    {
+    }
+
+    virtual void OnHttpStatusReceived(HttpStatus status)
+    {
+      status_ = status;
+    }
+
+    virtual void Send(bool isHeader, const void* buffer, size_t length)
+    {
+      if (length > 0)
+      {
+        (isHeader ? header_ : body_).append(reinterpret_cast<const char*>(buffer), length);
+      }
+    }
+
+    virtual void DisableKeepAlive()
+    {
+      keepAlive_ = false;
+    }
+
+    bool IsKeepAlive() const
+    {
+      return keepAlive_;
+    }
+
+    HttpStatus GetStatus() const
+    {
+      return status_;
+    }
+
+    const std::string& GetHeader() const
+    {
+      return header_;
+    }
+
+    bool HasHeader(const std::string& header) const
+    {
+      return header_.find("\r\n" + header + "\r\n") != std::string::npos;
+    }
+
+    const std::string& GetBody() const
+    {
+      return body_;
+    }
+  };
+}
+
+
+static void AnswerBuffer(RecordingHttpOutputStream& stream,
+                         const std::string& content,
+                         const std::string& ifNoneMatch,
+                         const std::string& range,
+                         const std::string& ifRange)
+{
+  BufferHttpSender sender;
+  sender.SetChunkSize(3);
+  sender.GetBuffer() = content;
+  sender.SetETag("abc");
+
+  HttpOutput output(stream, false);
+  output.SetIfNoneMatch(ifNoneMatch);
+  output.SetRange(range, ifRange);
+  output.Answer(sender);
+}
+
+
+TEST(HttpOutput, ETag)
+{
+  const std::string s = "Hello world";
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "", "");
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("ETag: \"abc\""));
+    ASSERT_TRUE(stream.HasHeader("Accept-Ranges: bytes"));
+    ASSERT_EQ(s, stream.GetBody());
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "\"nope\", W/\"abc\"", "", "");
+    ASSERT_EQ(HttpStatus_304_NotModified, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("ETag: \"abc\""));
+    ASSERT_EQ(std::string::npos, stream.GetHeader().find("Content-Length"));
+    ASSERT_EQ("\r\n\r\n", stream.GetHeader().substr(stream.GetHeader().size() - 4));
+    ASSERT_TRUE(stream.GetBody().empty());
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "\"nope\"", "", "");
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_EQ(s, stream.GetBody());
+  }
+
+  {
+    // The content is compressed as "deflate", which is another representation
+    ZlibCompressor compressor;
+    BufferHttpSender sender;
+    IBufferCompressor::Compress(sender.GetBuffer(), compressor, s);
+    sender.SetETag("abc");
+    HttpStreamTranscoder transcoder(sender, CompressionType_ZlibWithSize);
+
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, false);
+    output.SetDeflateAllowed(true);
+    output.SetIfNoneMatch("\"abc\"");
+    output.SetRange("bytes=0-1", "");
+    output.Answer(transcoder);
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("ETag: \"abc-deflate\""));
+    ASSERT_FALSE(stream.HasHeader("Accept-Ranges: bytes"));
+  }
+}
+
+
+TEST(HttpOutput, Range)
+{
+  const std::string s = "Hello world";
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "bytes=2-7", "");
+    ASSERT_EQ(HttpStatus_206_PartialContent, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("Content-Range: bytes 2-7/11"));
+    ASSERT_EQ("llo wo", stream.GetBody());
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "bytes=6-", "\"abc\"");
+    ASSERT_EQ(HttpStatus_206_PartialContent, stream.GetStatus());
+    ASSERT_EQ("world", stream.GetBody());
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "bytes=-3", "");
+    ASSERT_EQ(HttpStatus_206_PartialContent, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("Content-Range: bytes 8-10/11"));
+    ASSERT_EQ("rld", stream.GetBody());
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "bytes=4-100", "");
+    ASSERT_EQ(HttpStatus_206_PartialContent, stream.GetStatus());
+    ASSERT_EQ("o world", stream.GetBody());
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "bytes=20-", "");
+    ASSERT_EQ(HttpStatus_416_RequestedRangeNotSatisfiable, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("Content-Range: bytes */11"));
+  }
+
+  {
+    // The content has changed since the first download: Full answer
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "bytes=2-7", "\"other\"");
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_EQ(s, stream.GetBody());
+  }
+
+  {
+    // Multiple ranges are not supported: Full answer
+    RecordingHttpOutputStream stream;
+    AnswerBuffer(stream, s, "", "bytes=0-1,4-5", "");
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_EQ(s, stream.GetBody());
+  }
+}
+
+
+TEST(HttpOutput, MultipartKeepAlive)
+{
+  std::map<std::string, std::string> headers;
+  headers["Content-Type"] = "text/plain";
+
+  {
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, false);
+    output.StartMultipart("related", "text/plain");
+    output.SendMultipartItem("Hello", 5, headers);
+    output.CloseMultipart();
+
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_FALSE(stream.HasHeader("Transfer-Encoding: chunked"));
+    ASSERT_NE(std::string::npos, stream.GetBody().find("\r\n\r\nHello\r\n--"));
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.StartMultipart("related", "text/plain");
+    output.SendMultipartItem("Hello", 5, headers);
+    output.SendMultipartItem("", 0, headers);
+    output.CloseMultipart();
+
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("Connection: keep-alive"));
+    ASSERT_TRUE(stream.HasHeader("Transfer-Encoding: chunked"));
+
+    // Decode the chunked body
+    const std::string& body = stream.GetBody();
+    std::string decoded;
+    size_t pos = 0;
+    size_t chunks = 0;
+
+    for (;;)
+    {
+      size_t eol = body.find("\r\n", pos);
+      ASSERT_NE(std::string::npos, eol);
+
+      size_t size = strtoul(body.substr(pos, eol - pos).c_str(), NULL, 16);
+      pos = eol + 2;
+
+      if (size == 0)
+      {
+        ASSERT_EQ("\r\n", body.substr(pos));
+        break;
+      }
+
+      ASSERT_LE(pos + size + 2, body.size());
+      decoded += body.substr(pos, size);
+      ASSERT_EQ("\r\n", body.substr(pos + size, 2));
+      pos += size + 2;
+      chunks++;
+    }
+
+    ASSERT_EQ(3u, chunks);
+    ASSERT_NE(std::string::npos, decoded.find("\r\n\r\nHello\r\n--"));
+    ASSERT_EQ("--\r\n", decoded.substr(decoded.size() - 4));
+  }
+}
+
+
+TEST(HttpOutput, MultipartReplace)
+{
+  std::map<std::string, std::string> headers;
+
+  RecordingHttpOutputStream stream;
+  HttpOutput output(stream, false);
+  ASSERT_THROW(output.StartMultipart("nope", "image/jpeg"), OrthancException);
+
+  output.StartMultipart("x-mixed-replace", "image/jpeg");
+  output.SendMultipartItem("a", 1, headers);
+  output.SendMultipartItem("b", 1, headers);
+  output.CloseMultipart();
+
+  ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+  ASSERT_TRUE(stream.HasHeader("Cache-Control: no-cache"));
+  ASSERT_NE(std::string::npos, stream.GetBody().find("Content-Type: image/jpeg\r\n"));
+  ASSERT_NE(std::string::npos, stream.GetBody().find("\r\n\r\na\r\n--"));
+  ASSERT_NE(std::string::npos, stream.GetBody().find("\r\n\r\nb\r\n--"));
+}
+
+
+TEST(HttpOutput, CloseConnection)
+{
+  std::map<std::string, std::string> headers;
+
+  {
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.StartMultipart("related", "text/plain");
+    output.SendMultipartItem("Hello", 5, headers);
+    output.CloseMultipart();
+    ASSERT_TRUE(stream.IsKeepAlive());
+  }
+
+  {
+    // Truncated answer: The closing boundary is never sent
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.StartMultipart("related", "text/plain");
+    output.SendMultipartItem("Hello", 5, headers);
+    output.CloseConnection();
+    ASSERT_FALSE(stream.IsKeepAlive());
+    ASSERT_TRUE(output.IsWritingMultipart());
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.StartChunkedBody();
+    output.SendChunk("Hello", 5);
+    output.CloseConnection();
+    ASSERT_FALSE(stream.IsKeepAlive());
+  }
+}
+
+
+static size_t DecodeChunkedBody(std::string& decoded,
+                                const std::string& body)
+{
+  decoded.clear();
+
+  size_t pos = 0;
+  size_t chunks = 0;
+
+  for (;;)
+  {
+    size_t eol = body.find("\r\n", pos);
+    if (eol == std::string::npos)
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    size_t size = strtoul(body.substr(pos, eol - pos).c_str(), NULL, 16);
+    pos = eol + 2;
+
+    if (size == 0)
+    {
+      if (body.substr(pos) != "\r\n")
+      {
+        throw OrthancException(ErrorCode_BadFileFormat);
+      }
+
+      return chunks;
+    }
+
+    if (pos + size + 2 > body.size() ||
+        body.substr(pos + size, 2) != "\r\n")
+    {
+      throw OrthancException(ErrorCode_BadFileFormat);
+    }
+
+    decoded += body.substr(pos, size);
+    pos += size + 2;
+    chunks++;
+  }
+}
+
+
+TEST(HttpOutput, CompressedChunks)
+{
+  std::string s;
+  for (unsigned int i = 0; i < 100000; i++)
+  {
+    s += boost::lexical_cast<std::string>(i % 1000);
+  }
+
+  {
+    // Compression is not allowed by the handler
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.SetGzipAllowed(true);
+    output.StartChunkedBody();
+    output.SendChunk(s.c_str(), s.size());
+    output.CloseChunkedBody();
+
+    ASSERT_FALSE(stream.HasHeader("Content-Encoding: gzip"));
+
+    std::string decoded;
+    DecodeChunkedBody(decoded, stream.GetBody());
+    ASSERT_EQ(s, decoded);
+  }
+
+  {
+    // Compression is not accepted by the client
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.StartChunkedBody(true);
+    output.SendChunk(s.c_str(), s.size());
+    output.CloseChunkedBody();
+
+    ASSERT_FALSE(stream.HasHeader("Content-Encoding: gzip"));
+    ASSERT_FALSE(stream.HasHeader("Content-Encoding: deflate"));
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.SetGzipAllowed(true);
+    output.StartChunkedBody(true);
+
+    for (size_t pos = 0; pos < s.size(); pos += 1000)
+    {
+      output.SendChunk(s.c_str() + pos, std::min(static_cast<size_t>(1000), s.size() - pos));
+    }
+
+    output.CloseChunkedBody();
+
+    ASSERT_TRUE(stream.HasHeader("Content-Encoding: gzip"));
+
+    std::string compressed, decoded;
+    DecodeChunkedBody(compressed, stream.GetBody());
+    ASSERT_LT(compressed.size(), s.size());
+
+    GzipCompressor compressor;
+    IBufferCompressor::Uncompress(decoded, compressor, compressed);
+    ASSERT_EQ(s, decoded);
+  }
+
+  {
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.SetDeflateAllowed(true);
+    output.StartChunkedBody(true);
+    output.SendChunk(s.c_str(), s.size());
+    output.CloseChunkedBody();
+
+    ASSERT_TRUE(stream.HasHeader("Content-Encoding: deflate"));
+
+    std::string compressed, decoded;
+    DecodeChunkedBody(compressed, stream.GetBody());
+
+    // "ZlibCompressor" expects the uncompressed size as a prefix
+    uint64_t size = s.size();
+    compressed = std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + compressed;
+
+    ZlibCompressor compressor;
+    compressor.SetPrefixWithUncompressedSize(true);
+    IBufferCompressor::Uncompress(decoded, compressor, compressed);
+    ASSERT_EQ(s, decoded);
+  }
+}
+
+
+static void WriteListOfResources(RestApiOutput& output,
+                                 size_t chunkSize)
+{
+  RestApiJsonWriter writer(output);
+  writer.SetChunkSize(chunkSize);
+  writer.StartArray();
+  writer.WriteString("a\"b");
+
+  Json::Value item = Json::objectValue;
+  item["ID"] = "c";
+  item["Instances"] = Json::arrayValue;
+  item["Instances"].append(42);
+  writer.WriteValue(item);
+
+  writer.StartObject();
+  writer.WriteKey("d");
+  writer.StartArray();
+  writer.EndArray();
+  writer.WriteKey("e");
+  writer.WriteString("f");
+  writer.EndObject();
+
+  ASSERT_THROW(writer.Close(), OrthancException);
+  writer.EndArray();
+  ASSERT_THROW(writer.WriteString("nope"), OrthancException);
+  writer.Close();
+}
+
+
+TEST(RestApiJsonWriter, Basic)
+{
+  const std::string expected = "[\"a\\\"b\",{\"ID\":\"c\",\"Instances\":[42]},{\"d\":[],\"e\":\"f\"}]";
+
+  {
+    // Small answer, sent at once as styled JSON
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, false);
+    RestApiOutput restOutput(output, HttpMethod_Get);
+    WriteListOfResources(restOutput, 1024);
+
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_FALSE(stream.HasHeader("Transfer-Encoding: chunked"));
+    ASSERT_TRUE(stream.HasHeader("Content-Type: application/json; charset=utf-8"));
+
+    Json::Value root;
+    Json::Reader reader;
+    ASSERT_TRUE(reader.parse(expected, root));
+    Json::StyledWriter writer;
+    ASSERT_EQ(writer.write(root), stream.GetBody());
+  }
+
+  {
+    // Large answer, streamed using the chunked transfer encoding
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    RestApiOutput restOutput(output, HttpMethod_Get);
+    WriteListOfResources(restOutput, 5);
+
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("Transfer-Encoding: chunked"));
+    ASSERT_TRUE(stream.HasHeader("Content-Type: application/json; charset=utf-8"));
+
+    std::string decoded;
+    ASSERT_LT(1u, DecodeChunkedBody(decoded, stream.GetBody()));
+    ASSERT_EQ(expected, decoded);
+  }
+
+  {
+    // Large answer, compressed on the fly
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, true);
+    output.SetGzipAllowed(true);
+    RestApiOutput restOutput(output, HttpMethod_Get);
+    WriteListOfResources(restOutput, 5);
+
+    ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+    ASSERT_TRUE(stream.HasHeader("Transfer-Encoding: chunked"));
+    ASSERT_TRUE(stream.HasHeader("Content-Encoding: gzip"));
+
+    std::string compressed, decoded;
+    DecodeChunkedBody(compressed, stream.GetBody());
+
+    GzipCompressor compressor;
+    IBufferCompressor::Uncompress(decoded, compressor, compressed);
+    ASSERT_EQ(expected, decoded);
+  }
+
+  {
+    // Misuse of the writer
+    RecordingHttpOutputStream stream;
+    HttpOutput output(stream, false);
+    RestApiOutput restOutput(output, HttpMethod_Get);
+    RestApiJsonWriter writer(restOutput);
+    ASSERT_THROW(writer.WriteKey("a"), OrthancException);
+    writer.StartObject();
+    ASSERT_THROW(writer.WriteString("a"), OrthancException);
+    ASSERT_THROW(writer.EndArray(), OrthancException);
+    writer.WriteKey("a");
+    ASSERT_THROW(writer.WriteKey("b"), OrthancException);
+    ASSERT_THROW(writer.EndObject(), OrthancException);
+  }
+}
+
+
+TEST(FilesystemHttpSender, Range)
+{
+  const std::string& path = "UnitTestsResults/stream";
+  SystemToolbox::WriteFile("Hello world", path);
+
+  FilesystemHttpSender sender(path);
+  ASSERT_EQ(HttpCompression_None, sender.SetupHttpCompression(false, false));
+  ASSERT_TRUE(sender.SeekTo(6));
+  ASSERT_FALSE(sender.SeekTo(12));
+
+  ASSERT_TRUE(sender.ReadNextChunk());
+  ASSERT_EQ("world", std::string(sender.GetChunkContent(), sender.GetChunkSize()));
+}